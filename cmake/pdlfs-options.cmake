@@ -37,6 +37,9 @@ include (xpkg-import)
 #     - GFLAGS_INCLUDE_DIR: optional hint for finding gflags/gflags.h
 #     - GFLAGS_LIBRARY_DIR: optional hint for finding gflags lib
 #   -DPDLFS_GLOG=ON                        -- use glog for logging
+#   -DPDLFS_LZ4=ON                         -- compile in lz4 compression
+#     - LZ4_INCLUDE_DIR: optional hint for finding lz4.h
+#     - LZ4_LIBRARY_DIR: optional hint for finding lz4 lib
 #   -DPDLFS_SILT_ECT=ON                    -- include SILT ECT code
 #   -DPDLFS_DFS_COMMON=ON                  -- include common DFS code
 #   -DPDLFS_MARGO_RPC=ON                   -- compile in margo rpc code
@@ -47,6 +50,9 @@ include (xpkg-import)
 #   -DPDLFS_SNAPPY=ON                      -- compile in snappy compression
 #     - SNAPPY_INCLUDE_DIR: optional hint for finding snappy.h
 #     - SNAPPY_LIBRARY_DIR: optional hint for finding snappy lib
+#   -DPDLFS_ZSTD=ON                        -- compile in zstd compression
+#     - ZSTD_INCLUDE_DIR: optional hint for finding zstd.h
+#     - ZSTD_LIBRARY_DIR: optional hint for finding zstd lib
 #   -DPDLFS_VERBOSE=1                      -- set max log verbose level
 #
 # output variables:
@@ -115,10 +121,12 @@ set (PDLFS_DFS_COMMON  "OFF" CACHE BOOL "Include common DFS code")
 set (PDLFS_SILT_ECT    "OFF" CACHE BOOL "Include SILT ECT code")
 set (PDLFS_GFLAGS      "OFF" CACHE BOOL "Use GFLAGS for arg parsing")
 set (PDLFS_GLOG        "OFF" CACHE BOOL "Use GLOG for logging")
+set (PDLFS_LZ4         "OFF" CACHE BOOL "Use LZ4 for compression")
 set (PDLFS_MARGO_RPC   "OFF" CACHE BOOL "Use Margo RPC")
 set (PDLFS_MERCURY_RPC "OFF" CACHE BOOL "Use Mercury RPC")
 set (PDLFS_RADOS       "OFF" CACHE BOOL "Use RADOS OSD")
 set (PDLFS_SNAPPY      "OFF" CACHE BOOL "Use Snappy for compression")
+set (PDLFS_ZSTD        "OFF" CACHE BOOL "Use Zstd for compression")
 
 #
 # now start pulling the parts in.  currently we set find_package to
@@ -141,6 +149,12 @@ if (PDLFS_GLOG)
     message (STATUS "Enabled glog - PDLFS_GLOG=ON")
 endif ()
 
+if (PDLFS_LZ4)
+    find_package(LZ4 MODULE REQUIRED)
+    list (APPEND PDLFS_COMPONENT_CFG "LZ4")
+    message (STATUS "Enabled LZ4 - PDLFS_LZ4=ON")
+endif ()
+
 if (PDLFS_MERCURY_RPC)
     find_package(mercury CONFIG REQUIRED)
     list (APPEND PDLFS_COMPONENT_CFG "mercury")
@@ -164,3 +178,9 @@ if (PDLFS_SNAPPY)
     list (APPEND PDLFS_COMPONENT_CFG "Snappy")
     message (STATUS "Enabled Snappy - PDLFS_SNAPPY=ON")
 endif ()
+
+if (PDLFS_ZSTD)
+    find_package(Zstd MODULE REQUIRED)
+    list (APPEND PDLFS_COMPONENT_CFG "Zstd")
+    message (STATUS "Enabled Zstd - PDLFS_ZSTD=ON")
+endif ()
@@ -21,6 +21,7 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <atomic>
 #include <vector>
 
 namespace pdlfs {
@@ -38,11 +39,17 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc
   char* AllocateAligned(size_t bytes);
 
+  // Thread-safe variants of Allocate() and AllocateAligned(). Callers must not
+  // mix them with the non-thread-safe variants without external
+  // synchronization.
+  char* AllocateConcurrently(size_t bytes);
+  char* AllocateAlignedConcurrently(size_t bytes);
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena (including space allocated but not yet used for user
-  // allocations).
+  // allocations). May be called concurrently with allocations.
   size_t MemoryUsage() const {
-    return blocks_memory_ + blocks_.capacity() * sizeof(char*);
+    return memory_usage_.load(std::memory_order_relaxed);
   }
 
  private:
@@ -56,8 +63,11 @@ class Arena {
   // Array of new[] allocated memory blocks
   std::vector<char*> blocks_;
 
-  // Bytes of memory in blocks allocated so far
-  size_t blocks_memory_;
+  // Total memory usage of the arena
+  std::atomic<size_t> memory_usage_;
+
+  // Serializes concurrent allocations
+  port::Mutex mu_;
 
   // No copying allowed
   Arena(const Arena&);
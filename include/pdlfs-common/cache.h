@@ -41,6 +41,21 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache with a fixed size capacity. This implementation uses a
+// CLOCK eviction policy and serves cache hits without taking any locks, which
+// scales better than NewLRUCache() when many threads read the cache
+// concurrently. Insertions and erasures are still serialized per shard.
+// "num_shards" is rounded up to a power of 2.
+extern Cache* NewClockCache(size_t capacity, int num_shards = 16);
+
+// Create a new cache with a fixed size capacity. This implementation uses a
+// scan-resistant segmented LRU policy. New entries are placed in a probation
+// segment and only move to a protected segment when they are hit again, so a
+// one-pass scan cannot flush entries that are repeatedly accessed.
+// "protected_ratio" is the fraction of the capacity reserved for the
+// protected segment.
+extern Cache* NewSLRUCache(size_t capacity, double protected_ratio = 0.8);
+
 class Cache {
  public:
   Cache() {}
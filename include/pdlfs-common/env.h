@@ -67,6 +67,16 @@ class Env {
   // Result of this call belongs to the caller and should be deleted after use.
   static Env* NewMmapIoEnvWrapper(Env* base);
 
+  // Return a new Env wrapper object performing all file io (as defined in
+  // SequentialFile, RandomAccessFile, and WritableFile) through a Linux
+  // io_uring shared by all files opened through the wrapper. Writes are
+  // performed in the background and multiple reads passed to
+  // RandomAccessFile::MultiRead() are performed in parallel. If io_uring is
+  // not available, all calls are forwarded to base unchanged. Result of this
+  // call belongs to the caller and should be deleted after use. Files opened
+  // through it must be deleted first.
+  static Env* NewIoUringEnvWrapper(Env* base);
+
   // Return an Env implementation that performs sequential io using standard os
   // io calls such as open(), read(), write(), lseek(), fsync(), and
   // close(), and random reads using pread(). Result of this call belongs to the
@@ -252,6 +262,23 @@ class RandomAccessFile {
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
 
+  // A read of up to "n" bytes at "offset" for MultiRead().
+  struct ReadRequest {
+    uint64_t offset;
+    size_t n;
+    char* scratch;
+    Slice result;
+    Status status;
+  };
+
+  // Perform all reads in "reqs[0..n-1]" as Read() would, storing the
+  // outcome of each read in its "result" and "status". Implementations
+  // may have all reads in progress at the same time. The default
+  // implementation performs them one by one.
+  //
+  // Safe for concurrent use by multiple threads.
+  virtual void MultiRead(ReadRequest* reqs, size_t n) const;
+
  private:
   // No copying allowed
   RandomAccessFile(const RandomAccessFile&);
@@ -409,6 +436,14 @@ class ThreadPool {
   static ThreadPool* NewFixed(int num_threads, bool eager_init = false,
                               void* attr = NULL);
 
+  // Instantiate a new work-stealing thread pool with a fixed number of
+  // threads. Each thread owns a lock-free task queue and idle threads steal
+  // from their peers, so Schedule() does not serialize on a single pool lock.
+  // If "pin_threads" is true, each thread is bound to a cpu in round-robin
+  // order. Currently only supported on Linux and ignored elsewhere.
+  static ThreadPool* NewWorkStealing(int num_threads, bool eager_init = false,
+                                     bool pin_threads = false);
+
   // Arrange to run "(*function)(arg)" once in one of a pool of
   // background threads.
   //
@@ -66,6 +66,13 @@ class MXDB {
   template <typename KX, typename TX, typename OPT, typename PERF>
   Status GET(const DirId& id, const Slice& suf, Stat* stat, std::string* name,
              OPT* opt, TX* tx, PERF* perf);
+  // Batched GET. Looks up n entries under the same directory at once. The
+  // outcome for sufs[i] is stored in statuses[i], and on success its stat
+  // and, if names is not NULL, its name in stats[i] and names[i].
+  template <typename KX, typename TX, typename OPT, typename PERF>
+  void MULTIGET(const DirId& id, size_t n, const Slice* sufs, Stat* stats,
+                std::string* names, Status* statuses, OPT* opt, TX* tx,
+                PERF* perf);
   template <typename KX, typename TX, typename OPT, typename PERF>
   Status PUT(const DirId& id, const Slice& suf, const Stat& stat,
              const Slice& name, OPT* opt, TX* tx, PERF* perf);
@@ -228,6 +235,56 @@ Status MXDB<DX, xslice, xstatus, fmt>::GET(  ////
   return s;
 }
 
+MXDBTEMDECL(DX, xslice, xstatus, fmt)
+template <typename KX, typename TX, typename OPT, typename PERF>
+void MXDB<DX, xslice, xstatus, fmt>::MULTIGET(  ////
+    const DirId& id, size_t n, const Slice* sufs, Stat* stats,
+    std::string* names, Status* statuses, OPT* opt, TX* tx, PERF* perf) {
+  if (n == 0) return;
+  std::vector<std::string> keys(n);
+  std::vector<xslice> keyencs(n);
+  for (size_t i = 0; i < n; i++) {
+    KX key(KEY_INITIALIZER(id, kDirEntType));
+    key.SetSuffix(sufs[i]);
+    keys[i].assign(key.data(), key.size());
+    keyencs[i] = xslice(keys[i].data(), keys[i].size());
+  }
+  std::vector<std::string> tmp(n);
+  std::vector<xstatus> sts(n);
+  if (tx != NULL) {
+    opt->snapshot = tx->snap;
+  }
+  dx_->MultiGet(*opt, n, &keyencs[0], &tmp[0], &sts[0]);
+  for (size_t i = 0; i < n; i++) {
+    Status s;
+    if (sts[i].ok()) {
+      Slice input(tmp[i]);
+      Slice filename;
+      if (!stats[i].DecodeFrom(&input)) {
+        s = Status::Corruption(Slice());
+      } else if (names != NULL) {  // Filename requested
+        if (fmt == kNameInKey) {
+          names[i] = sufs[i].ToString();
+        } else if (!GetLengthPrefixedSlice(&input, &filename)) {
+          s = Status::Corruption(Slice());
+        } else {
+          names[i] = filename.ToString();
+        }
+      }
+    } else {
+      s = XSTATUS(sts[i]);
+    }
+    statuses[i] = s;
+
+    // Collect performance stats
+    if (perf != NULL) {
+      perf->getkeybytes += keyencs[i].size();
+      perf->getbytes += tmp[i].size();
+      perf->gets++;
+    }
+  }
+}
+
 MXDBTEMDECL(DX, xslice, xstatus, fmt)
 template <typename KX, typename TX, typename OPT>
 Status MXDB<DX, xslice, xstatus, fmt>::DELETE(  ////
@@ -21,6 +21,8 @@
 
 namespace pdlfs {
 
+class Slice;
+
 struct BlockContents;
 
 class Comparator;
@@ -36,12 +38,21 @@ class Block {
   size_t size() const { return size_; }
   Iterator* NewIterator(const Comparator* comparator);
 
+  // Return an iterator positioned for a point lookup of "target", an
+  // internal key: at the first entry whose key is >= target, or invalid if
+  // the block's hash index shows that it has no entry with target's user key.
+  // Blocks without a hash index fall back to a regular Seek().
+  Iterator* NewIteratorForGet(const Comparator* comparator,
+                              const Slice& target);
+
  private:
   uint32_t NumRestarts() const;
 
   const char* data_;
   size_t size_;
   uint32_t restart_offset_;  // Offset in data_ of restart array
+  const char* hash_buckets_;  // Hash index buckets, or NULL if none
+  uint32_t num_hash_buckets_;
   bool owned_;               // Block owns data_[]
 
   // No copying allowed
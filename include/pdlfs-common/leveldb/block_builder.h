@@ -20,6 +20,7 @@
 #include "pdlfs-common/slice.h"
 
 #include <stdint.h>
+#include <utility>
 #include <vector>
 
 namespace pdlfs {
@@ -110,6 +111,11 @@ class BlockBuilder : public AbstractBlockBuilder {
   // Set a new restart interval.
   void ChangeRestartInterval(int interval) { restart_interval_ = interval; }
 
+  // Append a hash index mapping the user key of each entry to its restart
+  // interval to future blocks. Point lookups can then skip the binary search
+  // over restart points. REQUIRES: keys are internal keys.
+  void EnableHashIndex() { hash_index_ = true; }
+
   // Reset the contents as if the BlockBuilder was just constructed.
   void Reset();
 
@@ -128,6 +134,9 @@ class BlockBuilder : public AbstractBlockBuilder {
   std::vector<uint32_t> restarts_;  // Restart points
   int counter_;                     // Number of entries emitted since restart
   std::string last_key_;
+  bool hash_index_;
+  // Hash of each distinct user key and the restart interval it starts in
+  std::vector<std::pair<uint32_t, uint32_t> > hashes_;
 
   // No copying allowed
   void operator=(const BlockBuilder&);
@@ -110,6 +110,16 @@ class DB {
   virtual Status Get(const ReadOptions& options, const Slice& key, Slice* value,
                      char* scratch, size_t scratch_size) = 0;
 
+  // Look up keys[0,n-1] at once. For each keys[i], store the status Get()
+  // would have returned in statuses[i] and the value found, if any, in
+  // values[i]. Keys may be given in any order. All keys are read from the
+  // same db state, and data blocks shared by multiple keys are read only
+  // once.
+  //
+  // The default implementation simply calls Get() for each key.
+  virtual void MultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                        std::string* values, Status* statuses);
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -142,6 +152,9 @@ class DB {
   //     about the internal operation of the DB.
   //  "leveldb.sstables" - returns a multi-line string that describes all
   //     of the sstables that make up the db contents.
+  //  "leveldb.coalesced-loads" - returns the number of table opens and block
+  //     reads avoided by waiting for another thread loading the same table
+  //     or block.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
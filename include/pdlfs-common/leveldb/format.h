@@ -29,6 +29,10 @@ class RandomAccessFile;
 
 struct ReadOptions;
 
+namespace port {
+struct ZstdDecompressionDict;
+}
+
 // BlockHandle is a pointer to the extent of a file that stores a data
 // block or a meta block.
 class BlockHandle {
@@ -89,6 +93,17 @@ static const uint64_t kTableMagicNumber = 0xdb4775248b80fb57ull;
 // 1-byte type + 32-bit crc
 static const size_t kBlockTrailerSize = 5;
 
+// Blocks ending with a hash index have this bit set in their restart count.
+static const uint32_t kBlockHashIndexFlag = 1u << 31;
+
+// Restart interval marks in a block hash index bucket
+static const uint8_t kBlockHashIndexEmpty = 255;
+static const uint8_t kBlockHashIndexCollision = 254;
+static const uint32_t kBlockHashIndexMaxRestarts = 254;
+
+// Return the hash of an internal key's user key used by block hash indexes.
+extern uint32_t BlockHashIndexHash(const Slice& internal_key);
+
 struct BlockContents {
   Slice data;           // Actual contents of data
   bool cachable;        // True iff data can be cached
@@ -96,9 +111,20 @@ struct BlockContents {
 };
 
 // Read the block identified by "handle" from "file".  On failure
-// return non-OK.  On success fill *result and return OK.
+// return non-OK.  On success fill *result and return OK.  "dict" is the
+// table's compression dictionary, if any.
 extern Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
-                        const BlockHandle& handle, BlockContents* result);
+                        const BlockHandle& handle, BlockContents* result,
+                        const port::ZstdDecompressionDict* dict = NULL);
+
+// Same as ReadBlock() for the blocks identified by "handles[0..n-1]", storing
+// each block at results[i] and the outcome of its read at statuses[i]. All
+// blocks are read through a single RandomAccessFile::MultiRead() so that the
+// file may have them all in flight at once.
+extern void ReadBlocks(RandomAccessFile* file, const ReadOptions& options,
+                       size_t n, const BlockHandle* handles,
+                       BlockContents* results, Status* statuses,
+                       const port::ZstdDecompressionDict* dict = NULL);
 
 // Implementation details follow.  Clients should ignore,
 inline BlockHandle::BlockHandle()
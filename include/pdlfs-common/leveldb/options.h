@@ -20,6 +20,7 @@
 #include "pdlfs-common/leveldb/types.h"
 
 #include <stddef.h>
+#include <vector>
 
 namespace pdlfs {
 
@@ -31,6 +32,17 @@ class Logger;
 class Snapshot;
 class ThreadPool;
 
+// In-memory data structures that may be used to implement memtables.
+enum MemTableType {
+  // All keys are kept in a single skip list.
+  kSkipListMemTable = 0x0,
+  // Keys are hashed by their first DBOptions::memtable_prefix_length bytes
+  // into per-prefix skip lists. Point lookups only search the keys sharing the
+  // target's prefix, such as the entries of a single directory, while
+  // iteration still returns all keys in order.
+  kPrefixHashMemTable = 0x1
+};
+
 // Options to control the behavior of a database (passed to DB::Open)
 struct DBOptions {
   // -------------------
@@ -80,6 +92,12 @@ struct DBOptions {
   // Default: NULL
   ThreadPool* compaction_pool;
 
+  // Maximum number of background compaction jobs that may run at the same
+  // time. Concurrent jobs never take overlapping inputs. Values greater than
+  // 1 only make sense when compaction_pool has at least as many threads.
+  // Default: 1
+  int max_background_compactions;
+
   // -------------------
   // Parameters that affect performance
 
@@ -95,6 +113,22 @@ struct DBOptions {
   // Default: 4MB
   size_t write_buffer_size;
 
+  // The in-memory data structure used for memtables. kPrefixHashMemTable
+  // requires a comparator that orders keys bytewise and is otherwise
+  // replaced by kSkipListMemTable.
+  // Default: kSkipListMemTable
+  MemTableType memtable_type;
+
+  // Number of leading key bytes hashed by kPrefixHashMemTable. The default
+  // matches the length of tablefs and indexfs key prefixes: a parent
+  // directory inode no. and a key type.
+  // Default: 8
+  size_t memtable_prefix_length;
+
+  // Number of hash buckets used by kPrefixHashMemTable.
+  // Default: 16384
+  size_t memtable_hash_buckets;
+
   // Control over open tables (max number of tables that can be opened).
   // You may need to increase this if your database has a large working set (
   // budget one open file per 2MB of working set).
@@ -136,6 +170,37 @@ struct DBOptions {
   // Default: 1
   int index_block_restart_interval;
 
+  // If true, each data block ends with a small hash index mapping user keys
+  // to restart intervals, which lets point lookups skip the binary search
+  // over the block's restart points. Costs about 1.3 bytes per distinct user
+  // key in a block. Tables written with the index cannot be read by versions
+  // that do not support it.
+  //
+  // Default: false
+  bool data_block_hash_index;
+
+  // If non-zero, the index of each table is split into partitions of about
+  // this many bytes. Partitions are read through the block cache on demand,
+  // and only a small top-level index over them is held in memory while the
+  // table is open. If a filter policy is set, filters are partitioned
+  // along with the index and whole_table_filter is ignored.
+  //
+  // Default: 0 (a single index block per table)
+  size_t index_partition_size;
+
+  // If true, tables whose user keys all have the same length replace their
+  // index block with an entropy-coded trie (ECT) over the last user key of
+  // each data block plus a packed array of block sizes. This takes a few
+  // bytes per data block instead of a full separator key and block handle.
+  // A point lookup may then read one or two data blocks before the one that
+  // holds its key. If a filter policy is set, whole_table_filter is implied.
+  // Tables with keys of varying length get a regular index block. Ignored
+  // if index_partition_size is non-zero, if the comparator is not the
+  // bytewise comparator, or if the library is built without ECT support.
+  //
+  // Default: false
+  bool ect_index;
+
   // Compress blocks using the specified compression algorithm.  This
   // parameter can be changed dynamically.
   //
@@ -152,6 +217,36 @@ struct DBOptions {
   // efficiently detect that and will switch to uncompressed mode.
   CompressionType compression;
 
+  // If not empty, tables written to level L are compressed using
+  // compression_per_level[L], or the last entry if L is beyond the end of
+  // the vector, instead of using compression. Tables flushed from memtables
+  // use the entry for level 0. Fast algorithms such as kLZ4Compression suit
+  // the upper levels, which are rewritten often, while kZstdCompression
+  // saves the most space at the lower levels, which hold most data.
+  //
+  // kLZ4Compression and kZstdCompression require the library to be built
+  // with LZ4 and Zstd support. Blocks are stored uncompressed otherwise.
+  //
+  // Default: empty
+  std::vector<CompressionType> compression_per_level;
+
+  // Compression level used by kZstdCompression.
+  //
+  // Default: 3
+  int zstd_level;
+
+  // If not 0, tables compressed with kZstdCompression sample their first
+  // zstd_dict_training_size bytes of data blocks to train a dictionary of
+  // up to zstd_dict_size bytes. All later data blocks of the table are
+  // compressed using the dictionary, which is stored in the table. This
+  // mostly helps small data blocks, which share little within themselves.
+  //
+  // Default: 0
+  size_t zstd_dict_size;
+
+  // Default: 256KB
+  size_t zstd_dict_training_size;
+
   // If non-NULL, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
@@ -159,6 +254,14 @@ struct DBOptions {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If true, each table gets a single filter over all its keys instead of
+  // one filter per 2KB of data. Point lookups then check the filter before
+  // searching the index block, saving the index search on negative lookups
+  // at the cost of building the filter in memory at the end of each table.
+  // Tables written either way remain readable.
+  // Default: false
+  bool whole_table_filter;
+
   // -------------------
   // Dangerous zone - parameters for experts
 
@@ -194,6 +297,18 @@ struct DBOptions {
   // Default: false
   bool disable_write_ahead_log;
 
+  // If true, writers grouped into a single write-ahead log record insert
+  // their own batches into the memtable in parallel after the log record is
+  // written, instead of having the group leader insert all of them.
+  // Default: false
+  bool allow_concurrent_memtable_write;
+
+  // If true, the write-ahead log append of one write group is allowed to
+  // overlap the memtable insertion of the previous group. Writes become
+  // visible to readers in the order they were logged.
+  // Default: false
+  bool enable_pipelined_write;
+
   // If true, no background compaction will be performed except for
   // those triggered by MemTable dumps.
   // All Tables will stay in Level-0 forever.
@@ -221,6 +336,13 @@ struct DBOptions {
   // Default: 256KB
   size_t table_bulk_read_size;
 
+  // Maximum number of key ranges a single compaction may be split into.
+  // Ranges are cut at the boundaries of the input table files and are
+  // compacted concurrently on the compaction_pool (or env if NULL). All
+  // resulting tables are installed together as a single version edit.
+  // Default: 1 (no splitting)
+  int max_subcompactions;
+
   // Target table file size before data compression is applied.
   // Default: 2MB
   size_t table_file_size;
@@ -284,6 +406,22 @@ struct ReadOptions {
   // Default: NULL
   const Snapshot* snapshot;
 
+  // Maximum number of data blocks an iterator may read ahead of its current
+  // block on readahead_pool. Readahead starts once the iterator moves from
+  // one data block to the next, and its window doubles with each further
+  // block, up to this limit. Seeks reset it. Useful for long scans on high
+  // latency storage.
+  // Default: 0 (no readahead)
+  int readahead_blocks;
+
+  // Thread pool for running readahead. Readahead is disabled if NULL. A block
+  // whose read has not started on the pool by the time the iterator needs it
+  // is read by the iterator itself. Deleting an iterator waits for all the
+  // tasks it has scheduled to run, so the pool must keep running tasks until
+  // every iterator using it is deleted.
+  // Default: NULL
+  ThreadPool* readahead_pool;
+
   ReadOptions();
 };
 
@@ -19,6 +19,8 @@
 #include "pdlfs-common/status.h"
 
 #include <stdint.h>
+#include <atomic>
+#include <vector>
 
 namespace pdlfs {
 
@@ -27,6 +29,7 @@ struct ReadOptions;
 
 class Block;
 class BlockHandle;
+struct BlockContents;
 class Footer;
 class Iterator;
 class RandomAccessFile;
@@ -79,8 +82,35 @@ class Table {
   Rep* rep_;
 
   explicit Table(Rep* rep) { rep_ = rep; }
+  // Count block reads avoided by waiting for a concurrent read of the same
+  // block into *counter. *counter must outlive the table.
+  void SetCoalescedLoadCounter(std::atomic<uint64_t>* counter);
   static Iterator* BlockReader(void* table, const ReadOptions& options,
                                const Slice& block_handle);
+  // Same as BlockReader() for block_handles[0..n-1]. Blocks missing from the
+  // block cache are read together.
+  static void BlockBatchReader(void* table, const ReadOptions& options,
+                               size_t n, const Slice* block_handles,
+                               Iterator** results);
+  // If "prefetched" is not NULL, it holds the contents of the block read by
+  // PrefetchBlocks() and is used instead of reading the block again. Takes
+  // ownership of "prefetched".
+  Iterator* NewBlockIterator(const ReadOptions& options,
+                             const Slice& block_handle,
+                             const Slice* get_target,
+                             BlockContents* prefetched = NULL) const;
+  // Read the data blocks at block_handles[0..n-1] that are missing from the
+  // block cache with a single RandomAccessFile::MultiRead(). Sets
+  // (*results)[i] to the contents of each block read, or NULL if the block
+  // is left to NewBlockIterator() to fetch.
+  void PrefetchBlocks(const ReadOptions& options, size_t n,
+                      const Slice* block_handles,
+                      std::vector<BlockContents*>* results) const;
+  // Return an iterator over the index entries of all data blocks.
+  Iterator* NewIndexIterator(const ReadOptions& options) const;
+  bool PartitionFilterMayMatch(const ReadOptions& options,
+                               const Slice& filter_handle_value,
+                               const Slice& key) const;
 
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
@@ -89,10 +119,19 @@ class Table {
   Status InternalGet(const ReadOptions& options, const Slice& key, void* arg,
                      void (*handle_result)(void* arg, const Slice& k,
                                            const Slice& v));
-
-  void ReadMeta(const Footer& footer);
+  // Same as InternalGet() for keys[0,n-1], which must be sorted. Results for
+  // keys[i] are passed to args[i] and its status is stored in statuses[i].
+  // Data blocks and index partitions shared by keys are only read once.
+  void InternalMultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                        void* const* args,
+                        void (*handle_result)(void* arg, const Slice& k,
+                                              const Slice& v),
+                        Status* statuses);
+
+  Status ReadMeta(const Footer& footer);
   void ReadProperties(const Slice& props_handle_value);
-  void ReadFilter(const Slice& filter_handle_value);
+  Status ReadDict(const Slice& dict_handle_value);
+  void ReadFilter(const Slice& filter_handle_value, bool whole_table);
 
   // No copying allowed
   void operator=(const Table&);
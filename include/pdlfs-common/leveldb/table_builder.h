@@ -35,6 +35,10 @@ class BlockHandle;
 class WritableFile;
 class TableProperties;
 
+namespace port {
+struct ZstdCompressionDict;
+}
+
 class TableBuilder {
   typedef DBOptions Options;
 
@@ -95,13 +99,16 @@ class TableBuilder {
   uint64_t FileSize() const;
 
  private:
-  void WriteBlock(const Slice& block_contents, BlockHandle* handle);
+  void WriteBlock(const Slice& block_contents, BlockHandle* handle,
+                  const port::ZstdCompressionDict* dict = NULL);
   void WriteRawBlock(const Slice& raw_block_contents, CompressionType,
                      BlockHandle* handle);
 
   bool ok() const { return status().ok(); }
 
   void AddBlock(BlockBuilder* builder, BlockHandle* handle);
+  void SampleBlock(const Slice& block_contents);
+  void FlushIndexPartition();
 
   struct Rep;
   Rep* rep_;
@@ -40,10 +40,28 @@ class TableProperties {
     }
   }
 
+  // Set if the table has a single filter over all its keys instead of one
+  // filter per 2KB of data block offsets.
+  void SetWholeTableFilter(bool whole_table_filter) {
+    whole_table_filter_ = whole_table_filter;
+  }
+
+  // Set if the index of the table is split into partitions.
+  void SetPartitionedIndex(bool partitioned_index) {
+    partitioned_index_ = partitioned_index;
+  }
+
+  // Set if the index block of the table is an ECT index instead of a block
+  // of separator keys.
+  void SetECTIndex(bool ect_index) { ect_index_ = ect_index; }
+
   Slice first_key() const { return first_key_; }
   Slice last_key() const { return last_key_; }
   uint64_t min_seq() const { return min_seq_; }
   uint64_t max_seq() const { return max_seq_; }
+  bool whole_table_filter() const { return whole_table_filter_; }
+  bool partitioned_index() const { return partitioned_index_; }
+  bool ect_index() const { return ect_index_; }
 
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
@@ -54,6 +72,9 @@ class TableProperties {
   std::string last_key_;
   uint64_t min_seq_;
   uint64_t max_seq_;
+  bool whole_table_filter_;
+  bool partitioned_index_;
+  bool ect_index_;
 };
 
 }  // namespace pdlfs
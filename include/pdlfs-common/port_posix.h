@@ -61,6 +61,13 @@
 #ifdef PDLFS_SNAPPY
 #include <snappy.h>
 #endif
+#ifdef PDLFS_LZ4
+#include <lz4.h>
+#endif
+#ifdef PDLFS_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
 #include "pdlfs-common/atomic_pointer.h"  // Platform-specific atomic pointer
 
 #include <limits.h>
@@ -185,6 +192,222 @@ inline bool Snappy_Uncompress(const char* input, size_t length, char* output) {
 #endif
 }
 
+// LZ4 block data does not record its uncompressed length, so we store it
+// as a fixed32 before the compressed data.
+inline bool LZ4_Compress(const char* input, size_t length,
+                         ::std::string* output) {
+#ifdef PDLFS_LZ4
+  if (length > static_cast<size_t>(LZ4_MAX_INPUT_SIZE)) {
+    return false;
+  }
+  const int bound = LZ4_compressBound(static_cast<int>(length));
+  output->resize(4 + bound);
+  char* const dst = &(*output)[0];
+  for (int i = 0; i < 4; i++) {
+    dst[i] = static_cast<char>((length >> (8 * i)) & 0xff);
+  }
+  const int outlen =
+      LZ4_compress_default(input, dst + 4, static_cast<int>(length), bound);
+  if (outlen <= 0) {
+    return false;
+  }
+  output->resize(4 + outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool LZ4_GetUncompressedLength(const char* input, size_t length,
+                                      size_t* result) {
+#ifdef PDLFS_LZ4
+  if (length < 4) {
+    return false;
+  }
+  *result = 0;
+  for (int i = 0; i < 4; i++) {
+    *result |= static_cast<size_t>(static_cast<unsigned char>(input[i]))
+               << (8 * i);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool LZ4_Uncompress(const char* input, size_t length, char* output) {
+#ifdef PDLFS_LZ4
+  size_t ulength;
+  if (!LZ4_GetUncompressedLength(input, length, &ulength)) {
+    return false;
+  }
+  const int outlen =
+      LZ4_decompress_safe(input + 4, output, static_cast<int>(length - 4),
+                          static_cast<int>(ulength));
+  return outlen >= 0 && static_cast<size_t>(outlen) == ulength;
+#else
+  return false;
+#endif
+}
+
+#ifdef PDLFS_ZSTD
+// Return the calling thread's zstd contexts. Never deleted by the caller.
+extern ZSTD_CCtx* ZstdCompressionContext();
+extern ZSTD_DCtx* ZstdDecompressionContext();
+#endif
+
+// Dictionaries digested once for compressing or uncompressing many blocks.
+// Digesting a dictionary costs much more than using it on a single block.
+struct ZstdCompressionDict;
+struct ZstdDecompressionDict;
+#ifdef PDLFS_ZSTD
+struct ZstdCompressionDict {
+  ZSTD_CDict* cdict;
+};
+
+struct ZstdDecompressionDict {
+  ZSTD_DDict* ddict;
+};
+#endif
+
+// Digest a dictionary, as returned by Zstd_TrainDictionary(), for
+// compressing at the given level. Return NULL if zstd is not supported or if
+// the dictionary cannot be loaded.
+inline ZstdCompressionDict* Zstd_NewCompressionDict(int level,
+                                                    const char* dict,
+                                                    size_t dict_size) {
+#ifdef PDLFS_ZSTD
+  ZSTD_CDict* const cdict = ZSTD_createCDict(dict, dict_size, level);
+  if (cdict != NULL) {
+    ZstdCompressionDict* const result = new ZstdCompressionDict;
+    result->cdict = cdict;
+    return result;
+  }
+#endif
+  return NULL;
+}
+
+inline void Zstd_DeleteCompressionDict(ZstdCompressionDict* dict) {
+#ifdef PDLFS_ZSTD
+  if (dict != NULL) {
+    ZSTD_freeCDict(dict->cdict);
+    delete dict;
+  }
+#endif
+}
+
+// Same as above, for uncompressing.
+inline ZstdDecompressionDict* Zstd_NewDecompressionDict(const char* dict,
+                                                        size_t dict_size) {
+#ifdef PDLFS_ZSTD
+  ZSTD_DDict* const ddict = ZSTD_createDDict(dict, dict_size);
+  if (ddict != NULL) {
+    ZstdDecompressionDict* const result = new ZstdDecompressionDict;
+    result->ddict = ddict;
+    return result;
+  }
+#endif
+  return NULL;
+}
+
+inline void Zstd_DeleteDecompressionDict(ZstdDecompressionDict* dict) {
+#ifdef PDLFS_ZSTD
+  if (dict != NULL) {
+    ZSTD_freeDDict(dict->ddict);
+    delete dict;
+  }
+#endif
+}
+
+// If "dict" is not NULL, compress using it at the level it was digested for
+// instead of "level". The output records the dictionary's id.
+inline bool Zstd_Compress(int level, const char* input, size_t length,
+                          ::std::string* output,
+                          const ZstdCompressionDict* dict = NULL) {
+#ifdef PDLFS_ZSTD
+  ZSTD_CCtx* const ctx = ZstdCompressionContext();
+  if (ctx == NULL) {
+    return false;
+  }
+  output->resize(ZSTD_compressBound(length));
+  const size_t outlen =
+      dict != NULL
+          ? ZSTD_compress_usingCDict(ctx, &(*output)[0], output->size(),
+                                     input, length, dict->cdict)
+          : ZSTD_compressCCtx(ctx, &(*output)[0], output->size(), input,
+                              length, level);
+  if (ZSTD_isError(outlen)) {
+    return false;
+  }
+  output->resize(outlen);
+  return true;
+#endif
+
+  return false;
+}
+
+inline bool Zstd_GetUncompressedLength(const char* input, size_t length,
+                                       size_t* result) {
+#ifdef PDLFS_ZSTD
+  const unsigned long long ulength = ZSTD_getFrameContentSize(input, length);
+  if (ulength == ZSTD_CONTENTSIZE_UNKNOWN ||
+      ulength == ZSTD_CONTENTSIZE_ERROR) {
+    return false;
+  }
+  *result = static_cast<size_t>(ulength);
+  return true;
+#else
+  return false;
+#endif
+}
+
+// "dict" is only used if the input was compressed with a dictionary, in
+// which case it must be that dictionary.
+inline bool Zstd_Uncompress(const char* input, size_t length, char* output,
+                            size_t output_length,
+                            const ZstdDecompressionDict* dict = NULL) {
+#ifdef PDLFS_ZSTD
+  const bool use_dict = ZSTD_getDictID_fromFrame(input, length) != 0;
+  if (use_dict && dict == NULL) {
+    return false;  // Dictionary missing
+  }
+  ZSTD_DCtx* const ctx = ZstdDecompressionContext();
+  if (ctx == NULL) {
+    return false;
+  }
+  const size_t outlen =
+      use_dict ? ZSTD_decompress_usingDDict(ctx, output, output_length, input,
+                                            length, dict->ddict)
+               : ZSTD_decompressDCtx(ctx, output, output_length, input, length);
+  return !ZSTD_isError(outlen) && outlen == output_length;
+#else
+  return false;
+#endif
+}
+
+// Train a dictionary of at most "max_dict_size" bytes from "num_samples"
+// samples stored back to back in "samples". Return false if there is not
+// enough sample data to train a useful dictionary.
+inline bool Zstd_TrainDictionary(const ::std::string& samples,
+                                 const size_t* sample_sizes,
+                                 size_t num_samples, size_t max_dict_size,
+                                 ::std::string* dict) {
+#ifdef PDLFS_ZSTD
+  dict->resize(max_dict_size);
+  const size_t dict_size = ZDICT_trainFromBuffer(
+      &(*dict)[0], max_dict_size, samples.data(), sample_sizes,
+      static_cast<unsigned>(num_samples));
+  if (ZDICT_isError(dict_size)) {
+    dict->clear();
+    return false;
+  }
+  dict->resize(dict_size);
+  return true;
+#endif
+
+  return false;
+}
+
 inline bool GetHeapProfile(void (*)(void*, const char*, int), void*) {
   return false;
 }
@@ -100,6 +100,27 @@ struct RPCOptions {
   // Per-socket UDP server-side sender buffer size.
   // Default: -1
   int udp_srv_sndbuf;
+
+  // Max number of UDP messages a server thread receives, and replies it
+  // sends, per system call. Values larger than 1 enable batched processing
+  // through recvmmsg() and sendmmsg() on platforms that support them.
+  // Default: 1
+  int udp_srv_batch_size;
+
+  // If true, each server thread binds a socket of its own to the server
+  // address using SO_REUSEPORT so that the kernel spreads incoming UDP
+  // messages and TCP connections across threads instead of having all
+  // threads contend for one shared socket. Requires SO_REUSEPORT support.
+  // Default: false
+  bool srv_reuseport;
+
+  // If true, TCP clients keep a persistent connection to each server and
+  // share it among all stubs opened for that server. Messages are framed and
+  // tagged with request ids so that many calls may be in flight over a single
+  // connection. Servers serve many such connections per thread. Clients and
+  // servers must agree on this setting.
+  // Default: false
+  bool tcp_persistent_connections;
 };
 
 // Each RPC* is a reference to an RPC instance. This instance either acts as a
@@ -210,6 +231,37 @@ class If {
   // Return OK on success, or a non-OK status on errors.
   // Must not throw any exceptions.
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT = 0;
+
+  // Callback for asynchronous calls. "status" is the final status of the call
+  // and "arg" is the argument passed to AsyncCall().
+  typedef void (*Callback)(const Status& status, void* arg);
+
+  // Submit a call without waiting for its reply so that a single caller may
+  // keep many calls in flight. On OK, "cb" will be invoked exactly once when
+  // the call completes, either from within a future Poll() or, for calls that
+  // complete synchronously, before AsyncCall() returns. "in" may be reused as
+  // soon as AsyncCall() returns, but "out" must remain valid until "cb" has
+  // been invoked. Return a non-OK status if the call cannot be submitted, in
+  // which case "cb" will not be invoked. The asynchronous interface of a stub
+  // must not be used by more than one thread at a time, and a stub must not be
+  // deleted while it has calls outstanding. The default implementation
+  // performs the call synchronously and invokes "cb" before returning.
+  virtual Status AsyncCall(Message& in, Message& out, Callback cb,
+                           void* arg) RPCNOEXCEPT;
+
+  // Invoke callbacks for asynchronous calls that have completed. If "wait" is
+  // true and no completed calls are pending, block until at least one
+  // outstanding call completes. Return the number of callbacks invoked, which
+  // is 0 when there are no outstanding calls.
+  // The default implementation has no outstanding calls and returns 0.
+  virtual int Poll(bool wait) RPCNOEXCEPT;
+
+  // Block until all outstanding asynchronous calls have completed.
+  void WaitAll() {
+    while (Poll(true) != 0) {
+    }
+  }
+
   virtual ~If();
   If() {}
 
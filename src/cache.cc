@@ -55,14 +55,12 @@
 // operation (reading an SSTable data block or opening an SSTable file).
 //
 // To ensure that "expensive" operations are only performed once by one client
-// thread (this is not always necessary though), the client code will have to
-// use locks outside of the cache. Thus only the first client thread does the
-// expensive operation, and the other concurrent threads wait for the first to
-// complete and reap its result.
-//
-// Unless keeping memory consumption low is critical, having multiple client
-// threads perform the expensive operation and "compete" may lead to better
-// performance.
+// thread, the client code has to use locks outside of the cache. Leveldb's
+// TableCache and Table::BlockReader do so through the SingleFlight helper in
+// src/leveldb/single_flight.h: only the first client thread to miss a table or
+// a data block loads it, and the other concurrent threads wait for the first
+// to complete and then reap its result from the cache. The number of loads
+// saved this way is reported by the "leveldb.coalesced-loads" DB property.
 namespace pdlfs {
 
 Cache::~Cache() {}
@@ -16,6 +16,8 @@
  */
 #include "pdlfs-common/cache.h"
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/testharness.h"
 
 #include <vector>
@@ -50,6 +52,7 @@ class CacheTest {
   Cache* cache_;
 
   CacheTest() : cache_(NewLRUCache(kCacheSize)) { current_ = this; }
+  explicit CacheTest(Cache* cache) : cache_(cache) { current_ = this; }
 
   ~CacheTest() { delete cache_; }
 
@@ -185,6 +188,222 @@ TEST(CacheTest, NewId) {
   ASSERT_NE(a, b);
 }
 
+class ClockCacheTest : public CacheTest {
+ public:
+  // Use a single shard so eviction is deterministic
+  ClockCacheTest() : CacheTest(NewClockCache(kCacheSize, 1)) {}
+};
+
+TEST(ClockCacheTest, ClockHitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  Insert(200, 201);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(2, deleted_keys_.size());
+  // Many more keys than initial hash buckets
+  for (int i = 0; i < 500; i++) {
+    Insert(1000 + i, 2000 + i);
+  }
+  for (int i = 0; i < 500; i++) {
+    ASSERT_EQ(2000 + i, Lookup(1000 + i));
+  }
+}
+
+TEST(ClockCacheTest, ClockEntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+  Insert(100, 102);
+  Cache::Handle* h2 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(102, DecodeValue(cache_->Value(h2)));
+  ASSERT_EQ(0, deleted_keys_.size());
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+  // Pinned entries survive eviction
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000 + i, 2000 + i);
+  }
+  ASSERT_EQ(102, DecodeValue(cache_->Value(h2)));
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  const size_t n = deleted_keys_.size();
+  cache_->Release(h2);
+  ASSERT_EQ(n + 1, deleted_keys_.size());
+  ASSERT_EQ(102, deleted_values_.back());
+}
+
+TEST(ClockCacheTest, ClockEvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // Frequently used entry must be kept around
+  for (int i = 0; i < kCacheSize + 100; i++) {
+    Insert(1000 + i, 2000 + i);
+    ASSERT_EQ(2000 + i, Lookup(1000 + i));
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+}
+
+TEST(ClockCacheTest, ClockHeavyEntries) {
+  const int kLight = 1;
+  const int kHeavy = 10;
+  int added = 0;
+  int index = 0;
+  while (added < 2 * kCacheSize) {
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000 + index, weight);
+    added += weight;
+    index++;
+  }
+
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    const int weight = (i & 1 ? kLight : kHeavy);
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += weight;
+      ASSERT_EQ(1000 + i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
+}
+
+class SLRUCacheTest : public CacheTest {
+ public:
+  SLRUCacheTest() : CacheTest(NewSLRUCache(kCacheSize)) {}
+};
+
+TEST(SLRUCacheTest, SLRUHitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  Insert(200, 201);
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(102, deleted_values_[1]);
+}
+
+TEST(SLRUCacheTest, SLRUEntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h = cache_->Lookup(EncodeKey(100));
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000 + i, 2000 + i);
+  }
+  ASSERT_EQ(101, Lookup(100));
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  const size_t n = deleted_keys_.size();
+  cache_->Release(h);
+  ASSERT_EQ(n + 1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_.back());
+}
+
+TEST(SLRUCacheTest, SLRUScanResistance) {
+  const int kHot = 50;
+  for (int i = 0; i < kHot; i++) {
+    Insert(i, 1000 + i);
+    ASSERT_EQ(1000 + i, Lookup(i));  // Promote
+  }
+  // A long scan inserting each key exactly once
+  for (int i = 0; i < 5 * kCacheSize; i++) {
+    Insert(10000 + i, 20000 + i);
+  }
+  for (int i = 0; i < kHot; i++) {
+    ASSERT_EQ(1000 + i, Lookup(i));
+  }
+}
+
+TEST(SLRUCacheTest, SLRUHeavyEntries) {
+  const int kLight = 1;
+  const int kHeavy = 10;
+  int added = 0;
+  int index = 0;
+  while (added < 2 * kCacheSize) {
+    const int weight = (index & 1) ? kLight : kHeavy;
+    Insert(index, 1000 + index, weight);
+    added += weight;
+    index++;
+  }
+
+  int cached_weight = 0;
+  for (int i = 0; i < index; i++) {
+    const int weight = (i & 1 ? kLight : kHeavy);
+    int r = Lookup(i);
+    if (r >= 0) {
+      cached_weight += weight;
+      ASSERT_EQ(1000 + i, r);
+    }
+  }
+  ASSERT_LE(cached_weight, kCacheSize + kCacheSize / 10);
+}
+
+namespace {
+struct ClockReaderState {
+  Cache* cache;
+  port::Mutex mu;
+  int done;
+};
+
+void ClockNoopDeleter(const Slice& key, void* value) {}
+
+void ClockReader(void* arg) {
+  ClockReaderState* state = reinterpret_cast<ClockReaderState*>(arg);
+  for (int i = 0; i < 20000; i++) {
+    const int k = i % 1500;
+    Cache::Handle* h = state->cache->Lookup(EncodeKey(k));
+    if (h != NULL) {
+      ASSERT_EQ(k + 1, DecodeValue(state->cache->Value(h)));
+      state->cache->Release(h);
+    } else {
+      state->cache->Release(state->cache->Insert(
+          EncodeKey(k), EncodeValue(k + 1), 1, ClockNoopDeleter));
+    }
+  }
+  MutexLock ml(&state->mu);
+  state->done++;
+}
+}  // namespace
+
+TEST(ClockCacheTest, ClockConcurrentAccess) {
+  ClockReaderState state;
+  state.cache = NewClockCache(kCacheSize, 4);
+  state.done = 0;
+  const int kThreads = 4;
+  for (int i = 0; i < kThreads; i++) {
+    Env::Default()->StartThread(ClockReader, &state);
+  }
+  while (true) {
+    state.mu.Lock();
+    const int done = state.done;
+    state.mu.Unlock();
+    if (done == kThreads) break;
+    SleepForMicroseconds(1000);
+  }
+  delete state.cache;
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
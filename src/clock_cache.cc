@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/hash.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <atomic>
+#include <string.h>
+#include <vector>
+
+// A CLOCK cache whose hits take no locks.
+//
+// Each entry carries a 64-bit atomic state word holding its reference count,
+// a "visible" bit, and a small CLOCK counter. A lookup walks a hash chain
+// without locking, optimistically increments the reference count of a
+// candidate entry, and then verifies that the entry is still visible and holds
+// the wanted key. A hit additionally bumps the entry's CLOCK counter. A release
+// simply decrements the reference count. Neither touches any shared list.
+//
+// Insertions, erasures, and evictions are serialized by a per-shard mutex.
+// Eviction sweeps a CLOCK hand over the entries of a shard, decrementing
+// counters and evicting the first unreferenced entry whose counter is zero.
+//
+// Entry objects are never returned to the allocator until the cache is
+// destroyed. Instead, freed entries are recycled within their shard. This
+// keeps concurrent readers that still hold a pointer to a removed entry safe:
+// they may observe a stale hash chain and report a false miss, but they can
+// never return a wrong entry because key and visibility are checked after a
+// reference is taken. Lookups therefore may miss an entry that is being
+// concurrently inserted, erased, or rehashed, which is harmless for a cache.
+namespace pdlfs {
+
+namespace {
+
+struct ClockEntry {
+  // Layout of the state word:
+  //   [63..32] reference count, held by client handles
+  //   [9]      claimed, set once the entry is being freed or is free
+  //   [8]      visible, set while the entry is in the cache's hash table
+  //   [7..0]   clock counter
+  std::atomic<uint64_t> state;
+  std::atomic<uint32_t> hash;
+  std::atomic<ClockEntry*> next_hash;
+  // The following fields are protected by the shard mutex
+  ClockEntry* next;
+  ClockEntry* prev;
+  // The following fields are immutable while the entry is visible or
+  // referenced
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  size_t charge;
+  char* key_data;
+  size_t key_length;
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+enum {
+  kClockMask = 0xFF,
+  kMaxClock = 3,
+  kVisible = 1 << 8,
+  kClaimed = 1 << 9,
+  kRefShift = 32,
+  // Bound on the number of hash chain links followed by a lock-free lookup.
+  // Only reached if the lookup is racing with concurrent updates.
+  kMaxChainSteps = 256
+};
+
+static const uint64_t kOneRef = uint64_t(1) << kRefShift;
+
+inline uint64_t Refs(uint64_t state) { return state >> kRefShift; }
+
+struct ClockTable {
+  ClockTable(size_t n) : mask(n - 1), heads(new std::atomic<ClockEntry*>[n]) {
+    for (size_t i = 0; i < n; i++) {
+      heads[i].store(NULL, std::memory_order_relaxed);
+    }
+  }
+  ~ClockTable() { delete[] heads; }
+  size_t mask;
+  std::atomic<ClockEntry*>* heads;
+};
+
+class ClockCacheShard {
+ public:
+  ClockCacheShard();
+  ~ClockCacheShard();
+
+  void SetCapacity(size_t capacity) { capacity_ = capacity; }
+  ClockEntry* Insert(const Slice& key, uint32_t hash, void* value,
+                     size_t charge,
+                     void (*deleter)(const Slice& key, void* value));
+  ClockEntry* Lookup(const Slice& key, uint32_t hash);
+  void Release(ClockEntry* e);
+  void Erase(const Slice& key, uint32_t hash);
+
+ private:
+  bool TryClaim(ClockEntry* e);
+  // Remove e from the hash table and the clock ring. Free it if it is no
+  // longer referenced. REQUIRES: mu_ has been locked.
+  void Remove(ClockEntry* e);
+  // Call the deleter of e and put e on the free list.
+  // REQUIRES: mu_ has been locked.
+  void Free(ClockEntry* e);
+  void EvictIfNeeded();
+  void Resize();
+  std::atomic<ClockEntry*>* Bucket(uint32_t hash) const {
+    ClockTable* t = table_.load(std::memory_order_relaxed);
+    return &t->heads[hash & t->mask];
+  }
+
+  port::Mutex mu_;
+  std::atomic<ClockTable*> table_;
+  // Old tables are kept until destruction since concurrent lookups may
+  // still be reading them
+  std::vector<ClockTable*> retired_tables_;
+  std::vector<ClockEntry*> all_entries_;  // For final deallocation
+  std::vector<ClockEntry*> free_entries_;
+  ClockEntry* hand_;  // Head of the clock ring
+  size_t num_entries_;
+  size_t capacity_;
+  size_t usage_;
+  // Keep shards on different cache lines
+  char pad_[64];
+};
+
+ClockCacheShard::ClockCacheShard()
+    : table_(new ClockTable(16)),
+      hand_(NULL),
+      num_entries_(0),
+      capacity_(0),
+      usage_(0) {}
+
+ClockCacheShard::~ClockCacheShard() {
+  ClockEntry* e = hand_;
+  for (size_t i = 0; i < num_entries_; i++) {
+    assert(Refs(e->state.load()) == 0);  // Error if caller has a handle
+    (*e->deleter)(e->key(), e->value);
+    delete[] e->key_data;
+    e = e->next;
+  }
+  for (size_t i = 0; i < all_entries_.size(); i++) {
+    delete all_entries_[i];
+  }
+  for (size_t i = 0; i < retired_tables_.size(); i++) {
+    delete retired_tables_[i];
+  }
+  delete table_.load();
+}
+
+ClockEntry* ClockCacheShard::Lookup(const Slice& key, uint32_t hash) {
+  ClockTable* t = table_.load(std::memory_order_acquire);
+  ClockEntry* e = t->heads[hash & t->mask].load(std::memory_order_acquire);
+  for (int n = 0; e != NULL && n < kMaxChainSteps; n++) {
+    if (e->hash.load(std::memory_order_relaxed) == hash) {
+      uint64_t s = e->state.fetch_add(kOneRef, std::memory_order_acquire);
+      if ((s & kVisible) != 0 &&
+          e->hash.load(std::memory_order_relaxed) == hash && e->key() == key) {
+        while ((s & kClockMask) < kMaxClock) {
+          if (e->state.compare_exchange_weak(s, s + 1)) {
+            break;
+          }
+        }
+        return e;
+      }
+      Release(e);  // Not the entry we are looking for
+    }
+    e = e->next_hash.load(std::memory_order_acquire);
+  }
+  return NULL;
+}
+
+bool ClockCacheShard::TryClaim(ClockEntry* e) {
+  uint64_t s = e->state.load();
+  while (Refs(s) == 0 && (s & (kVisible | kClaimed)) == 0) {
+    if (e->state.compare_exchange_weak(s, s | kClaimed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ClockCacheShard::Release(ClockEntry* e) {
+  const uint64_t s = e->state.fetch_sub(kOneRef, std::memory_order_acq_rel);
+  assert(Refs(s) != 0);
+  if (Refs(s) == 1 && (s & (kVisible | kClaimed)) == 0) {
+    if (TryClaim(e)) {
+      MutexLock ml(&mu_);
+      Free(e);
+    }
+  }
+}
+
+void ClockCacheShard::Free(ClockEntry* e) {
+  mu_.AssertHeld();
+  (*e->deleter)(e->key(), e->value);
+  delete[] e->key_data;
+  e->key_data = NULL;
+  free_entries_.push_back(e);
+}
+
+void ClockCacheShard::Remove(ClockEntry* e) {
+  mu_.AssertHeld();
+  const uint32_t hash = e->hash.load(std::memory_order_relaxed);
+  std::atomic<ClockEntry*>* ptr = Bucket(hash);
+  while (ptr->load(std::memory_order_relaxed) != e) {
+    ptr = &ptr->load(std::memory_order_relaxed)->next_hash;
+  }
+  ptr->store(e->next_hash.load(std::memory_order_relaxed),
+             std::memory_order_release);
+  if (num_entries_ == 1) {
+    hand_ = NULL;
+  } else {
+    if (hand_ == e) hand_ = e->next;
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+  }
+  num_entries_--;
+  assert(usage_ >= e->charge);
+  usage_ -= e->charge;
+  e->state.fetch_and(~uint64_t(kVisible));
+  if (TryClaim(e)) {
+    Free(e);
+  }
+}
+
+void ClockCacheShard::EvictIfNeeded() {
+  mu_.AssertHeld();
+  // Each entry is visited at most kMaxClock + 1 times before it is either
+  // evicted or found pinned. Give up if everything is pinned.
+  size_t budget = num_entries_ * (kMaxClock + 1);
+  while (usage_ > capacity_ && hand_ != NULL && budget-- != 0) {
+    ClockEntry* const e = hand_;
+    hand_ = e->next;
+    uint64_t s = e->state.load();
+    if (Refs(s) != 0) {
+      continue;
+    } else if ((s & kClockMask) != 0) {
+      e->state.fetch_sub(1);
+    } else {
+      Remove(e);
+    }
+  }
+}
+
+void ClockCacheShard::Resize() {
+  mu_.AssertHeld();
+  ClockTable* const old_table = table_.load(std::memory_order_relaxed);
+  ClockTable* const new_table = new ClockTable(2 * (old_table->mask + 1));
+  for (size_t i = 0; i <= old_table->mask; i++) {
+    ClockEntry* e = old_table->heads[i].load(std::memory_order_relaxed);
+    while (e != NULL) {
+      ClockEntry* const next = e->next_hash.load(std::memory_order_relaxed);
+      const uint32_t hash = e->hash.load(std::memory_order_relaxed);
+      std::atomic<ClockEntry*>* head = &new_table->heads[hash & new_table->mask];
+      e->next_hash.store(head->load(std::memory_order_relaxed),
+                         std::memory_order_release);
+      head->store(e, std::memory_order_relaxed);
+      e = next;
+    }
+  }
+  table_.store(new_table, std::memory_order_release);
+  retired_tables_.push_back(old_table);
+}
+
+ClockEntry* ClockCacheShard::Insert(const Slice& key, uint32_t hash,
+                                    void* value, size_t charge,
+                                    void (*deleter)(const Slice& key,
+                                                    void* value)) {
+  MutexLock ml(&mu_);
+  ClockEntry* e;
+  if (!free_entries_.empty()) {
+    e = free_entries_.back();
+    free_entries_.pop_back();
+  } else {
+    e = new ClockEntry;
+    e->state.store(kClaimed);
+    all_entries_.push_back(e);
+  }
+  e->value = value;
+  e->deleter = deleter;
+  e->charge = charge;
+  e->key_length = key.size();
+  e->key_data = new char[key.size() > 0 ? key.size() : 1];
+  memcpy(e->key_data, key.data(), key.size());
+  e->hash.store(hash, std::memory_order_relaxed);
+  // Concurrent lookups holding a stale pointer to this entry may still be
+  // adjusting its reference count, which we must preserve
+  uint64_t s = e->state.load();
+  while (!e->state.compare_exchange_weak(
+      s, (s & ~((uint64_t(1) << kRefShift) - 1)) + kOneRef + kVisible + 1,
+      std::memory_order_release)) {
+  }
+
+  std::atomic<ClockEntry*>* const bucket = Bucket(hash);
+  for (ClockEntry* old = bucket->load(std::memory_order_relaxed); old != NULL;
+       old = old->next_hash.load(std::memory_order_relaxed)) {
+    if (old->hash.load(std::memory_order_relaxed) == hash &&
+        old->key() == key) {
+      Remove(old);
+      break;
+    }
+  }
+  e->next_hash.store(bucket->load(std::memory_order_relaxed),
+                     std::memory_order_relaxed);
+  bucket->store(e, std::memory_order_release);
+  // Insert e right behind the clock hand so that it is the last to be visited
+  if (hand_ == NULL) {
+    e->next = e->prev = e;
+    hand_ = e;
+  } else {
+    e->next = hand_;
+    e->prev = hand_->prev;
+    e->prev->next = e;
+    e->next->prev = e;
+  }
+  num_entries_++;
+  usage_ += charge;
+  EvictIfNeeded();
+  if (num_entries_ > table_.load(std::memory_order_relaxed)->mask + 1) {
+    Resize();
+  }
+  return e;
+}
+
+void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
+  MutexLock ml(&mu_);
+  for (ClockEntry* e = Bucket(hash)->load(std::memory_order_relaxed);
+       e != NULL; e = e->next_hash.load(std::memory_order_relaxed)) {
+    if (e->hash.load(std::memory_order_relaxed) == hash && e->key() == key) {
+      Remove(e);
+      break;
+    }
+  }
+}
+
+class ShardedClockCache : public Cache {
+ private:
+  port::Mutex id_mu_;
+  uint64_t id_;  // The last allocated id number
+
+  static inline uint32_t hashval(const Slice& in) {
+    return Hash(in.data(), in.size(), 0);
+  }
+
+  uint32_t sha(uint32_t hash) const {
+    return shard_bits_ != 0 ? hash >> (32 - shard_bits_) : 0;
+  }
+
+  int shard_bits_;
+  ClockCacheShard* sh_;
+
+ public:
+  ShardedClockCache(size_t capacity, int num_shards) : id_(0), shard_bits_(0) {
+    while ((1 << shard_bits_) < num_shards && shard_bits_ < 16) {
+      shard_bits_++;
+    }
+    const int n = 1 << shard_bits_;
+    sh_ = new ClockCacheShard[n];
+    const size_t per_shard = (capacity + (n - 1)) / n;
+    for (int s = 0; s < n; s++) {
+      sh_[s].SetCapacity(per_shard);
+    }
+  }
+
+  virtual ~ShardedClockCache() { delete[] sh_; }
+
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    const uint32_t hash = hashval(key);
+    ClockEntry* e = sh_[sha(hash)].Insert(key, hash, value, charge, deleter);
+    return reinterpret_cast<Handle*>(e);
+  }
+
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = hashval(key);
+    ClockEntry* e = sh_[sha(hash)].Lookup(key, hash);
+    return reinterpret_cast<Handle*>(e);
+  }
+
+  virtual void Release(Handle* handle) {
+    ClockEntry* e = reinterpret_cast<ClockEntry*>(handle);
+    sh_[sha(e->hash.load(std::memory_order_relaxed))].Release(e);
+  }
+
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = hashval(key);
+    sh_[sha(hash)].Erase(key, hash);
+  }
+
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<ClockEntry*>(handle)->value;
+  }
+
+  virtual uint64_t NewId() {
+    MutexLock l(&id_mu_);
+    return ++(id_);
+  }
+};
+
+}  // namespace
+
+Cache* NewClockCache(size_t capacity, int num_shards) {
+  return new ShardedClockCache(capacity, num_shards);
+}
+
+}  // namespace pdlfs
@@ -11,6 +11,7 @@
 #include "ectrie/bit_vector.h"
 #include "ectrie/trie.h"
 
+#include "pdlfs-common/coding.h"
 #include "pdlfs-common/ect.h"
 
 #include <vector>
@@ -73,6 +74,35 @@ class ECTIndex : public ECT {
     n_ = n;
   }
 
+  // Encoding format:
+  //   num_bits : varint64
+  //   bits     : uint8[(num_bits + 7) / 8], most significant bit first
+  virtual void EncodeTo(std::string* dst) const {
+    const size_t bits = bitvec_.size();
+    PutVarint64(dst, bits);
+    for (size_t i = 0; i < bits; i += 8) {
+      const size_t len = bits - i < 8 ? bits - i : 8;
+      const uint8_t b = bitvec_.get<uint8_t>(i, len);
+      dst->push_back(static_cast<char>(b << (8 - len)));
+    }
+  }
+
+  bool DecodeFrom(size_t n, const Slice& encoding) {
+    assert(n_ == 0);
+    Slice input = encoding;
+    uint64_t bits;
+    if (!GetVarint64(&input, &bits) || (bits + 7) / 8 != input.size()) {
+      return false;
+    }
+    if (bits != 0) {
+      bitvec_.append(reinterpret_cast<const uint8_t*>(input.data()), 0,
+                     static_cast<size_t>(bits));
+    }
+    bitvec_.compact();
+    n_ = n;
+    return true;
+  }
+
  private:
   typedef ectrie::bit_vector<> bitvec_t;
   bitvec_t bitvec_;
@@ -82,6 +112,15 @@ class ECTIndex : public ECT {
 
 }  // anonymous namespace
 
+ECT* ECT::Load(size_t key_len, size_t n, const Slice& encoding) {
+  ECTIndex* ect = new ECTIndex(key_len);
+  if (!ect->DecodeFrom(n, encoding)) {
+    delete ect;
+    return NULL;
+  }
+  return ect;
+}
+
 void ECT::InitTrie(ECT* ect, size_t n, const Slice* keys) {
   std::vector<const uint8_t*> ukeys;
   ukeys.reserve(n);
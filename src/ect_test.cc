@@ -16,10 +16,9 @@
 #include "pdlfs-common/ect.h"
 #include "pdlfs-common/random.h"
 #include "pdlfs-common/slice.h"
+#include "pdlfs-common/spooky.h"
 #include "pdlfs-common/testharness.h"
 
-#include "spooky_impl.h"
-
 namespace pdlfs {
 
 class ECTTest {};
@@ -128,6 +127,29 @@ TEST(ECTTest, KeyLenIs8) {
   BETWEEN(trie.Locate("99999999"), 8, 9);
 }
 
+TEST(ECTTest, EncodeAndLoad) {
+  std::vector<Slice> keys;
+  keys.push_back("aaaaa");
+  keys.push_back("fghdc");
+  keys.push_back("fzhdc");
+  keys.push_back("zdfgr");
+  keys.push_back("zzfgr");
+  ECT* ect = ECT::Default(5, keys.size(), &keys[0]);
+  std::string encoding;
+  ect->EncodeTo(&encoding);
+  ECT* loaded = ECT::Load(5, keys.size(), encoding);
+  ASSERT_TRUE(loaded != NULL);
+  ASSERT_EQ(loaded->MemUsage(), ect->MemUsage());
+  for (size_t i = 0; i < keys.size(); i++) {
+    ASSERT_EQ(loaded->Find(keys[i]), i);
+  }
+  BETWEEN(loaded->Find("fzbbb"), 1, 2);
+  BETWEEN(loaded->Find("zzzzz"), 4, 5);
+  ASSERT_TRUE(ECT::Load(5, keys.size(), Slice(encoding.data(), 1)) == NULL);
+  delete loaded;
+  delete ect;
+}
+
 #if 0
 static std::string RandomKey(Random* rnd, int k_len) {
   std::string result;
@@ -138,12 +160,9 @@ static std::string RandomKey(Random* rnd, int k_len) {
 #else
 static std::string RandomKey(Random* rnd, int k_len) {
   uint32_t seed = rnd->Next();
-  uint64_t h1 = 301;
-  uint64_t h2 = 103;
-  SpookyHash::Hash128(&seed, sizeof(seed), &h1, &h2);
-  std::string result;
-  result.append((char*)&h1, sizeof(h1));
-  result.append((char*)&h2, sizeof(h2));
+  char h[16];
+  Spooky128(&seed, sizeof(seed), 301, 103, h);
+  std::string result(h, sizeof(h));
   result.resize(k_len);
   return result;
 }
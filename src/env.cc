@@ -42,6 +42,13 @@ SequentialFile::~SequentialFile() {}
 
 RandomAccessFile::~RandomAccessFile() {}
 
+void RandomAccessFile::MultiRead(ReadRequest* reqs, size_t n) const {
+  for (size_t i = 0; i < n; i++) {
+    reqs[i].status =
+        Read(reqs[i].offset, reqs[i].n, &reqs[i].result, reqs[i].scratch);
+  }
+}
+
 WritableFile::~WritableFile() {}
 
 WritableFileWrapper::~WritableFileWrapper() {}
@@ -15,8 +15,11 @@
  * found at https://github.com/google/leveldb.
  */
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
+#include "pdlfs-common/random.h"
 #include "pdlfs-common/testharness.h"
+#include "pdlfs-common/testutil.h"
 
 namespace pdlfs {
 
@@ -108,6 +111,201 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+class IoUringEnvTest {
+ public:
+  IoUringEnvTest() : cv_(&mu_), num_running_(0) {
+    env_ = Env::NewIoUringEnvWrapper(Env::GetUnBufferedIoEnv());
+    env_->GetTestDirectory(&fname_);
+    fname_ += "/iouring_test";
+  }
+
+  ~IoUringEnvTest() {
+    env_->DeleteFile(fname_.c_str());
+    delete env_;
+  }
+
+  // Write random data to the test file through many small appends.
+  void WriteFile() {
+    Random rnd(301);
+    WritableFile* file;
+    ASSERT_OK(env_->NewWritableFile(fname_.c_str(), &file));
+    for (int i = 0; i < 2000; i++) {
+      std::string piece;
+      test::RandomString(&rnd, rnd.Uniform(500), &piece);
+      ASSERT_OK(file->Append(piece));
+      contents_ += piece;
+      if (i % 7 == 0) {
+        ASSERT_OK(file->Flush());
+      }
+    }
+    ASSERT_OK(file->Sync());
+    ASSERT_OK(file->Close());
+    delete file;
+  }
+
+  // Read random ranges of the test file and check the results.
+  void RandomReads(RandomAccessFile* file, uint32_t seed) {
+    Random rnd(seed);
+    const int kReads = 64;
+    RandomAccessFile::ReadRequest reqs[kReads];
+    std::string scratch[kReads];
+    for (int i = 0; i < kReads; i++) {
+      reqs[i].offset = rnd.Uniform(contents_.size());
+      reqs[i].n = rnd.Uniform(8192);
+      scratch[i].resize(reqs[i].n);
+      reqs[i].scratch = &scratch[i][0];
+    }
+    file->MultiRead(reqs, kReads);
+    for (int i = 0; i < kReads; i++) {
+      ASSERT_OK(reqs[i].status);
+      ASSERT_EQ(reqs[i].result.ToString(),
+                contents_.substr(reqs[i].offset, reqs[i].n));
+      Slice result;
+      ASSERT_OK(
+          file->Read(reqs[i].offset, reqs[i].n, &result, &scratch[i][0]));
+      ASSERT_EQ(result.ToString(),
+                contents_.substr(reqs[i].offset, reqs[i].n));
+    }
+  }
+
+  struct ReaderArg {
+    IoUringEnvTest* t;
+    RandomAccessFile* file;
+    uint32_t seed;
+  };
+
+  static void ReaderBody(void* arg) {
+    ReaderArg* const a = reinterpret_cast<ReaderArg*>(arg);
+    for (int i = 0; i < 20; i++) {
+      a->t->RandomReads(a->file, a->seed + i);
+    }
+    MutexLock ml(&a->t->mu_);
+    a->t->num_running_--;
+    a->t->cv_.SignalAll();
+  }
+
+  Env* env_;
+  std::string fname_;
+  std::string contents_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  int num_running_;
+};
+
+TEST(IoUringEnvTest, WriteAndRead) {
+  WriteFile();
+  uint64_t size;
+  ASSERT_OK(env_->GetFileSize(fname_.c_str(), &size));
+  ASSERT_EQ(size, contents_.size());
+
+  SequentialFile* seq;
+  ASSERT_OK(env_->NewSequentialFile(fname_.c_str(), &seq));
+  std::string data;
+  std::string scratch(1000, 0);
+  ASSERT_OK(seq->Skip(10));
+  while (true) {
+    Slice result;
+    ASSERT_OK(seq->Read(scratch.size(), &result, &scratch[0]));
+    if (result.empty()) break;
+    data.append(result.data(), result.size());
+  }
+  delete seq;
+  ASSERT_EQ(data, contents_.substr(10));
+
+  RandomAccessFile* file;
+  ASSERT_OK(env_->NewRandomAccessFile(fname_.c_str(), &file));
+  RandomReads(file, 301);
+  Slice result;
+  ASSERT_OK(file->Read(contents_.size(), 100, &result, &scratch[0]));
+  ASSERT_TRUE(result.empty());
+  delete file;
+}
+
+TEST(IoUringEnvTest, ConcurrentReads) {
+  WriteFile();
+  RandomAccessFile* file;
+  ASSERT_OK(env_->NewRandomAccessFile(fname_.c_str(), &file));
+  const int kThreads = 4;
+  ReaderArg args[kThreads];
+  num_running_ = kThreads;
+  for (int i = 0; i < kThreads; i++) {
+    args[i].t = this;
+    args[i].file = file;
+    args[i].seed = 1000 * (i + 1);
+    Env::Default()->StartThread(ReaderBody, &args[i]);
+  }
+  MutexLock ml(&mu_);
+  while (num_running_ != 0) {
+    cv_.Wait();
+  }
+  delete file;
+}
+
+class WorkStealingPoolTest {
+ public:
+  WorkStealingPoolTest() : cv_(&mu_), done_(0) {
+    pool_ = ThreadPool::NewWorkStealing(4, true);
+  }
+
+  ~WorkStealingPoolTest() { delete pool_; }
+
+  static void Done(void* arg) {
+    WorkStealingPoolTest* t = reinterpret_cast<WorkStealingPoolTest*>(arg);
+    MutexLock ml(&t->mu_);
+    t->done_++;
+    t->cv_.SignalAll();
+  }
+
+  // Reschedule itself from within the pool before finishing
+  static void Fork(void* arg) {
+    WorkStealingPoolTest* t = reinterpret_cast<WorkStealingPoolTest*>(arg);
+    t->pool_->Schedule(Done, t);
+  }
+
+  static void Schedule(void* arg) {
+    WorkStealingPoolTest* t = reinterpret_cast<WorkStealingPoolTest*>(arg);
+    for (int i = 0; i < 5000; i++) {
+      t->pool_->Schedule(i % 2 == 0 ? Fork : Done, t);
+    }
+    Done(arg);
+  }
+
+  void WaitFor(int n) {
+    MutexLock ml(&mu_);
+    while (done_ < n) {
+      cv_.Wait();
+    }
+  }
+
+  ThreadPool* pool_;
+  port::Mutex mu_;
+  port::CondVar cv_;
+  int done_;
+};
+
+TEST(WorkStealingPoolTest, ScheduleFromManyThreads) {
+  const int kThreads = 4;
+  for (int i = 0; i < kThreads; i++) {
+    Env::Default()->StartThread(Schedule, this);
+  }
+  WaitFor(kThreads * 5000 + kThreads);
+  MutexLock ml(&mu_);
+  ASSERT_EQ(done_, kThreads * 5000 + kThreads);
+}
+
+TEST(WorkStealingPoolTest, PauseResume) {
+  pool_->Pause();
+  for (int i = 0; i < 100; i++) {
+    pool_->Schedule(Done, this);
+  }
+  SleepForMicroseconds(kDelayMicros);
+  mu_.Lock();
+  ASSERT_EQ(done_, 0);
+  mu_.Unlock();
+  pool_->Resume();
+  WaitFor(100);
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/leveldb/filter_policy.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/slice.h"
+#include "pdlfs-common/xxhash.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+// A binary fuse filter [Graf and Lemire 2022] is a static filter storing one
+// f-bit fingerprint per slot in an array of about 1.125 * n slots. Each key
+// maps to 3 slots and is considered present iff the xor of the fingerprints
+// stored there equals the key's own fingerprint, giving a false positive
+// rate of 2^-f. With f = 8, this is a 0.39% false positive rate at about 9
+// bits per key, whereas a bloom filter needs about 11.5 bits per key for the
+// same rate.
+//
+// The 3 slots of a key are in 3 consecutive segments of the array. Filling
+// the array requires "peeling" all keys: repeatedly removing a key that is
+// the only one mapped to some slot. This fails with a small probability, in
+// which case we retry with a different hash seed.
+//
+// Filter format:
+//   fingerprints    : uint8[array_length] or uint16[array_length]
+//   seed            : fixed64
+//   segment_length  : fixed32
+//   segment_count   : fixed32 (0 for an empty filter)
+//   fingerprint_bits: uint8
+namespace pdlfs {
+
+namespace {
+
+enum { kTrailerSize = 8 + 4 + 4 + 1 };
+
+// Special segment count for filters that failed to build. They match all keys.
+static const uint32_t kMatchAll = ~static_cast<uint32_t>(0);
+
+inline uint64_t MulHi64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 uint128_t;
+  return static_cast<uint64_t>((static_cast<uint128_t>(a) * b) >> 64);
+#else
+  const uint64_t a_lo = static_cast<uint32_t>(a), a_hi = a >> 32;
+  const uint64_t b_lo = static_cast<uint32_t>(b), b_hi = b >> 32;
+  const uint64_t lo_lo = a_lo * b_lo;
+  const uint64_t hi_lo = a_hi * b_lo;
+  const uint64_t lo_hi = a_lo * b_hi;
+  const uint64_t cross = (lo_lo >> 32) + static_cast<uint32_t>(hi_lo) + lo_hi;
+  return a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+// The finalizer of MurmurHash3
+inline uint64_t Mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+struct FuseGeometry {
+  uint32_t segment_length;
+  uint32_t segment_count;
+
+  uint32_t array_length() const { return (segment_count + 2) * segment_length; }
+
+  // Return the 3 slots of a key with the given seeded hash.
+  void Slots(uint64_t hash, uint32_t* slots) const {
+    const uint64_t segment_count_length =
+        static_cast<uint64_t>(segment_count) * segment_length;
+    const uint32_t mask = segment_length - 1;
+    slots[0] = static_cast<uint32_t>(MulHi64(hash, segment_count_length));
+    slots[1] = (slots[0] + segment_length) ^
+               (static_cast<uint32_t>(hash >> 18) & mask);
+    slots[2] = (slots[0] + 2 * segment_length) ^
+               (static_cast<uint32_t>(hash) & mask);
+  }
+};
+
+inline FuseGeometry ComputeGeometry(size_t n) {
+  FuseGeometry g;
+  if (n <= 1) {
+    g.segment_length = 4;
+  } else {
+    const int bits = static_cast<int>(floor(log(double(n)) / log(3.33) + 2.25));
+    g.segment_length = 1u << std::min(bits, 18);
+  }
+  // Small filters need relatively more room for peeling to succeed
+  const double size_factor =
+      n <= 1 ? 0
+             : std::max(1.125, 0.875 + 0.25 * log(1000000.0) / log(double(n)));
+  const uint64_t capacity = static_cast<uint64_t>(n * size_factor + 0.5);
+  const uint64_t segments =
+      (capacity + g.segment_length - 1) / g.segment_length;
+  g.segment_count = segments > 3 ? static_cast<uint32_t>(segments - 2) : 1;
+  return g;
+}
+
+// Try filling in *fingerprints using hash seed "seed". Return false if some
+// keys cannot be peeled.
+template <typename T>
+bool Build(const std::vector<uint64_t>& hashes, uint64_t seed,
+           const FuseGeometry& g, T* fingerprints) {
+  const uint32_t len = g.array_length();
+  // For each slot, the number of keys mapped to it in the upper bits and the
+  // xor of the slot's position (0, 1, or 2) within each key in the lower 2
+  // bits, and the xor of the keys' hashes.
+  std::vector<uint32_t> counts(len, 0);
+  std::vector<uint64_t> xors(len, 0);
+  uint32_t slots[3];
+  for (size_t i = 0; i < hashes.size(); i++) {
+    const uint64_t h = Mix(hashes[i] + seed);
+    g.Slots(h, slots);
+    for (uint32_t j = 0; j < 3; j++) {
+      counts[slots[j]] += 4;
+      counts[slots[j]] ^= j;
+      xors[slots[j]] ^= h;
+    }
+  }
+
+  std::vector<uint32_t> queue;
+  for (uint32_t i = 0; i < len; i++) {
+    if ((counts[i] >> 2) == 1) {
+      queue.push_back(i);
+    }
+  }
+  std::vector<uint64_t> stack_hash;
+  std::vector<uint8_t> stack_pos;  // Position of the peeled slot in its key
+  stack_hash.reserve(hashes.size());
+  stack_pos.reserve(hashes.size());
+  while (!queue.empty()) {
+    const uint32_t i = queue.back();
+    queue.pop_back();
+    if ((counts[i] >> 2) != 1) {
+      continue;  // Already peeled through another slot
+    }
+    const uint64_t h = xors[i];
+    const uint32_t pos = counts[i] & 3;
+    stack_hash.push_back(h);
+    stack_pos.push_back(static_cast<uint8_t>(pos));
+    g.Slots(h, slots);
+    for (uint32_t j = 0; j < 3; j++) {
+      const uint32_t s = slots[j];
+      counts[s] -= 4;
+      counts[s] ^= j;
+      xors[s] ^= h;
+      if (s != i && (counts[s] >> 2) == 1) {
+        queue.push_back(s);
+      }
+    }
+  }
+  if (stack_hash.size() != hashes.size()) {
+    return false;
+  }
+
+  std::fill(fingerprints, fingerprints + len, T(0));
+  // Assign fingerprints in reverse peeling order so that each key's
+  // peeled slot is written after all other slots of that key are final
+  for (size_t i = stack_hash.size(); i-- > 0;) {
+    const uint64_t h = stack_hash[i];
+    g.Slots(h, slots);
+    const uint32_t pos = stack_pos[i];
+    T f = static_cast<T>(h ^ (h >> 32));
+    f ^= fingerprints[slots[(pos + 1) % 3]];
+    f ^= fingerprints[slots[(pos + 2) % 3]];
+    fingerprints[slots[pos]] = f;
+  }
+  return true;
+}
+
+template <typename T>
+bool MayMatch(const T* fingerprints, uint64_t hash, uint64_t seed,
+              const FuseGeometry& g) {
+  const uint64_t h = Mix(hash + seed);
+  uint32_t slots[3];
+  g.Slots(h, slots);
+  T f = static_cast<T>(h ^ (h >> 32));
+  f ^= fingerprints[slots[0]] ^ fingerprints[slots[1]] ^ fingerprints[slots[2]];
+  return f == 0;
+}
+
+class BinaryFuseFilterPolicy : public FilterPolicy {
+ private:
+  int fingerprint_bits_;
+
+ public:
+  explicit BinaryFuseFilterPolicy(int fingerprint_bits)
+      : fingerprint_bits_(fingerprint_bits <= 8 ? 8 : 16) {}
+
+  virtual const char* Name() const { return "pdlfs.BinaryFuseFilter"; }
+
+  virtual void CreateFilter(const Slice* keys, int n, std::string* dst) const {
+    // Duplicate keys would never peel
+    std::vector<uint64_t> hashes;
+    hashes.reserve(n);
+    for (int i = 0; i < n; i++) {
+      hashes.push_back(xxhash64(keys[i].data(), keys[i].size(), 0));
+    }
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+
+    FuseGeometry g = ComputeGeometry(hashes.size());
+    const size_t width = fingerprint_bits_ / 8;
+    uint64_t seed = 0;
+    if (hashes.empty()) {
+      g.segment_count = 0;
+    } else {
+      const size_t init_size = dst->size();
+      dst->resize(init_size + g.array_length() * width);
+      char* const array = &(*dst)[init_size];
+      bool ok = false;
+      for (int attempt = 0; !ok && attempt < 100; attempt++) {
+        seed = Mix(seed + 0x9e3779b97f4a7c15ULL);
+        if (width == 1) {
+          ok = Build(hashes, seed, g, reinterpret_cast<uint8_t*>(array));
+        } else {
+          std::vector<uint16_t> tmp(g.array_length());
+          ok = Build(hashes, seed, g, &tmp[0]);
+          for (size_t i = 0; ok && i < tmp.size(); i++) {
+            EncodeFixed16(array + 2 * i, tmp[i]);
+          }
+        }
+      }
+      if (!ok) {
+        dst->resize(init_size);
+        g.segment_count = kMatchAll;
+      }
+    }
+    PutFixed64(dst, seed);
+    PutFixed32(dst, g.segment_length);
+    PutFixed32(dst, g.segment_count);
+    dst->push_back(static_cast<char>(fingerprint_bits_));
+  }
+
+  virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const {
+    const size_t len = filter.size();
+    if (len < kTrailerSize) return false;
+    const char* const trailer = filter.data() + len - kTrailerSize;
+    FuseGeometry g;
+    const uint64_t seed = DecodeFixed64(trailer);
+    g.segment_length = DecodeFixed32(trailer + 8);
+    g.segment_count = DecodeFixed32(trailer + 12);
+    const int bits = static_cast<unsigned char>(trailer[16]);
+    if (g.segment_count == 0) {
+      return false;
+    } else if (g.segment_count == kMatchAll || (bits != 8 && bits != 16)) {
+      return true;
+    }
+    const size_t width = bits / 8;
+    if (g.segment_length == 0 ||
+        (g.segment_length & (g.segment_length - 1)) != 0 ||
+        static_cast<uint64_t>(g.array_length()) * width !=
+            len - kTrailerSize) {
+      return true;  // Not a filter we know how to read
+    }
+    const uint64_t hash = xxhash64(key.data(), key.size(), 0);
+    if (width == 1) {
+      return MayMatch(reinterpret_cast<const uint8_t*>(filter.data()), hash,
+                      seed, g);
+    } else {
+      // Fingerprints are stored little-endian
+      const uint64_t h = Mix(hash + seed);
+      uint32_t slots[3];
+      g.Slots(h, slots);
+      uint16_t f = static_cast<uint16_t>(h ^ (h >> 32));
+      for (int j = 0; j < 3; j++) {
+        f ^= DecodeFixed16(filter.data() + 2 * slots[j]);
+      }
+      return f == 0;
+    }
+  }
+};
+
+}  // namespace
+
+const FilterPolicy* NewBinaryFuseFilterPolicy(int fingerprint_bits) {
+  return new BinaryFuseFilterPolicy(fingerprint_bits);
+}
+
+}  // namespace pdlfs
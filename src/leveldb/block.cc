@@ -30,23 +30,41 @@ namespace pdlfs {
 
 inline uint32_t Block::NumRestarts() const {
   assert(size_ >= sizeof(uint32_t));
-  return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+  return DecodeFixed32(data_ + size_ - sizeof(uint32_t)) & ~kBlockHashIndexFlag;
 }
 
 Block::Block(const BlockContents& contents)
     : data_(contents.data.data()),
       size_(contents.data.size()),
+      hash_buckets_(NULL),
+      num_hash_buckets_(0),
       owned_(contents.heap_allocated) {
   if (size_ < sizeof(uint32_t)) {
     size_ = 0;  // Error marker
-  } else {
-    size_t max_restarts_allowed = (size_ - sizeof(uint32_t)) / sizeof(uint32_t);
-    if (NumRestarts() > max_restarts_allowed) {
-      // The size is too small for NumRestarts()
+    return;
+  }
+  // Size of the block without its hash index
+  size_t limit = size_ - sizeof(uint32_t);
+  if ((DecodeFixed32(data_ + limit) & kBlockHashIndexFlag) != 0) {
+    if (limit < sizeof(uint16_t)) {
       size_ = 0;
-    } else {
-      restart_offset_ = size_ - (1 + NumRestarts()) * sizeof(uint32_t);
+      return;
+    }
+    num_hash_buckets_ = DecodeFixed16(data_ + limit - sizeof(uint16_t));
+    if (num_hash_buckets_ == 0 ||
+        limit < sizeof(uint16_t) + num_hash_buckets_) {
+      size_ = 0;
+      return;
     }
+    limit -= sizeof(uint16_t) + num_hash_buckets_;
+    hash_buckets_ = data_ + limit;
+  }
+  size_t max_restarts_allowed = limit / sizeof(uint32_t);
+  if (NumRestarts() > max_restarts_allowed) {
+    // The size is too small for NumRestarts()
+    size_ = 0;
+  } else {
+    restart_offset_ = limit - NumRestarts() * sizeof(uint32_t);
   }
 }
 
@@ -212,6 +230,15 @@ class Block::Iter : public Iterator {
     }
   }
 
+  // Same as Seek() but skips the binary search by starting the linear search
+  // at the given restart point.
+  void SeekFromRestartPoint(uint32_t index, const Slice& target) {
+    SeekToRestartPoint(index);
+    while (ParseNextKey() && Compare(key_, target) < 0) {
+      // Keep skipping
+    }
+  }
+
   virtual void SeekToFirst() {
     SeekToRestartPoint(0);
     ParseNextKey();
@@ -275,4 +302,25 @@ Iterator* Block::NewIterator(const Comparator* cmp) {
   }
 }
 
+Iterator* Block::NewIteratorForGet(const Comparator* cmp,
+                                   const Slice& target) {
+  if (hash_buckets_ == NULL || size_ < sizeof(uint32_t) ||
+      NumRestarts() == 0) {
+    Iterator* const iter = NewIterator(cmp);
+    iter->Seek(target);
+    return iter;
+  }
+  Iter* const iter = new Iter(cmp, data_, restart_offset_, NumRestarts());
+  const uint8_t bucket = static_cast<uint8_t>(
+      hash_buckets_[BlockHashIndexHash(target) % num_hash_buckets_]);
+  if (bucket == kBlockHashIndexEmpty) {
+    // No entry has target's user key. Leave the iterator invalid.
+  } else if (bucket == kBlockHashIndexCollision || bucket >= NumRestarts()) {
+    iter->Seek(target);
+  } else {
+    iter->SeekFromRestartPoint(bucket, target);
+  }
+  return iter;
+}
+
 }  // namespace pdlfs
@@ -48,6 +48,16 @@
 //     restarts: uint32[num_restarts]
 //     num_restarts: uint32
 // restarts[i] contains the offset within the block of the ith restart point.
+//
+// If a hash index is enabled, the trailer instead has the form:
+//     restarts: uint32[num_restarts]
+//     buckets: uint8[num_buckets]
+//     num_buckets: uint16
+//     num_restarts | kBlockHashIndexFlag: uint32
+// Each user key is hashed into a bucket, which holds the index of the restart
+// interval the key's first entry is in, kBlockHashIndexEmpty if no key hashes
+// into it, or kBlockHashIndexCollision if keys from different restart
+// intervals do. Blocks with too many restart points get no hash index.
 namespace pdlfs {
 
 AbstractBlockBuilder::AbstractBlockBuilder(const Comparator* cmp)
@@ -61,7 +71,8 @@ AbstractBlockBuilder::AbstractBlockBuilder(const Comparator* cmp)
 BlockBuilder::BlockBuilder(int restart_interval)
     : AbstractBlockBuilder(BytewiseComparator()),
       restart_interval_(restart_interval),
-      counter_(0) {
+      counter_(0),
+      hash_index_(false) {
   restarts_.push_back(0);  // First restart point is at offset 0
   if (restart_interval_ < 1) {
     restart_interval_ = 1;
@@ -73,7 +84,8 @@ BlockBuilder::BlockBuilder(int restart_interval)
 BlockBuilder::BlockBuilder(int restart_interval, const Comparator* cmp)
     : AbstractBlockBuilder(cmp),
       restart_interval_(restart_interval),
-      counter_(0) {
+      counter_(0),
+      hash_index_(false) {
   restarts_.push_back(0);  // First restart point is at offset 0
   if (restart_interval_ < 1) {
     restart_interval_ = 1;
@@ -110,13 +122,26 @@ Slice AbstractBlockBuilder::Finish(CompressionType compression, bool force) {
     case kNoCompression:
       break;
     case kSnappyCompression:
-      if (!port::Snappy_Compress(contents.data(), sz, &compressed) ||
-          (compressed.size() >= (sz - sz / 8u) && !force)) {
-        compression = kNoCompression;
+      if (!port::Snappy_Compress(contents.data(), sz, &compressed)) {
+        compressed.clear();
+      }
+      break;
+    case kLZ4Compression:
+      if (!port::LZ4_Compress(contents.data(), sz, &compressed)) {
+        compressed.clear();
+      }
+      break;
+    case kZstdCompression:
+      if (!port::Zstd_Compress(3 /* Default level */, contents.data(), sz,
+                               &compressed)) {
         compressed.clear();
       }
       break;
   }
+  if (compressed.empty() || (compressed.size() >= (sz - sz / 8u) && !force)) {
+    compression = kNoCompression;
+    compressed.clear();
+  }
 
   if (!compressed.empty()) {
     compression_ = compression;
@@ -135,13 +160,28 @@ void BlockBuilder::Reset() {
   restarts_.clear();
   restarts_.push_back(0);  // First restart point is at offset 0
   counter_ = 0;
+  hashes_.clear();
+}
+
+static Slice UserKeyOf(const Slice& internal_key) {
+  if (internal_key.size() < 8) return internal_key;
+  return Slice(internal_key.data(), internal_key.size() - 8);
+}
+
+// Use about 4 buckets per 3 keys
+static size_t HashIndexBuckets(size_t num_keys) {
+  return std::min<size_t>(std::max<size_t>(num_keys * 4 / 3, 1), 65535);
 }
 
 size_t BlockBuilder::CurrentSizeEstimate() const {
   size_t result = buffer_.size() - buffer_start_;
   if (!finished_) {
     // Plus restart array contents and its length
-    return result + restarts_.size() * sizeof(uint32_t) + sizeof(uint32_t);
+    result += restarts_.size() * sizeof(uint32_t) + sizeof(uint32_t);
+    if (hash_index_) {
+      result += HashIndexBuckets(hashes_.size()) + sizeof(uint16_t);
+    }
+    return result;
   } else {
     return result;
   }
@@ -155,6 +195,24 @@ Slice BlockBuilder::Finish(CompressionType compression,
     PutFixed32(&buffer_, restarts_[i]);
   }
   uint32_t num_restarts = static_cast<uint32_t>(restarts_.size());
+  if (hash_index_ && num_restarts <= kBlockHashIndexMaxRestarts) {
+    const size_t num_buckets = HashIndexBuckets(hashes_.size());
+    std::string buckets(num_buckets, static_cast<char>(kBlockHashIndexEmpty));
+    for (size_t i = 0; i < hashes_.size(); i++) {
+      const uint8_t r = static_cast<uint8_t>(hashes_[i].second);
+      char* const b = &buckets[hashes_[i].first % num_buckets];
+      if (static_cast<uint8_t>(*b) == kBlockHashIndexEmpty) {
+        *b = static_cast<char>(r);
+      } else if (static_cast<uint8_t>(*b) != r) {
+        *b = static_cast<char>(kBlockHashIndexCollision);
+      }
+    }
+    buffer_.append(buckets);
+    char buf[2];
+    EncodeFixed16(buf, static_cast<uint16_t>(num_buckets));
+    buffer_.append(buf, sizeof(buf));
+    num_restarts |= kBlockHashIndexFlag;
+  }
   // Remember the array size
   PutFixed32(&buffer_, num_restarts);
   return AbstractBlockBuilder::Finish(compression, force_compression);
@@ -205,6 +263,12 @@ void BlockBuilder::Add(const Slice& key, const Slice& value) {
   const size_t non_shared = key.size() - shared;
   const size_t vlen = value.size();
 
+  // Only the first entry of each user key goes into the hash index
+  if (hash_index_ && (empty() || UserKeyOf(key) != UserKeyOf(last_key_piece))) {
+    hashes_.push_back(std::make_pair(
+        BlockHashIndexHash(key), static_cast<uint32_t>(restarts_.size() - 1)));
+  }
+
   // Add "<shared><non_shared><value_size>" to buffer_
   PutVarint32(&buffer_, static_cast<uint32_t>(shared));
   PutVarint32(&buffer_, static_cast<uint32_t>(non_shared));
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/leveldb/filter_policy.h"
+
+#include "pdlfs-common/slice.h"
+#include "pdlfs-common/xxhash.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PDLFS_BLOOM_AVX2 1
+#endif
+
+// A blocked bloom filter confines all probes of a key to a single 64-byte
+// cache line. The line is selected by the lower 32 bits of a 64-bit hash of
+// the key. Each probe then takes the top 9 bits of the upper 32 bits of the
+// hash, multiplied by the i-th power of the golden ratio constant, as a bit
+// position within the line. A negative lookup thus touches one cache line
+// instead of up to k of them, at the cost of a slightly higher false positive
+// rate than a standard bloom filter using the same space.
+//
+// Filter format:
+//   line[0..n-1]  : char[64] each
+//   k             : uint8 (number of probes per key)
+namespace pdlfs {
+
+namespace {
+
+enum { kLineBytes = 64 };
+
+// Powers of the golden ratio constant 0x9e3779b9 (mod 2^32).
+static const uint32_t kMultipliers[9] = {
+    0x00000001, 0x9e3779b9, 0xe35e67b1, 0x734297e9, 0x35fbe861,
+    0xdeb7c719, 0x0448b211, 0x3459b749, 0xab25f4c1};
+
+// Map a 32-bit hash uniformly onto [0, n).
+inline uint32_t FastRange32(uint32_t hash, uint32_t n) {
+  return static_cast<uint32_t>((static_cast<uint64_t>(hash) * n) >> 32);
+}
+
+inline void AddHash(uint32_t h, int k, char* line) {
+  for (int i = 0; i < k; i++, h *= kMultipliers[1]) {
+    const uint32_t bitpos = h >> 23;  // Top 9 bits
+    line[bitpos >> 3] |= static_cast<char>(1 << (bitpos & 7));
+  }
+}
+
+bool ScalarHashMayMatch(uint32_t h, int k, const char* line) {
+  for (int i = 0; i < k; i++, h *= kMultipliers[1]) {
+    const uint32_t bitpos = h >> 23;
+    if ((line[bitpos >> 3] & (1 << (bitpos & 7))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if defined(PDLFS_BLOOM_AVX2)
+// Check up to 8 probes at a time. Bits are set in little-endian byte order,
+// so bit position p is bit p % 32 of 32-bit word p / 32.
+__attribute__((target("avx2"))) bool AVX2HashMayMatch(uint32_t h, int k,
+                                                      const char* line) {
+  const __m256i multipliers = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(static_cast<const void*>(kMultipliers)));
+  const __m256i lower = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+      static_cast<const void*>(line)));
+  const __m256i upper = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+      static_cast<const void*>(line + 32)));
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i ones = _mm256_set1_epi32(1);
+  while (true) {
+    const __m256i hashes =
+        _mm256_mullo_epi32(_mm256_set1_epi32(h), multipliers);
+    // The top 4 bits select one of the 16 words in the line. The top bit
+    // selects the half, and the other 3 are used as a permutation index.
+    const __m256i words = _mm256_srli_epi32(hashes, 28);
+    const __m256i values = _mm256_blendv_epi8(
+        _mm256_permutevar8x32_epi32(lower, words),
+        _mm256_permutevar8x32_epi32(upper, words),
+        _mm256_srai_epi32(hashes, 31));
+    // The next 5 bits select the bit within the word.
+    const __m256i bits =
+        _mm256_srli_epi32(_mm256_slli_epi32(hashes, 4), 27);
+    __m256i masks = _mm256_sllv_epi32(ones, bits);
+    // Disable lanes beyond the remaining number of probes
+    masks = _mm256_and_si256(
+        masks, _mm256_cmpgt_epi32(_mm256_set1_epi32(k), lanes));
+    if (!_mm256_testc_si256(values, masks)) {
+      return false;
+    }
+    if (k <= 8) {
+      return true;
+    }
+    k -= 8;
+    h *= kMultipliers[8];
+  }
+}
+
+bool HasAVX2() {
+  static const bool result = __builtin_cpu_supports("avx2");
+  return result;
+}
+#endif
+
+inline bool HashMayMatch(uint32_t h, int k, const char* line) {
+#if defined(PDLFS_BLOOM_AVX2)
+  if (HasAVX2()) {
+    return AVX2HashMayMatch(h, k, line);
+  }
+#endif
+  return ScalarHashMayMatch(h, k, line);
+}
+
+class BlockedBloomFilterPolicy : public FilterPolicy {
+ private:
+  size_t bits_per_key_;
+  int k_;
+
+ public:
+  explicit BlockedBloomFilterPolicy(int bits_per_key)
+      : bits_per_key_(bits_per_key) {
+    // Keys in the same cache line collide more often than they would in a
+    // standard bloom filter, so the optimal number of probes is a bit lower
+    // than bits_per_key * ln(2).
+    if (bits_per_key <= 2) {
+      k_ = 1;
+    } else if (bits_per_key <= 3) {
+      k_ = 2;
+    } else if (bits_per_key <= 5) {
+      k_ = 3;
+    } else if (bits_per_key <= 6) {
+      k_ = 4;
+    } else if (bits_per_key <= 8) {
+      k_ = 5;
+    } else if (bits_per_key <= 10) {
+      k_ = 6;
+    } else if (bits_per_key <= 11) {
+      k_ = 7;
+    } else if (bits_per_key <= 14) {
+      k_ = 8;
+    } else {
+      k_ = static_cast<int>(bits_per_key * 0.55);
+      if (k_ > 24) k_ = 24;
+    }
+  }
+
+  virtual const char* Name() const { return "pdlfs.BlockedBloomFilter"; }
+
+  virtual void CreateFilter(const Slice* keys, int n, std::string* dst) const {
+    size_t lines = (n * bits_per_key_ + kLineBytes * 8 - 1) / (kLineBytes * 8);
+    if (lines < 1) lines = 1;
+    const size_t bytes = lines * kLineBytes;
+
+    const size_t init_size = dst->size();
+    dst->resize(init_size + bytes, 0);
+    dst->push_back(static_cast<char>(k_));  // Remember # of probes in filter
+    char* array = &(*dst)[init_size];
+    for (int i = 0; i < n; i++) {
+      const uint64_t h = xxhash64(keys[i].data(), keys[i].size(), 0);
+      const uint32_t l = FastRange32(static_cast<uint32_t>(h), lines);
+      AddHash(static_cast<uint32_t>(h >> 32), k_, array + l * kLineBytes);
+    }
+  }
+
+  virtual bool KeyMayMatch(const Slice& key, const Slice& filter) const {
+    const size_t len = filter.size();
+    if (len < kLineBytes + 1) return false;
+    if ((len - 1) % kLineBytes != 0) {
+      // Not a filter we know how to read. Consider it a match.
+      return true;
+    }
+
+    const char* array = filter.data();
+    const size_t lines = (len - 1) / kLineBytes;
+    const int k = static_cast<unsigned char>(array[len - 1]);
+    if (k < 1 || k > 30) {
+      // Reserved for potentially new encodings. Consider it a match.
+      return true;
+    }
+
+    const uint64_t h = xxhash64(key.data(), key.size(), 0);
+    const uint32_t l = FastRange32(static_cast<uint32_t>(h), lines);
+    return HashMayMatch(static_cast<uint32_t>(h >> 32), k,
+                        array + l * kLineBytes);
+  }
+};
+
+}  // namespace
+
+const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key) {
+  return new BlockedBloomFilterPolicy(bits_per_key);
+}
+
+}  // namespace pdlfs
@@ -18,6 +18,7 @@
 #include "pdlfs-common/leveldb/filter_policy.h"
 
 #include "pdlfs-common/coding.h"
+#include "pdlfs-common/env.h"
 #include "pdlfs-common/strutil.h"
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
@@ -42,6 +43,13 @@ class BloomTest {
 
   ~BloomTest() { delete policy_; }
 
+  // Switch to a different filter policy. Takes ownership of "policy".
+  void UsePolicy(const FilterPolicy* policy) {
+    delete policy_;
+    policy_ = policy;
+    Reset();
+  }
+
   void Reset() {
     keys_.clear();
     filter_.clear();
@@ -90,6 +98,65 @@ class BloomTest {
     }
     return result / 10000.0;
   }
+
+  // Check filters built from varying numbers of keys. Each filter may use up
+  // to "slack" bytes beyond "bits_per_key" bits per key.
+  void TestVaryingLengths(size_t bits_per_key, size_t slack) {
+    char buffer[sizeof(int)];
+
+    // Count number of filters that significantly exceed the false positive
+    // rate
+    int mediocre_filters = 0;
+    int good_filters = 0;
+
+    for (int length = 1; length <= 10000; length = NextLength(length)) {
+      Reset();
+      for (int i = 0; i < length; i++) {
+        Add(Key(i, buffer));
+      }
+      Build();
+
+      ASSERT_LE(FilterSize(), (length * bits_per_key / 8) + slack) << length;
+
+      // All added keys must match
+      for (int i = 0; i < length; i++) {
+        ASSERT_TRUE(Matches(Key(i, buffer)))
+            << "Length " << length << "; key " << i;
+      }
+
+      // Check false positive rate
+      double rate = FalsePositiveRate();
+      if (kVerbose >= 1) {
+        fprintf(stderr,
+                "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+                rate * 100.0, length, static_cast<int>(FilterSize()));
+      }
+      ASSERT_LE(rate, 0.02);  // Must not be over 2%
+      if (rate > 0.0125)
+        mediocre_filters++;  // Allowed, but not too often
+      else
+        good_filters++;
+    }
+    if (kVerbose >= 1) {
+      fprintf(stderr, "Filters: %d good, %d mediocre\n", good_filters,
+              mediocre_filters);
+    }
+    ASSERT_LE(mediocre_filters, good_filters / 5);
+  }
+
+ private:
+  static int NextLength(int length) {
+    if (length < 10) {
+      length += 1;
+    } else if (length < 100) {
+      length += 10;
+    } else if (length < 1000) {
+      length += 100;
+    } else {
+      length += 1000;
+    }
+    return length;
+  }
 };
 
 TEST(BloomTest, EmptyFilter) {
@@ -106,59 +173,111 @@ TEST(BloomTest, Small) {
   ASSERT_TRUE(!Matches("foo"));
 }
 
-static int NextLength(int length) {
-  if (length < 10) {
-    length += 1;
-  } else if (length < 100) {
-    length += 10;
-  } else if (length < 1000) {
-    length += 100;
-  } else {
-    length += 1000;
-  }
-  return length;
+TEST(BloomTest, VaryingLengths) { TestVaryingLengths(10, 40); }
+
+TEST(BloomTest, BlockedEmptyFilter) {
+  UsePolicy(NewBlockedBloomFilterPolicy(10));
+  ASSERT_TRUE(!Matches("hello"));
+  ASSERT_TRUE(!Matches("world"));
 }
 
-TEST(BloomTest, VaryingLengths) {
-  char buffer[sizeof(int)];
+TEST(BloomTest, BlockedSmall) {
+  UsePolicy(NewBlockedBloomFilterPolicy(10));
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(!Matches("x"));
+  ASSERT_TRUE(!Matches("foo"));
+}
 
-  // Count number of filters that significantly exceed the false positive rate
-  int mediocre_filters = 0;
-  int good_filters = 0;
+TEST(BloomTest, BlockedVaryingLengths) {
+  UsePolicy(NewBlockedBloomFilterPolicy(10));
+  // Filters are rounded up to whole cache lines
+  TestVaryingLengths(10, 64 + 1);
+}
 
-  for (int length = 1; length <= 10000; length = NextLength(length)) {
-    Reset();
-    for (int i = 0; i < length; i++) {
-      Add(Key(i, buffer));
-    }
-    Build();
+TEST(BloomTest, FuseEmptyFilter) {
+  UsePolicy(NewBinaryFuseFilterPolicy(8));
+  ASSERT_TRUE(!Matches("hello"));
+  ASSERT_TRUE(!Matches("world"));
+}
+
+TEST(BloomTest, FuseSmall) {
+  UsePolicy(NewBinaryFuseFilterPolicy(8));
+  Add("hello");
+  Add("world");
+  Add("hello");  // Duplicate keys are allowed
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(!Matches("x"));
+  ASSERT_TRUE(!Matches("foo"));
+}
 
-    ASSERT_LE(FilterSize(), static_cast<size_t>((length * 10 / 8) + 40))
-        << length;
+TEST(BloomTest, FuseVaryingLengths) {
+  UsePolicy(NewBinaryFuseFilterPolicy(8));
+  // Small filters need relatively more slots per key
+  TestVaryingLengths(14, 256);
+}
 
-    // All added keys must match
-    for (int i = 0; i < length; i++) {
-      ASSERT_TRUE(Matches(Key(i, buffer)))
-          << "Length " << length << "; key " << i;
-    }
+TEST(BloomTest, Fuse16VaryingLengths) {
+  UsePolicy(NewBinaryFuseFilterPolicy(16));
+  TestVaryingLengths(28, 512);
+}
 
-    // Check false positive rate
-    double rate = FalsePositiveRate();
+// Compare the build cost, probe cost, false positive rate, and size of the
+// standard bloom filter, the blocked bloom filter, and the binary fuse filter.
+// Kept small so that it runs quickly; the timings are only a rough guide.
+TEST(BloomTest, Comparison) {
+  const int kKeys = 10000;
+  const int kProbes = 100000;
+  std::vector<std::string> keys;
+  std::vector<Slice> key_slices;
+  char buffer[sizeof(int)];
+  for (int i = 0; i < kKeys; i++) {
+    keys.push_back(Key(i, buffer).ToString());
+  }
+  for (int i = 0; i < kKeys; i++) {
+    key_slices.push_back(Slice(keys[i]));
+  }
+  const int kPolicies = 4;
+  const FilterPolicy* policies[kPolicies];
+  policies[0] = NewBloomFilterPolicy(10);
+  policies[1] = NewBlockedBloomFilterPolicy(10);
+  // The bloom filter needs this many bits per key to match the false
+  // positive rate of the 8-bit binary fuse filter
+  policies[2] = NewBloomFilterPolicy(12);
+  policies[3] = NewBinaryFuseFilterPolicy(8);
+  Env* const env = Env::Default();
+  for (int p = 0; p < kPolicies; p++) {
+    std::string filter;
+    uint64_t start = env->NowMicros();
+    policies[p]->CreateFilter(&key_slices[0], kKeys, &filter);
+    const uint64_t build_micros = env->NowMicros() - start;
+    for (int i = 0; i < kKeys; i++) {
+      ASSERT_TRUE(policies[p]->KeyMayMatch(key_slices[i], filter));
+    }
+    int false_positives = 0;
+    start = env->NowMicros();
+    for (int i = 0; i < kProbes; i++) {
+      if (policies[p]->KeyMayMatch(Key(i + 1000000000, buffer), filter)) {
+        false_positives++;
+      }
+    }
+    const uint64_t probe_micros = env->NowMicros() - start;
     if (kVerbose >= 1) {
-      fprintf(stderr, "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
-              rate * 100.0, length, static_cast<int>(FilterSize()));
+      fprintf(stderr,
+              "%-26s: build %6.2f ns/key, probe %6.2f ns/key, "
+              "false positives %5.2f%%, %5.2f bits/key\n",
+              policies[p]->Name(), 1000.0 * build_micros / kKeys,
+              1000.0 * probe_micros / kProbes,
+              100.0 * false_positives / kProbes, 8.0 * filter.size() / kKeys);
     }
-    ASSERT_LE(rate, 0.02);  // Must not be over 2%
-    if (rate > 0.0125)
-      mediocre_filters++;  // Allowed, but not too often
-    else
-      good_filters++;
+    ASSERT_LE(false_positives, kProbes / 50);
   }
-  if (kVerbose >= 1) {
-    fprintf(stderr, "Filters: %d good, %d mediocre\n", good_filters,
-            mediocre_filters);
+  for (int p = 0; p < kPolicies; p++) {
+    delete policies[p];
   }
-  ASSERT_LE(mediocre_filters, good_filters / 5);
 }
 
 // Different bits-per-byte
@@ -26,10 +26,16 @@ class TableCache;
 class Iterator;
 
 struct FileMetaData {
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0), seq_off(0) {}
+  FileMetaData()
+      : refs(0),
+        allowed_seeks(1 << 30),
+        being_compacted(false),
+        file_size(0),
+        seq_off(0) {}
 
   int refs;
-  int allowed_seeks;  // Max seeks until compaction
+  int allowed_seeks;     // Max seeks until compaction
+  bool being_compacted;  // True iff an ongoing compaction takes this file
   uint64_t number;
   // File size in bytes
   uint64_t file_size;
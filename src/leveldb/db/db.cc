@@ -45,6 +45,13 @@ Status DB::Delete(const WriteOptions& opt, const Slice& key) {
   return Write(opt, &batch);
 }
 
+void DB::MultiGet(const ReadOptions& opt, size_t n, const Slice* keys,
+                  std::string* values, Status* statuses) {
+  for (size_t i = 0; i < n; i++) {
+    statuses[i] = Get(opt, keys[i], &values[i]);
+  }
+}
+
 Status DestroyDB(const std::string& dbname, const DBOptions& options) {
   Env* env = options.env;
   if (!env) env = Env::Default();
@@ -58,7 +58,23 @@ struct DBImpl::Writer {
   bool done;
   port::CondVar cv;
 
-  explicit Writer(port::Mutex* mu) : cv(mu) {}
+  // Set by the leader of a write group to have this writer insert its own
+  // batch into *insert_mem in parallel with the rest of the group.
+  MemTable* insert_mem;
+  Writer* leader;
+  // Used by the leader to wait for the members of its group that are still
+  // inserting. Also collects the first insertion error.
+  int pending_inserts;
+  // The last sequence number used by the group led by this writer. Only set
+  // for pipelined writes.
+  SequenceNumber last_sequence;
+
+  explicit Writer(port::Mutex* mu)
+      : cv(mu),
+        insert_mem(NULL),
+        leader(NULL),
+        pending_inserts(0),
+        last_sequence(0) {}
 };
 
 struct DBImpl::CompactionState {
@@ -131,20 +147,28 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       logfile_number_(0),
       log_(NULL),
       seed_(0),
+      super_version_(NULL),
+      super_version_number_(0),
       l0_soft_limits_(0),
       l0_hard_limits_(0),
       l0_waits_(0),
       bg_compaction_disabled_(0),
       bg_compaction_paused_(0),
-      bg_compaction_scheduled_(false),
-      bg_compaction_in_progress_(false),
+      bg_compactions_scheduled_(0),
+      bg_compactions_in_progress_(0),
+      bg_table_compactions_(0),
+      imm_compaction_in_progress_(false),
+      manifest_write_in_progress_(false),
       bulk_insert_in_progress_(false),
       manual_compaction_(NULL) {
   if (!options_.no_memtable) {
-    mem_ = new MemTable(internal_comparator_);
+    mem_ = new MemTable(internal_comparator_, options_);
     mem_->Ref();
   }
   has_imm_.Release_Store(NULL);
+  for (int i = 0; i < kNumSuperVersionSlots; i++) {
+    sv_slots_[i].sv.store(NULL, std::memory_order_relaxed);
+  }
   table_cache_ = new TableCache(dbname_, &options_, options_.table_cache);
 
   versions_ =
@@ -162,9 +186,14 @@ DBImpl::~DBImpl() {
   Log(options_.info_log, 1, "Shutting down ...");
 #endif
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_ || bg_compaction_paused_) {
+  while (bg_compactions_scheduled_ != 0 || bg_compaction_paused_) {
     bg_cv_.Wait();
   }
+  if (super_version_ != NULL) {
+    ScrapeSuperVersionSlots();
+    UnrefSuperVersionLocked(super_version_);
+    super_version_ = NULL;
+  }
   mutex_.Unlock();
 
   delete versions_;
@@ -309,6 +338,10 @@ void DBImpl::DeleteObsoleteFiles() {
     // After a background error, we don't know whether a new version may
     // or may not have been committed, so we cannot safely garbage collect.
     return;
+  } else if (imm_compaction_in_progress_) {
+    // The table being dumped from imm_ is neither pending nor live until its
+    // version edit is applied. CompactMemTable() will call us once it is done.
+    return;
   }
 
   // Make a set of all of the live files
@@ -525,7 +558,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, VersionEdit* edit,
     WriteBatchInternal::SetContents(&batch, record);
 
     if (mem == NULL) {
-      mem = new MemTable(internal_comparator_);
+      mem = new MemTable(internal_comparator_, options_);
       mem->Ref();
     }
     status = WriteBatchInternal::InsertInto(&batch, mem);
@@ -593,8 +626,8 @@ Status DBImpl::WriteLevel0Table(Iterator* iter, VersionEdit* edit,
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, min_seq,
-                   max_seq, &meta);
+    s = BuildTable(dbname_, env_, TableOptionsForLevel(0), table_cache_, iter,
+                   min_seq, max_seq, &meta);
     mutex_.Lock();
   }
 #if VERBOSE >= 2
@@ -635,7 +668,8 @@ Status DBImpl::WriteLevel0Table(Iterator* iter, VersionEdit* edit,
 
 void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
-  assert(imm_ != NULL);
+  assert(CanCompactMemTable());
+  imm_compaction_in_progress_ = true;
 
   // Save memtable contents into a new table file
   VersionEdit edit;
@@ -661,14 +695,17 @@ void DBImpl::CompactMemTable() {
       edit.SetPrevLogNumber(0);
       edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
     }
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
   }
 
+  imm_compaction_in_progress_ = false;
+
   if (s.ok()) {
     // Commit to the new state
     imm_->Unref();
     imm_ = NULL;
     has_imm_.Release_Store(NULL);
+    InstallSuperVersion();
     DeleteObsoleteFiles();
 #if VERBOSE >= 1
     VersionSet::LevelSummaryStorage tmp;
@@ -760,7 +797,7 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 }
 
 bool DBImpl::HasCompaction() {
-  if (imm_ != NULL) {
+  if (CanCompactMemTable()) {
     return true;
   } else if (manual_compaction_ != NULL) {
     return true;
@@ -777,8 +814,11 @@ bool DBImpl::HasCompaction() {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_ || bg_compaction_paused_) {
-    // Already scheduled or paused
+  if (bg_compaction_paused_) {
+    // Paused
+  } else if (bg_compactions_scheduled_ >=
+             std::max(options_.max_background_compactions, 1)) {
+    // Already scheduled
   } else if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
   } else if (!bg_error_.ok()) {
@@ -786,7 +826,7 @@ void DBImpl::MaybeScheduleCompaction() {
   } else if (!HasCompaction()) {
     // No work to be done
   } else {
-    bg_compaction_scheduled_ = true;
+    bg_compactions_scheduled_++;
     if (options_.compaction_pool != NULL) {
       options_.compaction_pool->Schedule(&DBImpl::BGWork, this);
     } else {
@@ -801,7 +841,8 @@ void DBImpl::BGWork(void* db) {
 
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(bg_compaction_scheduled_);
+  assert(bg_compactions_scheduled_ > 0);
+  bool did_work = false;
   if (shutting_down_.Acquire_Load()) {
     // No more background work when shutting down.
   } else if (!bg_error_.ok()) {
@@ -809,35 +850,46 @@ void DBImpl::BackgroundCall() {
   } else if (bg_compaction_paused_) {
     // Abort
   } else {
-    BackgroundCompactionWrapper();
+    did_work = BackgroundCompactionWrapper();
   }
 
-  bg_compaction_scheduled_ = false;
+  bg_compactions_scheduled_--;
   // Previous compaction may have produced too many files in a level,
-  // so reschedule another compaction if needed.
-  MaybeScheduleCompaction();
+  // so reschedule another compaction if needed. A job that found nothing to
+  // do while other jobs are running leaves rescheduling to those jobs to
+  // avoid spinning on work that is blocked by ongoing compactions.
+  if (did_work || bg_compactions_scheduled_ == 0) {
+    MaybeScheduleCompaction();
+  }
   bg_cv_.SignalAll();
 }
 
-void DBImpl::BackgroundCompactionWrapper() {
-  assert(!bg_compaction_in_progress_);
-  bg_compaction_in_progress_ = true;
-  BackgroundCompaction();
-  bg_compaction_in_progress_ = false;
+bool DBImpl::BackgroundCompactionWrapper() {
+  bg_compactions_in_progress_++;
+  const bool did_work = BackgroundCompaction();
+  assert(bg_compactions_in_progress_ > 0);
+  bg_compactions_in_progress_--;
+  return did_work;
 }
 
-void DBImpl::BackgroundCompaction() {
+// Return false if no compaction was done.
+bool DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != NULL) {
+  if (CanCompactMemTable()) {
     CompactMemTable();
-    return;
+    return true;
   }
 
   Compaction* c;
   bool is_manual = (manual_compaction_ != NULL);
   InternalKey manual_end;
   if (is_manual) {
+    // Manual compactions run alone. Wait for ongoing compactions to drain
+    // and pick no new ones in the meantime.
+    if (bg_table_compactions_ != 0) {
+      return false;
+    }
     ManualCompaction* m = manual_compaction_;
     c = versions_->CompactRange(m->level, m->begin, m->end);
     m->done = (c == NULL);
@@ -857,6 +909,15 @@ void DBImpl::BackgroundCompaction() {
     c = NULL;
   }
 
+  if (c != NULL) {
+    bg_table_compactions_++;
+    // Let another job look for compactions that do not conflict with
+    // this one
+    MaybeScheduleCompaction();
+  } else if (!is_manual) {
+    return false;
+  }
+
   Status status;
   if (c == NULL) {
     // Nothing to do
@@ -867,10 +928,11 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size, f->seq_off,
                        f->smallest, f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+    status = LogAndApply(c->edit());
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
+    c->MarkFilesBeingCompacted(false);
 #if VERBOSE >= 3
     VersionSet::LevelSummaryStorage tmp;
     Log(options_.info_log, 3, "Moved #%lld to level-%d %lld bytes %s: %s",
@@ -885,9 +947,14 @@ void DBImpl::BackgroundCompaction() {
       RecordBackgroundError(status);
     }
     CleanupCompaction(compact);
+    c->MarkFilesBeingCompacted(false);
     c->ReleaseInputs();
     DeleteObsoleteFiles();
   }
+  if (c != NULL) {
+    assert(bg_table_compactions_ > 0);
+    bg_table_compactions_--;
+  }
   delete c;
 
   if (status.ok()) {
@@ -912,6 +979,7 @@ void DBImpl::BackgroundCompaction() {
     }
     manual_compaction_ = NULL;
   }
+  return true;
 }
 
 void DBImpl::CleanupCompaction(CompactionState* compact) {
@@ -931,6 +999,17 @@ void DBImpl::CleanupCompaction(CompactionState* compact) {
   delete compact;
 }
 
+DBOptions DBImpl::TableOptionsForLevel(int level) const {
+  Options result = options_;
+  const std::vector<CompressionType>& per_level =
+      options_.compression_per_level;
+  if (!per_level.empty()) {
+    result.compression =
+        per_level[std::min<size_t>(level, per_level.size() - 1)];
+  }
+  return result;
+}
+
 Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   assert(compact != NULL);
   assert(compact->builder == NULL);
@@ -955,7 +1034,9 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname.c_str(), &compact->outfile);
   if (s.ok()) {
-    compact->builder = new TableBuilder(options_, compact->outfile);
+    compact->builder = new TableBuilder(
+        TableOptionsForLevel(compact->compaction->level() + 1),
+        compact->outfile);
   }
   return s;
 }
@@ -1037,65 +1118,275 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
                                          off, out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return LogAndApply(compact->compaction->edit());
 }
 
-Status DBImpl::DoCompactionWork(CompactionState* compact) {
-  const uint64_t start_micros = CurrentMicros();
-  int64_t paused_micros = 0;
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  while (manifest_write_in_progress_) {
+    bg_cv_.Wait();
+  }
+  manifest_write_in_progress_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  if (s.ok()) {
+    InstallSuperVersion();
+  }
+  manifest_write_in_progress_ = false;
+  bg_cv_.SignalAll();
+  return s;
+}
+
+// A compaction split into disjoint user key ranges, or slices, that are
+// processed concurrently. Slices are claimed one at a time by the thread
+// running the compaction and by helper tasks scheduled on the compaction
+// pool. A helper that starts after all slices have been claimed returns
+// without touching the db, so the job is reference counted and deleted by its
+// last user rather than by the compaction itself. Helpers count as background
+// compactions while they process a slice so that they are paused along with
+// the compaction.
+struct DBImpl::SubcompactionJob {
+  DBImpl* const db;
+  // Slice i covers user keys in [bounds[i - 1], bounds[i]). The first slice
+  // has no lower bound and the last slice has no upper bound.
+  std::vector<std::string> bounds;
+  std::vector<CompactionState*> slices;
+  std::vector<Status> statuses;
+
+  port::Mutex mu;
+  port::CondVar cv;  // Signalled when a slice is done
+  // State below is protected by mu
+  size_t next_slice;  // Index of the next slice to claim
+  int num_running;    // Number of slices being processed
+  int refs;           // The compaction plus helpers that have not yet run
+
+  explicit SubcompactionJob(DBImpl* db)
+      : db(db), cv(&mu), next_slice(0), num_running(0), refs(1) {}
+
+  // Claim and process slices until there are none left.
+  void Work(int64_t* imm_micros, int64_t* paused_micros) {
+    MutexLock ml(&mu);
+    while (next_slice < slices.size()) {
+      const size_t i = next_slice++;
+      num_running++;
+      mu.Unlock();
+      Slice lower, upper;
+      if (i != 0) lower = bounds[i - 1];
+      if (i + 1 < slices.size()) upper = bounds[i];
+      if (imm_micros == NULL) {
+        db->BeginSubcompaction();
+      }
+      Status s = db->ProcessCompactionInput(
+          slices[i], i != 0 ? &lower : NULL,
+          i + 1 < slices.size() ? &upper : NULL, imm_micros, paused_micros);
+      if (imm_micros == NULL) {
+        db->EndSubcompaction();
+      }
+      mu.Lock();
+      statuses[i] = s;
+      num_running--;
+      cv.SignalAll();
+    }
+  }
+
+  void Unref() {
+    mu.Lock();
+    const bool last = (--refs == 0);
+    mu.Unlock();
+    if (last) {
+      delete this;
+    }
+  }
+};
+
+void DBImpl::BGSubcompactionWork(void* job) {
+  SubcompactionJob* const j = reinterpret_cast<SubcompactionJob*>(job);
+  j->Work(NULL, NULL);
+  j->Unref();
+}
+
+namespace {
+struct UserKeyLess {
+  const Comparator* ucmp;
+  explicit UserKeyLess(const Comparator* c) : ucmp(c) {}
+  bool operator()(const std::string& a, const std::string& b) const {
+    return ucmp->Compare(a, b) < 0;
+  }
+};
+}  // namespace
+
+void DBImpl::BeginSubcompaction() {
+  MutexLock l(&mutex_);
+  while (bg_compaction_paused_) {
+    bg_cv_.Wait();
+  }
+  bg_compactions_in_progress_++;
+}
+
+void DBImpl::EndSubcompaction() {
+  MutexLock l(&mutex_);
+  assert(bg_compactions_in_progress_ > 0);
+  bg_compactions_in_progress_--;
+  bg_cv_.SignalAll();
+}
+
+// Cut the compaction at the smallest keys of its input files and spread the
+// cuts evenly across the inputs. Leave the job empty if the compaction
+// cannot be split.
+void DBImpl::SetupSubcompactions(CompactionState* compact,
+                                 SubcompactionJob* job) {
+  mutex_.AssertHeld();  // Each slice refs the input version
+  Compaction* const c = compact->compaction;
+  const Comparator* const ucmp = user_comparator();
+  std::vector<std::string> keys;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < c->num_input_files(which); i++) {
+      keys.push_back(c->input(which, i)->smallest.user_key().ToString());
+    }
+  }
+  std::sort(keys.begin(), keys.end(), UserKeyLess(ucmp));
+  size_t n = 0;  // Number of unique keys
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (n == 0 || ucmp->Compare(keys[i], keys[n - 1]) != 0) {
+      keys[n++].swap(keys[i]);
+    }
+  }
+  // keys[0] is the smallest key of the compaction and is never a cut
+  const size_t m = n != 0 ? n - 1 : 0;  // Number of candidate cuts
+  size_t num_slices = static_cast<size_t>(options_.max_subcompactions);
+  if (num_slices > m + 1) num_slices = m + 1;
+  if (num_slices <= 1) {
+    return;
+  }
+  for (size_t j = 1; j < num_slices; j++) {
+    job->bounds.push_back(keys[1 + (j * m) / num_slices]);
+  }
+  for (size_t j = 0; j < num_slices; j++) {
+    CompactionState* const slice = new CompactionState(c->NewSubcompaction());
+    slice->smallest_snapshot = compact->smallest_snapshot;
+    job->slices.push_back(slice);
+  }
+  job->statuses.resize(num_slices);
+}
+
+Status DBImpl::RunSubcompactions(CompactionState* compact,
+                                 SubcompactionJob* job, int64_t* imm_micros,
+                                 int64_t* paused_micros) {
 #if VERBOSE >= 4
-  Log(options_.info_log, 4, "Compacting %d@%d + %d@%d files ...",
-      compact->compaction->num_input_files(0), compact->compaction->level(),
-      compact->compaction->num_input_files(1),
-      compact->compaction->level() + 1);
+  Log(options_.info_log, 4, "Splitting compaction into %d slices",
+      static_cast<int>(job->slices.size()));
 #endif
-  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
-  assert(compact->builder == NULL);
-  assert(compact->outfile == NULL);
-  if (snapshots_.empty()) {
-    compact->smallest_snapshot = versions_->LastSequence();
-  } else {
-    compact->smallest_snapshot = snapshots_.oldest()->number_;
+  const int num_helpers = static_cast<int>(job->slices.size()) - 1;
+  job->mu.Lock();
+  job->refs += num_helpers;
+  job->mu.Unlock();
+  for (int i = 0; i < num_helpers; i++) {
+    if (options_.compaction_pool != NULL) {
+      options_.compaction_pool->Schedule(&DBImpl::BGSubcompactionWork, job);
+    } else {
+      env_->Schedule(&DBImpl::BGSubcompactionWork, job);
+    }
   }
 
-  // Release mutex while we're actually doing the compaction work
-  mutex_.Unlock();
+  // Take part in the job so that progress is made even if no helper gets to
+  // run, such as when we are running on the only thread of the pool
+  job->Work(imm_micros, paused_micros);
+  job->mu.Lock();
+  while (job->num_running != 0) {
+    job->mu.Unlock();
+    YieldCompaction(imm_micros, paused_micros);
+    job->mu.Lock();
+    if (job->num_running != 0) {
+      job->cv.TimedWait(1000);
+    }
+  }
+  job->mu.Unlock();
+
+  // Outputs are already in key order since slices are disjoint and sorted
+  Status status;
+  for (size_t i = 0; i < job->slices.size(); i++) {
+    CompactionState* const slice = job->slices[i];
+    if (status.ok()) {
+      status = job->statuses[i];
+    }
+    if (slice->builder != NULL) {
+      slice->builder->Abandon();
+      delete slice->builder;
+    }
+    delete slice->outfile;
+    compact->outputs.insert(compact->outputs.end(), slice->outputs.begin(),
+                            slice->outputs.end());
+    compact->total_bytes += slice->total_bytes;
+  }
+  return status;
+}
+
+void DBImpl::ReleaseSubcompactions(SubcompactionJob* job) {
+  mutex_.AssertHeld();  // Each slice unrefs the input version
+  for (size_t i = 0; i < job->slices.size(); i++) {
+    delete job->slices[i]->compaction;
+    delete job->slices[i];
+  }
+  job->Unref();
+}
+
+void DBImpl::YieldCompaction(int64_t* imm_micros, int64_t* paused_micros) {
+  // Prioritize memtable compactions and bulk insertion work
+  if (has_imm_.NoBarrier_Load() != NULL) {
+    const uint64_t imm_start = CurrentMicros();
+    mutex_.Lock();
+    if (CanCompactMemTable()) {
+      CompactMemTable();
+      bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
+    }
+    mutex_.Unlock();
+    *imm_micros += (CurrentMicros() - imm_start);
+  }
+  if (bg_compaction_paused_) {
+    const uint64_t pause_start = CurrentMicros();
+    mutex_.Lock();
+    assert(bg_compactions_in_progress_ > 0);
+    bg_compactions_in_progress_--;
+    bg_cv_.SignalAll();
+    while (bg_compaction_paused_) {
+      bg_cv_.Wait();
+    }
+    bg_compactions_in_progress_++;
+    mutex_.Unlock();
+    *paused_micros += (CurrentMicros() - pause_start);
+  }
+}
 
+Status DBImpl::ProcessCompactionInput(CompactionState* compact,
+                                      const Slice* begin, const Slice* end,
+                                      int64_t* imm_micros,
+                                      int64_t* paused_micros) {
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
+  if (begin != NULL) {
+    InternalKey start(*begin, kMaxSequenceNumber, kValueTypeForSeek);
+    input->Seek(start.Encode());
+  } else {
+    input->SeekToFirst();
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
   bool has_current_user_key = false;
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
   for (; input->Valid() && !shutting_down_.Acquire_Load();) {
-    // Prioritize memtable compactions and bulk insertion work
-    if (has_imm_.NoBarrier_Load() != NULL) {
-      const uint64_t imm_start = CurrentMicros();
-      mutex_.Lock();
-      if (imm_ != NULL) {
-        CompactMemTable();
-        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
-      }
-      mutex_.Unlock();
-      imm_micros += (CurrentMicros() - imm_start);
-    }
-    if (bg_compaction_paused_) {
-      const uint64_t pause_start = CurrentMicros();
-      mutex_.Lock();
-      assert(bg_compaction_in_progress_);
-      bg_compaction_in_progress_ = false;
-      bg_cv_.SignalAll();
-      while (bg_compaction_paused_) {
-        bg_cv_.Wait();
-      }
-      bg_compaction_in_progress_ = true;
-      mutex_.Unlock();
-      paused_micros += (CurrentMicros() - pause_start);
+    if (imm_micros != NULL) {
+      YieldCompaction(imm_micros, paused_micros);
+    } else if (compact->builder == NULL && bg_compaction_paused_) {
+      // Subcompaction helpers yield between output files
+      EndSubcompaction();
+      BeginSubcompaction();
     }
 
     Slice key = input->key();
+    const bool parsed = ParseInternalKey(key, &ikey);
+    if (parsed && end != NULL &&
+        user_comparator()->Compare(ikey.user_key, *end) >= 0) {
+      break;
+    }
     if (compact->compaction->ShouldStopBefore(key) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
@@ -1106,7 +1397,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
     // Handle key/value, add to state, etc.
     bool drop = false;
-    if (!ParseInternalKey(key, &ikey)) {
+    if (!parsed) {
       // Do not hide error keys
       current_user_key.clear();
       has_current_user_key = false;
@@ -1183,7 +1474,48 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     status = input->status();
   }
   delete input;
-  input = NULL;
+  return status;
+}
+
+Status DBImpl::DoCompactionWork(CompactionState* compact) {
+  const uint64_t start_micros = CurrentMicros();
+  int64_t paused_micros = 0;
+  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
+#if VERBOSE >= 4
+  Log(options_.info_log, 4, "Compacting %d@%d + %d@%d files ...",
+      compact->compaction->num_input_files(0), compact->compaction->level(),
+      compact->compaction->num_input_files(1),
+      compact->compaction->level() + 1);
+#endif
+  assert(versions_->NumLevelFiles(compact->compaction->level()) > 0);
+  assert(compact->builder == NULL);
+  assert(compact->outfile == NULL);
+  if (snapshots_.empty()) {
+    compact->smallest_snapshot = versions_->LastSequence();
+  } else {
+    compact->smallest_snapshot = snapshots_.oldest()->number_;
+  }
+
+  SubcompactionJob* job = NULL;
+  if (options_.max_subcompactions > 1) {
+    job = new SubcompactionJob(this);
+    SetupSubcompactions(compact, job);
+    if (job->slices.empty()) {
+      delete job;
+      job = NULL;
+    }
+  }
+
+  // Release mutex while we're actually doing the compaction work
+  mutex_.Unlock();
+
+  Status status;
+  if (job != NULL) {
+    status = RunSubcompactions(compact, job, &imm_micros, &paused_micros);
+  } else {
+    status = ProcessCompactionInput(compact, NULL, NULL, &imm_micros,
+                                    &paused_micros);
+  }
 
   CompactionStats stats;
   stats.micros = CurrentMicros() - start_micros - paused_micros - imm_micros;
@@ -1201,6 +1533,9 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   stats.n = 1;
 
   mutex_.Lock();
+  if (job != NULL) {
+    ReleaseSubcompactions(job);
+  }
   stats_[compact->compaction->level() + 1].Add(stats);
 
   if (status.ok()) {
@@ -1219,54 +1554,139 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 }
 
 namespace {
-struct IterState {
-  port::Mutex* mu;
-  Version* version;
-  MemTable* mem;
-  MemTable* imm;
-};
+// Marks a super version slot as being used by its reader thread.
+char sv_in_use;
+void* const kSuperVersionInUse = &sv_in_use;
+
+std::atomic<uint32_t> next_sv_slot(0);
+#if defined(__GNUC__)
+__thread int sv_slot = -1;
+#else
+thread_local int sv_slot = -1;
+#endif
+}  // namespace
+
+void DBImpl::InstallSuperVersion() {
+  mutex_.AssertHeld();
+  SuperVersion* const sv = new SuperVersion;
+  sv->mem = mem_;
+  sv->imm = imm_;
+  sv->current = versions_->current();
+  sv->number = super_version_number_.load(std::memory_order_relaxed) + 1;
+  sv->refs.store(1, std::memory_order_relaxed);
+  if (sv->mem != NULL) sv->mem->Ref();
+  if (sv->imm != NULL) sv->imm->Ref();
+  sv->current->Ref();
+  SuperVersion* const old = super_version_;
+  super_version_ = sv;
+  super_version_number_.store(sv->number);
+  // Cached super versions are now stale
+  ScrapeSuperVersionSlots();
+  if (old != NULL) {
+    UnrefSuperVersionLocked(old);
+  }
+}
+
+void DBImpl::ScrapeSuperVersionSlots() {
+  mutex_.AssertHeld();
+  for (int i = 0; i < kNumSuperVersionSlots; i++) {
+    void* const p = sv_slots_[i].sv.exchange(NULL);
+    // A slot in use is emptied too, so its reader thread will find out and
+    // release its super version directly on its way out
+    if (p != NULL && p != kSuperVersionInUse) {
+      UnrefSuperVersionLocked(reinterpret_cast<SuperVersion*>(p));
+    }
+  }
+}
 
-static void CleanupIteratorState(void* arg1, void* arg2) {
-  IterState* state = reinterpret_cast<IterState*>(arg1);
-  state->mu->Lock();
-  if (state->mem != NULL) state->mem->Unref();
-  if (state->imm != NULL) state->imm->Unref();
-  state->version->Unref();
-  state->mu->Unlock();
-  delete state;
+void DBImpl::FreeSuperVersion(SuperVersion* sv) {
+  mutex_.AssertHeld();
+  assert(sv->refs.load() == 0);
+  if (sv->mem != NULL) sv->mem->Unref();
+  if (sv->imm != NULL) sv->imm->Unref();
+  sv->current->Unref();
+  delete sv;
+}
+
+void DBImpl::UnrefSuperVersionLocked(SuperVersion* sv) {
+  if (sv->refs.fetch_sub(1) == 1) {
+    FreeSuperVersion(sv);
+  }
+}
+
+void DBImpl::UnrefSuperVersion(SuperVersion* sv) {
+  // Version and memtable refs are protected by mutex_. Unless this is the
+  // last ref, there is no need to take the lock.
+  if (sv->refs.fetch_sub(1) == 1) {
+    MutexLock l(&mutex_);
+    FreeSuperVersion(sv);
+  }
+}
+
+DBImpl::SuperVersion* DBImpl::AcquireSuperVersion(SuperVersionSlot** slot) {
+  if (sv_slot < 0) {
+    sv_slot = next_sv_slot.fetch_add(1) % kNumSuperVersionSlots;
+  }
+  *slot = &sv_slots_[sv_slot];
+  void* const p = (*slot)->sv.exchange(kSuperVersionInUse);
+  if (p == kSuperVersionInUse) {
+    // Another thread sharing the same slot is using it
+    *slot = NULL;
+  } else if (p != NULL) {
+    SuperVersion* const sv = reinterpret_cast<SuperVersion*>(p);
+    if (sv->number == super_version_number_.load()) {
+      return sv;
+    }
+    // Put back by a thread sharing the slot after it was emptied
+    UnrefSuperVersion(sv);
+  }
+  // Slow path: take a new ref to the current super version. The ref is
+  // handed over to the slot when the caller is done.
+  MutexLock l(&mutex_);
+  SuperVersion* const sv = super_version_;
+  sv->refs.fetch_add(1);
+  return sv;
+}
+
+void DBImpl::ReleaseSuperVersion(SuperVersion* sv, SuperVersionSlot* slot) {
+  void* expected = kSuperVersionInUse;
+  // Put the super version back to the slot unless a new super version has
+  // been installed since, which empties the slot
+  if (slot == NULL || sv->number != super_version_number_.load() ||
+      !slot->sv.compare_exchange_strong(expected, sv)) {
+    UnrefSuperVersion(sv);
+  }
+}
+
+void DBImpl::CleanupSuperVersion(void* arg1, void* arg2) {
+  DBImpl* const db = reinterpret_cast<DBImpl*>(arg1);
+  db->UnrefSuperVersion(reinterpret_cast<SuperVersion*>(arg2));
 }
-}  // namespace
 
 Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
                                       SequenceNumber* latest_snapshot,
                                       uint32_t* seed) {
-  IterState* cleanup = new IterState;
-  mutex_.Lock();
+  SuperVersionSlot* slot;
+  SuperVersion* const sv = AcquireSuperVersion(&slot);
   *latest_snapshot = versions_->LastSequence();
 
   // Collect together all needed child iterators
   std::vector<Iterator*> list;
-  if (mem_ != NULL) {
-    list.push_back(mem_->NewIterator());
-    mem_->Ref();
+  if (sv->mem != NULL) {
+    list.push_back(sv->mem->NewIterator());
   }
-  if (imm_ != NULL) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+  if (sv->imm != NULL) {
+    list.push_back(sv->imm->NewIterator());
   }
-  versions_->current()->AddIterators(options, &list);
+  sv->current->AddIterators(options, &list);
   Iterator* internal_iter =
       NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
-
-  cleanup->mu = &mutex_;
-  cleanup->mem = mem_;
-  cleanup->imm = imm_;
-  cleanup->version = versions_->current();
-  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, NULL);
+  // The iterator keeps its own ref to the super version
+  sv->refs.fetch_add(1);
+  internal_iter->RegisterCleanup(CleanupSuperVersion, this, sv);
+  ReleaseSuperVersion(sv, slot);
 
   *seed = ++seed_;
-  mutex_.Unlock();
   return internal_iter;
 }
 
@@ -1283,48 +1703,17 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
 
 Status DBImpl::Get(const ReadOptions& options, const LookupKey& lkey,
                    Buffer* value) {
-  Status s;
-  MutexLock l(&mutex_);
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  if (mem != NULL) mem->Ref();
-  if (imm != NULL) imm->Ref();
-  current->Ref();
-
-  bool have_stat_update = false;
-  Version::GetStats stats;
-
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    if (mem != NULL && mem->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else {
-      current->Get(options, lkey, value, &s, &stats);
-      have_stat_update = true;
-    }
-    mutex_.Lock();
-  }
-
-  if (have_stat_update && current->UpdateStats(stats)) {
-    if (!options_.disable_seek_compaction) {
-      MaybeScheduleCompaction();
-    }
-  }
-  if (mem != NULL) mem->Unref();
-  if (imm != NULL) imm->Unref();
-  current->Unref();
+  SuperVersionSlot* slot;
+  SuperVersion* const sv = AcquireSuperVersion(&slot);
+  Status s = GetFrom(sv, options, lkey, value);
+  ReleaseSuperVersion(sv, slot);
   return s;
 }
 
 Status DBImpl::Get(const ReadOptions& options, const Slice& key,
                    Buffer* value) {
-  Status s;
-  MutexLock l(&mutex_);
+  SuperVersionSlot* slot;
+  SuperVersion* const sv = AcquireSuperVersion(&slot);
   SequenceNumber snapshot;
   if (options.snapshot != NULL) {
     snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
@@ -1332,40 +1721,33 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
     snapshot = versions_->LastSequence();
   }
 
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  if (mem != NULL) mem->Ref();
-  if (imm != NULL) imm->Ref();
-  current->Ref();
+  LookupKey lkey(key, snapshot);
+  Status s = GetFrom(sv, options, lkey, value);
+  ReleaseSuperVersion(sv, slot);
+  return s;
+}
 
-  bool have_stat_update = false;
+Status DBImpl::GetFrom(SuperVersion* sv, const ReadOptions& options,
+                       const LookupKey& lkey, Buffer* value) {
+  Status s;
   Version::GetStats stats;
-
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem != NULL && mem->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, options.limit, &s)) {
-      // Done
-    } else {
-      current->Get(options, lkey, value, &s, &stats);
-      have_stat_update = true;
-    }
-    mutex_.Lock();
-  }
-
-  if (have_stat_update && current->UpdateStats(stats)) {
-    if (!options_.disable_seek_compaction) {
-      MaybeScheduleCompaction();
+  // First look in the memtable, then in the immutable memtable (if any).
+  if (sv->mem != NULL && sv->mem->Get(lkey, value, options.limit, &s)) {
+    // Done
+  } else if (sv->imm != NULL && sv->imm->Get(lkey, value, options.limit, &s)) {
+    // Done
+  } else {
+    sv->current->Get(options, lkey, value, &s, &stats);
+    // Only take the lock when there are seek stats to charge
+    if (stats.seek_file != NULL) {
+      MutexLock l(&mutex_);
+      if (sv->current->UpdateStats(stats)) {
+        if (!options_.disable_seek_compaction) {
+          MaybeScheduleCompaction();
+        }
+      }
     }
   }
-  if (mem != NULL) mem->Unref();
-  if (imm != NULL) imm->Unref();
-  current->Unref();
   return s;
 }
 
@@ -1389,6 +1771,92 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key, Slice* value,
   return s;
 }
 
+namespace {
+struct UserKeyOrder {
+  const Comparator* ucmp;
+  const Slice* keys;
+  bool operator()(size_t a, size_t b) const {
+    return ucmp->Compare(keys[a], keys[b]) < 0;
+  }
+};
+}  // namespace
+
+void DBImpl::MultiGet(const ReadOptions& options, size_t n, const Slice* keys,
+                      std::string* values, Status* statuses) {
+  if (n == 0) {
+    return;
+  }
+  SuperVersionSlot* slot;
+  SuperVersion* const sv = AcquireSuperVersion(&slot);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  // Keys are looked up in user key order so that keys sharing a table or a
+  // data block are next to each other
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = i;
+  UserKeyOrder cmp;
+  cmp.ucmp = user_comparator();
+  cmp.keys = keys;
+  std::stable_sort(order.begin(), order.end(), cmp);
+
+  // First look in the memtables. Keys not found there are collected to be
+  // looked up in the current version all at once.
+  std::vector<db::StringBuf> bufs;
+  bufs.reserve(n);
+  std::vector<size_t> todo;
+  std::vector<LookupKey*> lkeys;
+  std::vector<Buffer*> vals;
+  for (size_t j = 0; j < n; j++) {
+    const size_t i = order[j];
+    bufs.push_back(db::StringBuf(&values[i]));
+    LookupKey* const lkey = new LookupKey(keys[i], snapshot);
+    Status s;
+    if (sv->mem != NULL && sv->mem->Get(*lkey, &bufs[j], options.limit, &s)) {
+      // Done
+    } else if (sv->imm != NULL &&
+               sv->imm->Get(*lkey, &bufs[j], options.limit, &s)) {
+      // Done
+    } else {
+      todo.push_back(i);
+      lkeys.push_back(lkey);
+      vals.push_back(&bufs[j]);
+      continue;
+    }
+    statuses[i] = s;
+    delete lkey;
+  }
+
+  if (!todo.empty()) {
+    std::vector<Status> s(todo.size());
+    std::vector<Version::GetStats> stats;
+    sv->current->MultiGet(options, todo.size(), &lkeys[0], &vals[0], &s[0],
+                          &stats);
+    for (size_t j = 0; j < todo.size(); j++) {
+      statuses[todo[j]] = s[j];
+      delete lkeys[j];
+    }
+    if (!stats.empty()) {
+      MutexLock l(&mutex_);
+      bool need_compaction = false;
+      for (size_t j = 0; j < stats.size(); j++) {
+        if (sv->current->UpdateStats(stats[j])) {
+          need_compaction = true;
+        }
+      }
+      if (need_compaction && !options_.disable_seek_compaction) {
+        MaybeScheduleCompaction();
+      }
+    }
+  }
+
+  ReleaseSuperVersion(sv, slot);
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1446,13 +1914,40 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   // commit all writes in the queue making writing more efficient.
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  // With pipelined writes, members of a logged group are removed from the
+  // writer list before they are done.
+  while (!w.done && w.insert_mem == NULL &&
+         (writers_.empty() || &w != writers_.front())) {
     w.cv.Wait();
   }
+  if (!w.done && w.insert_mem != NULL) {
+    // Our group leader has logged our batch and asked us to insert it into
+    // the memtable ourselves. The leader will finish the group once all its
+    // members are done inserting.
+    mutex_.Unlock();
+    Status s = WriteBatchInternal::ConcurrentInsertInto(w.batch, w.insert_mem);
+    mutex_.Lock();
+    Writer* const leader = w.leader;
+    if (!s.ok() && leader->status.ok()) {
+      leader->status = s;
+    }
+    assert(leader->pending_inserts > 0);
+    if (--leader->pending_inserts == 0) {
+      leader->cv.Signal();
+    }
+    while (!w.done) {
+      w.cv.Wait();
+    }
+  }
   if (w.done) {
     return w.status;
   }
 
+  if (options_.enable_pipelined_write && !options_.no_memtable &&
+      my_batch != &flush_memtable_ && my_batch != &sync_wal_) {
+    return PipelinedWrite(options, &w);
+  }
+
   Status status;
   Writer* last_writer = &w;
   if (my_batch != &sync_wal_) {
@@ -1486,7 +1981,16 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
           }
         }
         if (status.ok()) {
-          status = WriteBatchInternal::InsertInto(final_batch, mem_);
+          if (last_writer != &w && options_.allow_concurrent_memtable_write) {
+            mutex_.Lock();
+            std::vector<Writer*> group;
+            AssignGroupSequences(last_writer, versions_->LastSequence() + 1,
+                                 &group);
+            status = ConcurrentInsertGroup(group, mem_);
+            mutex_.Unlock();
+          } else {
+            status = WriteBatchInternal::InsertInto(final_batch, mem_);
+          }
         }
         mutex_.Lock();
         if (sync_error) {
@@ -1502,12 +2006,12 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
         // batch of writes. We start by temporarily blocking background
         // compactions.
         bg_compaction_paused_++;
-        while (bg_compaction_in_progress_ || bulk_insert_in_progress_) {
+        while (bg_compactions_in_progress_ != 0 || bulk_insert_in_progress_) {
           bg_cv_.Wait();
         }
 
         bulk_insert_in_progress_ = true;
-        MemTable* const mem = new MemTable(internal_comparator_);
+        MemTable* const mem = new MemTable(internal_comparator_, options_);
         mem->Ref();
         status = WriteBatchInternal::InsertInto(final_batch, mem);
         if (status.ok()) {
@@ -1515,7 +2019,7 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
           status = DumpMemTable(mem, &edit, NULL);
           if (status.ok()) {
             versions_->SetLastSequence(last_sequence);
-            status = versions_->LogAndApply(&edit, &mutex_);
+            status = LogAndApply(&edit);
           } else {
             RecordBackgroundError(status);
           }
@@ -1572,6 +2076,150 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   return status;
 }
 
+// Assign each batch in the group ending at *last_writer the sequence numbers
+// it occupies in the group's combined log record, starting at "first". The
+// members of the group are stored in *group in order.
+// REQUIRES: mutex_ is held.
+void DBImpl::AssignGroupSequences(Writer* last_writer, SequenceNumber first,
+                                  std::vector<Writer*>* group) {
+  mutex_.AssertHeld();
+  std::deque<Writer*>::iterator iter = writers_.begin();
+  for (; iter != writers_.end(); ++iter) {
+    Writer* const w = *iter;
+    WriteBatchInternal::SetSequence(w->batch, first);
+    first += WriteBatchInternal::Count(w->batch);
+    group->push_back(w);
+    if (w == last_writer) {
+      break;
+    }
+  }
+}
+
+// Have every writer in a group insert its own batch into *mem in parallel.
+// The first writer of the group is its leader. The result is identical to
+// inserting the group's combined batch serially.
+// REQUIRES: AssignGroupSequences() has been called for the group.
+// REQUIRES: mutex_ is held.
+Status DBImpl::ConcurrentInsertGroup(const std::vector<Writer*>& group,
+                                     MemTable* mem) {
+  mutex_.AssertHeld();
+  Writer* const leader = group[0];
+  leader->status = Status::OK();
+  leader->pending_inserts = 0;
+  for (size_t i = 1; i < group.size(); i++) {
+    Writer* const w = group[i];
+    leader->pending_inserts++;
+    w->leader = leader;
+    w->insert_mem = mem;
+    w->cv.Signal();
+  }
+  mutex_.Unlock();
+  Status s = WriteBatchInternal::ConcurrentInsertInto(leader->batch, mem);
+  mutex_.Lock();
+  while (leader->pending_inserts != 0) {
+    leader->cv.Wait();
+  }
+  if (s.ok()) {
+    s = leader->status;
+  }
+  return s;
+}
+
+// Write a group of regular batches led by *w in two stages. In the first
+// stage, the group is appended to the write-ahead log while *w is at the
+// front of the writer list. The writer list is then handed to the next group
+// so its log write overlaps our memtable insertion. In the second stage,
+// groups insert into the memtable in log order and publish their sequence
+// numbers once done.
+// REQUIRES: *w is at the front of the writer list.
+// REQUIRES: mutex_ is held.
+Status DBImpl::PipelinedWrite(const WriteOptions& options, Writer* w) {
+  mutex_.AssertHeld();
+  assert(w == writers_.front());
+  Writer* last_writer = w;
+  std::vector<Writer*> group;
+  Status status = MakeRoomForWrite(false);
+  if (status.ok()) {
+    WriteBatch* const final_batch = BuildBatchGroup(&last_writer);
+    // Sequence numbers taken by groups still in the memtable stage are not
+    // yet reflected by versions_->LastSequence().
+    const SequenceNumber last_sequence =
+        mem_writers_.empty() ? versions_->LastSequence()
+                             : mem_writers_.back()->last_sequence;
+    WriteBatchInternal::SetSequence(final_batch, last_sequence + 1);
+    w->last_sequence = last_sequence + WriteBatchInternal::Count(final_batch);
+    AssignGroupSequences(last_writer, last_sequence + 1, &group);
+
+    if (!options_.disable_write_ahead_log) {
+      bool sync_error = false;
+      mutex_.Unlock();
+      status = log_->AddRecord(WriteBatchInternal::Contents(final_batch));
+      if (status.ok() && options.sync) {
+        status = logfile_->Sync();
+        if (!status.ok()) {
+          sync_error = true;
+        }
+      }
+      mutex_.Lock();
+      if (sync_error) {
+        RecordBackgroundError(status);
+      }
+    }
+
+    if (final_batch == &tmp_batch_) {
+      final_batch->Clear();
+    }
+  }
+
+  while (true) {
+    Writer* ready = writers_.front();
+    writers_.pop_front();
+    if (ready == last_writer) {
+      break;
+    }
+  }
+
+  // Let the next group start logging
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+
+  if (status.ok()) {
+    mem_writers_.push_back(w);
+    while (w != mem_writers_.front()) {
+      w->cv.Wait();
+    }
+    // mem_ won't be switched while there are groups in the memtable stage
+    MemTable* const mem = mem_;
+    if (group.size() > 1 && options_.allow_concurrent_memtable_write) {
+      status = ConcurrentInsertGroup(group, mem);
+    } else {
+      mutex_.Unlock();
+      for (size_t i = 0; i < group.size() && status.ok(); i++) {
+        status = WriteBatchInternal::InsertInto(group[i]->batch, mem);
+      }
+      mutex_.Lock();
+    }
+
+    versions_->SetLastSequence(w->last_sequence);
+    mem_writers_.pop_front();
+    if (!mem_writers_.empty()) {
+      mem_writers_.front()->cv.Signal();
+    } else {
+      bg_cv_.SignalAll();  // Wake up MakeRoomForWrite() waiting for us
+    }
+  }
+
+  for (size_t i = 1; i < group.size(); i++) {
+    Writer* const ready = group[i];
+    ready->status = status;
+    ready->done = true;
+    ready->cv.Signal();
+  }
+
+  return status;
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-NULL batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1673,6 +2321,9 @@ Status DBImpl::MakeRoomForWrite(bool force) {
 #endif
       bg_cv_.Wait();
       l0_hard_limits_++;
+    } else if (!mem_writers_.empty()) {
+      // Pipelined writes are still inserting into the current memtable
+      bg_cv_.Wait();
     } else if (!options_.no_memtable) {
       // Close the current log file and open a new one
       if (!options_.disable_write_ahead_log) {
@@ -1700,8 +2351,9 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // trigger compaction of old
       imm_ = mem_;
       has_imm_.Release_Store(imm_);
-      mem_ = new MemTable(internal_comparator_);
+      mem_ = new MemTable(internal_comparator_, options_);
       mem_->Ref();
+      InstallSuperVersion();
       force = false;  // Do not force another compaction if have room
       MaybeScheduleCompaction();
     } else {
@@ -1719,7 +2371,7 @@ Status DBImpl::BulkInsert(Iterator* iter) {
   MutexLock l(&mutex_);
   // Temporarily block any background compaction
   bg_compaction_paused_++;
-  while (bg_compaction_in_progress_ || bulk_insert_in_progress_) {
+  while (bg_compactions_in_progress_ != 0 || bulk_insert_in_progress_) {
     bg_cv_.Wait();
   }
 
@@ -1730,7 +2382,7 @@ Status DBImpl::BulkInsert(Iterator* iter) {
     if (max_seq > versions_->LastSequence()) {
       versions_->SetLastSequence(max_seq);
     }
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
   }
 
   if (!s.ok()) {
@@ -1813,6 +2465,15 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "coalesced-loads") {
+    char buf[200];
+    snprintf(buf, sizeof(buf), "Tables Blocks\n%-6llu %-6llu\n",
+             static_cast<unsigned long long>(
+                 table_cache_->NumCoalescedTableLoads()),
+             static_cast<unsigned long long>(
+                 table_cache_->NumCoalescedBlockLoads()));
+    value->append(buf);
+    return true;
   }
 
   return false;
@@ -2044,7 +2705,7 @@ Status DBImpl::InsertLevel0Tables(InsertionState* insert) {
       edit.AddFile(level, insert->files[i].number, insert->files[i].file_size,
                    off, insert->files[i].smallest, insert->files[i].largest);
     }
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
     if (s.ok()) {
       versions_->SetLastSequence(
           std::max(next, insert->options->suggested_max_seq));
@@ -2077,7 +2738,7 @@ Status DBImpl::AddL0Tables(const InsertOptions& options,
     MutexLock l(&mutex_);
     // Temporarily block any background compaction
     bg_compaction_paused_++;
-    while (bg_compaction_in_progress_ || bulk_insert_in_progress_) {
+    while (bg_compactions_in_progress_ != 0 || bulk_insert_in_progress_) {
       bg_cv_.Wait();
     }
 
@@ -2226,6 +2887,7 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
       s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
     }
     if (s.ok()) {
+      impl->InstallSuperVersion();
       impl->DeleteObsoleteFiles();
       impl->MaybeScheduleCompaction();
     }
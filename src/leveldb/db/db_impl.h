@@ -26,8 +26,10 @@
 #include "pdlfs-common/log_writer.h"
 #include "pdlfs-common/port.h"
 
+#include <atomic>
 #include <deque>
 #include <set>
+#include <vector>
 
 namespace pdlfs {
 // Sanitize db options. The caller should delete result.info_log if it is not
@@ -60,6 +62,8 @@ class DBImpl : public DB {
   virtual Status Get(const ReadOptions&, const Slice& key, std::string* value);
   virtual Status Get(const ReadOptions&, const Slice& key, Slice* value,
                      char* scratch, size_t scratch_size);
+  virtual void MultiGet(const ReadOptions&, size_t n, const Slice* keys,
+                        std::string* values, Status* statuses);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
@@ -100,6 +104,7 @@ class DBImpl : public DB {
  protected:
   friend class DB;
   struct CompactionState;
+  struct SubcompactionJob;
   struct InsertionState;
   struct Writer;
 
@@ -138,6 +143,11 @@ class DBImpl : public DB {
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
+  void AssignGroupSequences(Writer* last_writer, SequenceNumber first,
+                            std::vector<Writer*>* group);
+  Status ConcurrentInsertGroup(const std::vector<Writer*>& group,
+                               MemTable* mem);
+  Status PipelinedWrite(const WriteOptions& options, Writer* w);
 
   void RecordBackgroundError(const Status& s);
 
@@ -145,11 +155,38 @@ class DBImpl : public DB {
   void MaybeScheduleCompaction();
   static void BGWork(void* db);
   void BackgroundCall();
-  void BackgroundCompactionWrapper();
-  void BackgroundCompaction();
+  bool BackgroundCompactionWrapper();
+  bool BackgroundCompaction();
+  bool CanCompactMemTable() const {
+    return imm_ != NULL && !imm_compaction_in_progress_;
+  }
+  // Apply *edit to the current version. Serializes concurrent calls
+  // from background compactions and foreground bulk insertions.
+  Status LogAndApply(VersionEdit* edit);
   void CleanupCompaction(CompactionState* compact);
   Status DoCompactionWork(CompactionState* compact);
-
+  void SetupSubcompactions(CompactionState* compact, SubcompactionJob* job);
+  Status RunSubcompactions(CompactionState* compact, SubcompactionJob* job,
+                           int64_t* imm_micros, int64_t* paused_micros);
+  void ReleaseSubcompactions(SubcompactionJob* job);
+  static void BGSubcompactionWork(void* job);
+  // Account for a subcompaction helper working on a slice. Waits while
+  // background compactions are paused.
+  void BeginSubcompaction();
+  void EndSubcompaction();
+  // Compact the input keys whose user keys fall in [*begin, *end) into
+  // *compact. NULL bounds mean an unbounded range. Memtable compactions and
+  // compaction pauses are serviced iff imm_micros and paused_micros are not
+  // NULL; in that case the caller must be the thread that runs the
+  // background compaction job. Otherwise the caller must be a subcompaction
+  // helper, which only pauses between output files.
+  Status ProcessCompactionInput(CompactionState* compact, const Slice* begin,
+                                const Slice* end, int64_t* imm_micros,
+                                int64_t* paused_micros);
+  void YieldCompaction(int64_t* imm_micros, int64_t* paused_micros);
+
+  // Return the options for building tables at the given level.
+  Options TableOptionsForLevel(int level) const;
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
   Status InstallCompactionResults(CompactionState* compact);
@@ -174,6 +211,50 @@ class DBImpl : public DB {
   // Lock over the persistent DB state.  Non-NULL iff successfully acquired.
   FileLock* db_lock_;
 
+  // A consistent view of the memtables and the current version. Reads hold a
+  // ref to a super version instead of refs to each of its parts, which would
+  // require mutex_. A new super version is installed whenever mem_, imm_, or
+  // the current version changes. Its parts are unrefed under mutex_ once the
+  // last ref to it goes away.
+  struct SuperVersion {
+    MemTable* mem;
+    MemTable* imm;
+    Version* current;
+    uint64_t number;  // Larger for super versions installed later
+    std::atomic<int> refs;
+  };
+
+  // Super versions cached by reader threads. Each thread is assigned one of
+  // the slots. A slot either holds a referenced super version, is marked in
+  // use while the thread reads with the super version taken from it, or is
+  // empty. Installing a new super version empties all slots. Slots are
+  // padded to avoid false sharing between threads. Threads may share a slot,
+  // in which case one of them may put a super version back after a new one
+  // is installed. Super versions taken from a slot are therefore checked
+  // against the number of the installed one before use.
+  enum { kNumSuperVersionSlots = 64 };
+  struct SuperVersionSlot {
+    std::atomic<void*> sv;
+    char padding[64 - sizeof(std::atomic<void*>)];
+  };
+
+  // REQUIRES: mutex_ is held
+  void InstallSuperVersion();
+  void ScrapeSuperVersionSlots();
+  void UnrefSuperVersionLocked(SuperVersion* sv);
+  void FreeSuperVersion(SuperVersion* sv);
+  // Return the current super version for a read without taking mutex_ in
+  // the common case. The caller must pass the result along with *slot to
+  // ReleaseSuperVersion() once done.
+  SuperVersion* AcquireSuperVersion(SuperVersionSlot** slot);
+  void ReleaseSuperVersion(SuperVersion* sv, SuperVersionSlot* slot);
+  void UnrefSuperVersion(SuperVersion* sv);
+  static void CleanupSuperVersion(void* arg1, void* arg2);
+  Status GetFrom(SuperVersion* sv, const ReadOptions& options,
+                 const LookupKey& lkey, Buffer* value);
+
+  SuperVersionSlot sv_slots_[kNumSuperVersionSlots];
+
   // State below is protected by mutex_
   port::Mutex mutex_;
   port::AtomicPointer shutting_down_;
@@ -184,10 +265,16 @@ class DBImpl : public DB {
   WritableFile* logfile_;
   uint64_t logfile_number_;
   log::Writer* log_;
-  uint32_t seed_;  // For sampling.
+  std::atomic<uint32_t> seed_;  // For sampling. Not protected by mutex_.
+  SuperVersion* super_version_;
+  // Number of the installed super version. Read without mutex_.
+  std::atomic<uint64_t> super_version_number_;
 
   // Queue of writers.
   std::deque<Writer*> writers_;
+  // Leaders of logged write groups waiting to insert into mem_, in log
+  // order. Only used by pipelined writes.
+  std::deque<Writer*> mem_writers_;
   WriteBatch flush_memtable_;  // Dummy batch representing a compaction request
   WriteBatch sync_wal_;        // Dummy batch representing a WAL sync request
   // Temporary storage for grouping write batches
@@ -210,11 +297,18 @@ class DBImpl : public DB {
   // If not zero, will stop scheduling any new compactions and will pause the
   // progress of an ongoing compaction if there is one
   unsigned int bg_compaction_paused_;
-  // Has a background compaction been scheduled and not yet completed?
-  bool bg_compaction_scheduled_;
-  // Is there an active background compaction job? Background compaction work
+  // Number of background compaction jobs scheduled and not yet completed
+  int bg_compactions_scheduled_;
+  // Number of active background compaction jobs. Background compaction work
   // may be paused (inactive) in the middle
-  bool bg_compaction_in_progress_;
+  int bg_compactions_in_progress_;
+  // Number of table compactions (excluding memtable compactions) that have
+  // picked their inputs and not yet completed
+  int bg_table_compactions_;
+  // Is the immutable memtable being compacted?
+  bool imm_compaction_in_progress_;
+  // Is the MANIFEST being written by LogAndApply()?
+  bool manifest_write_in_progress_;
   // Is there an active foreground bulk insertion job?
   bool bulk_insert_in_progress_;
 
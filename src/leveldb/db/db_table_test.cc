@@ -198,6 +198,9 @@ class BlockConstructor : public Constructor {
     delete block_;
     block_ = NULL;
     BlockBuilder builder(options.block_restart_interval, comparator_);
+    if (options.data_block_hash_index) {
+      builder.EnableHashIndex();
+    }
 
     for (KVMap::const_iterator it = data.begin(); it != data.end(); ++it) {
       builder.Add(it->first, it->second);
@@ -322,7 +325,7 @@ class MemTableConstructor : public Constructor {
   ~MemTableConstructor() { memtable_->Unref(); }
   virtual Status FinishImpl(const Options& options, const KVMap& data) {
     memtable_->Unref();
-    memtable_ = new MemTable(internal_comparator_);
+    memtable_ = new MemTable(internal_comparator_, options);
     memtable_->Ref();
     int seq = 1;
     for (KVMap::const_iterator it = data.begin(); it != data.end(); ++it) {
@@ -385,7 +388,15 @@ class DBConstructor : public Constructor {
   DB* db_;
 };
 
-enum TestType { TABLE_TEST, BLOCK_TEST, MEMTABLE_TEST, DB_TEST };
+enum TestType {
+  TABLE_TEST,
+  BLOCK_TEST,
+  MEMTABLE_TEST,
+  PREFIX_HASH_MEMTABLE_TEST,
+  HASH_INDEX_TABLE_TEST,
+  HASH_INDEX_BLOCK_TEST,
+  DB_TEST
+};
 
 struct TestArgs {
   TestType type;
@@ -408,9 +419,16 @@ static const TestArgs kTestArgList[] = {
     {BLOCK_TEST, true, 1},
     {BLOCK_TEST, true, 1024},
 
+    // Blocks with a hash index must scan and seek like any other block
+    {HASH_INDEX_TABLE_TEST, false, 16},
+    {HASH_INDEX_TABLE_TEST, true, 1},
+    {HASH_INDEX_BLOCK_TEST, false, 16},
+    {HASH_INDEX_BLOCK_TEST, true, 1},
+
     // Restart interval does not matter for memtables
     {MEMTABLE_TEST, false, 16},
     {MEMTABLE_TEST, true, 16},
+    {PREFIX_HASH_MEMTABLE_TEST, false, 16},
 
     // Do not bother with restart interval variations for DB
     {DB_TEST, false, 16},
@@ -447,6 +465,22 @@ class Harness {
       case MEMTABLE_TEST:
         constructor_ = new MemTableConstructor(options_.comparator);
         break;
+      case PREFIX_HASH_MEMTABLE_TEST:
+        // Use a short prefix so random keys both share prefixes and are
+        // shorter than the prefix
+        options_.memtable_type = kPrefixHashMemTable;
+        options_.memtable_prefix_length = 2;
+        options_.memtable_hash_buckets = 16;
+        constructor_ = new MemTableConstructor(options_.comparator);
+        break;
+      case HASH_INDEX_TABLE_TEST:
+        options_.data_block_hash_index = true;
+        constructor_ = new TableConstructor(options_.comparator);
+        break;
+      case HASH_INDEX_BLOCK_TEST:
+        options_.data_block_hash_index = true;
+        constructor_ = new BlockConstructor(options_.comparator);
+        break;
       case DB_TEST:
         constructor_ = new DBConstructor(options_.comparator);
         break;
@@ -780,6 +814,58 @@ class TableTest {
   typedef DBOptions Options;
 };
 
+class BlockHashIndexTest {};
+
+TEST(BlockHashIndexTest, PointLookups) {
+  InternalKeyComparator icmp(BytewiseComparator());
+  BlockBuilder builder(4, &icmp);
+  builder.EnableHashIndex();
+  // Several versions of each user key, some spanning restart intervals
+  std::vector<std::string> keys;
+  for (int i = 0; i < 100; i++) {
+    char user_key[16];
+    snprintf(user_key, sizeof(user_key), "k%05d", 2 * i);
+    for (int seq = 1 + i % 5; seq > 0; seq--) {
+      std::string key;
+      AppendInternalKey(&key, ParsedInternalKey(user_key, 10 * seq, kTypeValue));
+      builder.Add(key, user_key);
+      keys.push_back(key);
+    }
+  }
+  std::string data = builder.Finish().ToString();
+  BlockContents contents;
+  contents.data = data;
+  contents.cachable = false;
+  contents.heap_allocated = false;
+  Block block(contents);
+
+  for (int i = 0; i < 200; i++) {
+    char user_key[16];
+    snprintf(user_key, sizeof(user_key), "k%05d", i);
+    for (int seq = 0; seq < 60; seq += 5) {
+      std::string target;
+      AppendInternalKey(&target,
+                        ParsedInternalKey(user_key, seq, kValueTypeForSeek));
+      Iterator* iter = block.NewIteratorForGet(&icmp, target);
+      Iterator* expected = block.NewIterator(&icmp);
+      expected->Seek(target);
+      if (expected->Valid() &&
+          ExtractUserKey(expected->key()) == Slice(user_key)) {
+        ASSERT_TRUE(iter->Valid());
+        ASSERT_EQ(iter->key().ToString(), expected->key().ToString());
+        ASSERT_EQ(iter->value().ToString(), user_key);
+      } else {
+        // Must not produce an entry of the target's user key
+        ASSERT_TRUE(!iter->Valid() ||
+                    ExtractUserKey(iter->key()) != Slice(user_key));
+      }
+      ASSERT_OK(iter->status());
+      delete expected;
+      delete iter;
+    }
+  }
+}
+
 TEST(TableTest, ApproximateOffsetOfPlain) {
   TableConstructor c(BytewiseComparator());
   c.Add("k01", "hello");
@@ -809,14 +895,23 @@ TEST(TableTest, ApproximateOffsetOfPlain) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 610000, 612000));
 }
 
-static bool SnappyCompressionSupported() {
+static bool CompressionSupported(CompressionType type) {
   std::string out;
   Slice in = "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa";
-  return port::Snappy_Compress(in.data(), in.size(), &out);
+  switch (type) {
+    case kSnappyCompression:
+      return port::Snappy_Compress(in.data(), in.size(), &out);
+    case kLZ4Compression:
+      return port::LZ4_Compress(in.data(), in.size(), &out);
+    case kZstdCompression:
+      return port::Zstd_Compress(3, in.data(), in.size(), &out);
+    default:
+      return true;
+  }
 }
 
-TEST(TableTest, ApproximateOffsetOfCompressed) {
-  if (!SnappyCompressionSupported()) {
+static void TestApproximateOffsetOfCompressed(CompressionType type) {
+  if (!CompressionSupported(type)) {
     fprintf(stderr, "skipping compression tests\n");
     return;
   }
@@ -830,9 +925,9 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   c.Add("k04", test::CompressibleString(&rnd, 0.25, 10000, &tmp));
   std::vector<std::string> keys;
   KVMap kvmap;
-  Options options;
+  DBOptions options;
   options.block_size = 1024;
-  options.compression = kSnappyCompression;
+  options.compression = type;
   c.Finish(options, &keys, &kvmap);
 
   // Expected upper and lower bounds of space used by compressible strings.
@@ -851,6 +946,18 @@ TEST(TableTest, ApproximateOffsetOfCompressed) {
   ASSERT_TRUE(Between(c.ApproximateOffsetOf("xyz"), 2 * min_z, 2 * max_z));
 }
 
+TEST(TableTest, ApproximateOffsetOfCompressed) {
+  TestApproximateOffsetOfCompressed(kSnappyCompression);
+}
+
+TEST(TableTest, ApproximateOffsetOfLZ4Compressed) {
+  TestApproximateOffsetOfCompressed(kLZ4Compression);
+}
+
+TEST(TableTest, ApproximateOffsetOfZstdCompressed) {
+  TestApproximateOffsetOfCompressed(kZstdCompression);
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -33,6 +33,9 @@
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
 
+#include <atomic>
+#include <stdlib.h>
+
 namespace pdlfs {
 
 static const int kVerbose = 1;
@@ -92,14 +95,22 @@ class SpecialEnv : public EnvWrapper {
   // Force write to manifest files to fail while this pointer is non-NULL
   port::AtomicPointer manifest_write_error_;
 
+  // Random reads are delayed while this pointer is non-NULL.
+  port::AtomicPointer delay_random_reads_;
+
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
+  // Calls to MultiRead() and the reads they carry. Each read is also
+  // counted by random_read_counter_.
+  AtomicCounter multi_read_counter_;
+  AtomicCounter multi_read_request_counter_;
 
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
     delay_data_sync_.Release_Store(NULL);
     data_sync_error_.Release_Store(NULL);
     no_space_.Release_Store(NULL);
     non_writable_.Release_Store(NULL);
+    delay_random_reads_.Release_Store(NULL);
     count_random_reads_ = false;
     manifest_sync_error_.Release_Store(NULL);
     manifest_write_error_.Release_Store(NULL);
@@ -179,22 +190,34 @@ class SpecialEnv : public EnvWrapper {
     class CountingFile : public RandomAccessFile {
      private:
       RandomAccessFile* target_;
-      AtomicCounter* counter_;
+      SpecialEnv* env_;
 
      public:
-      CountingFile(RandomAccessFile* target, AtomicCounter* counter)
-          : target_(target), counter_(counter) {}
+      CountingFile(RandomAccessFile* target, SpecialEnv* env)
+          : target_(target), env_(env) {}
       virtual ~CountingFile() { delete target_; }
       virtual Status Read(uint64_t offset, size_t n, Slice* result,
                           char* scratch) const {
-        counter_->Increment();
+        env_->random_read_counter_.Increment();
+        if (env_->delay_random_reads_.Acquire_Load() != NULL) {
+          SleepForMicroseconds(10000);
+        }
         return target_->Read(offset, n, result, scratch);
       }
+      virtual void MultiRead(ReadRequest* reqs, size_t n) const {
+        env_->random_read_counter_.IncrementBy(int(n));
+        env_->multi_read_counter_.Increment();
+        env_->multi_read_request_counter_.IncrementBy(int(n));
+        if (env_->delay_random_reads_.Acquire_Load() != NULL) {
+          SleepForMicroseconds(10000);
+        }
+        target_->MultiRead(reqs, n);
+      }
     };
 
     Status s = target()->NewRandomAccessFile(f, r);
     if (s.ok() && count_random_reads_) {
-      *r = new CountingFile(*r, &random_read_counter_);
+      *r = new CountingFile(*r, this);
     }
     return s;
   }
@@ -208,7 +231,19 @@ class DBTest {
   const FilterPolicy* filter_policy_;
 
   // Sequence of option configurations to try
-  enum OptionConfig { kDefault, kFilter, kUncompressed, kEnd };
+  enum OptionConfig {
+    kDefault,
+    kFilter,
+    kUncompressed,
+    kConcurrentMemTableWrite,
+    kPipelinedWrite,
+    kPrefixHash,
+    kWholeTableFilter,
+    kPartitionedIndex,
+    kDataBlockHashIndex,
+    kECTIndex,
+    kEnd
+  };
   int option_config_;
 
  public:
@@ -235,8 +270,15 @@ class DBTest {
 
   // Switch to a fresh database with the next option configuration to
   // test.  Return false if there are no more configurations to test.
-  bool ChangeOptions() {
+  // Switch to a fresh database with the next option configuration to test.
+  // If "exact_index" is true, skip configurations whose table indexes only
+  // locate keys to within a few data blocks. Return false if there are no
+  // more configurations to test.
+  bool ChangeOptions(bool exact_index = false) {
     option_config_++;
+    if (exact_index && option_config_ == kECTIndex) {
+      option_config_++;
+    }
     if (option_config_ >= kEnd) {
       return false;
     } else {
@@ -255,6 +297,32 @@ class DBTest {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kConcurrentMemTableWrite:
+        options.allow_concurrent_memtable_write = true;
+        break;
+      case kPipelinedWrite:
+        options.enable_pipelined_write = true;
+        break;
+      case kPrefixHash:
+        options.memtable_type = kPrefixHashMemTable;
+        options.memtable_prefix_length = 3;
+        options.allow_concurrent_memtable_write = true;
+        break;
+      case kWholeTableFilter:
+        options.filter_policy = filter_policy_;
+        options.whole_table_filter = true;
+        break;
+      case kPartitionedIndex:
+        options.filter_policy = filter_policy_;
+        options.index_partition_size = 1024;
+        break;
+      case kDataBlockHashIndex:
+        options.data_block_hash_index = true;
+        break;
+      case kECTIndex:
+        options.filter_policy = filter_policy_;
+        options.ect_index = true;
+        break;
       default:
         break;
     }
@@ -311,6 +379,24 @@ class DBTest {
     return result;
   }
 
+  std::vector<std::string> MultiGet(const std::vector<std::string>& keys,
+                                    const Snapshot* snapshot = NULL) {
+    ReadOptions options;
+    options.snapshot = snapshot;
+    std::vector<Slice> key_slices(keys.begin(), keys.end());
+    std::vector<std::string> results(keys.size());
+    std::vector<Status> s(keys.size());
+    db_->MultiGet(options, keys.size(), &key_slices[0], &results[0], &s[0]);
+    for (size_t i = 0; i < keys.size(); i++) {
+      if (s[i].IsNotFound()) {
+        results[i] = "NOT_FOUND";
+      } else if (!s[i].ok()) {
+        results[i] = s[i].ToString();
+      }
+    }
+    return results;
+  }
+
   int FetchSize(const std::string& k) {
     ReadOptions options;
     char buf[1];
@@ -1157,6 +1243,102 @@ TEST(DBTest, CompactionsGenerateMultipleFiles) {
   }
 }
 
+TEST(DBTest, Subcompactions) {
+  ThreadPool* const pool = ThreadPool::NewFixed(3);
+  Options options = CurrentOptions();
+  options.write_buffer_size = 100000000;  // Large write buffer
+  options.compaction_pool = pool;
+  options.max_subcompactions = 4;
+  Reopen(&options);
+
+  Random rnd(301);
+
+  // Write 8MB (80 values, each 100K) and push them to level-1
+  std::vector<std::string> values;
+  for (int i = 0; i < 80; i++) {
+    values.push_back(RandomString(&rnd, 100000));
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  ASSERT_GT(NumTableFilesAtLevel(1), 3);
+
+  // Overwrite and delete keys across the entire key range so that the next
+  // compaction is split into multiple slices
+  for (int i = 0; i < 80; i += 3) {
+    values[i] = RandomString(&rnd, 100000);
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  for (int i = 1; i < 80; i += 7) {
+    ASSERT_OK(Delete(Key(i)));
+    values[i] = "NOT_FOUND";
+  }
+  Reopen(&options);
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(NumTableFilesAtLevel(0), 0);
+  for (int i = 0; i < 80; i++) {
+    ASSERT_EQ(Get(Key(i)), values[i]);
+  }
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int n = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    while (values[n] == "NOT_FOUND") n++;
+    ASSERT_EQ(iter->key().ToString(), Key(n));
+    n++;
+  }
+  ASSERT_EQ(n, 80);
+  delete iter;
+
+  Close();
+  delete pool;
+}
+
+TEST(DBTest, ConcurrentCompactions) {
+  ThreadPool* const pool = ThreadPool::NewFixed(4);
+  Options options = CurrentOptions();
+  options.write_buffer_size = 64 << 10;
+  options.table_file_size = 32 << 10;
+  options.l1_compaction_trigger = 2;
+  options.compaction_pool = pool;
+  options.max_background_compactions = 4;
+  options.max_subcompactions = 2;
+  Reopen(&options);
+
+  Random rnd(301);
+  std::map<std::string, std::string> model;
+  for (int i = 0; i < 20000; i++) {
+    const std::string k = Key(rnd.Uniform(5000));
+    if (rnd.OneIn(10)) {
+      ASSERT_OK(Delete(k));
+      model.erase(k);
+    } else {
+      const std::string v = RandomString(&rnd, 100);
+      ASSERT_OK(Put(k, v));
+      model[k] = v;
+    }
+  }
+
+  for (int iter = 0; iter < 2; iter++) {
+    Iterator* it = db_->NewIterator(ReadOptions());
+    std::map<std::string, std::string>::iterator m = model.begin();
+    for (it->SeekToFirst(); it->Valid(); it->Next(), ++m) {
+      ASSERT_TRUE(m != model.end());
+      ASSERT_EQ(it->key().ToString(), m->first);
+      ASSERT_EQ(it->value().ToString(), m->second);
+    }
+    ASSERT_TRUE(m == model.end());
+    ASSERT_OK(it->status());
+    delete it;
+    // Verify again after compactions have settled down
+    Reopen(&options);
+    dbfull()->CompactRange(NULL, NULL);
+  }
+
+  Close();
+  delete pool;
+}
+
 TEST(DBTest, RepeatedWritesToSameKey) {
   Options options = CurrentOptions();
   options.env = env_;
@@ -1218,6 +1400,37 @@ TEST(DBTest, SparseMerge) {
   ASSERT_LE(dbfull()->TEST_MaxNextLevelOverlappingBytes(), 20 * 1048576);
 }
 
+TEST(DBTest, CompressionPerLevel) {
+  Options options = CurrentOptions();
+  options.compression_per_level.push_back(kNoCompression);
+  options.compression_per_level.push_back(kLZ4Compression);
+  options.compression_per_level.push_back(kZstdCompression);
+  options.zstd_dict_size = 1024;
+  options.zstd_dict_training_size = 64 << 10;
+  options.max_mem_compact_level = 0;
+  Reopen(&options);
+
+  Random rnd(301);
+  std::vector<std::string> values;
+  for (int i = 0; i < 2000; i++) {
+    std::string value;
+    test::CompressibleString(&rnd, 0.5, 200, &value);
+    values.push_back(value);
+    ASSERT_OK(Put(Key(i), value));
+  }
+  // Push the data through levels 0, 1, and 2
+  dbfull()->TEST_CompactMemTable();
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_GT(NumTableFilesAtLevel(1), 0);
+  dbfull()->TEST_CompactRange(1, NULL, NULL);
+  ASSERT_GT(NumTableFilesAtLevel(2), 0);
+
+  Reopen(&options);
+  for (int i = 0; i < 2000; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+}
+
 static bool Between(uint64_t val, uint64_t low, uint64_t high) {
   bool result = (val >= low) && (val <= high);
   if (!result) {
@@ -1276,7 +1489,7 @@ TEST(DBTest, ApproximateSizes) {
       ASSERT_EQ(NumTableFilesAtLevel(0), 0);
       ASSERT_GT(NumTableFilesAtLevel(1), 0);
     }
-  } while (ChangeOptions());
+  } while (ChangeOptions(true));
 }
 
 TEST(DBTest, ApproximateSizes_MixOfSmallAndLarge) {
@@ -1314,6 +1527,49 @@ TEST(DBTest, ApproximateSizes_MixOfSmallAndLarge) {
 
       dbfull()->TEST_CompactRange(0, NULL, NULL);
     }
+  } while (ChangeOptions(true));
+}
+
+TEST(DBTest, MultiGet) {
+  do {
+    // Spread versions of the keys over multiple tables and the memtable
+    for (int i = 0; i < 100; i++) {
+      ASSERT_OK(Put(Key(i), "v1." + Key(i)));
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 100; i += 2) {
+      ASSERT_OK(Put(Key(i), "v2." + Key(i)));
+    }
+    dbfull()->TEST_CompactMemTable();
+    for (int i = 0; i < 100; i += 3) {
+      ASSERT_OK(Put(Key(i), "v3." + Key(i)));
+    }
+    ASSERT_OK(Delete(Key(5)));
+    ASSERT_OK(Delete(Key(6)));
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(Put(Key(7), "v4"));
+
+    // Keys come in reverse order, with a duplicate and a missing key
+    std::vector<std::string> keys;
+    for (int i = 99; i >= 0; i--) {
+      keys.push_back(Key(i));
+    }
+    keys.push_back(Key(3));
+    keys.push_back("missing");
+    std::vector<std::string> results = MultiGet(keys);
+    ASSERT_EQ(keys.size(), results.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(Get(keys[i]), results[i]);
+    }
+    ASSERT_EQ("v4", results[99 - 7]);
+    ASSERT_EQ("NOT_FOUND", results[99 - 6]);
+    ASSERT_EQ("NOT_FOUND", results.back());
+    results = MultiGet(keys, snapshot);
+    for (size_t i = 0; i < keys.size(); i++) {
+      ASSERT_EQ(Get(keys[i], snapshot), results[i]);
+    }
+    ASSERT_EQ("v1." + Key(7), results[99 - 7]);
+    db_->ReleaseSnapshot(snapshot);
   } while (ChangeOptions());
 }
 
@@ -1372,6 +1628,9 @@ TEST(DBTest, HiddenValuesAreRemoved) {
   do {
     Random rnd(301);
     FillLevels("a", "z");
+    // A level-0 compaction started while the snapshot below is held would
+    // keep the hidden value
+    ASSERT_OK(db_->DrainCompactions());
 
     std::string big = RandomString(&rnd, 50000);
     Put("foo", big);
@@ -1856,53 +2115,203 @@ TEST(DBTest, FilesDeletedAfterCompaction) {
   ASSERT_EQ(CountFiles(), num_files);
 }
 
+namespace {
+struct CoalesceState {
+  DB* db;
+  port::Mutex mu;
+  int done;
+};
+
+static void CoalesceReader(void* arg) {
+  CoalesceState* state = reinterpret_cast<CoalesceState*>(arg);
+  std::string value;
+  ASSERT_OK(state->db->Get(ReadOptions(), "foo", &value));
+  ASSERT_EQ(value, "v1");
+  MutexLock ml(&state->mu);
+  state->done++;
+}
+}  // namespace
+
+TEST(DBTest, CoalescedLoads) {
+  // Read tables through pread() so blocks may be cached
+  SpecialEnv env(Env::GetUnBufferedIoEnv());
+  env.count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = &env;
+  Reopen(&options);
+  ASSERT_OK(Put("foo", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  Reopen(&options);  // Start with empty table and block caches
+
+  // Reads needed by a single reader to open the table and read its block
+  env.random_read_counter_.Reset();
+  ASSERT_EQ("v1", Get("foo"));
+  const int reads = env.random_read_counter_.Read();
+  Reopen(&options);
+
+  env.random_read_counter_.Reset();
+  env.delay_random_reads_.Release_Store(&env);
+  CoalesceState state;
+  state.db = db_;
+  state.done = 0;
+  const int kThreads = 4;
+  for (int i = 0; i < kThreads; i++) {
+    env.StartThread(CoalesceReader, &state);
+  }
+  while (true) {
+    state.mu.Lock();
+    const int done = state.done;
+    state.mu.Unlock();
+    if (done == kThreads) break;
+    SleepForMicroseconds(10000);
+  }
+  env.delay_random_reads_.Release_Store(NULL);
+  // Concurrent readers load the table and its block only once
+  ASSERT_EQ(reads, env.random_read_counter_.Read());
+
+  std::string prop;
+  ASSERT_TRUE(db_->GetProperty("leveldb.coalesced-loads", &prop));
+  unsigned long long tables, blocks;
+  ASSERT_EQ(2, sscanf(prop.c_str(), "Tables Blocks\n%llu %llu", &tables,
+                      &blocks));
+  // The other readers all wait for the table open of the first reader.
+  // Each of them is counted once no matter how many times it is woken up.
+  ASSERT_EQ(tables, kThreads - 1);
+  Close();
+}
+
 TEST(DBTest, BloomFilter) {
+  env_->count_random_reads_ = true;
+  for (int whole_table = 0; whole_table < 2; whole_table++) {
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.block_cache = NewLRUCache(0);  // Prevent cache hits
+    options.filter_policy = NewBloomFilterPolicy(10);
+    options.whole_table_filter = (whole_table != 0);
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+
+    // Populate multiple layers
+    const int N = 10000;
+    for (int i = 0; i < N; i++) {
+      ASSERT_OK(Put(Key(i), Key(i)));
+    }
+    Compact("a", "z");
+    for (int i = 0; i < N; i += 100) {
+      ASSERT_OK(Put(Key(i), Key(i)));
+    }
+    dbfull()->TEST_CompactMemTable();
+
+    // Prevent auto compactions triggered by seeks
+    env_->delay_data_sync_.Release_Store(env_);
+
+    // Lookup present keys.  Should rarely read from small sstable.
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < N; i++) {
+      ASSERT_EQ(Key(i), Get(Key(i)));
+    }
+    int reads = env_->random_read_counter_.Read();
+    fprintf(stderr, "%d present => %d reads\n", N, reads);
+    ASSERT_GE(reads, N);
+    ASSERT_LE(reads, N + 2 * N / 100);
+
+    // Lookup present keys.  Should rarely read from either sstable.
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < N; i++) {
+      ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+    }
+    reads = env_->random_read_counter_.Read();
+    fprintf(stderr, "%d missing => %d reads\n", N, reads);
+    ASSERT_LE(reads, 3 * N / 100);
+
+    env_->delay_data_sync_.Release_Store(NULL);
+    Close();
+    delete options.block_cache;
+    delete options.filter_policy;
+  }
+}
+
+TEST(DBTest, MultiGetReadsBlocksOnce) {
   env_->count_random_reads_ = true;
   Options options = CurrentOptions();
   options.env = env_;
   options.block_cache = NewLRUCache(0);  // Prevent cache hits
   options.filter_policy = NewBloomFilterPolicy(10);
-  Reopen(&options);
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
 
-  // Populate multiple layers
-  const int N = 10000;
+  const int N = 1000;
+  std::vector<std::string> keys;
   for (int i = 0; i < N; i++) {
     ASSERT_OK(Put(Key(i), Key(i)));
+    keys.push_back(Key(i));
   }
   Compact("a", "z");
-  for (int i = 0; i < N; i += 100) {
-    ASSERT_OK(Put(Key(i), Key(i)));
-  }
-  dbfull()->TEST_CompactMemTable();
-
-  // Prevent auto compactions triggered by seeks
-  env_->delay_data_sync_.Release_Store(env_);
 
-  // Lookup present keys.  Should rarely read from small sstable.
+  // Each data block holds many keys but is read only once
   env_->random_read_counter_.Reset();
-  for (int i = 0; i < N; i++) {
-    ASSERT_EQ(Key(i), Get(Key(i)));
-  }
+  std::vector<std::string> results = MultiGet(keys);
   int reads = env_->random_read_counter_.Read();
   fprintf(stderr, "%d present => %d reads\n", N, reads);
-  ASSERT_GE(reads, N);
-  ASSERT_LE(reads, N + 2 * N / 100);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i), results[i]);
+  }
+  ASSERT_LE(reads, N / 20);
 
-  // Lookup present keys.  Should rarely read from either sstable.
-  env_->random_read_counter_.Reset();
+  // Missing keys are filtered out before reading any blocks
   for (int i = 0; i < N; i++) {
-    ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+    keys[i] += ".missing";
   }
+  env_->random_read_counter_.Reset();
+  results = MultiGet(keys);
   reads = env_->random_read_counter_.Read();
   fprintf(stderr, "%d missing => %d reads\n", N, reads);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ("NOT_FOUND", results[i]);
+  }
   ASSERT_LE(reads, 3 * N / 100);
 
-  env_->delay_data_sync_.Release_Store(NULL);
   Close();
   delete options.block_cache;
   delete options.filter_policy;
 }
 
+TEST(DBTest, MultiGetBatchesBlockReads) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+
+  const int N = 1000;
+  std::vector<std::string> keys;
+  for (int i = 0; i < N; i++) {
+    ASSERT_OK(Put(Key(i), Key(i)));
+    keys.push_back(Key(i));
+  }
+  Compact("a", "z");
+
+  // The data blocks of a table are read together so that the file may
+  // have them all in flight at once
+  env_->random_read_counter_.Reset();
+  env_->multi_read_counter_.Reset();
+  env_->multi_read_request_counter_.Reset();
+  std::vector<std::string> results = MultiGet(keys);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(Key(i), results[i]);
+  }
+  const int reads = env_->random_read_counter_.Read();
+  const int multi_reads = env_->multi_read_counter_.Read();
+  const int batched = env_->multi_read_request_counter_.Read();
+  ASSERT_GT(multi_reads, 0);
+  ASSERT_GE(batched, 2 * multi_reads);
+  ASSERT_GE(2 * batched, reads);  // Most reads are batched
+
+  Close();
+  delete options.block_cache;
+}
+
 // Multi-threaded test:
 namespace {
 
@@ -2002,6 +2411,164 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+namespace {
+
+struct ReaderState {
+  DB* db;
+  port::AtomicPointer stop;
+  port::AtomicPointer done[kNumThreads];
+  port::AtomicPointer reads[kNumThreads];
+};
+
+struct ReaderThread {
+  ReaderState* state;
+  int id;
+};
+
+// Keys [0, kNumKeys) are never deleted, so they must always be found no
+// matter how the memtables and versions change underneath.
+static void ReaderThreadBody(void* arg) {
+  ReaderThread* t = reinterpret_cast<ReaderThread*>(arg);
+  DB* db = t->state->db;
+  Random rnd(301 + t->id);
+  uintptr_t reads = 0;
+  std::string value;
+  char keybuf[20];
+  while (t->state->stop.Acquire_Load() == NULL) {
+    snprintf(keybuf, sizeof(keybuf), "%016d", int(rnd.Uniform(kNumKeys)));
+    if (rnd.OneIn(8)) {
+      Iterator* iter = db->NewIterator(ReadOptions());
+      iter->Seek(keybuf);
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(keybuf, iter->key().ToString());
+      delete iter;
+    } else {
+      ASSERT_OK(db->Get(ReadOptions(), keybuf, &value));
+    }
+    t->state->reads[t->id].Release_Store(reinterpret_cast<void*>(++reads));
+  }
+  t->state->done[t->id].Release_Store(t);
+}
+
+}  // namespace
+
+TEST(DBTest, ReadsDuringMemTableSwitchesAndCompactions) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 64 << 10;
+  Reopen(&options);
+  char keybuf[20];
+  for (int i = 0; i < kNumKeys; i++) {
+    snprintf(keybuf, sizeof(keybuf), "%016d", i);
+    ASSERT_OK(Put(keybuf, "v0"));
+  }
+
+  ReaderState state;
+  state.db = db_;
+  state.stop.Release_Store(NULL);
+  ReaderThread threads[kNumThreads];
+  for (int id = 0; id < kNumThreads; id++) {
+    state.done[id].Release_Store(NULL);
+    state.reads[id].Release_Store(NULL);
+    threads[id].state = &state;
+    threads[id].id = id;
+    env_->StartThread(ReaderThreadBody, &threads[id]);
+  }
+
+  // Overwrite keys with large values to keep switching memtables, and add
+  // extra keys to keep compactions busy
+  Random rnd(301);
+  for (int i = 0; i < 20; i++) {
+    for (int j = 0; j < 100; j++) {
+      snprintf(keybuf, sizeof(keybuf), "%016d", int(rnd.Uniform(kNumKeys)));
+      ASSERT_OK(Put(keybuf, RandomString(&rnd, 1000)));
+    }
+    ASSERT_OK(Put("z" + Key(i), RandomString(&rnd, 1000)));
+    if (i % 5 == 4) {
+      dbfull()->TEST_CompactRange(0, NULL, NULL);
+    }
+  }
+  for (int id = 0; id < kNumThreads; id++) {
+    while (state.reads[id].Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  state.stop.Release_Store(&state);
+  for (int id = 0; id < kNumThreads; id++) {
+    while (state.done[id].Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+
+  // Reads after all the changes must see the latest state
+  ASSERT_OK(Put("foo", "v1"));
+  ASSERT_EQ("v1", Get("foo"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("v1", Get("foo"));
+  ASSERT_OK(Put("foo", "v2"));
+  ASSERT_EQ("v2", Get("foo"));
+}
+
+namespace {
+
+// More readers than super version slots, so that readers share slots
+static const int kNumFreshReaders = 96;
+
+struct FreshReaderState {
+  DB* db;
+  port::AtomicPointer stop;
+  std::atomic<int> written;  // Last value of "foo" known to be written
+  std::atomic<int> stale_reads;
+  std::atomic<int> done;
+};
+
+// A read must see at least the value written before the read started
+static void FreshReaderBody(void* arg) {
+  FreshReaderState* state = reinterpret_cast<FreshReaderState*>(arg);
+  std::string value;
+  while (state->stop.Acquire_Load() == NULL) {
+    const int written = state->written.load();
+    ASSERT_OK(state->db->Get(ReadOptions(), "foo", &value));
+    if (atoi(value.c_str()) < written) {
+      state->stale_reads.fetch_add(1);
+    }
+  }
+  state->done.fetch_add(1);
+}
+
+}  // namespace
+
+TEST(DBTest, FreshReadsWithSharedSuperVersionSlots) {
+  Options options = CurrentOptions();
+  options.write_buffer_size = 16 << 10;  // Switch memtables often
+  Reopen(&options);
+  ASSERT_OK(Put("foo", "0"));
+
+  FreshReaderState state;
+  state.db = db_;
+  state.stop.Release_Store(NULL);
+  state.written.store(0);
+  state.stale_reads.store(0);
+  state.done.store(0);
+  for (int i = 0; i < kNumFreshReaders; i++) {
+    env_->StartThread(FreshReaderBody, &state);
+  }
+
+  // Each value is padded so that every few writes install a new memtable
+  char valbuf[1100];
+  for (int i = 1; i <= 500; i++) {
+    snprintf(valbuf, sizeof(valbuf), "%-1000d", i);
+    ASSERT_OK(Put("foo", valbuf));
+    state.written.store(i);
+  }
+
+  state.stop.Release_Store(&state);
+  while (state.done.load() != kNumFreshReaders) {
+    DelayMilliseconds(10);
+  }
+  ASSERT_EQ(state.stale_reads.load(), 0);
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
@@ -18,6 +18,7 @@
 
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/leveldb/options.h"
 
 #include <algorithm>
 
@@ -31,20 +32,28 @@ static Slice GetLengthPrefixedSlice(const char* data) {
 }
 
 MemTable::MemTable(const InternalKeyComparator& cmp)
-    : comparator_(cmp), refs_(0), table_(comparator_, &arena_) {}
-
-MemTable::~MemTable() { assert(refs_ == 0); }
+    : comparator_(cmp), refs_(0) {
+  rep_ = NewSkipListRep(comparator_, &arena_);
+}
 
-size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
+MemTable::MemTable(const InternalKeyComparator& cmp, const DBOptions& options)
+    : comparator_(cmp), refs_(0) {
+  if (options.memtable_type == kPrefixHashMemTable) {
+    rep_ = NewPrefixHashRep(comparator_, &arena_,
+                            options.memtable_prefix_length,
+                            options.memtable_hash_buckets);
+  } else {
+    rep_ = NewSkipListRep(comparator_, &arena_);
+  }
+}
 
-int MemTable::KeyComparator::operator()(const char* aptr,
-                                        const char* bptr) const {
-  // Internal keys are encoded as length-prefixed strings.
-  Slice a = GetLengthPrefixedSlice(aptr);
-  Slice b = GetLengthPrefixedSlice(bptr);
-  return comparator.Compare(a, b);
+MemTable::~MemTable() {
+  assert(refs_ == 0);
+  delete rep_;
 }
 
+size_t MemTable::ApproximateMemoryUsage() { return arena_.MemoryUsage(); }
+
 // Encode a suitable internal key target for "target" and return it.
 // Uses *scratch as scratch space, and the returned pointer will point
 // into this scratch space.
@@ -57,24 +66,25 @@ static const char* EncodeKey(std::string* scratch, const Slice& target) {
 
 class MemTableIterator : public Iterator {
  public:
-  explicit MemTableIterator(MemTable::Table* table) : iter_(table) {}
-
-  virtual bool Valid() const { return iter_.Valid(); }
-  virtual void Seek(const Slice& k) { iter_.Seek(EncodeKey(&tmp_, k)); }
-  virtual void SeekToFirst() { iter_.SeekToFirst(); }
-  virtual void SeekToLast() { iter_.SeekToLast(); }
-  virtual void Next() { iter_.Next(); }
-  virtual void Prev() { iter_.Prev(); }
-  virtual Slice key() const { return GetLengthPrefixedSlice(iter_.key()); }
+  explicit MemTableIterator(MemTableRep::Iterator* iter) : iter_(iter) {}
+  virtual ~MemTableIterator() { delete iter_; }
+
+  virtual bool Valid() const { return iter_->Valid(); }
+  virtual void Seek(const Slice& k) { iter_->Seek(EncodeKey(&tmp_, k)); }
+  virtual void SeekToFirst() { iter_->SeekToFirst(); }
+  virtual void SeekToLast() { iter_->SeekToLast(); }
+  virtual void Next() { iter_->Next(); }
+  virtual void Prev() { iter_->Prev(); }
+  virtual Slice key() const { return GetLengthPrefixedSlice(iter_->key()); }
   virtual Slice value() const {
-    Slice key_slice = GetLengthPrefixedSlice(iter_.key());
+    Slice key_slice = GetLengthPrefixedSlice(iter_->key());
     return GetLengthPrefixedSlice(key_slice.data() + key_slice.size());
   }
 
   virtual Status status() const { return Status::OK(); }
 
  private:
-  MemTable::Table::Iterator iter_;
+  MemTableRep::Iterator* const iter_;
   std::string tmp_;  // For passing to EncodeKey
 
   // No copying allowed
@@ -82,38 +92,59 @@ class MemTableIterator : public Iterator {
   void operator=(const MemTableIterator&);
 };
 
-Iterator* MemTable::NewIterator() { return new MemTableIterator(&table_); }
+Iterator* MemTable::NewIterator() {
+  return new MemTableIterator(rep_->NewIterator());
+}
 
-void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
-                   const Slice& value) {
-  // Format of an entry is concatenation of:
-  //  key_size     : varint32 of internal_key.size()
-  //  key bytes    : char[internal_key.size()]
-  //  value_size   : varint32 of value.size()
-  //  value bytes  : char[value.size()]
+// Format of an entry is concatenation of:
+//  key_size     : varint32 of internal_key.size()
+//  key bytes    : char[internal_key.size()]
+//  value_size   : varint32 of value.size()
+//  value bytes  : char[value.size()]
+size_t MemTable::EntryLength(const Slice& key, const Slice& value) {
+  const size_t internal_key_size = key.size() + 8;
+  return VarintLength(internal_key_size) + internal_key_size +
+         VarintLength(value.size()) + value.size();
+}
+
+char* MemTable::EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                            const Slice& key, const Slice& value) {
   size_t key_size = key.size();
   size_t val_size = value.size();
-  size_t internal_key_size = key_size + 8;
-  const size_t encoded_len = VarintLength(internal_key_size) +
-                             internal_key_size + VarintLength(val_size) +
-                             val_size;
-  char* buf = arena_.Allocate(encoded_len);
-  char* p = EncodeVarint32(buf, internal_key_size);
+  char* p = EncodeVarint32(buf, key_size + 8);
   memcpy(p, key.data(), key_size);
   p += key_size;
   EncodeFixed64(p, (s << 8) | type);
   p += 8;
   p = EncodeVarint32(p, val_size);
   memcpy(p, value.data(), val_size);
-  assert((p + val_size) - buf == encoded_len);
-  table_.Insert(buf);
+  return p + val_size;
+}
+
+void MemTable::Add(SequenceNumber s, ValueType type, const Slice& key,
+                   const Slice& value) {
+  const size_t encoded_len = EntryLength(key, value);
+  char* buf = arena_.Allocate(encoded_len);
+  char* end = EncodeEntry(buf, s, type, key, value);
+  assert(end - buf == encoded_len);
+  (void)end;
+  rep_->Insert(buf);
+}
+
+void MemTable::ConcurrentAdd(SequenceNumber s, ValueType type,
+                             const Slice& key, const Slice& value) {
+  const size_t encoded_len = EntryLength(key, value);
+  char* buf = arena_.AllocateConcurrently(encoded_len);
+  char* end = EncodeEntry(buf, s, type, key, value);
+  assert(end - buf == encoded_len);
+  (void)end;
+  rep_->InsertConcurrently(buf);
 }
 
 bool MemTable::Get(const LookupKey& key, Buffer* buf, size_t limit, Status* s) {
   Slice memkey = key.memtable_key();
-  Table::Iterator iter(&table_);
-  iter.Seek(memkey.data());
-  if (iter.Valid()) {
+  const char* const entry = rep_->Lookup(memkey.data());
+  if (entry != NULL) {
     // entry format is:
     //    klength  varint32
     //    userkey  char[klength]
@@ -121,9 +152,8 @@ bool MemTable::Get(const LookupKey& key, Buffer* buf, size_t limit, Status* s) {
     //    vlength  varint32
     //    value    char[vlength]
     // Check that it belongs to same user key.  We do not check the
-    // sequence number since the Seek() call above should have skipped
+    // sequence number since the Lookup() call above should have skipped
     // all entries with overly large sequence numbers.
-    const char* entry = iter.key();
     uint32_t key_length;
     const char* key_ptr = GetVarint32Ptr(entry, entry + 5, &key_length);
 
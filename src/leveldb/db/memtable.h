@@ -16,7 +16,7 @@
  */
 #pragma once
 
-#include "../skiplist.h"
+#include "memtable_rep.h"
 
 #include "pdlfs-common/arena.h"
 #include "pdlfs-common/leveldb/internal_types.h"
@@ -28,12 +28,15 @@ namespace pdlfs {
 
 class InternalKeyComparator;
 class MemTableIterator;
+struct DBOptions;
 
 class MemTable {
  public:
   // MemTables are reference counted.  The initial reference count
   // is zero and the caller must call Ref() at least once.
   explicit MemTable(const InternalKeyComparator& comparator);
+  // Use the memtable representation selected by "options".
+  MemTable(const InternalKeyComparator& comparator, const DBOptions& options);
 
   // Increase reference count.
   void Ref() { ++refs_; }
@@ -68,6 +71,11 @@ class MemTable {
   void Add(SequenceNumber seq, ValueType type, const Slice& key,
            const Slice& value);
 
+  // Same as Add(), but may be called by multiple threads at the same time.
+  // REQUIRES: all concurrent writers use ConcurrentAdd()
+  void ConcurrentAdd(SequenceNumber seq, ValueType type, const Slice& key,
+                     const Slice& value);
+
   // If memtable contains a value for key, store a prefix of it in *value
   // and return true. If memtable contains a deletion for key,
   // store a NotFound() error in *status and return true.
@@ -77,19 +85,17 @@ class MemTable {
  private:
   ~MemTable();  // Private since only Unref() should be used to delete it
 
-  struct KeyComparator {
-    const InternalKeyComparator comparator;
-    explicit KeyComparator(const InternalKeyComparator& c) : comparator(c) {}
-    int operator()(const char* a, const char* b) const;
-  };
   friend class MemTableIterator;
 
-  typedef SkipList<const char*, KeyComparator> Table;
+  // Encode an entry into buf and return the end of the entry.
+  static char* EncodeEntry(char* buf, SequenceNumber s, ValueType type,
+                           const Slice& key, const Slice& value);
+  static size_t EntryLength(const Slice& key, const Slice& value);
 
-  KeyComparator comparator_;
+  MemTableRep::KeyComparator comparator_;
   int refs_;
   Arena arena_;
-  Table table_;
+  MemTableRep* rep_;
 
   // No copying allowed
   MemTable(const MemTable&);
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "memtable_rep.h"
+
+#include "../skiplist.h"
+
+#include "pdlfs-common/arena.h"
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/hash.h"
+
+#include <atomic>
+#include <new>
+#include <string.h>
+
+namespace pdlfs {
+
+static Slice GetLengthPrefixedSlice(const char* data) {
+  uint32_t len;
+  const char* p = data;
+  p = GetVarint32Ptr(p, p + 5, &len);  // +5: we assume "p" is not corrupted
+  return Slice(p, len);
+}
+
+int MemTableRep::KeyComparator::operator()(const char* aptr,
+                                           const char* bptr) const {
+  // Internal keys are encoded as length-prefixed strings.
+  Slice a = GetLengthPrefixedSlice(aptr);
+  Slice b = GetLengthPrefixedSlice(bptr);
+  return comparator.Compare(a, b);
+}
+
+MemTableRep::~MemTableRep() {}
+
+MemTableRep::Iterator::~Iterator() {}
+
+namespace {
+
+typedef SkipList<const char*, MemTableRep::KeyComparator> Table;
+
+class SkipListRep : public MemTableRep {
+ public:
+  SkipListRep(const KeyComparator& cmp, Arena* arena) : table_(cmp, arena) {}
+  virtual ~SkipListRep() {}
+
+  virtual void Insert(const char* entry) { table_.Insert(entry); }
+
+  virtual void InsertConcurrently(const char* entry) {
+    table_.InsertConcurrently(entry);
+  }
+
+  virtual const char* Lookup(const char* target) const {
+    Table::Iterator iter(&table_);
+    iter.Seek(target);
+    return iter.Valid() ? iter.key() : NULL;
+  }
+
+  class Iter : public MemTableRep::Iterator {
+   public:
+    explicit Iter(const Table* table) : iter_(table) {}
+    virtual ~Iter() {}
+
+    virtual bool Valid() const { return iter_.Valid(); }
+    virtual const char* key() const { return iter_.key(); }
+    virtual void Next() { iter_.Next(); }
+    virtual void Prev() { iter_.Prev(); }
+    virtual void Seek(const char* target) { iter_.Seek(target); }
+    virtual void SeekToFirst() { iter_.SeekToFirst(); }
+    virtual void SeekToLast() { iter_.SeekToLast(); }
+
+   private:
+    Table::Iterator iter_;
+  };
+
+  virtual MemTableRep::Iterator* NewIterator() const {
+    return new Iter(&table_);
+  }
+
+ private:
+  Table table_;
+};
+
+// All entries sharing a key prefix. Allocated from the arena and never freed.
+struct Bucket {
+  Slice prefix;
+  Table* table;
+  std::atomic<Bucket*> next;  // Next bucket in the same hash chain
+};
+
+struct BucketComparator {
+  int operator()(const Bucket* a, const Bucket* b) const {
+    return a->prefix.compare(b->prefix);
+  }
+};
+
+typedef SkipList<const Bucket*, BucketComparator> BucketIndex;
+
+// With a bytewise user key order, all user keys sharing a prefix form a
+// contiguous key range, and the ranges are ordered the same way as their
+// prefixes. This is true even for user keys shorter than the prefix length,
+// which use the entire user key as their prefix. Iterating through buckets in
+// prefix order and through each bucket in key order therefore visits all
+// entries in key order.
+class PrefixHashRep : public MemTableRep {
+ public:
+  PrefixHashRep(const KeyComparator& cmp, Arena* arena, size_t prefix_length,
+                size_t num_buckets)
+      : cmp_(cmp),
+        arena_(arena),
+        prefix_length_(prefix_length),
+        num_buckets_(num_buckets),
+        index_(BucketComparator(), arena) {
+    assert(num_buckets_ > 0);
+    // The bucket array is not allocated from the arena so that it is not
+    // counted against the write buffer size.
+    buckets_ = new std::atomic<Bucket*>[num_buckets_];
+    for (size_t i = 0; i < num_buckets_; i++) {
+      buckets_[i].store(NULL, std::memory_order_relaxed);
+    }
+  }
+
+  virtual ~PrefixHashRep() { delete[] buckets_; }
+
+  virtual void Insert(const char* entry) {
+    GetOrCreateBucket(EntryPrefix(entry), false)->table->Insert(entry);
+  }
+
+  virtual void InsertConcurrently(const char* entry) {
+    GetOrCreateBucket(EntryPrefix(entry), true)
+        ->table->InsertConcurrently(entry);
+  }
+
+  virtual const char* Lookup(const char* target) const {
+    // Entries of the same user key always live in the same bucket
+    const Bucket* const b = FindBucket(EntryPrefix(target));
+    if (b == NULL) {
+      return NULL;
+    }
+    Table::Iterator iter(b->table);
+    iter.Seek(target);
+    return iter.Valid() ? iter.key() : NULL;
+  }
+
+  class Iter : public MemTableRep::Iterator {
+   public:
+    explicit Iter(const PrefixHashRep* rep)
+        : rep_(rep), index_iter_(&rep->index_), iter_(NULL) {}
+    virtual ~Iter() {}
+
+    virtual bool Valid() const { return index_iter_.Valid() && iter_.Valid(); }
+    virtual const char* key() const { return iter_.key(); }
+
+    virtual void Next() {
+      assert(Valid());
+      iter_.Next();
+      if (!iter_.Valid()) {
+        index_iter_.Next();
+        SkipEmptyBucketsForward();
+      }
+    }
+
+    virtual void Prev() {
+      assert(Valid());
+      iter_.Prev();
+      if (!iter_.Valid()) {
+        index_iter_.Prev();
+        SkipEmptyBucketsBackward();
+      }
+    }
+
+    virtual void Seek(const char* target) {
+      Bucket tmp;
+      tmp.prefix = rep_->EntryPrefix(target);
+      index_iter_.Seek(&tmp);
+      if (index_iter_.Valid() && index_iter_.key()->prefix == tmp.prefix) {
+        iter_ = Table::Iterator(index_iter_.key()->table);
+        iter_.Seek(target);
+        if (iter_.Valid()) {
+          return;
+        }
+        index_iter_.Next();
+      }
+      SkipEmptyBucketsForward();
+    }
+
+    virtual void SeekToFirst() {
+      index_iter_.SeekToFirst();
+      SkipEmptyBucketsForward();
+    }
+
+    virtual void SeekToLast() {
+      index_iter_.SeekToLast();
+      SkipEmptyBucketsBackward();
+    }
+
+   private:
+    // Position at the first entry of the current bucket, moving on to later
+    // buckets if it is empty.
+    void SkipEmptyBucketsForward() {
+      while (index_iter_.Valid()) {
+        iter_ = Table::Iterator(index_iter_.key()->table);
+        iter_.SeekToFirst();
+        if (iter_.Valid()) {
+          break;
+        }
+        index_iter_.Next();
+      }
+    }
+
+    void SkipEmptyBucketsBackward() {
+      while (index_iter_.Valid()) {
+        iter_ = Table::Iterator(index_iter_.key()->table);
+        iter_.SeekToLast();
+        if (iter_.Valid()) {
+          break;
+        }
+        index_iter_.Prev();
+      }
+    }
+
+    const PrefixHashRep* const rep_;
+    BucketIndex::Iterator index_iter_;
+    Table::Iterator iter_;
+  };
+
+  virtual MemTableRep::Iterator* NewIterator() const { return new Iter(this); }
+
+ private:
+  Slice EntryPrefix(const char* entry) const {
+    Slice user_key = ExtractUserKey(GetLengthPrefixedSlice(entry));
+    if (user_key.size() > prefix_length_) {
+      user_key = Slice(user_key.data(), prefix_length_);
+    }
+    return user_key;
+  }
+
+  std::atomic<Bucket*>* HashSlot(const Slice& prefix) const {
+    const uint32_t hash = Hash(prefix.data(), prefix.size(), 0);
+    return &buckets_[hash % num_buckets_];
+  }
+
+  static Bucket* FindInChain(Bucket* b, const Slice& prefix) {
+    while (b != NULL && b->prefix != prefix) {
+      b = b->next.load(std::memory_order_acquire);
+    }
+    return b;
+  }
+
+  Bucket* FindBucket(const Slice& prefix) const {
+    return FindInChain(HashSlot(prefix)->load(std::memory_order_acquire),
+                       prefix);
+  }
+
+  Bucket* GetOrCreateBucket(const Slice& prefix, bool concurrent) {
+    std::atomic<Bucket*>* const slot = HashSlot(prefix);
+    Bucket* head = slot->load(std::memory_order_acquire);
+    Bucket* b = FindInChain(head, prefix);
+    if (b != NULL) {
+      return b;
+    }
+    b = NewBucket(prefix, concurrent);
+    while (true) {
+      b->next.store(head, std::memory_order_relaxed);
+      if (slot->compare_exchange_strong(head, b)) {
+        break;
+      }
+      // Another writer has changed the chain. The bucket may have been
+      // created by it, in which case we discard ours and use its.
+      Bucket* const other = FindInChain(head, prefix);
+      if (other != NULL) {
+        return other;
+      }
+    }
+    // Entries added to the bucket by other writers before it reaches the index
+    // are not yet visible to readers: their sequence numbers are only
+    // published once all concurrent writers are done.
+    if (concurrent) {
+      index_.InsertConcurrently(b);
+    } else {
+      index_.Insert(b);
+    }
+    return b;
+  }
+
+  Bucket* NewBucket(const Slice& prefix, bool concurrent) {
+    const size_t bytes = sizeof(Bucket) + sizeof(Table) + prefix.size();
+    char* const mem = concurrent ? arena_->AllocateAlignedConcurrently(bytes)
+                                 : arena_->AllocateAligned(bytes);
+    Bucket* const b = new (mem) Bucket;
+    char* const prefix_data = mem + sizeof(Bucket) + sizeof(Table);
+    memcpy(prefix_data, prefix.data(), prefix.size());
+    b->prefix = Slice(prefix_data, prefix.size());
+    b->table = new (mem + sizeof(Bucket)) Table(cmp_, arena_, concurrent);
+    b->next.store(NULL, std::memory_order_relaxed);
+    return b;
+  }
+
+  const KeyComparator cmp_;
+  Arena* const arena_;
+  const size_t prefix_length_;
+  const size_t num_buckets_;
+  std::atomic<Bucket*>* buckets_;  // Heads of all hash chains
+  BucketIndex index_;              // All buckets ordered by prefix
+};
+
+}  // namespace
+
+MemTableRep* NewSkipListRep(const MemTableRep::KeyComparator& cmp,
+                            Arena* arena) {
+  return new SkipListRep(cmp, arena);
+}
+
+MemTableRep* NewPrefixHashRep(const MemTableRep::KeyComparator& cmp,
+                              Arena* arena, size_t prefix_length,
+                              size_t num_buckets) {
+  return new PrefixHashRep(cmp, arena, prefix_length, num_buckets);
+}
+
+}  // namespace pdlfs
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/leveldb/internal_types.h"
+
+#include <stddef.h>
+
+namespace pdlfs {
+
+class Arena;
+
+// The in-memory data structure backing a memtable. Entries are opaque
+// pointers to memtable entries, each starting with a length-prefixed internal
+// key. Entries are kept sorted by their internal keys and are never removed.
+//
+// Insert() requires external synchronization. InsertConcurrently() may be
+// called by multiple threads at the same time as long as no thread calls
+// Insert(). Readers may run concurrently with writers without any
+// synchronization.
+class MemTableRep {
+ public:
+  // Compares two memtable entries by their internal keys.
+  struct KeyComparator {
+    const InternalKeyComparator comparator;
+    explicit KeyComparator(const InternalKeyComparator& c) : comparator(c) {}
+    int operator()(const char* a, const char* b) const;
+  };
+
+  MemTableRep() {}
+  virtual ~MemTableRep();
+
+  // Insert an entry into the rep.
+  // REQUIRES: nothing that compares equal to entry is currently in the rep.
+  virtual void Insert(const char* entry) = 0;
+  virtual void InsertConcurrently(const char* entry) = 0;
+
+  // Return the first entry in the rep whose internal key has the same user key
+  // as "target" and is at or after "target". Return NULL if there is no such
+  // entry. May also return an entry with a different user key, in which case
+  // the caller treats the lookup as a miss. "target" is a memtable key as
+  // returned by LookupKey::memtable_key().
+  virtual const char* Lookup(const char* target) const = 0;
+
+  class Iterator {
+   public:
+    Iterator() {}
+    virtual ~Iterator();
+
+    virtual bool Valid() const = 0;
+    // REQUIRES: Valid()
+    virtual const char* key() const = 0;
+    // REQUIRES: Valid()
+    virtual void Next() = 0;
+    // REQUIRES: Valid()
+    virtual void Prev() = 0;
+    // Advance to the first entry at or after "target", a memtable key.
+    virtual void Seek(const char* target) = 0;
+    virtual void SeekToFirst() = 0;
+    virtual void SeekToLast() = 0;
+
+   private:
+    // No copying allowed
+    Iterator(const Iterator&);
+    void operator=(const Iterator&);
+  };
+
+  // Return an iterator over all entries of the rep in internal key order.
+  virtual Iterator* NewIterator() const = 0;
+
+ private:
+  // No copying allowed
+  MemTableRep(const MemTableRep&);
+  void operator=(const MemTableRep&);
+};
+
+// Return a rep that keeps all entries in a single skip list.
+extern MemTableRep* NewSkipListRep(const MemTableRep::KeyComparator& cmp,
+                                   Arena* arena);
+
+// Return a rep that hashes the first "prefix_length" bytes of each user key
+// into "num_buckets" hash buckets and keeps the entries that share a prefix in
+// a skip list of their own. Point lookups only search the entries sharing the
+// target's prefix. A separate skip list orders all prefixes for iteration.
+// REQUIRES: user keys are ordered bytewise.
+extern MemTableRep* NewPrefixHashRep(const MemTableRep::KeyComparator& cmp,
+                                     Arena* arena, size_t prefix_length,
+                                     size_t num_buckets);
+
+}  // namespace pdlfs
@@ -34,25 +34,39 @@ DBOptions::DBOptions()
       env(Env::Default()),
       info_log(NULL),
       compaction_pool(NULL),
+      max_background_compactions(1),
       write_buffer_size(4 * 1048576),
+      memtable_type(kSkipListMemTable),
+      memtable_prefix_length(8),
+      memtable_hash_buckets(16384),
       table_cache(NULL),
       block_cache(NULL),
       block_size(4 * 1024),
       block_restart_interval(16),
       index_block_restart_interval(1),
+      data_block_hash_index(false),
+      index_partition_size(0),
+      ect_index(false),
       compression(kSnappyCompression),
+      zstd_level(3),
+      zstd_dict_size(0),
+      zstd_dict_training_size(256 * 1024),
       filter_policy(NULL),
+      whole_table_filter(false),
       no_memtable(false),
       gc_skip_deletion(false),
       skip_lock_file(false),
       rotating_manifest(false),
       sync_log_on_close(false),
       disable_write_ahead_log(false),
+      allow_concurrent_memtable_write(false),
+      enable_pipelined_write(false),
       disable_compaction(false),
       disable_seek_compaction(false),
       table_builder_skip_verification(false),
       prefetch_compaction_input(false),
       table_bulk_read_size(256 * 1024),
+      max_subcompactions(1),
       table_file_size(2 * 1048576),
       max_mem_compact_level(2),
       level_factor(10),
@@ -65,7 +79,9 @@ ReadOptions::ReadOptions()
     : verify_checksums(false),
       fill_cache(true),
       limit(1 << 30),
-      snapshot(NULL) {}
+      snapshot(NULL),
+      readahead_blocks(0),
+      readahead_pool(NULL) {}
 
 WriteOptions::WriteOptions() : sync(false) {}
 
@@ -107,6 +123,19 @@ DBOptions SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.index_block_restart_interval, 1, 1024);
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
+  if (result.index_partition_size != 0) {
+    ClipToRange(&result.index_partition_size, 1 << 10, 4 << 20);
+  }
+  ClipToRange(&result.memtable_hash_buckets, 1, 1 << 24);
+  if (result.zstd_dict_size != 0) {
+    ClipToRange(&result.zstd_dict_size, 256, 1 << 20);
+    ClipToRange(&result.zstd_dict_training_size, result.zstd_dict_size,
+                static_cast<size_t>(64 << 20));
+  }
+  if (src.comparator != BytewiseComparator()) {
+    result.memtable_type = kSkipListMemTable;
+    result.ect_index = false;
+  }
   if (create_infolog && result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname.c_str());  // In case it does not exist
@@ -35,7 +35,12 @@ struct TableAndFile {
 
 TableCache::TableCache(const std::string& dbname, const Options* options,
                        Cache* cache)
-    : env_(options->env), dbname_(dbname), options_(options), cache_(cache) {
+    : env_(options->env),
+      dbname_(dbname),
+      options_(options),
+      cache_(cache),
+      coalesced_table_loads_(0),
+      coalesced_block_loads_(0) {
   id_ = cache_->NewId();
 }
 
@@ -109,12 +114,28 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
   Slice key(buf, 16);
 
   *handle = cache_->Lookup(key);
+  // Only one thread opens a missing table; the others wait for it and then
+  // fetch the table from the cache
+  bool loading = false;
+  while (*handle == NULL) {
+    if (table_loads_.Begin(file_number)) {
+      loading = true;
+      // The previous loader may have finished right before we began
+      *handle = cache_->Lookup(key);
+      break;
+    }
+    *handle = cache_->Lookup(key);
+    if (*handle != NULL) {
+      coalesced_table_loads_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
   if (*handle == NULL) {
     // Load table from storage
     RandomAccessFile* file = NULL;
     Table* table = NULL;
     s = OpenTable(file_number, file_size, &table, &file, false);
     if (s.ok()) {
+      table->SetCoalescedLoadCounter(&coalesced_block_loads_);
       TableAndFile* tf = new TableAndFile;
       tf->off = seq_off;
       tf->file = file;
@@ -122,7 +143,11 @@ Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
 
       *handle = cache_->Insert(key, tf, 1, &DeleteEntry);
     }
+    table_loads_.End(file_number);
   } else {
+    if (loading) {
+      table_loads_.End(file_number);
+    }
     // Fetch table from cache
     TableAndFile* const tf =
         reinterpret_cast<TableAndFile*>(cache_->Value(*handle));
@@ -403,6 +428,32 @@ Status TableCache::Get(const ReadOptions& options, uint64_t fnum,
   return s;
 }
 
+void TableCache::MultiGet(const ReadOptions& options, uint64_t fnum,
+                          uint64_t fsize, SequenceOff off, size_t n,
+                          const Slice* keys, void* const* args, Saver saver,
+                          Status* statuses) {
+  if (off != 0) {
+    // Keys must be translated one by one
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = Get(options, fnum, fsize, off, keys[i], args[i], saver);
+    }
+    return;
+  }
+
+  Cache::Handle* handle;
+  Status s = FindTable(fnum, fsize, off, &handle);
+  if (!s.ok()) {
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = s;
+    }
+    return;
+  }
+
+  Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
+  t->InternalMultiGet(options, n, keys, args, saver, statuses);
+  cache_->Release(handle);
+}
+
 void TableCache::Evict(uint64_t fnum) {
   char buf[16];
   EncodeFixed64(buf, id_);
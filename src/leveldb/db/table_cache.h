@@ -16,6 +16,8 @@
  */
 #pragma once
 
+#include "../single_flight.h"
+
 #include "pdlfs-common/leveldb/internal_types.h"
 #include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/table.h"
@@ -24,6 +26,7 @@
 #include "pdlfs-common/port.h"
 
 #include <stdint.h>
+#include <atomic>
 #include <string>
 
 namespace pdlfs {
@@ -60,9 +63,29 @@ class TableCache {
              uint64_t file_size, SequenceOff seq_off, const Slice& k, void* arg,
              void (*handle_result)(void*, const Slice&, const Slice&));
 
+  // Same as Get() for internal keys[0,n-1], which must be sorted. Results for
+  // keys[i] are passed to args[i] and its status is stored in statuses[i].
+  void MultiGet(const ReadOptions& options, uint64_t file_number,
+                uint64_t file_size, SequenceOff seq_off, size_t n,
+                const Slice* keys, void* const* args,
+                void (*handle_result)(void*, const Slice&, const Slice&),
+                Status* statuses);
+
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
+  // Return the number of table opens avoided because another thread was
+  // already opening the same table.
+  uint64_t NumCoalescedTableLoads() const {
+    return coalesced_table_loads_.load(std::memory_order_relaxed);
+  }
+
+  // Return the number of data block reads avoided because another thread was
+  // already reading the same block into the block cache.
+  uint64_t NumCoalescedBlockLoads() const {
+    return coalesced_block_loads_.load(std::memory_order_relaxed);
+  }
+
  private:
   // Fetch table from storage. By default, only table header and metadata blocks
   // are fetched. If prefetch is true, will read the entire table into memory so
@@ -85,6 +108,10 @@ class TableCache {
   const Options* options_;
   Cache* cache_;
   uint64_t id_;
+
+  SingleFlight<uint64_t> table_loads_;  // Indexed by file number
+  std::atomic<uint64_t> coalesced_table_loads_;
+  std::atomic<uint64_t> coalesced_block_loads_;
 };
 
 }  // namespace pdlfs
@@ -450,6 +450,154 @@ bool Version::Get(const ReadOptions& options, const LookupKey& k, Buffer* buf,
   return false;
 }
 
+namespace {
+// The state of a single key of a Version::MultiGet()
+struct KeyState {
+  Saver saver;
+  bool done;
+  FileMetaData* last_file_read;
+  int last_file_read_level;
+  Version::GetStats stats;
+};
+
+// Look up keys[batch[0..]] in file "f" and settle the keys that are found.
+void MultiGetFromFile(TableCache* table_cache, const ReadOptions& options,
+                      FileMetaData* f, int level,
+                      const std::vector<size_t>& batch,
+                      const LookupKey* const* keys, KeyState* states,
+                      Status* s) {
+  const size_t n = batch.size();
+  std::vector<Slice> ikeys(n);
+  std::vector<void*> args(n);
+  std::vector<Status> statuses(n);
+  for (size_t j = 0; j < n; j++) {
+    KeyState* const st = &states[batch[j]];
+    if (st->last_file_read != NULL && st->stats.seek_file == NULL) {
+      // More than one seek for this key. Charge the 1st file.
+      st->stats.seek_file = st->last_file_read;
+      st->stats.seek_file_level = st->last_file_read_level;
+    }
+    st->last_file_read = f;
+    st->last_file_read_level = level;
+    st->saver.state = kNotFound;
+    ikeys[j] = keys[batch[j]]->internal_key();
+    args[j] = &st->saver;
+  }
+  table_cache->MultiGet(options, f->number, f->file_size, f->seq_off, n,
+                        &ikeys[0], &args[0], SaveValue, &statuses[0]);
+  for (size_t j = 0; j < n; j++) {
+    const size_t i = batch[j];
+    KeyState* const st = &states[i];
+    if (!statuses[j].ok()) {
+      s[i] = statuses[j];  // Read error
+      st->done = true;
+      continue;
+    }
+    switch (st->saver.state) {
+      case kNotFound:
+        break;  // Keep searching in other files
+      case kFound:
+        s[i] = Status::OK();
+        st->done = true;
+        break;
+      case kDeleted:
+        s[i] = Status::NotFound(Slice());
+        st->done = true;
+        break;
+      case kCorrupt:
+        s[i] = Status::Corruption("Corrupted key for ", st->saver.user_key);
+        st->done = true;
+        break;
+    }
+  }
+}
+}  // namespace
+
+void Version::MultiGet(const ReadOptions& options, size_t n,
+                       const LookupKey* const* keys, Buffer* const* vals,
+                       Status* s, std::vector<GetStats>* stats) {
+  const Comparator* ucmp = vset_->icmp_.user_comparator();
+  TableCache* const table_cache = vset_->table_cache_;
+  std::vector<KeyState> states(n);
+  for (size_t i = 0; i < n; i++) {
+    KeyState* const st = &states[i];
+    st->saver.state = kNotFound;
+    st->saver.options = &options;
+    st->saver.ucmp = ucmp;
+    st->saver.user_key = keys[i]->user_key();
+    st->saver.buf = vals[i];
+    st->done = false;
+    st->last_file_read = NULL;
+    st->last_file_read_level = -1;
+    st->stats.seek_file = NULL;
+    st->stats.seek_file_level = -1;
+  }
+
+  // Level-0 files may overlap each other. Visiting them from newest to oldest
+  // visits the files overlapping each key in the same order as Get().
+  std::vector<size_t> batch;
+  std::vector<FileMetaData*> tmp(files_[0]);
+  std::sort(tmp.begin(), tmp.end(), NewestFirst);
+  for (size_t k = 0; k < tmp.size(); k++) {
+    FileMetaData* const f = tmp[k];
+    batch.clear();
+    for (size_t i = 0; i < n; i++) {
+      const Slice user_key = keys[i]->user_key();
+      if (!states[i].done &&
+          ucmp->Compare(user_key, f->smallest.user_key()) >= 0 &&
+          ucmp->Compare(user_key, f->largest.user_key()) <= 0) {
+        batch.push_back(i);
+      }
+    }
+    if (!batch.empty()) {
+      MultiGetFromFile(table_cache, options, f, 0, batch, keys, &states[0], s);
+    }
+  }
+
+  // Files of other levels are sorted, and so are the keys. Keys falling into
+  // the same file are therefore next to each other.
+  for (int level = 1; level < config::kNumLevels; level++) {
+    const size_t num_files = files_[level].size();
+    if (num_files == 0) continue;
+    FileMetaData* batch_file = NULL;
+    batch.clear();
+    for (size_t i = 0; i < n; i++) {
+      if (states[i].done) continue;
+      uint32_t index =
+          FindFile(vset_->icmp_, files_[level], keys[i]->internal_key());
+      if (index >= num_files) {
+        continue;
+      }
+      FileMetaData* const f = files_[level][index];
+      if (ucmp->Compare(keys[i]->user_key(), f->smallest.user_key()) < 0) {
+        continue;  // All of "f" is past any data for the key
+      }
+      if (f != batch_file) {
+        if (!batch.empty()) {
+          MultiGetFromFile(table_cache, options, batch_file, level, batch,
+                           keys, &states[0], s);
+          batch.clear();
+        }
+        batch_file = f;
+      }
+      batch.push_back(i);
+    }
+    if (!batch.empty()) {
+      MultiGetFromFile(table_cache, options, batch_file, level, batch, keys,
+                       &states[0], s);
+    }
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (!states[i].done) {
+      s[i] = Status::NotFound(Slice());
+    }
+    if (states[i].stats.seek_file != NULL) {
+      stats->push_back(states[i].stats);
+    }
+  }
+}
+
 bool Version::UpdateStats(const GetStats& stats) {
   FileMetaData* f = stats.seek_file;
   if (f != NULL) {
@@ -1226,6 +1374,7 @@ void VersionSet::Finalize(Version* v) {
       score = static_cast<double>(bytes) / MaxBytesForLevel(options_, level);
     }
 
+    v->level_scores_[level] = score;
     if (score > best_score) {
       best_level = level;
       best_score = score;
@@ -1432,43 +1581,75 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   return result;
 }
 
-Compaction* VersionSet::PickCompaction(bool allow_seek_compaction) {
-  Compaction* c;
-  int level;
+static bool AnyBeingCompacted(const std::vector<FileMetaData*>& files) {
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i]->being_compacted) {
+      return true;
+    }
+  }
+  return false;
+}
 
+Compaction* VersionSet::PickCompaction(bool allow_seek_compaction) {
   // We prefer compactions triggered by too much data in a level over
-  // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
-    assert(level + 1 < config::kNumLevels);
-    c = new Compaction(options_, level);
-
-    // Pick the first file that comes after compact_pointer_[level]
-    for (size_t i = 0; i < current_->files_[level].size(); i++) {
-      FileMetaData* f = current_->files_[level][i];
-      if (compact_pointer_[level].empty() ||
-          icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0) {
-        c->inputs_[0].push_back(f);
-        break;
+  // the compactions triggered by seeks. Levels are tried in the decreasing
+  // order of their scores so that a level whose files are all being
+  // compacted does not block compactions at other levels.
+  int levels[config::kNumLevels];
+  int num_levels = 0;
+  for (int level = 0; level + 1 < config::kNumLevels; level++) {
+    if (current_->level_scores_[level] >= 1) {
+      int i = num_levels++;
+      for (; i > 0 && current_->level_scores_[levels[i - 1]] <
+                          current_->level_scores_[level];
+           i--) {
+        levels[i] = levels[i - 1];
+      }
+      levels[i] = level;
+    }
+  }
+  for (int j = 0; j < num_levels; j++) {
+    const int level = levels[j];
+    const std::vector<FileMetaData*>& files = current_->files_[level];
+    // Start with the first file that comes after compact_pointer_[level]
+    size_t start = 0;
+    if (!compact_pointer_[level].empty()) {
+      while (start < files.size() &&
+             icmp_.Compare(files[start]->largest.Encode(),
+                           compact_pointer_[level]) <= 0) {
+        start++;
+      }
+      if (start == files.size()) {
+        // Wrap-around to the beginning of the key space
+        start = 0;
       }
     }
-    if (c->inputs_[0].empty()) {
-      // Wrap-around to the beginning of the key space
-      c->inputs_[0].push_back(current_->files_[level][0]);
+    for (size_t i = 0; i < files.size(); i++) {
+      FileMetaData* const f = files[(start + i) % files.size()];
+      if (!f->being_compacted) {
+        Compaction* const c = SetupCompaction(level, f);
+        if (c != NULL) {
+          return c;
+        }
+      }
     }
-  } else if (allow_seek_compaction && seek_compaction) {
-    level = current_->file_to_compact_level_;
-    c = new Compaction(options_, level);
-    c->inputs_[0].push_back(current_->file_to_compact_);
+  }
+
+  FileMetaData* const f = current_->file_to_compact_;
+  if (allow_seek_compaction && f != NULL && !f->being_compacted) {
+    return SetupCompaction(current_->file_to_compact_level_, f);
   } else {
     return NULL;
   }
+}
 
+Compaction* VersionSet::SetupCompaction(int level, FileMetaData* f) {
+  assert(level >= 0);
+  assert(level + 1 < config::kNumLevels);
+  Compaction* c = new Compaction(options_, level);
   c->input_version_ = current_;
   c->input_version_->Ref();
+  c->inputs_[0].push_back(f);
 
   // Files in level 0 may overlap each other, so pick up all overlapping ones
   if (level == 0) {
@@ -1481,18 +1662,25 @@ Compaction* VersionSet::PickCompaction(bool allow_seek_compaction) {
     assert(!c->inputs_[0].empty());
   }
 
-  SetupOtherInputs(c);
+  if (AnyBeingCompacted(c->inputs_[0]) || !SetupOtherInputs(c)) {
+    delete c;
+    return NULL;
+  }
 
+  c->MarkFilesBeingCompacted(true);
   return c;
 }
 
-void VersionSet::SetupOtherInputs(Compaction* c) {
+bool VersionSet::SetupOtherInputs(Compaction* c) {
   const int level = c->level();
   InternalKey smallest, largest;
   GetRange(c->inputs_[0], &smallest, &largest);
 
   current_->GetOverlappingInputs(level + 1, &smallest, &largest,
                                  &c->inputs_[1]);
+  if (AnyBeingCompacted(c->inputs_[1])) {
+    return false;
+  }
 
   // Get entire range covered by compaction
   InternalKey all_start, all_limit;
@@ -1508,7 +1696,8 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
     const int64_t expanded0_size = TotalFileSize(expanded0);
     if (expanded0.size() > c->inputs_[0].size() &&
         inputs1_size + expanded0_size <
-            ExpandedCompactionByteSizeLimit(options_)) {
+            ExpandedCompactionByteSizeLimit(options_) &&
+        !AnyBeingCompacted(expanded0)) {
       InternalKey new_start, new_limit;
       GetRange(expanded0, &new_start, &new_limit);
       std::vector<FileMetaData*> expanded1;
@@ -1547,6 +1736,7 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   // key range next time.
   compact_pointer_[level] = largest.Encode().ToString();
   c->edit_.SetCompactPointer(level, largest);
+  return true;
 }
 
 Compaction* VersionSet::CompactRange(int level, const InternalKey* begin,
@@ -1578,7 +1768,12 @@ Compaction* VersionSet::CompactRange(int level, const InternalKey* begin,
   c->input_version_ = current_;
   c->input_version_->Ref();
   c->inputs_[0] = inputs;
-  SetupOtherInputs(c);
+  if (AnyBeingCompacted(c->inputs_[0]) || !SetupOtherInputs(c)) {
+    delete c;
+    return NULL;
+  }
+
+  c->MarkFilesBeingCompacted(true);
   return c;
 }
 
@@ -1661,6 +1856,29 @@ bool Compaction::ShouldStopBefore(const Slice& internal_key) {
   }
 }
 
+Compaction* Compaction::NewSubcompaction() const {
+  assert(input_version_ != NULL);
+  Compaction* const c = new Compaction(*this);
+  c->edit_.Clear();
+  c->input_version_->Ref();
+  c->grandparent_index_ = 0;
+  c->seen_key_ = false;
+  c->overlapped_bytes_ = 0;
+  for (int i = 0; i < config::kNumLevels; i++) {
+    c->level_ptrs_[i] = 0;
+  }
+  return c;
+}
+
+void Compaction::MarkFilesBeingCompacted(bool value) {
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      assert(inputs_[which][i]->being_compacted != value);
+      inputs_[which][i]->being_compacted = value;
+    }
+  }
+}
+
 void Compaction::ReleaseInputs() {
   if (input_version_ != NULL) {
     input_version_->Unref();
@@ -22,6 +22,7 @@
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/port.h"
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <vector>
@@ -86,6 +87,14 @@ class Version {
   bool Get(const ReadOptions& options, const LookupKey& key, Buffer* val,
            Status* s, GetStats* stats);
 
+  // Same as Get() for keys[0,n-1], which must be sorted by user key. Fills
+  // s[i] and vals[i] for keys[i]. Keys landing in the same table are looked
+  // up together. Appends stats needing an update to *stats.
+  // REQUIRES: lock is not held
+  void MultiGet(const ReadOptions& options, size_t n,
+                const LookupKey* const* keys, Buffer* const* vals, Status* s,
+                std::vector<GetStats>* stats);
+
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
   // REQUIRES: lock is held
@@ -157,6 +166,8 @@ class Version {
   // are initialized by Finalize().
   double compaction_score_;
   int compaction_level_;
+  // Compaction scores of all levels. Also initialized by Finalize().
+  double level_scores_[config::kNumLevels];
 
   explicit Version(VersionSet* vset)
       : vset_(vset),
@@ -166,7 +177,11 @@ class Version {
         file_to_compact_(NULL),
         file_to_compact_level_(-1),
         compaction_score_(-1),
-        compaction_level_(-1) {}
+        compaction_level_(-1) {
+    for (int i = 0; i < config::kNumLevels; i++) {
+      level_scores_[i] = -1;
+    }
+  }
 
   ~Version();
 
@@ -228,13 +243,17 @@ class VersionSet {
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
-  // Return the last sequence number.
-  uint64_t LastSequence() const { return last_sequence_; }
+  // Return the last sequence number. May be called without holding the db
+  // mutex. All writes up to the returned sequence number are visible in the
+  // memtables.
+  uint64_t LastSequence() const {
+    return last_sequence_.load(std::memory_order_acquire);
+  }
 
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
-    assert(s >= last_sequence_);
-    last_sequence_ = s;
+    assert(s >= LastSequence());
+    last_sequence_.store(s, std::memory_order_release);
   }
 
   // Mark the specified file number as used.
@@ -247,7 +266,9 @@ class VersionSet {
   // being compacted, or zero if there is no such log file.
   uint64_t PrevLogNumber() const { return prev_log_number_; }
 
-  // Pick level and inputs for a new compaction.
+  // Pick level and inputs for a new compaction. Files that are being
+  // compacted are never picked, so the result never conflicts with any
+  // ongoing compaction.
   // Returns NULL if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
   // describes the compaction.  Caller should delete the result.
@@ -255,7 +276,8 @@ class VersionSet {
 
   // Return a compaction object for compacting the range [begin,end] in
   // the specified level.  Returns NULL if there is nothing in that
-  // level that overlaps the specified range.  Caller should delete
+  // level that overlaps the specified range, or if the compaction would
+  // conflict with an ongoing compaction.  Caller should delete
   // the result.
   Compaction* CompactRange(int level, const InternalKey* begin,
                            const InternalKey* end);
@@ -306,7 +328,13 @@ class VersionSet {
                  const std::vector<FileMetaData*>& inputs2,
                  InternalKey* smallest, InternalKey* largest);
 
-  void SetupOtherInputs(Compaction* c);
+  // Return a new compaction of "f" at "level", or NULL if the compaction
+  // would take any file that is being compacted.
+  Compaction* SetupCompaction(int level, FileMetaData* f);
+
+  // Return false if the compaction would take any file that is being
+  // compacted. Compaction pointers are left untouched in that case.
+  bool SetupOtherInputs(Compaction* c);
 
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
@@ -320,7 +348,7 @@ class VersionSet {
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
-  uint64_t last_sequence_;
+  std::atomic<uint64_t> last_sequence_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
 
@@ -383,6 +411,18 @@ class Compaction {
   // is successful.
   void ReleaseInputs();
 
+  // Set or clear the being_compacted flag of all input files. Compactions
+  // returned by VersionSet have their inputs marked. The owner must clear
+  // the marks once the compaction is done or abandoned.
+  // REQUIRES: the mutex passed to VersionSet::LogAndApply() is held
+  void MarkFilesBeingCompacted(bool value);
+
+  // Return a new compaction over the same inputs with its own output
+  // splitting and base level states. Used to process disjoint key ranges of
+  // this compaction concurrently. The result must be deleted by the caller.
+  // REQUIRES: inputs have not been released
+  Compaction* NewSubcompaction() const;
+
  private:
   friend class Version;
   friend class VersionSet;
@@ -48,6 +48,11 @@ class WriteBatchInternal {
 
   static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
 
+  // Same as InsertInto(), but may be called by multiple threads at the same
+  // time to insert different batches into the same memtable.
+  static Status ConcurrentInsertInto(const WriteBatch* batch,
+                                     MemTable* memtable);
+
   static void Append(WriteBatch* dst, const WriteBatch* src);
 };
 
@@ -28,10 +28,14 @@ namespace pdlfs {
 static const size_t kFilterBaseLg = 11;
 static const size_t kFilterBase = 1 << kFilterBaseLg;
 
-FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy)
-    : policy_(policy) {}
+FilterBlockBuilder::FilterBlockBuilder(const FilterPolicy* policy,
+                                       bool whole_table)
+    : policy_(policy), whole_table_(whole_table) {}
 
 void FilterBlockBuilder::StartBlock(uint64_t block_offset) {
+  if (whole_table_) {
+    return;  // All keys go into a single filter
+  }
   uint64_t filter_index = (block_offset / kFilterBase);
   assert(filter_index >= filter_offsets_.size());
   while (filter_index > filter_offsets_.size()) {
@@ -46,6 +50,14 @@ void FilterBlockBuilder::AddKey(const Slice& key) {
 }
 
 Slice FilterBlockBuilder::Finish() {
+  if (whole_table_) {
+    result_.clear();
+    filter_offsets_.clear();
+    if (!start_.empty()) {
+      GenerateFilter();
+    }
+    return Slice(result_);
+  }
   if (!start_.empty()) {
     GenerateFilter();
   }
@@ -88,8 +100,17 @@ void FilterBlockBuilder::GenerateFilter() {
 }
 
 FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
-                                     const Slice& contents)
-    : policy_(policy), data_(NULL), offset_(NULL), num_(0), base_lg_(0) {
+                                     const Slice& contents, bool whole_table)
+    : policy_(policy),
+      whole_table_(whole_table),
+      data_(NULL),
+      offset_(NULL),
+      num_(0),
+      base_lg_(0) {
+  if (whole_table_) {
+    filter_ = contents;
+    return;
+  }
   size_t n = contents.size();
   if (n < 5) return;  // 1 byte for base_lg_ and 4 for start of offset array
   base_lg_ = contents[n - 1];
@@ -101,6 +122,9 @@ FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
 }
 
 bool FilterBlockReader::KeyMayMatch(uint64_t block_offset, const Slice& key) {
+  if (whole_table_) {
+    return KeyMayMatch(key);
+  }
   uint64_t index = block_offset >> base_lg_;
   if (index < num_) {
     uint32_t start = DecodeFixed32(offset_ + index * 4);
@@ -116,4 +140,12 @@ bool FilterBlockReader::KeyMayMatch(uint64_t block_offset, const Slice& key) {
   return true;  // Errors are treated as potential matches
 }
 
+bool FilterBlockReader::KeyMayMatch(const Slice& key) {
+  assert(whole_table_);
+  if (filter_.empty()) {
+    return false;  // Tables without keys have empty filters
+  }
+  return policy_->KeyMayMatch(key, filter_);
+}
+
 }  // namespace pdlfs
@@ -37,18 +37,26 @@ class FilterPolicy;
 //
 // The sequence of calls to FilterBlockBuilder must match the regexp:
 //      (StartBlock AddKey*)* Finish
+//
+// If "whole_table" is true, a single filter is built over all keys added
+// and is returned by Finish() as is. StartBlock() calls are ignored. Finish()
+// may then be called more than once, each time returning a filter over the
+// keys added since the previous call.
 class FilterBlockBuilder {
  public:
-  explicit FilterBlockBuilder(const FilterPolicy*);
+  explicit FilterBlockBuilder(const FilterPolicy*, bool whole_table = false);
 
   void StartBlock(uint64_t block_offset);
   void AddKey(const Slice& key);
   Slice Finish();
 
+  bool whole_table() const { return whole_table_; }
+
  private:
   void GenerateFilter();
 
   const FilterPolicy* policy_;
+  const bool whole_table_;
   std::string keys_;             // Flattened key contents
   std::vector<size_t> start_;    // Starting index in keys_ of each key
   std::string result_;           // Filter data computed so far
@@ -63,11 +71,20 @@ class FilterBlockBuilder {
 class FilterBlockReader {
  public:
   // REQUIRES: "contents" and *policy must stay live while *this is live.
-  FilterBlockReader(const FilterPolicy* policy, const Slice& contents);
+  // If "whole_table" is true, "contents" is a single filter as built by a
+  // whole-table FilterBlockBuilder.
+  FilterBlockReader(const FilterPolicy* policy, const Slice& contents,
+                    bool whole_table = false);
   bool KeyMayMatch(uint64_t block_offset, const Slice& key);
 
+  // REQUIRES: the reader was created for a whole-table filter.
+  bool KeyMayMatch(const Slice& key);
+  bool whole_table() const { return whole_table_; }
+
  private:
   const FilterPolicy* policy_;
+  const bool whole_table_;
+  Slice filter_;        // Whole-table filter
   const char* data_;    // Pointer to filter data (at block-start)
   const char* offset_;  // Pointer to beginning of offset array (at block-end)
   size_t num_;          // Number of entries in offset array
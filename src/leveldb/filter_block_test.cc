@@ -131,6 +131,36 @@ TEST(FilterBlockTest, MultiChunk) {
   ASSERT_TRUE(!reader.KeyMayMatch(9000, "bar"));
 }
 
+TEST(FilterBlockTest, WholeTable) {
+  FilterBlockBuilder builder(&policy_, true);
+  builder.StartBlock(0);
+  builder.AddKey("foo");
+  builder.StartBlock(2000);
+  builder.AddKey("bar");
+  builder.StartBlock(9000);
+  builder.AddKey("hello");
+  Slice block = builder.Finish();
+  // A single filter with no offset array
+  ASSERT_EQ(block.size(), 3 * 4);
+  FilterBlockReader reader(&policy_, block, true);
+  ASSERT_TRUE(reader.KeyMayMatch("foo"));
+  ASSERT_TRUE(reader.KeyMayMatch("bar"));
+  ASSERT_TRUE(reader.KeyMayMatch("hello"));
+  ASSERT_TRUE(!reader.KeyMayMatch("box"));
+  ASSERT_TRUE(!reader.KeyMayMatch("missing"));
+  // Block offsets are ignored
+  ASSERT_TRUE(reader.KeyMayMatch(100000, "foo"));
+  ASSERT_TRUE(!reader.KeyMayMatch(0, "box"));
+}
+
+TEST(FilterBlockTest, EmptyWholeTable) {
+  FilterBlockBuilder builder(&policy_, true);
+  Slice block = builder.Finish();
+  ASSERT_EQ(block.size(), 0);
+  FilterBlockReader reader(&policy_, block, true);
+  ASSERT_TRUE(!reader.KeyMayMatch("foo"));
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
@@ -21,8 +21,11 @@
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/hash.h"
 #include "pdlfs-common/port.h"
 
+#include <vector>
+
 namespace pdlfs {
 
 void BlockHandle::EncodeTo(std::string* dst) const {
@@ -75,22 +78,21 @@ Status Footer::DecodeFrom(Slice* input) {
   return result;
 }
 
-Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
-                 const BlockHandle& handle, BlockContents* result) {
-  result->data = Slice();
-  result->cachable = false;
-  result->heap_allocated = false;
+uint32_t BlockHashIndexHash(const Slice& internal_key) {
+  // Keys too short to be internal keys are hashed as is
+  const size_t n = internal_key.size() >= 8 ? internal_key.size() - 8
+                                            : internal_key.size();
+  return Hash(internal_key.data(), n, 0x6c8f2d1a);
+}
 
-  // Read the block contents as well as the type/crc footer.
-  // See table_builder.cc for the code that built this structure.
-  size_t n = static_cast<size_t>(handle.size());
-  char* buf = new char[n + kBlockTrailerSize];
-  Slice contents;
-  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
-  if (!s.ok()) {
-    delete[] buf;
-    return s;
-  }
+// Check and uncompress the contents of a block of "n" bytes read along with
+// its trailer into "buf", or elsewhere if the file returned its data in place.
+// Takes ownership of "buf".
+static Status DecodeBlock(const ReadOptions& options, size_t n,
+                          const Slice& contents, char* buf,
+                          BlockContents* result,
+                          const port::ZstdDecompressionDict* dict) {
+  Status s;
   if (contents.size() != n + kBlockTrailerSize) {
     delete[] buf;
     return Status::Corruption("truncated block read");
@@ -144,6 +146,42 @@ Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
       result->cachable = true;
       break;
     }
+    case kLZ4Compression: {
+      size_t ulength = 0;
+      if (!port::LZ4_GetUncompressedLength(data, n, &ulength)) {
+        delete[] buf;
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      char* ubuf = new char[ulength];
+      if (!port::LZ4_Uncompress(data, n, ubuf)) {
+        delete[] buf;
+        delete[] ubuf;
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      delete[] buf;
+      result->data = Slice(ubuf, ulength);
+      result->heap_allocated = true;
+      result->cachable = true;
+      break;
+    }
+    case kZstdCompression: {
+      size_t ulength = 0;
+      if (!port::Zstd_GetUncompressedLength(data, n, &ulength)) {
+        delete[] buf;
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      char* ubuf = new char[ulength];
+      if (!port::Zstd_Uncompress(data, n, ubuf, ulength, dict)) {
+        delete[] buf;
+        delete[] ubuf;
+        return Status::Corruption("corrupted compressed block contents");
+      }
+      delete[] buf;
+      result->data = Slice(ubuf, ulength);
+      result->heap_allocated = true;
+      result->cachable = true;
+      break;
+    }
     default:
       delete[] buf;
       return Status::Corruption("bad block type");
@@ -152,4 +190,54 @@ Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
   return Status::OK();
 }
 
+Status ReadBlock(RandomAccessFile* file, const ReadOptions& options,
+                 const BlockHandle& handle, BlockContents* result,
+                 const port::ZstdDecompressionDict* dict) {
+  result->data = Slice();
+  result->cachable = false;
+  result->heap_allocated = false;
+
+  // Read the block contents as well as the type/crc footer.
+  // See table_builder.cc for the code that built this structure.
+  size_t n = static_cast<size_t>(handle.size());
+  char* buf = new char[n + kBlockTrailerSize];
+  Slice contents;
+  Status s = file->Read(handle.offset(), n + kBlockTrailerSize, &contents, buf);
+  if (!s.ok()) {
+    delete[] buf;
+    return s;
+  }
+  return DecodeBlock(options, n, contents, buf, result, dict);
+}
+
+void ReadBlocks(RandomAccessFile* file, const ReadOptions& options,
+                size_t num_blocks, const BlockHandle* handles,
+                BlockContents* results, Status* statuses,
+                const port::ZstdDecompressionDict* dict) {
+  if (num_blocks == 0) {
+    return;
+  }
+  std::vector<RandomAccessFile::ReadRequest> reqs(num_blocks);
+  for (size_t i = 0; i < num_blocks; i++) {
+    results[i].data = Slice();
+    results[i].cachable = false;
+    results[i].heap_allocated = false;
+    const size_t n = static_cast<size_t>(handles[i].size());
+    reqs[i].offset = handles[i].offset();
+    reqs[i].n = n + kBlockTrailerSize;
+    reqs[i].scratch = new char[n + kBlockTrailerSize];
+  }
+  file->MultiRead(&reqs[0], num_blocks);
+  for (size_t i = 0; i < num_blocks; i++) {
+    if (!reqs[i].status.ok()) {
+      delete[] reqs[i].scratch;
+      statuses[i] = reqs[i].status;
+    } else {
+      statuses[i] = DecodeBlock(options, static_cast<size_t>(handles[i].size()),
+                                reqs[i].result, reqs[i].scratch, &results[i],
+                                dict);
+    }
+  }
+}
+
 }  // namespace pdlfs
@@ -10,11 +10,91 @@
  */
 #include "index_block.h"
 
+#include "pdlfs-common/leveldb/internal_types.h"
+#include "pdlfs-common/leveldb/iterator.h"
+
+#include "pdlfs-common/coding.h"
+#include "pdlfs-common/ect.h"
+#include "pdlfs-common/pdlfs_config.h"
+
+#include <algorithm>
+#include <assert.h>
+
+// An ECT index replaces the separator keys of a regular index block with
+// entropy-coded tries over the last user key of each data block. Data blocks
+// are split into groups of 32. Each group has its own trie and is headed by
+// the last user key of its first block. For a target user key, a binary
+// search over group heads finds the group, and the group's trie returns the
+// number of blocks in the group ending with a smaller user key, or that
+// number minus one. Looking up a trie decodes it from the start, so tries
+// are kept small. Data blocks are written back to back, so their handles are
+// recovered from their sizes.
+//
+// ECT index format:
+//   offsets    : fixed64[(num_blocks + 15) / 16] (offset of every 16th block)
+//   sizes      : uint8, fixed16, or fixed32[num_blocks] (minus min_size)
+//   heads      : char[key_length][num_groups]
+//   trie_ends  : fixed32[num_groups] (end offset of each trie in tries)
+//   tries      : ECT::EncodeTo() output of each group
+//   num_blocks : fixed32
+//   key_length : fixed32 (length of all user keys)
+//   min_size   : fixed32 (size of the smallest data block)
+//   size_width : uint8 (1, 2, or 4)
 namespace pdlfs {
 
+enum {
+  kECTSampleInterval = 16,
+  kECTGroupSize = 32,
+  kECTTrailerSize = 4 + 4 + 4 + 1
+};
+
+void IndexBlockBuilder::OnKeyAdded(const Slice& key) {
+  if (!ect_) {
+    return;
+  }
+  if (key.size() <= 8) {
+    DisableECT();
+  } else if (ect_key_length_ == 0) {
+    ect_key_length_ = key.size() - 8;
+  } else if (key.size() - 8 != ect_key_length_) {
+    DisableECT();
+  }
+}
+
+void IndexBlockBuilder::DisableECT() {
+  ect_ = false;
+  std::string().swap(ect_keys_);
+  std::vector<uint32_t>().swap(ect_block_sizes_);
+}
+
+bool IndexBlockBuilder::ect_index() const {
+#if defined(PDLFS_SILT_ECT)
+  return ect_ && !ect_block_sizes_.empty();
+#else
+  return false;
+#endif
+}
+
 void IndexBlockBuilder::AddIndexEntry(std::string* last_key,
                                       const Slice* next_key,
                                       const BlockHandle& block_handle) {
+  if (ect_) {
+    const Slice user_key = ExtractUserKey(*last_key);
+    assert(user_key.size() == ect_key_length_);
+    if (block_handle.offset() != ect_next_offset_ ||
+        block_handle.size() > 0xffffffffu ||
+        (!ect_keys_.empty() &&
+         Slice(ect_keys_.data() + ect_keys_.size() - ect_key_length_,
+               ect_key_length_) == user_key)) {
+      DisableECT();
+    } else {
+      ect_keys_.append(user_key.data(), user_key.size());
+      ect_block_sizes_.push_back(static_cast<uint32_t>(block_handle.size()));
+      ect_next_offset_ =
+          block_handle.offset() + block_handle.size() + kBlockTrailerSize;
+    }
+  }
+
   const Comparator* const cmp = builder_.comparator();
   if (next_key != NULL) {
     cmp->FindShortestSeparator(last_key, *next_key);
@@ -25,6 +105,315 @@ void IndexBlockBuilder::AddIndexEntry(std::string* last_key,
   std::string encoding;
   block_handle.EncodeTo(&encoding);
   builder_.Add(*last_key, encoding);
+  if (partitioned()) {
+    last_index_key_ = *last_key;
+  }
+}
+
+void IndexBlockBuilder::AddPartition(const BlockHandle& partition_handle,
+                                     const BlockHandle* filter_handle) {
+  assert(partitioned());
+  std::string encoding;
+  partition_handle.EncodeTo(&encoding);
+  if (filter_handle != NULL) {
+    filter_handle->EncodeTo(&encoding);
+  }
+  // The last index key of the partition is >= all keys indexed by it
+  // and < all keys indexed by later partitions
+  top_builder_.Add(last_index_key_, encoding);
+  builder_.Reset();
+}
+
+Slice IndexBlockBuilder::FinishECT() {
+  assert(ect_index());
+  const size_t n = ect_block_sizes_.size();
+  uint32_t min_size = ect_block_sizes_[0];
+  uint32_t max_size = ect_block_sizes_[0];
+  for (size_t i = 1; i < n; i++) {
+    min_size = std::min(min_size, ect_block_sizes_[i]);
+    max_size = std::max(max_size, ect_block_sizes_[i]);
+  }
+  // Most data blocks are cut right after reaching the block size, so their
+  // sizes tend to fit in a byte or two once the smallest size is subtracted
+  const uint32_t range = max_size - min_size;
+  const int size_width = range <= 0xff ? 1 : (range <= 0xffff ? 2 : 4);
+  ect_buffer_.clear();
+  uint64_t offset = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (i % kECTSampleInterval == 0) {
+      PutFixed64(&ect_buffer_, offset);
+    }
+    offset += ect_block_sizes_[i] + kBlockTrailerSize;
+  }
+  for (size_t i = 0; i < n; i++) {
+    const uint32_t size = ect_block_sizes_[i] - min_size;
+    if (size_width == 1) {
+      ect_buffer_.push_back(static_cast<char>(size));
+    } else if (size_width == 2) {
+      char buf[2];
+      EncodeFixed16(buf, static_cast<uint16_t>(size));
+      ect_buffer_.append(buf, sizeof(buf));
+    } else {
+      PutFixed32(&ect_buffer_, size);
+    }
+  }
+#if defined(PDLFS_SILT_ECT)
+  const size_t num_groups = (n + kECTGroupSize - 1) / kECTGroupSize;
+  for (size_t g = 0; g < num_groups; g++) {
+    ect_buffer_.append(ect_keys_.data() + g * kECTGroupSize * ect_key_length_,
+                       ect_key_length_);
+  }
+  std::string tries;
+  std::vector<Slice> keys;
+  for (size_t g = 0; g < num_groups; g++) {
+    keys.clear();
+    for (size_t i = g * kECTGroupSize; i < n && i < (g + 1) * kECTGroupSize;
+         i++) {
+      keys.push_back(
+          Slice(ect_keys_.data() + i * ect_key_length_, ect_key_length_));
+    }
+    ECT* const trie = ECT::Default(ect_key_length_, keys.size(), &keys[0]);
+    trie->EncodeTo(&tries);
+    delete trie;
+    PutFixed32(&ect_buffer_, static_cast<uint32_t>(tries.size()));
+  }
+  ect_buffer_.append(tries);
+#endif
+  PutFixed32(&ect_buffer_, static_cast<uint32_t>(n));
+  PutFixed32(&ect_buffer_, static_cast<uint32_t>(ect_key_length_));
+  PutFixed32(&ect_buffer_, min_size);
+  ect_buffer_.push_back(static_cast<char>(size_width));
+  return ect_buffer_;
+}
+
+struct IndexBlockReader::ECTRep {
+  Status status;      // Non-OK if the index cannot be used
+  const char* owned;  // Index contents if we own them
+  size_t size;
+  const char* offsets;
+  const char* sizes;
+  const char* heads;
+  int size_width;
+  uint32_t min_size;
+  uint32_t num_blocks;
+  size_t key_length;
+  std::vector<ECT*> tries;  // One per group
+
+  uint64_t BlockSize(uint32_t i) const {
+    uint64_t size = min_size;
+    if (size_width == 1) {
+      size += static_cast<unsigned char>(sizes[i]);
+    } else if (size_width == 2) {
+      size += DecodeFixed16(sizes + 2 * i);
+    } else {
+      size += DecodeFixed32(sizes + 4 * i);
+    }
+    return size;
+  }
+
+  uint64_t BlockOffset(uint32_t i) const {
+    const uint32_t base = i - i % kECTSampleInterval;
+    uint64_t offset = DecodeFixed64(offsets + 8 * (i / kECTSampleInterval));
+    for (uint32_t j = base; j < i; j++) {
+      offset += BlockSize(j) + kBlockTrailerSize;
+    }
+    return offset;
+  }
+
+  Slice GroupHead(size_t g) const {
+    return Slice(heads + g * key_length, key_length);
+  }
+};
+
+namespace {
+
+class ECTIndexIter : public Iterator {
+ public:
+  explicit ECTIndexIter(const IndexBlockReader::ECTRep* rep)
+      : rep_(rep), current_(rep->num_blocks) {}
+  virtual ~ECTIndexIter() {}
+
+  virtual bool Valid() const { return current_ < rep_->num_blocks; }
+  virtual Status status() const { return Status::OK(); }
+
+  virtual Slice key() const {
+    assert(Valid());
+    return Slice();  // Keys are not stored
+  }
+
+  virtual Slice value() const {
+    assert(Valid());
+    return value_;
+  }
+
+  virtual void Next() {
+    assert(Valid());
+    current_++;
+    SetValue();
+  }
+
+  virtual void Prev() {
+    assert(Valid());
+    current_ = current_ != 0 ? current_ - 1 : rep_->num_blocks;
+    SetValue();
+  }
+
+  virtual void Seek(const Slice& target) {
+    const Slice user_key =
+        target.size() >= 8 ? ExtractUserKey(target) : target;
+    // Find the last group whose head is less than the target. All blocks
+    // in earlier groups end before the target.
+    size_t left = 0;
+    size_t right = rep_->tries.size() - 1;
+    while (left < right) {
+      const size_t mid = (left + right + 1) / 2;
+      if (rep_->GroupHead(mid).compare(user_key) < 0) {
+        left = mid;
+      } else {
+        right = mid - 1;
+      }
+    }
+    // Keys shorter than key_length are padded with zero bytes, which keeps
+    // their rank. Longer keys are truncated, which may lower their rank by
+    // one.
+    Slice key = user_key;
+    if (key.size() != rep_->key_length) {
+      key_buf_.assign(key.data(), std::min(key.size(), rep_->key_length));
+      key_buf_.resize(rep_->key_length, 0);
+      key = key_buf_;
+    }
+    const size_t rank = left * kECTGroupSize + rep_->tries[left]->Find(key);
+    current_ = static_cast<uint32_t>(std::min<size_t>(rank, rep_->num_blocks));
+    SetValue();
+  }
+
+  virtual void SeekToFirst() {
+    current_ = 0;
+    SetValue();
+  }
+
+  virtual void SeekToLast() {
+    current_ = rep_->num_blocks - 1;
+    SetValue();
+  }
+
+ private:
+  void SetValue() {
+    value_.clear();
+    if (Valid()) {
+      BlockHandle handle;
+      handle.set_offset(rep_->BlockOffset(current_));
+      handle.set_size(rep_->BlockSize(current_));
+      handle.EncodeTo(&value_);
+    }
+  }
+
+  const IndexBlockReader::ECTRep* const rep_;
+  uint32_t current_;  // num_blocks if not valid
+  std::string value_;
+  std::string key_buf_;
+};
+
+}  // namespace
+
+IndexBlockReader::IndexBlockReader(const BlockContents& contents, bool ect)
+    : ect_(NULL), block_(NULL) {
+  if (!ect) {
+    block_ = new Block(contents);
+    return;
+  }
+  ECTRep* const r = ect_ = new ECTRep;
+  r->owned = contents.heap_allocated ? contents.data.data() : NULL;
+  r->size = contents.data.size();
+  r->num_blocks = 0;
+#if defined(PDLFS_SILT_ECT)
+  const Slice input = contents.data;
+  bool ok = false;
+  if (input.size() >= kECTTrailerSize) {
+    const char* const trailer = input.data() + input.size() - kECTTrailerSize;
+    const uint32_t n = DecodeFixed32(trailer);
+    r->key_length = DecodeFixed32(trailer + 4);
+    r->min_size = DecodeFixed32(trailer + 8);
+    r->size_width = static_cast<unsigned char>(trailer[12]);
+    const uint64_t num_groups =
+        (static_cast<uint64_t>(n) + kECTGroupSize - 1) / kECTGroupSize;
+    const uint64_t offsets_size =
+        8 * ((static_cast<uint64_t>(n) + kECTSampleInterval - 1) /
+             kECTSampleInterval);
+    const uint64_t sizes_size = static_cast<uint64_t>(n) * r->size_width;
+    const uint64_t groups_size = num_groups * (r->key_length + 4);
+    const uint64_t limit = input.size() - kECTTrailerSize;
+    if ((r->size_width == 1 || r->size_width == 2 || r->size_width == 4) &&
+        n != 0 && r->key_length != 0 &&
+        offsets_size + sizes_size + groups_size <= limit) {
+      r->offsets = input.data();
+      r->sizes = r->offsets + offsets_size;
+      r->heads = r->sizes + sizes_size;
+      const char* const trie_ends = r->heads + num_groups * r->key_length;
+      const char* const tries = trie_ends + 4 * num_groups;
+      ok = true;
+      uint32_t start = 0;
+      for (uint32_t g = 0; ok && g < num_groups; g++) {
+        const uint32_t end = DecodeFixed32(trie_ends + 4 * g);
+        const uint32_t keys = std::min<uint32_t>(n - g * kECTGroupSize,
+                                                 kECTGroupSize);
+        ECT* trie = NULL;
+        if (start <= end && end <= trailer - tries) {
+          trie = ECT::Load(r->key_length, keys,
+                           Slice(tries + start, end - start));
+        }
+        if (trie != NULL) {
+          r->tries.push_back(trie);
+        } else {
+          ok = false;
+        }
+        start = end;
+      }
+    }
+    if (ok) {
+      r->num_blocks = n;
+    }
+  }
+  if (!ok) {
+    r->status = Status::Corruption("bad ECT index block");
+  }
+#else
+  r->status = Status::NotSupported("ECT index block");
+#endif
+}
+
+IndexBlockReader::~IndexBlockReader() {
+  if (ect_ != NULL) {
+    for (size_t i = 0; i < ect_->tries.size(); i++) {
+      delete ect_->tries[i];
+    }
+    delete[] ect_->owned;
+    delete ect_;
+  }
+  delete block_;
+}
+
+size_t IndexBlockReader::ApproximateMemoryUsage() const {
+  if (ect_ != NULL) {
+    size_t result = ect_->size;
+    for (size_t i = 0; i < ect_->tries.size(); i++) {
+      result += ect_->tries[i]->MemUsage() / 8;
+    }
+    return result;
+  } else {
+    return block_->size();
+  }
+}
+
+Iterator* IndexBlockReader::NewIterator(const Comparator* cmp) {
+  if (ect_ != NULL) {
+    if (!ect_->status.ok()) {
+      return NewErrorIterator(ect_->status);
+    }
+    return new ECTIndexIter(ect_);
+  } else {
+    return block_->NewIterator(cmp);
+  }
 }
 
 }  // namespace pdlfs
@@ -16,44 +16,124 @@
 #include "pdlfs-common/leveldb/format.h"
 #include "pdlfs-common/status.h"
 
+#include <stdint.h>
+#include <vector>
+
 namespace pdlfs {
 
+// If "partition_size" is non-zero, index entries are grouped into index
+// partitions of about that size, which are written out as separate blocks.
+// Finish() then returns a top-level index mapping the last key of each
+// partition to the partition's block handle, optionally followed by the
+// handle of a filter over the keys indexed by the partition.
+//
+// In partitioned mode, the caller checks PartitionFull() after adding each
+// index entry and, if true, writes FinishPartition() out as a block and
+// passes its handle to AddPartition(). The last partition must be added the
+// same way before calling Finish().
+//
+// If "ect" is true and "partition_size" is zero, Finish() returns an ECT
+// index instead of a block whenever ect_index() is true at that point, which
+// requires all keys to be internal keys with user keys of the same length and
+// no two data blocks to end with the same user key. Keys must be passed to
+// OnKeyAdded() as they are added to data blocks.
 class IndexBlockBuilder {
  public:
-  IndexBlockBuilder(int restart_interval, const Comparator* cmp)
-      : builder_(restart_interval, cmp) {}
+  IndexBlockBuilder(int restart_interval, const Comparator* cmp,
+                    size_t partition_size = 0, bool ect = false)
+      : builder_(restart_interval, cmp),
+        top_builder_(restart_interval, cmp),
+        partition_size_(partition_size),
+        ect_(ect && partition_size == 0),
+        ect_key_length_(0),
+        ect_next_offset_(0) {}
 
   void AddIndexEntry(std::string* last_key, const Slice* next_key,
                      const BlockHandle& block_handle);
 
-  Slice Finish() { return builder_.Finish(); }
+  bool partitioned() const { return partition_size_ != 0; }
+
+  bool PartitionFull() const {
+    return partitioned() && builder_.CurrentSizeEstimate() >= partition_size_;
+  }
+
+  bool PartitionEmpty() const { return builder_.empty(); }
+
+  Slice FinishPartition() { return builder_.Finish(); }
 
-  size_t CurrentSizeEstimate() const { return builder_.CurrentSizeEstimate(); }
+  // REQUIRES: FinishPartition() has been called for the current partition.
+  void AddPartition(const BlockHandle& partition_handle,
+                    const BlockHandle* filter_handle);
+
+  // Return true iff Finish() will return an ECT index.
+  bool ect_index() const;
+
+  Slice Finish() {
+    if (partitioned()) {
+      return top_builder_.Finish();
+    } else if (ect_index()) {
+      return FinishECT();
+    } else {
+      return builder_.Finish();
+    }
+  }
+
+  size_t CurrentSizeEstimate() const {
+    return partitioned() ? top_builder_.CurrentSizeEstimate()
+                         : builder_.CurrentSizeEstimate();
+  }
 
   void ChangeRestartInterval(int interval) {
     builder_.ChangeRestartInterval(interval);
+    top_builder_.ChangeRestartInterval(interval);
   }
 
-  void OnKeyAdded(const Slice& key) {
-    // Empty
-  }
+  void OnKeyAdded(const Slice& key);
 
  private:
-  BlockBuilder builder_;
+  Slice FinishECT();
+  void DisableECT();
+
+  BlockBuilder builder_;      // Index entries, or the current partition
+  BlockBuilder top_builder_;  // One entry per partition
+  std::string last_index_key_;
+  const size_t partition_size_;
+
+  // Index entries in ECT form. Kept along with the regular index entries
+  // until Finish() in case the table turns out not to qualify for ECT.
+  bool ect_;
+  size_t ect_key_length_;
+  std::string ect_keys_;  // Last user key of each data block
+  std::vector<uint32_t> ect_block_sizes_;
+  uint64_t ect_next_offset_;  // Expected offset of the next data block
+  std::string ect_buffer_;
 };
 
+// If "ect" is true, "contents" is an ECT index as built by IndexBlockBuilder.
+// The iterators of an ECT index have empty keys, and their Seek() may stop
+// a few entries before the first entry whose data block ends with a key at
+// or after the target. Callers must move on to later data blocks if the
+// target is after all keys in a data block.
 class IndexBlockReader {
  public:
-  explicit IndexBlockReader(const BlockContents& contents) : block_(contents) {}
+  explicit IndexBlockReader(const BlockContents& contents, bool ect = false);
+  ~IndexBlockReader();
 
-  size_t ApproximateMemoryUsage() const { return block_.size(); }
+  size_t ApproximateMemoryUsage() const;
 
-  Iterator* NewIterator(const Comparator* cmp) {
-    return block_.NewIterator(cmp);
-  }
+  Iterator* NewIterator(const Comparator* cmp);
+
+  bool ect() const { return ect_ != NULL; }
+
+  struct ECTRep;
 
  private:
-  Block block_;
+  ECTRep* ect_;
+  Block* block_;  // NULL if ect_ is not NULL
+
+  // No copying allowed
+  void operator=(const IndexBlockReader&);
+  IndexBlockReader(const IndexBlockReader&);
 };
 
 }  // namespace pdlfs
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+
+#include <set>
+
+namespace pdlfs {
+
+// Coordinates concurrent cache fills for the same key. The first thread to
+// miss a key becomes its loader. Threads missing the same key while the load
+// is in progress wait for the loader to finish and then retry their cache
+// lookups instead of loading the key again. If the loader fails or does not
+// insert its result into the cache, a retrying waiter will miss again and
+// become the next loader.
+//
+// Thread-safe (provides internal synchronization)
+template <typename K>
+class SingleFlight {
+ public:
+  SingleFlight() : cv_(&mu_) {}
+
+  // Return true if the caller has become the loader of "key" and must call
+  // End(key) once its result is in the cache. Otherwise, wait for the current
+  // loader of "key" to finish and return false.
+  bool Begin(const K& key) {
+    MutexLock ml(&mu_);
+    if (inflight_.insert(key).second) {
+      return true;
+    }
+    while (inflight_.count(key) != 0) {
+      cv_.Wait();
+    }
+    return false;
+  }
+
+  void End(const K& key) {
+    MutexLock ml(&mu_);
+    inflight_.erase(key);
+    cv_.SignalAll();
+  }
+
+ private:
+  port::Mutex mu_;
+  port::CondVar cv_;
+  std::set<K> inflight_;
+
+  // No copying allowed
+  void operator=(const SingleFlight&);
+  SingleFlight(const SingleFlight&);
+};
+
+}  // namespace pdlfs
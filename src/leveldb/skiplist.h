@@ -21,7 +21,9 @@
 #include "pdlfs-common/random.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <atomic>
 
 // Thread safety
 // -------------
@@ -57,12 +59,22 @@ class SkipList {
   // Create a new SkipList object that will use "cmp" for comparing keys,
   // and will allocate memory using "*arena".  Objects allocated in the arena
   // must remain allocated for the lifetime of the skiplist object.
-  explicit SkipList(Comparator cmp, Arena* arena);
+  // Set "concurrent" if *arena may be used by other threads through
+  // Arena::AllocateConcurrently() at the time of construction.
+  explicit SkipList(Comparator cmp, Arena* arena, bool concurrent = false);
 
   // Insert key into the list.
   // REQUIRES: nothing that compares equal to key is currently in the list.
+  // REQUIRES: external synchronization between writers.
   void Insert(const Key& key);
 
+  // Like Insert(), but may be called by multiple threads at the same time.
+  // Nodes are linked into the list using compare-and-swap, and are allocated
+  // using Arena::AllocateAlignedConcurrently().
+  // REQUIRES: nothing that compares equal to key is currently in the list.
+  // REQUIRES: all concurrent writers use InsertConcurrently().
+  void InsertConcurrently(const Key& key);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
@@ -114,20 +126,21 @@ class SkipList {
 
   Node* const head_;
 
-  // Modified only by Insert().  Read racily by readers, but stale
-  // values are ok.
-  port::AtomicPointer max_height_;  // Height of the entire list
+  // Modified only by Insert() and InsertConcurrently().  Read racily by
+  // readers, but stale values are ok.
+  std::atomic<int> max_height_;  // Height of the entire list
 
   inline int GetMaxHeight() const {
-    return static_cast<int>(
-        reinterpret_cast<intptr_t>(max_height_.NoBarrier_Load()));
+    return max_height_.load(std::memory_order_relaxed);
   }
 
   // Read/written only by Insert().
   Random rnd_;
 
-  Node* NewNode(const Key& key, int height);
+  Node* NewNode(const Key& key, int height, bool concurrent = false);
   int RandomHeight();
+  // Thread-safe variant of RandomHeight() for InsertConcurrently().
+  static int ConcurrentRandomHeight();
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
   // Return true if key is greater than the data stored in "n"
@@ -140,6 +153,13 @@ class SkipList {
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting at "before", find the two adjacent nodes at "level" between
+  // which key belongs. Set *prev to the node before key and *next to the
+  // node after key (NULL if none).
+  // REQUIRES: before is head_ or a node with a key < key.
+  void FindSpliceForLevel(const Key& key, Node* before, int level, Node** prev,
+                          Node** next) const;
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -166,35 +186,44 @@ struct SkipList<Key, Comparator>::Node {
     assert(n >= 0);
     // Use an 'acquire load' so that we observe a fully initialized
     // version of the returned Node.
-    return reinterpret_cast<Node*>(next_[n].Acquire_Load());
+    return next_[n].load(std::memory_order_acquire);
   }
   void SetNext(int n, Node* x) {
     assert(n >= 0);
     // Use a 'release store' so that anybody who reads through this
     // pointer observes a fully initialized version of the inserted node.
-    next_[n].Release_Store(x);
+    next_[n].store(x, std::memory_order_release);
+  }
+  // Link x after this node at level n iff the current link is still
+  // "expected". Has the same barrier as SetNext() when it succeeds.
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].compare_exchange_strong(expected, x,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed);
   }
 
   // No-barrier variants that can be safely used in a few locations.
   Node* NoBarrier_Next(int n) {
     assert(n >= 0);
-    return reinterpret_cast<Node*>(next_[n].NoBarrier_Load());
+    return next_[n].load(std::memory_order_relaxed);
   }
   void NoBarrier_SetNext(int n, Node* x) {
     assert(n >= 0);
-    next_[n].NoBarrier_Store(x);
+    next_[n].store(x, std::memory_order_relaxed);
   }
 
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
-  port::AtomicPointer next_[1];
+  std::atomic<Node*> next_[1];
 };
 
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::NewNode(
-    const Key& key, int height) {
-  char* mem = arena_->AllocateAligned(
-      sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+    const Key& key, int height, bool concurrent) {
+  const size_t n = sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
+  char* const mem = concurrent ? arena_->AllocateAlignedConcurrently(n)
+                               : arena_->AllocateAligned(n);
   return new (mem) Node(key);
 }
 
@@ -263,6 +292,32 @@ int SkipList<Key, Comparator>::RandomHeight() {
   return height;
 }
 
+template <typename Key, class Comparator>
+int SkipList<Key, Comparator>::ConcurrentRandomHeight() {
+  // Each thread draws heights from its own xorshift generator seeded by the
+  // address of its thread-local state
+#if defined(__GNUC__)
+  static __thread uint32_t seed = 0;
+#else
+  static thread_local uint32_t seed = 0;
+#endif
+  if (seed == 0) {
+    seed = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&seed)) | 1;
+  }
+  static const unsigned int kBranching = 4;
+  int height = 1;
+  while (height < kMaxHeight) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    if ((seed % kBranching) != 0) {
+      break;
+    }
+    height++;
+  }
+  return height;
+}
+
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
   // NULL n is considered infinite
@@ -292,6 +347,24 @@ SkipList<Key, Comparator>::FindGreaterOrEqual(const Key& key,
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::FindSpliceForLevel(const Key& key,
+                                                   Node* before, int level,
+                                                   Node** prev,
+                                                   Node** next) const {
+  Node* x = before;
+  while (true) {
+    Node* const n = x->Next(level);
+    if (KeyIsAfterNode(key, n)) {
+      x = n;
+    } else {
+      *prev = x;
+      *next = n;
+      return;
+    }
+  }
+}
+
 template <typename Key, class Comparator>
 typename SkipList<Key, Comparator>::Node*
 SkipList<Key, Comparator>::FindLessThan(const Key& key) const {
@@ -334,11 +407,12 @@ typename SkipList<Key, Comparator>::Node* SkipList<Key, Comparator>::FindLast()
 }
 
 template <typename Key, class Comparator>
-SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena)
+SkipList<Key, Comparator>::SkipList(Comparator cmp, Arena* arena,
+                                    bool concurrent)
     : compare_(cmp),
       arena_(arena),
-      head_(NewNode(0 /* any key will do */, kMaxHeight)),
-      max_height_(reinterpret_cast<void*>(1)),
+      head_(NewNode(0 /* any key will do */, kMaxHeight, concurrent)),
+      max_height_(1),
       rnd_(0xdeadbeef) {
   for (int i = 0; i < kMaxHeight; i++) {
     head_->SetNext(i, NULL);
@@ -369,7 +443,7 @@ void SkipList<Key, Comparator>::Insert(const Key& key) {
     // the loop below.  In the former case the reader will
     // immediately drop to the next level since NULL sorts after all
     // keys.  In the latter case the reader will use the new node.
-    max_height_.NoBarrier_Store(reinterpret_cast<void*>(height));
+    max_height_.store(height, std::memory_order_relaxed);
   }
 
   x = NewNode(key, height);
@@ -381,6 +455,49 @@ void SkipList<Key, Comparator>::Insert(const Key& key) {
   }
 }
 
+template <typename Key, class Comparator>
+void SkipList<Key, Comparator>::InsertConcurrently(const Key& key) {
+  const int height = ConcurrentRandomHeight();
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    // Readers that see the new height before the new node is linked into the
+    // upper levels simply find NULL links there, as in Insert().
+    if (max_height_.compare_exchange_weak(max_height, height,
+                                          std::memory_order_relaxed)) {
+      max_height = height;
+      break;
+    }
+  }
+
+  // Find the splice at each level from top to bottom. Levels above our own
+  // height only serve to narrow the search.
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* before = head_;
+  for (int i = max_height - 1; i >= 0; i--) {
+    FindSpliceForLevel(key, before, i, &prev[i], &next[i]);
+    before = prev[i];
+  }
+
+  // Our data structure does not allow duplicate insertion
+  assert(next[0] == NULL || !Equal(key, next[0]->key));
+
+  Node* const x = NewNode(key, height, true);
+  // Link bottom up so that a node reachable at a level is always reachable
+  // at all levels below it. If a CAS fails because another writer has linked
+  // a node into our splice, recompute the splice at that level starting from
+  // the old predecessor, which is still before key.
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      FindSpliceForLevel(key, prev[i], i, &prev[i], &next[i]);
+    }
+  }
+}
+
 template <typename Key, class Comparator>
 bool SkipList<Key, Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, NULL);
@@ -374,6 +374,68 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+// Multiple writers inserting disjoint sets of keys through
+// InsertConcurrently() must not lose any of them.
+namespace {
+struct ConcurrentInsertState {
+  SkipList<Key, Comparator>* list;
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_writers;
+  int done;
+
+  ConcurrentInsertState() : cv(&mu), done(0) {}
+};
+
+struct ConcurrentInsertArg {
+  ConcurrentInsertState* state;
+  int id;
+};
+
+static void ConcurrentInserter(void* arg) {
+  ConcurrentInsertArg* a = reinterpret_cast<ConcurrentInsertArg*>(arg);
+  ConcurrentInsertState* state = a->state;
+  for (int i = 0; i < 5000; i++) {
+    state->list->InsertConcurrently(
+        static_cast<Key>(i * state->num_writers + a->id));
+  }
+  state->mu.Lock();
+  state->done++;
+  state->cv.SignalAll();
+  state->mu.Unlock();
+}
+}  // namespace
+
+TEST(SkipTest, ConcurrentInsert) {
+  const int kWriters = 4;
+  Arena arena;
+  Comparator cmp;
+  SkipList<Key, Comparator> list(cmp, &arena);
+  ConcurrentInsertState state;
+  state.list = &list;
+  state.num_writers = kWriters;
+  ConcurrentInsertArg args[kWriters];
+  for (int i = 0; i < kWriters; i++) {
+    args[i].state = &state;
+    args[i].id = i;
+    Env::Default()->StartThread(ConcurrentInserter, &args[i]);
+  }
+  state.mu.Lock();
+  while (state.done < kWriters) {
+    state.cv.Wait();
+  }
+  state.mu.Unlock();
+
+  SkipList<Key, Comparator>::Iterator iter(&list);
+  iter.SeekToFirst();
+  for (Key k = 0; k < static_cast<Key>(5000 * kWriters); k++) {
+    ASSERT_TRUE(iter.Valid());
+    ASSERT_EQ(k, iter.key());
+    iter.Next();
+  }
+  ASSERT_TRUE(!iter.Valid());
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
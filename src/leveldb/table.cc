@@ -16,6 +16,7 @@
  */
 #include "filter_block.h"
 #include "index_block.h"
+#include "single_flight.h"
 #include "two_level_iterator.h"
 
 #include "pdlfs-common/leveldb/block.h"
@@ -30,6 +31,10 @@
 #include "pdlfs-common/cache.h"
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace pdlfs {
 
@@ -42,16 +47,32 @@ struct Table::Rep {
   const char* filter_data;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
-  IndexBlockReader* index_block;
+  IndexBlockReader* index_block;  // The top-level index if partitioned
+  bool partitioned_index;
+  bool partitioned_filter;  // Index partitions come with filters
+  bool ect_index;           // The index is an ECT index instead of a block
+  // Compression dictionary for data blocks, or NULL if there is none
+  port::ZstdDecompressionDict* dict;
 
   TableProperties props;  // All properties embedded in the table
   bool props_valid;
+
+  // Concurrent block cache fills, indexed by block offset
+  SingleFlight<uint64_t> block_loads;
+  // Set once a block read returns contents that cannot be cached (e.g., from
+  // an mmap()ed file). Coalescing reads is pointless after that.
+  std::atomic<bool> uncachable_blocks;
+  // Set once such a file also returns a block that can be cached (e.g., a
+  // decompressed one). Until then, the block cache is not even looked up.
+  std::atomic<bool> cachable_blocks;
+  std::atomic<uint64_t>* coalesced_loads;
   Rep() {}
 
   ~Rep() {
     delete filter;
     delete[] filter_data;
     delete index_block;
+    port::Zstd_DeleteDecompressionDict(dict);
   }
 };
 
@@ -76,34 +97,51 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     return s;
   }
 
-  // Read the index block
+  Rep* rep = new Table::Rep;
+  rep->options = options;
+  rep->file = file;
+  rep->metaindex_handle = footer.metaindex_handle();
+  rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
+  rep->index_block = NULL;
+  rep->filter_data = NULL;
+  rep->filter = NULL;
+  rep->props_valid = false;
+  rep->partitioned_index = false;
+  rep->partitioned_filter = false;
+  rep->ect_index = false;
+  rep->dict = NULL;
+  rep->uncachable_blocks.store(false);
+  rep->cachable_blocks.store(false);
+  rep->coalesced_loads = NULL;
+  Table* t = new Table(rep);
+  // The table properties tell how to read the index block
+  s = t->ReadMeta(footer);
+  if (!s.ok()) {
+    delete t;
+    return s;
+  }
+
+  // Read the index block. ECT indexes are always verified as they are not
+  // safe to decode if corrupted.
   BlockContents contents;
   ReadOptions opt;
-  if (options.paranoid_checks) {
+  if (options.paranoid_checks || rep->ect_index) {
     opt.verify_checksums = true;
   }
   s = ReadBlock(file, opt, footer.index_handle(), &contents);
   if (s.ok()) {
     // We've successfully read the footer and the index block: we're
     // ready to serve requests.
-    Rep* rep = new Table::Rep;
-    rep->options = options;
-    rep->file = file;
-    rep->metaindex_handle = footer.metaindex_handle();
-    rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
-    rep->index_block = new IndexBlockReader(contents);
-    rep->filter_data = NULL;
-    rep->filter = NULL;
-    rep->props_valid = false;
-
-    *table = new Table(rep);
-    (*table)->ReadMeta(footer);
+    rep->index_block = new IndexBlockReader(contents, rep->ect_index);
+    *table = t;
+  } else {
+    delete t;
   }
 
   return s;
 }
 
-void Table::ReadMeta(const Footer& footer) {
+Status Table::ReadMeta(const Footer& footer) {
   Rep* r = rep_;
   // TODO(sanjay): Skip this if footer.metaindex_handle() size indicates
   // it is an empty block.
@@ -114,7 +152,7 @@ void Table::ReadMeta(const Footer& footer) {
   BlockContents contents;
   if (!ReadBlock(r->file, opt, footer.metaindex_handle(), &contents).ok()) {
     // Do not propagate errors since meta info is not needed for operation
-    return;
+    return Status::OK();
   }
   Block* meta = new Block(contents);
   Iterator* iter = meta->NewIterator(BytewiseComparator());
@@ -125,20 +163,40 @@ void Table::ReadMeta(const Footer& footer) {
     ReadProperties(iter->value());
   }
 
-  if (r->options.filter_policy != NULL) {
-    std::string key = "filter.";
+  // Data blocks cannot be read without the dictionary they are compressed
+  // with, if any, so failing to load it fails the table.
+  Status s;
+  Slice dict_key("zstd.dict");
+  iter->Seek(dict_key);
+  if (iter->Valid() && iter->key() == dict_key) {
+    s = ReadDict(iter->value());
+  }
+
+  r->ect_index = r->props_valid && r->props.ect_index();
+  if (r->props_valid && r->props.partitioned_index()) {
+    r->partitioned_index = true;
+    if (r->options.filter_policy != NULL) {
+      std::string key = "partitionedfilter.";
+      key.append(r->options.filter_policy->Name());
+      iter->Seek(key);
+      r->partitioned_filter = iter->Valid() && iter->key() == Slice(key);
+    }
+  } else if (r->options.filter_policy != NULL) {
+    const bool whole_table = r->props_valid && r->props.whole_table_filter();
+    std::string key = whole_table ? "fullfilter." : "filter.";
     key.append(r->options.filter_policy->Name());
     iter->Seek(key);
     if (iter->Valid() && iter->key() == Slice(key)) {
-      ReadFilter(iter->value());
+      ReadFilter(iter->value(), whole_table);
     }
   }
 
   delete iter;
   delete meta;
+  return s;
 }
 
-void Table::ReadFilter(const Slice& handle_value) {
+void Table::ReadFilter(const Slice& handle_value, bool whole_table) {
   Rep* r = rep_;
   Slice v = handle_value;
   BlockHandle handle;
@@ -156,7 +214,8 @@ void Table::ReadFilter(const Slice& handle_value) {
   if (!ReadBlock(r->file, opt, handle, &block).ok()) {
     return;
   }
-  r->filter = new FilterBlockReader(r->options.filter_policy, block.data);
+  r->filter =
+      new FilterBlockReader(r->options.filter_policy, block.data, whole_table);
   if (block.heap_allocated) {
     r->filter_data = block.data.data();  // Will need to delete later
   }
@@ -186,6 +245,35 @@ void Table::ReadProperties(const Slice& props_handle_value) {
   }
 }
 
+Status Table::ReadDict(const Slice& dict_handle_value) {
+  Rep* r = rep_;
+  Slice v = dict_handle_value;
+  BlockHandle handle;
+  Status s = handle.DecodeFrom(&v);
+  if (!s.ok()) {
+    return s;
+  }
+
+  ReadOptions opt;
+  if (r->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents block;
+  s = ReadBlock(r->file, opt, handle, &block);
+  if (!s.ok()) {
+    return s;
+  }
+  r->dict = port::Zstd_NewDecompressionDict(block.data.data(),
+                                            block.data.size());
+  if (block.heap_allocated) {
+    delete[] block.data.data();
+  }
+  if (r->dict == NULL) {
+    return Status::NotSupported("cannot load zstd dictionary");
+  }
+  return s;
+}
+
 static void DeleteBlock(void* arg, void* ignored) {
   delete reinterpret_cast<Block*>(arg);
 }
@@ -205,7 +293,88 @@ static void ReleaseBlock(void* arg, void* h) {
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
                              const Slice& index_value) {
-  Table* table = reinterpret_cast<Table*>(arg);
+  return reinterpret_cast<Table*>(arg)->NewBlockIterator(options, index_value,
+                                                         NULL);
+}
+
+void Table::BlockBatchReader(void* arg, const ReadOptions& options, size_t n,
+                             const Slice* index_values, Iterator** results) {
+  const Table* const table = reinterpret_cast<Table*>(arg);
+  std::vector<BlockContents*> prefetched;
+  table->PrefetchBlocks(options, n, index_values, &prefetched);
+  for (size_t i = 0; i < n; i++) {
+    results[i] =
+        table->NewBlockIterator(options, index_values[i], NULL, prefetched[i]);
+  }
+}
+
+// Max number of data blocks read at once by InternalMultiGet()
+static const size_t kMultiGetGroupSize = 32;
+
+static void DeletePrefetched(BlockContents* prefetched) {
+  if (prefetched != NULL) {
+    if (prefetched->heap_allocated) {
+      delete[] prefetched->data.data();
+    }
+    delete prefetched;
+  }
+}
+
+void Table::PrefetchBlocks(const ReadOptions& options, size_t n,
+                           const Slice* index_values,
+                           std::vector<BlockContents*>* results) const {
+  Rep* const r = rep_;
+  Cache* const block_cache = r->options.block_cache;
+  results->assign(n, NULL);
+  std::vector<BlockHandle> handles;
+  std::vector<size_t> positions;  // Where each block to read is in the input
+  for (size_t i = 0; i < n; i++) {
+    BlockHandle handle;
+    Slice input = index_values[i];
+    if (!handle.DecodeFrom(&input).ok()) {
+      continue;  // Reported by NewBlockIterator()
+    }
+    if (block_cache != NULL &&
+        (!r->uncachable_blocks.load(std::memory_order_relaxed) ||
+         r->cachable_blocks.load(std::memory_order_relaxed))) {
+      char cache_key_buffer[16];
+      EncodeFixed64(cache_key_buffer, r->cache_id);
+      EncodeFixed64(cache_key_buffer + 8, handle.offset());
+      Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+      Cache::Handle* const cache_handle = block_cache->Lookup(key);
+      if (cache_handle != NULL) {
+        block_cache->Release(cache_handle);
+        continue;
+      }
+    }
+    handles.push_back(handle);
+    positions.push_back(i);
+  }
+  // A single block gains nothing from batching and is better read by
+  // NewBlockIterator(), which coalesces concurrent reads of it
+  if (handles.size() < 2) {
+    return;
+  }
+  std::vector<BlockContents> contents(handles.size());
+  std::vector<Status> statuses(handles.size());
+  ReadBlocks(r->file, options, handles.size(), &handles[0], &contents[0],
+             &statuses[0], r->dict);
+  for (size_t j = 0; j < handles.size(); j++) {
+    // Blocks that failed are read again by NewBlockIterator() to report
+    // their errors
+    if (statuses[j].ok()) {
+      (*results)[positions[j]] = new BlockContents(contents[j]);
+    }
+  }
+}
+
+// Same as BlockReader(). If "get_target" is not NULL, the returned iterator
+// is positioned for a point lookup of *get_target.
+Iterator* Table::NewBlockIterator(const ReadOptions& options,
+                                  const Slice& index_value,
+                                  const Slice* get_target,
+                                  BlockContents* prefetched) const {
+  const Table* table = this;
   Cache* block_cache = table->rep_->options.block_cache;
   Block* block = NULL;
   Cache::Handle* cache_handle = NULL;
@@ -219,34 +388,80 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
   if (s.ok()) {
     BlockContents contents;
     if (block_cache != NULL) {
+      Rep* const r = table->rep_;
       char cache_key_buffer[16];
-      EncodeFixed64(cache_key_buffer, table->rep_->cache_id);
+      EncodeFixed64(cache_key_buffer, r->cache_id);
       EncodeFixed64(cache_key_buffer + 8, handle.offset());
       Slice key(cache_key_buffer, sizeof(cache_key_buffer));
-      cache_handle = block_cache->Lookup(key);
+      // Blocks served in place by the file are never cached
+      if (!r->uncachable_blocks.load(std::memory_order_relaxed) ||
+          r->cachable_blocks.load(std::memory_order_relaxed)) {
+        cache_handle = block_cache->Lookup(key);
+      }
+      // Only one thread reads a missing block; the others wait for it and
+      // then fetch the block from the cache
+      bool loading = false;
+      while (cache_handle == NULL && prefetched == NULL && options.fill_cache &&
+             !r->uncachable_blocks.load(std::memory_order_relaxed)) {
+        if (r->block_loads.Begin(handle.offset())) {
+          loading = true;
+          // The previous loader may have finished right before we began
+          cache_handle = block_cache->Lookup(key);
+          break;
+        }
+        cache_handle = block_cache->Lookup(key);
+        if (cache_handle != NULL && r->coalesced_loads != NULL) {
+          r->coalesced_loads->fetch_add(1, std::memory_order_relaxed);
+        }
+      }
       if (cache_handle != NULL) {
         block = reinterpret_cast<Block*>(block_cache->Value(cache_handle));
       } else {
-        s = ReadBlock(table->rep_->file, options, handle, &contents);
+        if (prefetched != NULL) {
+          contents = *prefetched;
+          delete prefetched;
+          prefetched = NULL;
+        } else {
+          s = ReadBlock(r->file, options, handle, &contents, r->dict);
+        }
         if (s.ok()) {
           block = new Block(contents);
-          if (contents.cachable && options.fill_cache) {
-            cache_handle = block_cache->Insert(key, block, block->size(),
-                                               &DeleteCachedBlock);
+          if (!contents.cachable) {
+            r->uncachable_blocks.store(true, std::memory_order_relaxed);
+          } else {
+            r->cachable_blocks.store(true, std::memory_order_relaxed);
+            if (options.fill_cache) {
+              cache_handle = block_cache->Insert(key, block, block->size(),
+                                                 &DeleteCachedBlock);
+            }
           }
         }
       }
+      if (loading) {
+        r->block_loads.End(handle.offset());
+      }
     } else {
-      s = ReadBlock(table->rep_->file, options, handle, &contents);
+      if (prefetched != NULL) {
+        contents = *prefetched;
+        delete prefetched;
+        prefetched = NULL;
+      } else {
+        s = ReadBlock(table->rep_->file, options, handle, &contents,
+                      table->rep_->dict);
+      }
       if (s.ok()) {
         block = new Block(contents);
       }
     }
   }
+  // Not used if the block was found in the cache
+  DeletePrefetched(prefetched);
 
   Iterator* iter;
   if (block != NULL) {
-    iter = block->NewIterator(table->rep_->options.comparator);
+    const Comparator* const cmp = table->rep_->options.comparator;
+    iter = get_target != NULL ? block->NewIteratorForGet(cmp, *get_target)
+                              : block->NewIterator(cmp);
     if (cache_handle == NULL) {
       iter->RegisterCleanup(&DeleteBlock, block, NULL);
     } else {
@@ -258,34 +473,155 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
   return iter;
 }
 
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  BlockContents* contents = reinterpret_cast<BlockContents*>(value);
+  if (contents->heap_allocated) {
+    delete[] contents->data.data();
+  }
+  delete contents;
+}
+
+// Check "key" against the filter partition whose handle is encoded in
+// "filter_handle_value". Filter partitions are cached in the block cache
+// along with data blocks and index partitions.
+bool Table::PartitionFilterMayMatch(const ReadOptions& options,
+                                    const Slice& filter_handle_value,
+                                    const Slice& key) const {
+  Rep* const r = rep_;
+  BlockHandle handle;
+  Slice input = filter_handle_value;
+  if (!handle.DecodeFrom(&input).ok()) {
+    return true;  // Errors are treated as potential matches
+  }
+  const FilterPolicy* const policy = r->options.filter_policy;
+  Cache* const block_cache = r->options.block_cache;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, r->cache_id);
+  EncodeFixed64(cache_key_buffer + 8, handle.offset());
+  Slice cache_key(cache_key_buffer, sizeof(cache_key_buffer));
+  Cache::Handle* cache_handle = NULL;
+  BlockContents* contents = NULL;
+  BlockContents tmp;
+  if (block_cache != NULL &&
+      (!r->uncachable_blocks.load(std::memory_order_relaxed) ||
+       r->cachable_blocks.load(std::memory_order_relaxed))) {
+    cache_handle = block_cache->Lookup(cache_key);
+  }
+  if (cache_handle != NULL) {
+    contents =
+        reinterpret_cast<BlockContents*>(block_cache->Value(cache_handle));
+  } else {
+    if (!ReadBlock(r->file, options, handle, &tmp).ok()) {
+      return true;
+    }
+    if (!tmp.cachable) {
+      r->uncachable_blocks.store(true, std::memory_order_relaxed);
+    } else {
+      r->cachable_blocks.store(true, std::memory_order_relaxed);
+    }
+    if (block_cache != NULL && tmp.cachable && options.fill_cache) {
+      contents = new BlockContents(tmp);
+      cache_handle = block_cache->Insert(
+          cache_key, contents, contents->data.size(), &DeleteCachedFilter);
+    } else {
+      contents = &tmp;
+    }
+  }
+  // Partitions without keys have empty filters
+  const bool result =
+      !contents->data.empty() && policy->KeyMayMatch(key, contents->data);
+  if (cache_handle != NULL) {
+    block_cache->Release(cache_handle);
+  } else if (tmp.heap_allocated) {
+    delete[] tmp.data.data();
+  }
+  return result;
+}
+
+Iterator* Table::NewIndexIterator(const ReadOptions& options) const {
+  Iterator* iter = rep_->index_block->NewIterator(rep_->options.comparator);
+  if (rep_->partitioned_index) {
+    // Index partitions are read and cached the same way as data blocks
+    iter = NewTwoLevelIterator(iter, &Table::BlockReader,
+                               const_cast<Table*>(this), options);
+  }
+  return iter;
+}
+
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  Iterator* readahead_index_iter = NULL;
+  if (options.readahead_pool != NULL && options.readahead_blocks > 0) {
+    // Readahead walks the index with a cursor of its own
+    readahead_index_iter = NewIndexIterator(options);
+  }
+  return NewTwoLevelIterator(NewIndexIterator(options), &Table::BlockReader,
+                             const_cast<Table*>(this), options,
+                             readahead_index_iter, &Table::BlockBatchReader);
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
                           void (*saver)(void*, const Slice&, const Slice&)) {
   Status s;
-  Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  FilterBlockReader* filter = rep_->filter;
+  if (filter != NULL && filter->whole_table()) {
+    if (!filter->KeyMayMatch(k)) {
+      return s;  // Not found; skip the index search altogether
+    }
+    filter = NULL;
+  }
+  Iterator* iiter;
+  if (rep_->partitioned_index) {
+    // Find the index partition and check its filter before reading it
+    iiter = NULL;
+    Iterator* titer = rep_->index_block->NewIterator(rep_->options.comparator);
+    titer->Seek(k);
+    if (titer->Valid()) {
+      Slice handle_value = titer->value();
+      BlockHandle handle;
+      if (rep_->partitioned_filter && handle.DecodeFrom(&handle_value).ok() &&
+          !PartitionFilterMayMatch(options, handle_value, k)) {
+        // Not found
+      } else {
+        iiter = BlockReader(this, options, titer->value());
+      }
+    }
+    s = titer->status();
+    delete titer;
+    if (iiter == NULL) {
+      return s;
+    }
+  } else {
+    iiter = rep_->index_block->NewIterator(rep_->options.comparator);
+  }
   iiter->Seek(k);
-  if (iiter->Valid()) {
+  while (iiter->Valid()) {
     Slice handle_value = iiter->value();
-    FilterBlockReader* filter = rep_->filter;
     BlockHandle handle;
     if (filter != NULL && handle.DecodeFrom(&handle_value).ok() &&
         !filter->KeyMayMatch(handle.offset(), k)) {
-      // Not found
-    } else {
-      Iterator* block_iter = BlockReader(this, options, iiter->value());
+      break;  // Not found
+    }
+    Iterator* block_iter;
+    if (rep_->ect_index) {
+      // A data block hash index miss does not tell whether "k" is after all
+      // keys in the block, so it is not used with an ECT index
+      block_iter = NewBlockIterator(options, iiter->value(), NULL);
       block_iter->Seek(k);
-      if (block_iter->Valid()) {
-        Slice v = (options.limit != 0) ? block_iter->value() : Slice();
-        (*saver)(arg, block_iter->key(), v);
-      }
-      s = block_iter->status();
-      delete block_iter;
+    } else {
+      block_iter = NewBlockIterator(options, iiter->value(), &k);
     }
+    const bool found = block_iter->Valid();
+    if (found) {
+      Slice v = (options.limit != 0) ? block_iter->value() : Slice();
+      (*saver)(arg, block_iter->key(), v);
+    }
+    s = block_iter->status();
+    delete block_iter;
+    // An ECT index may have positioned us one block too early
+    if (found || !s.ok() || !rep_->ect_index) {
+      break;
+    }
+    iiter->Next();
   }
   if (s.ok()) {
     s = iiter->status();
@@ -294,9 +630,129 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
   return s;
 }
 
+void Table::InternalMultiGet(const ReadOptions& options, size_t n,
+                             const Slice* keys, void* const* args,
+                             void (*saver)(void*, const Slice&, const Slice&),
+                             Status* statuses) {
+  if (rep_->ect_index) {
+    // Blocks found through an ECT index may need to be skipped over, which
+    // does not mix well with sharing blocks among keys
+    for (size_t i = 0; i < n; i++) {
+      statuses[i] = InternalGet(options, keys[i], args[i], saver);
+    }
+    return;
+  }
+  FilterBlockReader* filter = rep_->filter;
+  std::vector<size_t> todo;
+  todo.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    statuses[i] = Status::OK();
+    // Check all keys against the whole table filter before reading anything
+    if (filter == NULL || !filter->whole_table() ||
+        filter->KeyMayMatch(keys[i])) {
+      todo.push_back(i);
+    }
+  }
+  if (filter != NULL && filter->whole_table()) {
+    filter = NULL;
+  }
+
+  const Comparator* const cmp = rep_->options.comparator;
+  // Find the data block of each key first so that blocks missing from the
+  // block cache can be read together. With sorted keys, consecutive keys
+  // often hit the same index partition or data block. We keep the last of
+  // them open and only move on once a key lands elsewhere.
+  Iterator* titer = NULL;
+  Iterator* iiter = NULL;
+  std::string partition;
+  std::vector<std::string> blocks;
+  const size_t kNoBlock = ~static_cast<size_t>(0);
+  std::vector<size_t> block_of(todo.size(), kNoBlock);  // Index into blocks
+  for (size_t j = 0; j < todo.size(); j++) {
+    const size_t i = todo[j];
+    const Slice& k = keys[i];
+    if (rep_->partitioned_index) {
+      if (titer == NULL) {
+        titer = rep_->index_block->NewIterator(cmp);
+      }
+      titer->Seek(k);
+      if (!titer->Valid()) {
+        statuses[i] = titer->status();
+        continue;
+      }
+      Slice handle_value = titer->value();
+      BlockHandle handle;
+      if (rep_->partitioned_filter && handle.DecodeFrom(&handle_value).ok() &&
+          !PartitionFilterMayMatch(options, handle_value, k)) {
+        continue;  // Not found
+      }
+      if (iiter == NULL || titer->value() != Slice(partition)) {
+        delete iiter;
+        iiter = BlockReader(this, options, titer->value());
+        partition = titer->value().ToString();
+      }
+    } else if (iiter == NULL) {
+      iiter = rep_->index_block->NewIterator(cmp);
+    }
+    iiter->Seek(k);
+    if (!iiter->Valid()) {
+      statuses[i] = iiter->status();
+      continue;
+    }
+    Slice handle_value = iiter->value();
+    BlockHandle handle;
+    if (filter != NULL && handle.DecodeFrom(&handle_value).ok() &&
+        !filter->KeyMayMatch(handle.offset(), k)) {
+      continue;  // Not found
+    }
+    if (blocks.empty() || iiter->value() != Slice(blocks.back())) {
+      blocks.push_back(iiter->value().ToString());
+    }
+    block_of[j] = blocks.size() - 1;
+  }
+  delete iiter;
+  delete titer;
+
+  // Read blocks in groups to bound the memory held by blocks read ahead
+  // of their use
+  std::vector<Slice> group;
+  std::vector<BlockContents*> prefetched;
+  size_t j = 0;
+  for (size_t first = 0; first < blocks.size(); first += kMultiGetGroupSize) {
+    const size_t m = std::min(kMultiGetGroupSize, blocks.size() - first);
+    group.assign(blocks.begin() + first, blocks.begin() + first + m);
+    PrefetchBlocks(options, m, &group[0], &prefetched);
+    for (size_t b = first; b < first + m; b++) {
+      Iterator* block_iter = NULL;
+      for (; j < todo.size() && (block_of[j] == kNoBlock || block_of[j] <= b);
+           j++) {
+        if (block_of[j] != b) {
+          continue;  // No block to search
+        }
+        const size_t i = todo[j];
+        const Slice& k = keys[i];
+        if (block_iter == NULL) {
+          // Positioned through the block's hash index, if any. Tables with
+          // an ECT index, which cannot use it, never get here.
+          block_iter = NewBlockIterator(options, blocks[b], &k,
+                                        prefetched[b - first]);
+          prefetched[b - first] = NULL;
+        } else {
+          block_iter->Seek(k);
+        }
+        if (block_iter->Valid()) {
+          Slice v = (options.limit != 0) ? block_iter->value() : Slice();
+          (*saver)(args[i], block_iter->key(), v);
+        }
+        statuses[i] = block_iter->status();
+      }
+      delete block_iter;
+    }
+  }
+}
+
 uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
-  Iterator* index_iter =
-      rep_->index_block->NewIterator(rep_->options.comparator);
+  Iterator* index_iter = NewIndexIterator(ReadOptions());
   index_iter->Seek(key);
   uint64_t result;
   if (index_iter->Valid()) {
@@ -323,6 +779,10 @@ uint64_t Table::ApproximateOffsetOf(const Slice& key) const {
 
 Table::~Table() { delete rep_; }
 
+void Table::SetCoalescedLoadCounter(std::atomic<uint64_t>* counter) {
+  rep_->coalesced_loads = counter;
+}
+
 const TableProperties* Table::GetProperties() const {
   Rep* r = rep_;
   if (r->props_valid) {
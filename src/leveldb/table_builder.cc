@@ -29,8 +29,10 @@
 #include "pdlfs-common/coding.h"
 #include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/env.h"
+#include "pdlfs-common/port.h"
 
 #include <assert.h>
+#include <vector>
 
 namespace pdlfs {
 
@@ -62,21 +64,42 @@ struct TableBuilder::Rep {
 
   std::string compressed_output;
 
+  // With zstd_dict_size set, data blocks are sampled until there are enough
+  // samples to train a dictionary. All later data blocks are compressed
+  // using the dictionary.
+  bool sampling;
+  std::string samples;
+  std::vector<size_t> sample_sizes;
+  std::string dict;  // Empty if no dictionary has been trained
+  port::ZstdCompressionDict* cdict;  // "dict" digested for compression
+
   Rep(const Options& options, WritableFile* f)
       : options(options),
         file(f),
         offset(0),
         data_block(options.block_restart_interval, options.comparator),
-        index_block(options.index_block_restart_interval, options.comparator),
+        index_block(options.index_block_restart_interval, options.comparator,
+                    options.index_partition_size, options.ect_index),
         num_entries(0),
         num_blocks(0),
         closed(false),
         filter_block(options.filter_policy != NULL
-                         ? new FilterBlockBuilder(options.filter_policy)
+                         ? new FilterBlockBuilder(
+                               options.filter_policy,
+                               options.whole_table_filter ||
+                                   options.index_partition_size != 0 ||
+                                   options.ect_index)
                          : NULL),
-        pending_index_entry(false) {
+        pending_index_entry(false),
+        sampling(options.zstd_dict_size != 0),
+        cdict(NULL) {
     assert(options.comparator != NULL);
+    if (options.data_block_hash_index) {
+      data_block.EnableHashIndex();
+    }
   }
+
+  ~Rep() { port::Zstd_DeleteCompressionDict(cdict); }
 };
 
 Status TableBuilder::status() const { return rep_->status; }
@@ -111,6 +134,13 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.whole_table_filter != rep_->options.whole_table_filter ||
+      options.index_partition_size != rep_->options.index_partition_size ||
+      options.data_block_hash_index != rep_->options.data_block_hash_index ||
+      options.ect_index != rep_->options.ect_index) {
+    return Status::InvalidArgument(
+        "changing table format while building table");
+  }
 
   rep_->options = options;
   rep_->data_block.ChangeRestartInterval(rep_->options.block_restart_interval);
@@ -140,6 +170,9 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
     assert(r->data_block.empty());
     r->index_block.AddIndexEntry(&r->last_key, &key, r->pending_handle);
     r->pending_index_entry = false;
+    if (r->index_block.PartitionFull()) {
+      FlushIndexPartition();
+    }
   }
 
   if (r->filter_block != NULL) {
@@ -176,13 +209,62 @@ void TableBuilder::Flush() {
   }
 }
 
+// Write out the current index partition along with a filter over all keys
+// added since the previous partition.
+void TableBuilder::FlushIndexPartition() {
+  Rep* r = rep_;
+  assert(r->index_block.partitioned());
+  if (!ok()) return;
+  BlockHandle filter_handle;
+  if (r->filter_block != NULL) {
+    WriteRawBlock(r->filter_block->Finish(), kNoCompression, &filter_handle);
+  }
+  BlockHandle partition_handle;
+  if (ok()) {
+    WriteBlock(r->index_block.FinishPartition(), &partition_handle);
+  }
+  if (ok()) {
+    r->index_block.AddPartition(
+        partition_handle, r->filter_block != NULL ? &filter_handle : NULL);
+  }
+}
+
 void TableBuilder::AddBlock(BlockBuilder* builder, BlockHandle* handle) {
-  WriteBlock(builder->Finish(), handle);
+  Rep* r = rep_;
+  const Slice block_contents = builder->Finish();
+  if (r->sampling && r->options.compression == kZstdCompression) {
+    SampleBlock(block_contents);
+  }
+  WriteBlock(block_contents, handle, r->cdict);
   builder->Reset();
 }
 
-void TableBuilder::WriteBlock(const Slice& block_contents,
-                              BlockHandle* handle) {
+// Keep a copy of a data block for training a compression dictionary. Train
+// the dictionary once enough data has been collected.
+void TableBuilder::SampleBlock(const Slice& block_contents) {
+  Rep* r = rep_;
+  assert(r->sampling);
+  r->samples.append(block_contents.data(), block_contents.size());
+  r->sample_sizes.push_back(block_contents.size());
+  if (r->samples.size() >= r->options.zstd_dict_training_size) {
+    // Data blocks are compressed without a dictionary if training fails
+    if (port::Zstd_TrainDictionary(r->samples, &r->sample_sizes[0],
+                                   r->sample_sizes.size(),
+                                   r->options.zstd_dict_size, &r->dict)) {
+      r->cdict = port::Zstd_NewCompressionDict(
+          r->options.zstd_level, r->dict.data(), r->dict.size());
+      if (r->cdict == NULL) {
+        r->dict.clear();
+      }
+    }
+    r->sampling = false;
+    std::string().swap(r->samples);
+    std::vector<size_t>().swap(r->sample_sizes);
+  }
+}
+
+void TableBuilder::WriteBlock(const Slice& block_contents, BlockHandle* handle,
+                              const port::ZstdCompressionDict* dict) {
   // File format contains a sequence of blocks where each block has:
   //    block_data: uint8[n]
   //    type: uint8
@@ -191,26 +273,36 @@ void TableBuilder::WriteBlock(const Slice& block_contents,
   Rep* r = rep_;
   Slice raw_block_contents;
   CompressionType type = r->options.compression;
+  std::string* compressed = &r->compressed_output;
+  bool compressed_ok = false;
   switch (type) {
     case kNoCompression:
-      raw_block_contents = block_contents;
       break;
 
-    case kSnappyCompression: {
-      std::string* compressed = &r->compressed_output;
-      if (port::Snappy_Compress(block_contents.data(), block_contents.size(),
-                                compressed) &&
-          compressed->size() <
-              block_contents.size() - (block_contents.size() / 8u)) {
-        raw_block_contents = *compressed;
-      } else {
-        // Snappy not supported, or compressed less than 12.5%, so just
-        // store uncompressed form
-        raw_block_contents = block_contents;
-        type = kNoCompression;
-      }
+    case kSnappyCompression:
+      compressed_ok = port::Snappy_Compress(
+          block_contents.data(), block_contents.size(), compressed);
       break;
-    }
+
+    case kLZ4Compression:
+      compressed_ok = port::LZ4_Compress(block_contents.data(),
+                                         block_contents.size(), compressed);
+      break;
+
+    case kZstdCompression:
+      compressed_ok = port::Zstd_Compress(
+          r->options.zstd_level, block_contents.data(), block_contents.size(),
+          compressed, dict);
+      break;
+  }
+  if (compressed_ok && compressed->size() < block_contents.size() -
+                                                (block_contents.size() / 8u)) {
+    raw_block_contents = *compressed;
+  } else {
+    // Compression disabled or not supported, or compressed less than 12.5%,
+    // so just store uncompressed form
+    raw_block_contents = block_contents;
+    type = kNoCompression;
   }
   WriteRawBlock(raw_block_contents, type, handle);
   r->compressed_output.clear();
@@ -243,12 +335,26 @@ Status TableBuilder::Finish() {
   r->closed = true;
   BlockHandle filter_block_handle;
   BlockHandle props_block_handle;
+  BlockHandle dict_block_handle;
   BlockHandle metaindex_block_handle;
   BlockHandle index_block_handle;
 
+  // The format of the index must be settled before writing the table
+  // properties
+  if (ok() && r->pending_index_entry) {
+    // The last key is still needed for the table properties
+    std::string last_index_key = r->last_key;
+    r->index_block.AddIndexEntry(&last_index_key, NULL, r->pending_handle);
+    r->pending_index_entry = false;
+  }
+  const bool partitioned = r->index_block.partitioned();
+  if (partitioned && !r->index_block.PartitionEmpty()) {
+    FlushIndexPartition();
+  }
+
   // Write filter block
   if (ok()) {
-    if (r->filter_block != NULL) {
+    if (r->filter_block != NULL && !partitioned) {
       WriteRawBlock(r->filter_block->Finish(), kNoCompression,
                     &filter_block_handle);
     }
@@ -257,18 +363,35 @@ Status TableBuilder::Finish() {
   // Write stats
   if (ok()) {
     r->props_.SetLastKey(r->last_key);
+    r->props_.SetWholeTableFilter(r->filter_block != NULL && !partitioned &&
+                                  r->filter_block->whole_table());
+    r->props_.SetPartitionedIndex(partitioned);
+    r->props_.SetECTIndex(r->index_block.ect_index());
     std::string props_encoding;
     r->props_.EncodeTo(&props_encoding);
     WriteRawBlock(props_encoding, kNoCompression, &props_block_handle);
   }
 
+  // Write compression dictionary
+  if (ok() && !r->dict.empty()) {
+    WriteRawBlock(r->dict, kNoCompression, &dict_block_handle);
+  }
+
   // Write metaindex block
   if (ok()) {
     BlockBuilder meta_index_block(1);
 
-    if (r->filter_block != NULL) {
-      // Add mapping from "filter.Name" to location of filter data
-      std::string key = "filter.";
+    if (r->filter_block != NULL && partitioned) {
+      // Filters are found through the index. Record the filter policy used.
+      std::string key = "partitionedfilter.";
+      key.append(r->options.filter_policy->Name());
+      meta_index_block.Add(key, Slice());
+    } else if (r->filter_block != NULL) {
+      // Add mapping from "filter.Name" to location of filter data. Whole-table
+      // filters use "fullfilter.Name" so that readers unaware of them never
+      // mistake one for a regular filter block.
+      std::string key =
+          r->filter_block->whole_table() ? "fullfilter." : "filter.";
       key.append(r->options.filter_policy->Name());
       std::string handle_encoding;
       filter_block_handle.EncodeTo(&handle_encoding);
@@ -280,16 +403,18 @@ Status TableBuilder::Finish() {
     props_block_handle.EncodeTo(&handle_encoding);
     meta_index_block.Add(key, handle_encoding);
 
+    if (!r->dict.empty()) {
+      handle_encoding.clear();
+      dict_block_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add("zstd.dict", handle_encoding);
+    }
+
     WriteRawBlock(meta_index_block.Finish(), kNoCompression,
                   &metaindex_block_handle);
   }
 
   // Write index block
   if (ok()) {
-    if (r->pending_index_entry) {
-      r->index_block.AddIndexEntry(&r->last_key, NULL, r->pending_handle);
-      r->pending_index_entry = false;
-    }
     WriteBlock(r->index_block.Finish(), &index_block_handle);
   }
 
@@ -16,11 +16,16 @@
 
 namespace pdlfs {
 
+enum { kWholeTableFilter = 0x1, kPartitionedIndex = 0x2, kECTIndex = 0x4 };
+
 TableProperties::~TableProperties() {}
 
 void TableProperties::Clear() {
   min_seq_ = kMaxSequenceNumber;
   max_seq_ = 0;
+  whole_table_filter_ = false;
+  partitioned_index_ = false;
+  ect_index_ = false;
   first_key_.clear();
   last_key_.clear();
 }
@@ -30,6 +35,11 @@ void TableProperties::EncodeTo(std::string* dst) const {
   PutVarint64(dst, max_seq_);
   PutLengthPrefixedSlice(dst, first_key_);
   PutLengthPrefixedSlice(dst, last_key_);
+  uint32_t flags = 0;
+  if (whole_table_filter_) flags |= kWholeTableFilter;
+  if (partitioned_index_) flags |= kPartitionedIndex;
+  if (ect_index_) flags |= kECTIndex;
+  PutVarint32(dst, flags);
 }
 
 Status TableProperties::DecodeFrom(const Slice& src) {
@@ -44,6 +54,14 @@ Status TableProperties::DecodeFrom(const Slice& src) {
   }
   SetFirstKey(first_key);
   SetLastKey(last_key);
+  // Tables written by older versions have no flags
+  uint32_t flags = 0;
+  if (!input.empty() && !GetVarint32(&input, &flags)) {
+    return Status::Corruption(Slice());
+  }
+  whole_table_filter_ = (flags & kWholeTableFilter) != 0;
+  partitioned_index_ = (flags & kPartitionedIndex) != 0;
+  ect_index_ = (flags & kECTIndex) != 0;
   return Status::OK();
 }
 
@@ -9,16 +9,25 @@
  * found in the LICENSE file. See the AUTHORS file for names of contributors.
  */
 #include "pdlfs-common/leveldb/table.h"
+#include "pdlfs-common/leveldb/block.h"
 #include "pdlfs-common/leveldb/comparator.h"
+#include "pdlfs-common/leveldb/format.h"
 #include "pdlfs-common/leveldb/internal_types.h"
+#include "pdlfs-common/leveldb/iterator.h"
 #include "pdlfs-common/leveldb/options.h"
 #include "pdlfs-common/leveldb/table_builder.h"
 #include "pdlfs-common/leveldb/table_properties.h"
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/pdlfs_config.h"
 #include "pdlfs-common/testharness.h"
 #include "pdlfs-common/testutil.h"
 
+#include <atomic>
 #include <map>
+#include <stdio.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace pdlfs {
 
@@ -56,8 +65,13 @@ class StringSink : public WritableFile {
 
 class StringSource : public RandomAccessFile {
  public:
-  StringSource(const Slice& contents)
-      : contents_(contents.data(), contents.size()) {}
+  // Blocks are returned in place, as if from an mmap()ed file, if "in_place"
+  // is true. Otherwise, they are copied to the buffers of the callers.
+  explicit StringSource(const Slice& contents, bool in_place = false)
+      : contents_(contents.data(), contents.size()),
+        in_place_(in_place),
+        num_multi_reads_(0),
+        num_multi_read_blocks_(0) {}
 
   virtual ~StringSource() {}
 
@@ -71,13 +85,29 @@ class StringSource : public RandomAccessFile {
     if (offset + n > contents_.size()) {
       n = contents_.size() - offset;
     }
-    memcpy(scratch, &contents_[offset], n);
-    *result = Slice(scratch, n);
+    if (in_place_) {
+      *result = Slice(contents_.data() + offset, n);
+    } else {
+      memcpy(scratch, &contents_[offset], n);
+      *result = Slice(scratch, n);
+    }
     return Status::OK();
   }
 
+  virtual void MultiRead(ReadRequest* reqs, size_t n) const {
+    num_multi_reads_.fetch_add(1);
+    num_multi_read_blocks_.fetch_add(int(n));
+    RandomAccessFile::MultiRead(reqs, n);
+  }
+
+  int num_multi_reads() const { return num_multi_reads_.load(); }
+  int num_multi_read_blocks() const { return num_multi_read_blocks_.load(); }
+
  private:
   std::string contents_;
+  bool in_place_;
+  mutable std::atomic<int> num_multi_reads_;
+  mutable std::atomic<int> num_multi_read_blocks_;
 };
 
 typedef std::map<std::string, std::string, STLLessThan> KVMap;
@@ -99,6 +129,8 @@ class TableWriter {
     data_[key] = value;
   }
 
+  const KVMap& data() const { return data_; }
+
   Slice SmallestKey() const {
     if (data_.empty()) {
       return Slice();
@@ -132,8 +164,9 @@ class TableReader {
   Table* table_;
 
  public:
-  TableReader(const Options& options, const std::string& contents)
-      : file_(contents) {
+  TableReader(const Options& options, const std::string& contents,
+              bool in_place = false)
+      : file_(contents, in_place) {
     Status s;
     s = Table::Open(options, &file_, file_.Size(), &table_);
     ASSERT_TRUE(s.ok());
@@ -141,6 +174,9 @@ class TableReader {
 
   ~TableReader() { delete table_; }
 
+  Table* table() { return table_; }
+  const StringSource* file() const { return &file_; }
+
   Slice SmallestKey() {
     const TableProperties* const props = table_->GetProperties();
     ASSERT_TRUE(props != NULL);
@@ -213,6 +249,427 @@ TEST(TableTest, ReadWrite) {
   ASSERT_EQ(reader.MaxSeq(), kMinSequenceNumber + kNumEntries - 1);
 }
 
+TEST(TableTest, PartitionedIndex) {
+  Options options;
+  options.block_size = 256;
+  options.index_partition_size = 128;
+  options.block_cache = NewLRUCache(1 << 20);
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  TableReader reader(options, contents);
+  const TableProperties* const props = reader.table()->GetProperties();
+  ASSERT_TRUE(props != NULL);
+  ASSERT_TRUE(props->partitioned_index());
+  ASSERT_EQ(reader.SmallestKey(), writer.SmallestKey());
+  ASSERT_EQ(reader.LargestKey(), writer.LargestKey());
+
+  // Walk the table forward and backward
+  Iterator* const iter = reader.table()->NewIterator(ReadOptions());
+  KVMap::const_iterator it = writer.data().begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != writer.data().end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    ASSERT_EQ(iter->value().ToString(), it->second);
+  }
+  ASSERT_TRUE(it == writer.data().end());
+  KVMap::const_reverse_iterator rit = writer.data().rbegin();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rit) {
+    ASSERT_TRUE(rit != writer.data().rend());
+    ASSERT_EQ(iter->key().ToString(), rit->first);
+  }
+  ASSERT_TRUE(rit == writer.data().rend());
+
+  // Seek to every key
+  for (it = writer.data().begin(); it != writer.data().end(); ++it) {
+    iter->Seek(it->first);
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+
+  ASSERT_LT(reader.table()->ApproximateOffsetOf(writer.SmallestKey()),
+            reader.table()->ApproximateOffsetOf(writer.LargestKey()));
+  delete options.block_cache;
+}
+
+namespace {
+// Counts the tasks scheduled on a thread pool.
+class CountingPool : public ThreadPool {
+ public:
+  explicit CountingPool(ThreadPool* base) : base_(base), num_scheduled_(0) {}
+  virtual ~CountingPool() { delete base_; }
+
+  virtual void Schedule(void (*function)(void*), void* arg) {
+    num_scheduled_.fetch_add(1);
+    base_->Schedule(function, arg);
+  }
+
+  virtual std::string ToDebugString() { return base_->ToDebugString(); }
+  virtual void Pause() { base_->Pause(); }
+  virtual void Resume() { base_->Resume(); }
+
+  int num_scheduled() const { return num_scheduled_.load(); }
+
+ private:
+  ThreadPool* const base_;
+  std::atomic<int> num_scheduled_;
+};
+
+// Holds scheduled tasks until told to run them, like a pool whose threads
+// are all busy.
+class StalledPool : public ThreadPool {
+ public:
+  StalledPool() {}
+  virtual ~StalledPool() { assert(tasks_.empty()); }
+
+  virtual void Schedule(void (*function)(void*), void* arg) {
+    tasks_.push_back(std::make_pair(function, arg));
+  }
+
+  virtual std::string ToDebugString() { return "stalled"; }
+  virtual void Pause() {}
+  virtual void Resume() {}
+
+  size_t num_scheduled() const { return tasks_.size(); }
+
+  void RunAll() {
+    for (size_t i = 0; i < tasks_.size(); i++) {
+      (*tasks_[i].first)(tasks_[i].second);
+    }
+    tasks_.clear();
+  }
+
+ private:
+  std::vector<std::pair<void (*)(void*), void*> > tasks_;
+};
+
+// Runs each task as soon as it is scheduled.
+class InlinePool : public ThreadPool {
+ public:
+  InlinePool() {}
+  virtual ~InlinePool() {}
+
+  virtual void Schedule(void (*function)(void*), void* arg) {
+    (*function)(arg);
+  }
+
+  virtual std::string ToDebugString() { return "inline"; }
+  virtual void Pause() {}
+  virtual void Resume() {}
+};
+}  // namespace
+
+TEST(TableTest, Readahead) {
+  for (int partitioned = 0; partitioned < 2; partitioned++) {
+    Options options;
+    options.block_size = 256;
+    if (partitioned) {
+      options.index_partition_size = 128;
+    }
+    TableWriter writer(options);
+    std::string contents = CreateTable(&writer);
+    TableReader reader(options, contents);
+    CountingPool pool(ThreadPool::NewFixed(2));
+    ReadOptions read_options;
+    read_options.readahead_blocks = 8;
+    read_options.readahead_pool = &pool;
+    Iterator* const iter = reader.table()->NewIterator(read_options);
+
+    // Scans read ahead
+    KVMap::const_iterator it = writer.data().begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+      ASSERT_TRUE(it != writer.data().end());
+      ASSERT_EQ(iter->key().ToString(), it->first);
+      ASSERT_EQ(iter->value().ToString(), it->second);
+    }
+    ASSERT_TRUE(it == writer.data().end());
+    ASSERT_GT(pool.num_scheduled(), 0);
+
+    // Seeks and backward moves discard blocks read ahead
+    Random rnd(301);
+    for (int i = 0; i < 100; i++) {
+      const std::string key = RandomInternalKey(&rnd, kMinSequenceNumber);
+      iter->Seek(key);
+      it = writer.data().lower_bound(key);
+      for (int j = 0; j < 50 && it != writer.data().end(); j++, ++it) {
+        ASSERT_TRUE(iter->Valid());
+        ASSERT_EQ(iter->key().ToString(), it->first);
+        iter->Next();
+      }
+      for (int j = 0; j < 20 && iter->Valid(); j++) {
+        iter->Prev();
+        --it;
+        ASSERT_TRUE(iter->Valid());
+        ASSERT_EQ(iter->key().ToString(), it->first);
+      }
+    }
+    ASSERT_OK(iter->status());
+    delete iter;  // Waits for reads in progress
+  }
+}
+
+TEST(TableTest, ReadaheadBatchesReads) {
+  Options options;
+  options.block_size = 256;
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  TableReader reader(options, contents);
+  InlinePool pool;
+  ReadOptions read_options;
+  read_options.readahead_blocks = 8;
+  read_options.readahead_pool = &pool;
+  Iterator* const iter = reader.table()->NewIterator(read_options);
+  KVMap::const_iterator it = writer.data().begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != writer.data().end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+  }
+  ASSERT_TRUE(it == writer.data().end());
+  ASSERT_OK(iter->status());
+  delete iter;
+
+  // Blocks read ahead together are fetched with a single MultiRead()
+  const int reads = reader.file()->num_multi_reads();
+  const int blocks = reader.file()->num_multi_read_blocks();
+  ASSERT_GT(reads, 0);
+  ASSERT_GE(blocks, 2 * reads);
+}
+
+TEST(TableTest, ReadaheadStalledPool) {
+  Options options;
+  options.block_size = 256;
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  TableReader reader(options, contents);
+  StalledPool pool;
+  ReadOptions read_options;
+  read_options.readahead_blocks = 8;
+  read_options.readahead_pool = &pool;
+  Iterator* const iter = reader.table()->NewIterator(read_options);
+
+  // Blocks whose reads never start are read by the iterator itself
+  KVMap::const_iterator it = writer.data().begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != writer.data().end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+  }
+  ASSERT_TRUE(it == writer.data().end());
+  ASSERT_OK(iter->status());
+  ASSERT_GT(pool.num_scheduled(), 0);
+
+  // Tasks of blocks read inline return at once
+  pool.RunAll();
+  delete iter;  // Waits for all tasks to run
+}
+
+namespace {
+// Counts the lookups and insertions made to a cache.
+class CountingCache : public Cache {
+ public:
+  explicit CountingCache(Cache* base)
+      : base_(base), num_lookups_(0), num_inserts_(0) {}
+  virtual ~CountingCache() { delete base_; }
+
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    num_inserts_.fetch_add(1);
+    return base_->Insert(key, value, charge, deleter);
+  }
+
+  virtual Handle* Lookup(const Slice& key) {
+    num_lookups_.fetch_add(1);
+    return base_->Lookup(key);
+  }
+
+  virtual void Release(Handle* handle) { base_->Release(handle); }
+  virtual void* Value(Handle* handle) { return base_->Value(handle); }
+  virtual void Erase(const Slice& key) { base_->Erase(key); }
+  virtual uint64_t NewId() { return base_->NewId(); }
+
+  int num_lookups() const { return num_lookups_.load(); }
+  int num_inserts() const { return num_inserts_.load(); }
+
+ private:
+  Cache* const base_;
+  std::atomic<int> num_lookups_;
+  std::atomic<int> num_inserts_;
+};
+}  // namespace
+
+TEST(TableTest, InPlaceBlocksBypassCache) {
+  Options options;
+  options.block_size = 256;
+  options.compression = kNoCompression;
+  CountingCache cache(NewLRUCache(1 << 20));
+  options.block_cache = &cache;
+  TableWriter writer(options);
+  std::string contents = CreateTable(&writer);
+  for (int in_place = 0; in_place < 2; in_place++) {
+    TableReader reader(options, contents, in_place);
+    const int lookups = cache.num_lookups();
+    const int inserts = cache.num_inserts();
+    Iterator* const iter = reader.table()->NewIterator(ReadOptions());
+    KVMap::const_iterator it = writer.data().begin();
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+      ASSERT_TRUE(it != writer.data().end());
+      ASSERT_EQ(iter->key().ToString(), it->first);
+      ASSERT_EQ(iter->value().ToString(), it->second);
+    }
+    ASSERT_TRUE(it == writer.data().end());
+    ASSERT_OK(iter->status());
+    delete iter;
+    if (in_place) {
+      // Only the first block is looked up
+      ASSERT_LE(cache.num_lookups() - lookups, 2);
+      ASSERT_EQ(cache.num_inserts(), inserts);
+    } else {
+      ASSERT_GT(cache.num_lookups() - lookups, 1);
+      ASSERT_GT(cache.num_inserts(), inserts);
+    }
+  }
+}
+
+static uint64_t IndexBlockSize(const std::string& contents) {
+  Footer footer;
+  Slice input(contents.data() + contents.size() - Footer::kEncodedLength,
+              Footer::kEncodedLength);
+  ASSERT_OK(footer.DecodeFrom(&input));
+  return footer.index_handle().size();
+}
+
+TEST(TableTest, ECTIndex) {
+  Options options;
+  options.block_size = 256;
+  options.compression = kNoCompression;
+  TableWriter writer(options);
+  const std::string regular_contents = CreateTable(&writer);
+  options.ect_index = true;
+  TableWriter ect_writer(options);
+  std::string contents = CreateTable(&ect_writer);
+  TableReader reader(options, contents);
+  const TableProperties* const props = reader.table()->GetProperties();
+  ASSERT_TRUE(props != NULL);
+#if defined(PDLFS_SILT_ECT)
+  ASSERT_TRUE(props->ect_index());
+  ASSERT_LT(IndexBlockSize(contents) * 4, IndexBlockSize(regular_contents));
+#else
+  // Tables fall back to a regular index block
+  ASSERT_TRUE(!props->ect_index());
+  ASSERT_EQ(IndexBlockSize(contents), IndexBlockSize(regular_contents));
+#endif
+
+  // Walk the table forward and backward
+  Iterator* const iter = reader.table()->NewIterator(ReadOptions());
+  KVMap::const_iterator it = writer.data().begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != writer.data().end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+  }
+  ASSERT_TRUE(it == writer.data().end());
+  KVMap::const_reverse_iterator rit = writer.data().rbegin();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev(), ++rit) {
+    ASSERT_TRUE(rit != writer.data().rend());
+    ASSERT_EQ(iter->key().ToString(), rit->first);
+  }
+  ASSERT_TRUE(rit == writer.data().rend());
+
+  // Seek to every key and to keys not in the table
+  for (it = writer.data().begin(); it != writer.data().end(); ++it) {
+    iter->Seek(it->first);
+    ASSERT_TRUE(iter->Valid());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+  }
+  Random rnd(test::RandomSeed());
+  for (int i = 0; i < 1000; i++) {
+    const std::string key = RandomInternalKey(&rnd, kMinSequenceNumber);
+    iter->Seek(key);
+    it = writer.data().lower_bound(key);
+    if (it == writer.data().end()) {
+      ASSERT_TRUE(!iter->Valid());
+    } else {
+      ASSERT_TRUE(iter->Valid());
+      ASSERT_EQ(iter->key().ToString(), it->first);
+    }
+  }
+  ASSERT_OK(iter->status());
+  delete iter;
+}
+
+static std::string CreateRecordTable(TableWriter* writer) {
+  char key[20];
+  char value[100];
+  for (int i = 0; i < kNumEntries; i++) {
+    snprintf(key, sizeof(key), "user%08d", i);
+    snprintf(value, sizeof(value),
+             "{\"id\": %d, \"name\": \"user-%d\", \"status\": \"active\"}",
+             i, i);
+    std::string ikey;
+    AppendInternalKey(&ikey, ParsedInternalKey(key, kMinSequenceNumber,
+                                               kTypeValue));
+    writer->Put(ikey, value);
+  }
+  writer->Finish();
+  return writer->contents();
+}
+
+TEST(TableTest, ZstdDictionary) {
+  Options options;
+  options.block_size = 256;
+  options.compression = kZstdCompression;
+  TableWriter writer(options);
+  const std::string plain_contents = CreateRecordTable(&writer);
+  options.zstd_dict_size = 1024;
+  options.zstd_dict_training_size = 8192;
+  TableWriter dict_writer(options);
+  std::string contents = CreateRecordTable(&dict_writer);
+#if defined(PDLFS_ZSTD)
+  // Small blocks compress much better with a dictionary
+  ASSERT_LT(contents.size(), plain_contents.size() * 3 / 4);
+#endif
+
+  TableReader reader(options, contents);
+  Iterator* const iter = reader.table()->NewIterator(ReadOptions());
+  KVMap::const_iterator it = writer.data().begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != writer.data().end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    ASSERT_EQ(iter->value().ToString(), it->second);
+  }
+  ASSERT_TRUE(it == writer.data().end());
+  ASSERT_OK(iter->status());
+  delete iter;
+
+#if defined(PDLFS_ZSTD)
+  // Find the dictionary through the metaindex block and corrupt it
+  Footer footer;
+  Slice input(contents.data() + contents.size() - Footer::kEncodedLength,
+              Footer::kEncodedLength);
+  ASSERT_OK(footer.DecodeFrom(&input));
+  StringSource file(contents);
+  BlockContents meta_contents;
+  ASSERT_OK(ReadBlock(&file, ReadOptions(), footer.metaindex_handle(),
+                      &meta_contents));
+  Block meta(meta_contents);
+  Iterator* const meta_iter = meta.NewIterator(BytewiseComparator());
+  meta_iter->Seek("zstd.dict");
+  ASSERT_TRUE(meta_iter->Valid() && meta_iter->key() == "zstd.dict");
+  Slice v = meta_iter->value();
+  BlockHandle dict_handle;
+  ASSERT_OK(dict_handle.DecodeFrom(&v));
+  delete meta_iter;
+  contents[dict_handle.offset()] ^= 0x80;
+
+  // Data blocks cannot be read without the dictionary
+  options.paranoid_checks = true;
+  StringSource corrupted_file(contents);
+  Table* table = NULL;
+  ASSERT_TRUE(!Table::Open(options, &corrupted_file, contents.size(), &table)
+                   .ok());
+  ASSERT_TRUE(table == NULL);
+#endif
+}
+
 }  // namespace pdlfs
 
 int main(int argc, char** argv) {
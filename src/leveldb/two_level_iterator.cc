@@ -21,15 +21,204 @@
 #include "pdlfs-common/leveldb/iterator_wrapper.h"
 #include "pdlfs-common/leveldb/options.h"
 
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/mutexlock.h"
+#include "pdlfs-common/port.h"
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
 namespace pdlfs {
 namespace {
 
 typedef Iterator* (*BlockFunction)(void*, const ReadOptions&, const Slice&);
+typedef void (*BlockBatchFunction)(void*, const ReadOptions&, size_t,
+                                   const Slice*, Iterator**);
+
+// Blocks read ahead of a two-level iterator. Blocks are queued in index
+// order. Each batch of blocks added between calls to Submit() is read by a
+// single task scheduled on options.readahead_pool, through the batch
+// function if there is one. A block whose read has not started when the
+// iterator reaches it is read by the iterator itself, so a busy pool never
+// stalls the iterator. A block is abandoned when the iterator skips or
+// takes it before its task is done, in which case the task deletes the
+// block. The destructor waits for all tasks to run so that none is left
+// referencing the readahead. Tasks whose blocks are all abandoned before
+// they start return at once.
+class Readahead {
+ public:
+  Readahead(BlockFunction block_function,
+            BlockBatchFunction block_batch_function, void* arg,
+            const ReadOptions& options)
+      : block_function_(block_function),
+        block_batch_function_(block_batch_function),
+        arg_(arg),
+        options_(options),
+        cv_(&mu_),
+        num_pending_(0) {}
+
+  ~Readahead() {
+    assert(batch_.empty());
+    MutexLock l(&mu_);
+    Clear();
+    while (num_pending_ != 0) {
+      cv_.Wait();
+    }
+  }
+
+  // Return the number of blocks queued.
+  size_t NumQueued() {
+    MutexLock l(&mu_);
+    return queue_.size();
+  }
+
+  // Queue the block with the given index value for reading by the next
+  // batch submitted.
+  void Add(const Slice& index_value) {
+    Block* const b = new Block;
+    b->index_value = index_value.ToString();
+    b->iter = NULL;
+    b->started = false;
+    b->ready = false;
+    b->abandoned = false;
+    batch_.push_back(b);
+    MutexLock l(&mu_);
+    queue_.push_back(b);
+  }
+
+  // Start reading the blocks added since the last call in the background.
+  void Submit() {
+    if (batch_.empty()) {
+      return;
+    }
+    Batch* const batch = new Batch;
+    batch->ra = this;
+    batch->blocks.swap(batch_);
+    {
+      MutexLock l(&mu_);
+      num_pending_++;
+    }
+    options_.readahead_pool->Schedule(ReadBatch, batch);
+  }
+
+  // If the block with the given index value is next in the queue, return an
+  // iterator over it, reading the block now if its read has not started or
+  // waiting for the read otherwise. Otherwise, abandon all queued blocks and
+  // return NULL.
+  Iterator* Take(const Slice& index_value) {
+    MutexLock l(&mu_);
+    if (queue_.empty() || index_value != Slice(queue_.front()->index_value)) {
+      Clear();
+      return NULL;
+    }
+    Block* const b = queue_.front();
+    queue_.pop_front();
+    if (!b->started) {
+      b->abandoned = true;  // The task will delete the block
+      mu_.Unlock();
+      Iterator* const iter = (*block_function_)(arg_, options_, index_value);
+      mu_.Lock();
+      return iter;
+    }
+    while (!b->ready) {
+      cv_.Wait();
+    }
+    Iterator* const iter = b->iter;
+    delete b;
+    return iter;
+  }
+
+ private:
+  struct Block {
+    std::string index_value;
+    Iterator* iter;
+    bool started;  // True once a task has begun reading the block
+    bool ready;
+    bool abandoned;
+  };
+
+  struct Batch {
+    Readahead* ra;
+    std::vector<Block*> blocks;
+  };
+
+  static void ReadBatch(void* arg) {
+    Batch* const batch = reinterpret_cast<Batch*>(arg);
+    Readahead* const ra = batch->ra;
+    std::vector<Block*> blocks;
+    std::vector<Slice> index_values;
+    MutexLock l(&ra->mu_);
+    for (size_t i = 0; i < batch->blocks.size(); i++) {
+      Block* const b = batch->blocks[i];
+      if (b->abandoned) {
+        delete b;
+      } else {
+        b->started = true;
+        blocks.push_back(b);
+        index_values.push_back(b->index_value);
+      }
+    }
+    delete batch;
+    if (!blocks.empty()) {
+      std::vector<Iterator*> iters(blocks.size());
+      ra->mu_.Unlock();
+      if (ra->block_batch_function_ != NULL) {
+        (*ra->block_batch_function_)(ra->arg_, ra->options_, blocks.size(),
+                                     &index_values[0], &iters[0]);
+      } else {
+        for (size_t i = 0; i < blocks.size(); i++) {
+          iters[i] =
+              (*ra->block_function_)(ra->arg_, ra->options_, index_values[i]);
+        }
+      }
+      ra->mu_.Lock();
+      for (size_t i = 0; i < blocks.size(); i++) {
+        Block* const b = blocks[i];
+        if (b->abandoned) {
+          delete iters[i];
+          delete b;
+        } else {
+          b->iter = iters[i];
+          b->ready = true;
+        }
+      }
+    }
+    ra->num_pending_--;
+    ra->cv_.SignalAll();
+  }
+
+  // REQUIRES: mu_ is held
+  void Clear() {
+    for (size_t i = 0; i < queue_.size(); i++) {
+      Block* const b = queue_[i];
+      if (b->ready) {
+        delete b->iter;
+        delete b;
+      } else {
+        b->abandoned = true;
+      }
+    }
+    queue_.clear();
+  }
+
+  BlockFunction const block_function_;
+  BlockBatchFunction const block_batch_function_;  // May be NULL
+  void* const arg_;
+  const ReadOptions options_;
+  std::vector<Block*> batch_;  // Blocks added but not yet submitted
+  port::Mutex mu_;
+  port::CondVar cv_;
+  std::deque<Block*> queue_;
+  int num_pending_;  // Number of tasks that have yet to run or finish
+};
 
 class TwoLevelIterator : public Iterator {
  public:
   TwoLevelIterator(Iterator* index_iter, BlockFunction block_function,
-                   void* arg, const ReadOptions& options);
+                   void* arg, const ReadOptions& options,
+                   Iterator* readahead_index_iter,
+                   BlockBatchFunction block_batch_function);
 
   virtual ~TwoLevelIterator();
 
@@ -63,10 +252,14 @@ class TwoLevelIterator : public Iterator {
   void SaveError(const Status& s) {
     if (status_.ok() && !s.ok()) status_ = s;
   }
-  void SkipEmptyDataBlocksForward();
+  // If "target" is not NULL, later blocks are searched for "target" instead
+  // of being positioned at their first entries.
+  void SkipEmptyDataBlocksForward(const Slice* target = NULL);
   void SkipEmptyDataBlocksBackward();
   void SetDataIterator(Iterator* data_iter);
-  void InitDataBlock();
+  // "sequential" is true if the index iterator has just moved forward by one.
+  void InitDataBlock(bool sequential = false);
+  void ReadAhead();
 
   BlockFunction block_function_;
   void* arg_;
@@ -77,24 +270,51 @@ class TwoLevelIterator : public Iterator {
   // If data_iter_ is non-NULL, then "data_block_handle_" holds the
   // "index_value" passed to block_function_ to create the data_iter_.
   std::string data_block_handle_;
+  Readahead* readahead_;  // NULL if readahead is disabled
+  int readahead_window_;  // Number of blocks to keep reading ahead
+  // A second cursor over the index for finding blocks to read ahead. When
+  // "readahead_positioned_" is true, it is at the last block queued, or at
+  // the current block if none is queued.
+  IteratorWrapper readahead_index_iter_;
+  bool readahead_positioned_;
 };
 
 TwoLevelIterator::TwoLevelIterator(Iterator* index_iter,
                                    BlockFunction block_function, void* arg,
-                                   const ReadOptions& options)
+                                   const ReadOptions& options,
+                                   Iterator* readahead_index_iter,
+                                   BlockBatchFunction block_batch_function)
     : block_function_(block_function),
       arg_(arg),
       options_(options),
       index_iter_(index_iter),
-      data_iter_(NULL) {}
+      data_iter_(NULL),
+      readahead_(NULL),
+      readahead_window_(0),
+      readahead_positioned_(false) {
+  if (readahead_index_iter != NULL) {
+    if (options.readahead_pool != NULL && options.readahead_blocks > 0) {
+      readahead_ =
+          new Readahead(block_function, block_batch_function, arg, options);
+      readahead_index_iter_.Set(readahead_index_iter);
+    } else {
+      delete readahead_index_iter;
+    }
+  }
+}
 
-TwoLevelIterator::~TwoLevelIterator() {}
+TwoLevelIterator::~TwoLevelIterator() {
+  // Blocks read in the background may reference state that is released
+  // along with the iterators below
+  delete readahead_;
+}
 
 void TwoLevelIterator::Seek(const Slice& target) {
   index_iter_.Seek(target);
   InitDataBlock();
   if (data_iter_.iter() != NULL) data_iter_.Seek(target);
-  SkipEmptyDataBlocksForward();
+  // Some indexes may stop one block before the one holding "target"
+  SkipEmptyDataBlocksForward(&target);
 }
 
 void TwoLevelIterator::SeekToFirst() {
@@ -123,7 +343,7 @@ void TwoLevelIterator::Prev() {
   SkipEmptyDataBlocksBackward();
 }
 
-void TwoLevelIterator::SkipEmptyDataBlocksForward() {
+void TwoLevelIterator::SkipEmptyDataBlocksForward(const Slice* target) {
   while (data_iter_.iter() == NULL || !data_iter_.Valid()) {
     // Move to next block
     if (!index_iter_.Valid()) {
@@ -131,8 +351,14 @@ void TwoLevelIterator::SkipEmptyDataBlocksForward() {
       return;
     }
     index_iter_.Next();
-    InitDataBlock();
-    if (data_iter_.iter() != NULL) data_iter_.SeekToFirst();
+    InitDataBlock(true);
+    if (data_iter_.iter() != NULL) {
+      if (target != NULL) {
+        data_iter_.Seek(*target);
+      } else {
+        data_iter_.SeekToFirst();
+      }
+    }
   }
 }
 
@@ -154,7 +380,7 @@ void TwoLevelIterator::SetDataIterator(Iterator* data_iter) {
   data_iter_.Set(data_iter);
 }
 
-void TwoLevelIterator::InitDataBlock() {
+void TwoLevelIterator::InitDataBlock(bool sequential) {
   if (!index_iter_.Valid()) {
     SetDataIterator(NULL);
   } else {
@@ -163,11 +389,57 @@ void TwoLevelIterator::InitDataBlock() {
       // data_iter_ is already constructed with this iterator, so
       // no need to change anything
     } else {
-      Iterator* iter = (*block_function_)(arg_, options_, handle);
+      Iterator* iter = NULL;
+      if (readahead_ != NULL) {
+        if (!sequential) {
+          readahead_window_ = 0;
+        } else if (readahead_window_ == 0) {
+          readahead_window_ = 1;
+        } else {
+          readahead_window_ =
+              std::min(2 * readahead_window_, options_.readahead_blocks);
+        }
+        iter = readahead_->Take(handle);
+        if (iter == NULL) {
+          // All queued blocks have been dropped
+          readahead_positioned_ = false;
+        }
+      }
+      if (iter == NULL) {
+        iter = (*block_function_)(arg_, options_, handle);
+      }
       data_block_handle_.assign(handle.data(), handle.size());
       SetDataIterator(iter);
+      if (readahead_window_ != 0) {
+        ReadAhead();
+      }
+    }
+  }
+}
+
+// Start reading the blocks following the current one that are not yet
+// queued, up to the readahead window, as a single batch. The readahead cursor
+// stays at the last block queued so that each block is found with a single
+// step. Topping up only once the queue is half drained keeps batches large.
+void TwoLevelIterator::ReadAhead() {
+  int queued = static_cast<int>(readahead_->NumQueued());
+  if (queued > readahead_window_ / 2) {
+    return;
+  }
+  assert(index_iter_.Valid());
+  if (!readahead_positioned_) {
+    assert(queued == 0);
+    readahead_index_iter_.Seek(index_iter_.key());
+    readahead_positioned_ = true;
+  }
+  while (queued < readahead_window_ && readahead_index_iter_.Valid()) {
+    readahead_index_iter_.Next();
+    if (readahead_index_iter_.Valid()) {
+      readahead_->Add(readahead_index_iter_.value());
+      queued++;
     }
   }
+  readahead_->Submit();
 }
 
 }  // namespace
@@ -176,8 +448,11 @@ Iterator* NewTwoLevelIterator(/* clang-format off */
     Iterator* index_iter,
     BlockFunction block_function,
     void* arg,
-    const ReadOptions& options) {
-  return new TwoLevelIterator(index_iter, block_function, arg, options);
+    const ReadOptions& options,
+    Iterator* readahead_index_iter,
+    BlockBatchFunction block_batch_function) {
+  return new TwoLevelIterator(index_iter, block_function, arg, options,
+                              readahead_index_iter, block_batch_function);
 } /* clang-format on */
 
 }  // namespace pdlfs
@@ -16,6 +16,8 @@
  */
 #pragma once
 
+#include <stddef.h>
+
 namespace pdlfs {
 
 class Slice;
@@ -31,10 +33,25 @@ struct ReadOptions;
 //
 // Uses a supplied function to convert an index_iter value into
 // an iterator over the contents of the corresponding block.
+//
+// If "readahead_index_iter" is not NULL, options.readahead_pool is not NULL,
+// and options.readahead_blocks is positive, blocks ahead of the current one
+// are converted on options.readahead_pool when the iterator moves forward
+// block by block. "readahead_index_iter" must be a second iterator over the
+// same index as "index_iter" and is used to find the blocks to read ahead.
+// Takes ownership of it. "block_function" must then be thread-safe. Blocks
+// are read ahead in batches. If "block_batch_function" is not NULL, each
+// batch is converted by a single call to it, which must store an iterator
+// for each of "index_values[0..n-1]" at "results[i]". It must then be
+// thread-safe too.
 extern Iterator* NewTwoLevelIterator(
     Iterator* index_iter,
     Iterator* (*block_function)(void* arg, const ReadOptions& options,
                                 const Slice& index_value),
-    void* arg, const ReadOptions& options);
+    void* arg, const ReadOptions& options,
+    Iterator* readahead_index_iter = NULL,
+    void (*block_batch_function)(void* arg, const ReadOptions& options,
+                                 size_t n, const Slice* index_values,
+                                 Iterator** results) = NULL);
 
 }  // namespace pdlfs
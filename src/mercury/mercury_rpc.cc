@@ -231,6 +231,104 @@ Status MercuryRPC::Client::Call(Message& in, Message& out) RPCNOEXCEPT {
   }
 }
 
+struct MercuryRPC::Client::AsyncState {
+  Client* cli;
+  AddrEntry* addr_entry;
+  hg_handle_t handle;
+  Timer timer;
+  hg_return_t ret;
+  Message* out;
+  Callback cb;
+  void* arg;
+};
+
+hg_return_t MercuryRPC::Client::SaveAsyncReply(const hg_cb_info* info) {
+  AsyncState* state = reinterpret_cast<AsyncState*>(info->arg);
+  hg_handle_t handle = info->info.forward.handle;
+  state->ret = info->ret;
+  if (state->ret == HG_SUCCESS) {
+    state->ret = HG_Get_output(handle, state->out);
+    if (state->ret == HG_SUCCESS) {
+      // XXX: safe for the same reason as explained in SaveReply()
+      HG_Free_output(handle, state->out);
+    }
+  }
+
+  Client* const cli = state->cli;
+  cli->mu_.Lock();
+  cli->outstanding_.erase(state);
+  cli->done_.push_back(state);
+  cli->cv_.SignalAll();
+  cli->mu_.Unlock();
+  return HG_SUCCESS;
+}
+
+Status MercuryRPC::Client::AsyncCall(Message& in, Message& out, Callback cb,
+                                     void* arg) RPCNOEXCEPT {
+  AddrEntry* addr_entry = NULL;
+  hg_return_t ret = rpc_->Lookup(addr_, &addr_entry);
+  if (ret != HG_SUCCESS) return Status::Disconnected(Slice());
+  assert(addr_entry != NULL);
+  hg_addr_t addr = addr_entry->value->rep;
+  AsyncState* const state = new AsyncState;
+  state->cli = this;
+  state->addr_entry = addr_entry;
+  state->out = &out;
+  state->cb = cb;
+  state->arg = arg;
+  ret = HG_Create(rpc_->hg_context_, addr, rpc_->hg_rpc_id_, &state->handle);
+  if (ret == HG_SUCCESS) {
+    mu_.Lock();
+    outstanding_.insert(state);
+    mu_.Unlock();
+    ret = HG_Forward(state->handle, SaveAsyncReply, state, &in);
+    if (ret == HG_SUCCESS) {
+      rpc_->AddTimerFor(state->handle, &state->timer);
+      return Status::OK();
+    }
+    mu_.Lock();
+    outstanding_.erase(state);
+    mu_.Unlock();
+    HG_Destroy(state->handle);
+  }
+  rpc_->Release(addr_entry);
+  delete state;
+  return Status::Disconnected(Slice());
+}
+
+int MercuryRPC::Client::Poll(bool wait) RPCNOEXCEPT {
+  std::vector<AsyncState*> done;
+  mu_.Lock();
+  while (wait && done_.empty() && !outstanding_.empty() && rpc_->ok()) {
+    cv_.TimedWait(500 * 1000);  // 500 milliseconds
+  }
+  done.swap(done_);
+  if (!rpc_->ok()) {
+    // No more replies will arrive, so fail the calls still waiting for them
+    // the same way Call() gives up on its reply
+    std::set<AsyncState*>::iterator it = outstanding_.begin();
+    for (; it != outstanding_.end(); ++it) {
+      (*it)->ret = HG_OTHER_ERROR;
+      done.push_back(*it);
+    }
+    outstanding_.clear();
+  }
+  mu_.Unlock();
+  for (size_t i = 0; i < done.size(); i++) {
+    AsyncState* const state = done[i];
+    rpc_->RemoveTimer(&state->timer);
+    HG_Destroy(state->handle);
+    rpc_->Release(state->addr_entry);
+    if (state->ret != HG_SUCCESS) {
+      state->cb(Status::Disconnected(Slice()), state->arg);
+    } else {
+      state->cb(Status::OK(), state->arg);
+    }
+    delete state;
+  }
+  return int(done.size());
+}
+
 void MercuryRPC::Ref() { ++refs_; }
 
 void MercuryRPC::Unref() {
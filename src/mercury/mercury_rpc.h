@@ -17,7 +17,9 @@
 #include <mercury.h>
 #include <mercury_proc.h>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 namespace pdlfs {
 namespace rpc {
@@ -205,6 +207,13 @@ class MercuryRPC::Client : public If {
   // Return OK on success, a non-OK status on RPC errors.
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
 
+  // Calls are forwarded without waiting for replies. Replies are collected by
+  // the looper threads and reported by Poll(). Once the rpc engine fails,
+  // Poll() reports all calls still waiting for replies as disconnected.
+  virtual Status AsyncCall(Message& in, Message& out, Callback cb,
+                           void* arg) RPCNOEXCEPT;
+  virtual int Poll(bool wait) RPCNOEXCEPT;
+
   virtual ~Client() {
     if (rpc_ != NULL) {
       rpc_->Unref();
@@ -217,6 +226,11 @@ class MercuryRPC::Client : public If {
 
   port::Mutex mu_;
   port::CondVar cv_;
+  struct AsyncState;
+  static hg_return_t SaveAsyncReply(const hg_cb_info* info);
+  // State below is protected by mu_
+  std::vector<AsyncState*> done_;      // Completed calls not yet reported
+  std::set<AsyncState*> outstanding_;  // Calls waiting for replies
   // No copying allowed
   void operator=(const Client&);
   Client(const Client&);
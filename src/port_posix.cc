@@ -139,5 +139,28 @@ uint64_t PthreadId() {
   return thread_id;
 }
 
+#ifdef PDLFS_ZSTD
+namespace {
+// Zstd contexts are expensive to create, so each thread reuses its own
+struct ZstdContexts {
+  ZSTD_CCtx* cctx;
+  ZSTD_DCtx* dctx;
+
+  ZstdContexts() : cctx(ZSTD_createCCtx()), dctx(ZSTD_createDCtx()) {}
+
+  ~ZstdContexts() {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+  }
+};
+
+thread_local ZstdContexts zstd_contexts;
+}  // namespace
+
+ZSTD_CCtx* ZstdCompressionContext() { return zstd_contexts.cctx; }
+
+ZSTD_DCtx* ZstdDecompressionContext() { return zstd_contexts.dctx; }
+#endif
+
 }  // namespace port
 }  // namespace pdlfs
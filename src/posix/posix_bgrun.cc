@@ -11,6 +11,7 @@
 #include "posix_bgrun.h"
 
 #include <stdio.h>
+#include <unistd.h>
 
 namespace pdlfs {
 
@@ -114,4 +115,304 @@ ThreadPool* ThreadPool::NewFixed(int num_threads, bool eager_init, void* attr) {
   return new PosixThreadPool(num_threads, eager_init, attr);
 }
 
+namespace {
+// A bounded multi-producer multi-consumer queue. Each slot carries a sequence
+// number telling producers and consumers whether the slot is ready for them,
+// so neither side takes a lock. Originally designed by Dmitry Vyukov.
+template <typename T, size_t kCapacity>
+class MPMCQueue {
+ public:
+  MPMCQueue() : head_(0), tail_(0) {
+    for (size_t i = 0; i < kCapacity; i++) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool Push(const T& item) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot* const slot = &slots_[pos & (kCapacity - 1)];
+      const size_t seq = slot->seq.load(std::memory_order_acquire);
+      const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          slot->item = item;
+          slot->seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // Full
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool Pop(T* item) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot* const slot = &slots_[pos & (kCapacity - 1)];
+      const size_t seq = slot->seq.load(std::memory_order_acquire);
+      const intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          *item = slot->item;
+          slot->seq.store(pos + kCapacity, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // Empty
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> seq;
+    T item;
+  };
+  // Keep producers and consumers on separate cache lines
+  char pad0_[64];
+  std::atomic<size_t> head_;
+  char pad1_[64];
+  std::atomic<size_t> tail_;
+  char pad2_[64];
+  Slot slots_[kCapacity];
+};
+
+// Set when the current thread is a worker of a work-stealing pool
+struct CurrentWorker {
+  void* pool;
+  int id;
+};
+
+#if defined(__GNUC__)
+__thread CurrentWorker current_worker = {NULL, 0};
+#else
+thread_local CurrentWorker current_worker = {NULL, 0};
+#endif
+
+struct WorkerStartState {
+  PosixWorkStealingPool* pool;
+  int id;
+};
+
+}  // namespace
+
+struct PosixWorkStealingPool::Worker {
+  Worker() : cv(&mu), sleeping(false) {}
+  MPMCQueue<BGItem, 1024> queue;
+  port::Mutex mu;
+  port::CondVar cv;
+  // Set by the worker itself and cleared by whoever wakes it up. Both are done
+  // while holding mu.
+  std::atomic<bool> sleeping;
+};
+
+PosixWorkStealingPool::PosixWorkStealingPool(int max_threads, bool eager_init,
+                                             bool pin_threads)
+    : bg_cv_(&mu_),
+      num_pool_threads_(0),
+      max_threads_(max_threads > 0 ? max_threads : 1),
+      pin_threads_(pin_threads),
+      started_(false),
+      shutting_down_(false),
+      paused_(false),
+      pending_(0),
+      num_sleeping_(0),
+      next_(0),
+      overflow_size_(0) {
+  for (int i = 0; i < max_threads_; i++) {
+    workers_.push_back(new Worker);
+  }
+  if (eager_init) {
+    InitPool();
+  }
+}
+
+PosixWorkStealingPool::~PosixWorkStealingPool() {
+  shutting_down_.store(true);
+  WakeAll();
+  mu_.Lock();
+  while (num_pool_threads_ != 0) {
+    bg_cv_.Wait();
+  }
+  mu_.Unlock();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    delete workers_[i];
+  }
+}
+
+std::string PosixWorkStealingPool::ToDebugString() {
+  char tmp[100];
+  snprintf(tmp, sizeof(tmp), "Tpool: work-stealing max_threads=%d",
+           max_threads_);
+  return tmp;
+}
+
+void* PosixWorkStealingPool::BGWrapper(void* arg) {
+  WorkerStartState* state = reinterpret_cast<WorkerStartState*>(arg);
+  PosixWorkStealingPool* const pool = state->pool;
+  const int id = state->id;
+  delete state;
+#if defined(PDLFS_OS_LINUX)
+  if (pool->pin_threads_) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus > 0) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(id % ncpus, &cpuset);
+      pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    }
+  }
+#endif
+  pool->BGThread(id);
+  return NULL;
+}
+
+void PosixWorkStealingPool::InitPool() {
+  MutexLock ml(&mu_);
+  if (started_.load()) return;
+  while (num_pool_threads_ < max_threads_) {
+    WorkerStartState* state = new WorkerStartState;
+    state->pool = this;
+    state->id = num_pool_threads_;
+    Pthread(BGWrapper, state, NULL);
+    num_pool_threads_++;
+  }
+  started_.store(true);
+}
+
+void PosixWorkStealingPool::Schedule(void (*function)(void*), void* arg) {
+  if (shutting_down_.load()) return;
+  if (!started_.load()) {
+    InitPool();  // Start background threads if necessary
+  }
+
+  BGItem item;
+  item.function = function;
+  item.arg = arg;
+  int target;
+  if (current_worker.pool == this) {
+    target = current_worker.id;
+  } else {
+    target = int(next_.fetch_add(1, std::memory_order_relaxed) %
+                 unsigned(max_threads_));
+  }
+  // Count the task before publishing it so that a worker popping it right
+  // away never drives pending_ below zero. The pending_ increment and the
+  // num_sleeping_ check below pair with the reverse sequence in Park() so
+  // that either we see a sleeping worker or the worker sees our task.
+  pending_.fetch_add(1);
+  if (!workers_[target]->queue.Push(item)) {
+    MutexLock ml(&overflow_mu_);
+    overflow_.push_back(item);
+    overflow_size_.fetch_add(1);
+  }
+
+  if (num_sleeping_.load() != 0) {
+    WakeOne(target);
+  }
+}
+
+bool PosixWorkStealingPool::Get(int id, BGItem* item) {
+  const int n = max_threads_;
+  for (int i = 0; i < n; i++) {
+    if (workers_[(id + i) % n]->queue.Pop(item)) {
+      pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  if (overflow_size_.load() != 0) {
+    MutexLock ml(&overflow_mu_);
+    if (!overflow_.empty()) {
+      *item = overflow_.front();
+      overflow_.pop_front();
+      overflow_size_.fetch_sub(1);
+      pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+void PosixWorkStealingPool::Park(Worker* w) {
+  MutexLock ml(&w->mu);
+  w->sleeping.store(true);
+  num_sleeping_.fetch_add(1);
+  while (w->sleeping.load()) {
+    if (ShouldWake()) {
+      w->sleeping.store(false);
+      num_sleeping_.fetch_sub(1);
+      break;
+    }
+    w->cv.Wait();
+  }
+}
+
+void PosixWorkStealingPool::WakeOne(int hint) {
+  const int n = max_threads_;
+  for (int i = 0; i < n; i++) {
+    Worker* const w = workers_[(hint + i) % n];
+    if (w->sleeping.load()) {
+      MutexLock ml(&w->mu);
+      if (w->sleeping.load()) {
+        w->sleeping.store(false);
+        num_sleeping_.fetch_sub(1);
+        w->cv.Signal();
+        return;
+      }
+    }
+  }
+}
+
+void PosixWorkStealingPool::WakeAll() {
+  for (size_t i = 0; i < workers_.size(); i++) {
+    Worker* const w = workers_[i];
+    MutexLock ml(&w->mu);
+    if (w->sleeping.load()) {
+      w->sleeping.store(false);
+      num_sleeping_.fetch_sub(1);
+      w->cv.Signal();
+    }
+  }
+}
+
+void PosixWorkStealingPool::BGThread(int id) {
+  current_worker.pool = this;
+  current_worker.id = id;
+  Worker* const w = workers_[id];
+  BGItem item;
+  while (!shutting_down_.load()) {
+    if (!paused_.load() && Get(id, &item)) {
+      assert(item.function != NULL);
+      item.function(item.arg);
+    } else {
+      Park(w);
+    }
+  }
+
+  current_worker.pool = NULL;
+  MutexLock ml(&mu_);
+  assert(num_pool_threads_ > 0);
+  num_pool_threads_--;
+  bg_cv_.SignalAll();
+}
+
+void PosixWorkStealingPool::Resume() {
+  paused_.store(false);
+  WakeAll();
+}
+
+void PosixWorkStealingPool::Pause() { paused_.store(true); }
+
+ThreadPool* ThreadPool::NewWorkStealing(int num_threads, bool eager_init,
+                                        bool pin_threads) {
+  return new PosixWorkStealingPool(num_threads, eager_init, pin_threads);
+}
+
 }  // namespace pdlfs
@@ -20,7 +20,9 @@
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 
+#include <atomic>
 #include <deque>
+#include <vector>
 
 namespace pdlfs {
 
@@ -88,4 +90,66 @@ class PosixThreadPool : public ThreadPool {
   }
 };
 
+// A thread pool where each thread owns a bounded lock-free task queue.
+// Schedule() pushes to the calling pool thread's own queue, or to the queues
+// of the pool threads in round-robin order when called from outside the pool.
+// Idle threads steal from their peers before going to sleep. Tasks that do not
+// fit in a queue go to a shared overflow queue. Instead of broadcasting, a
+// Schedule() wakes up at most one sleeping thread.
+class PosixWorkStealingPool : public ThreadPool {
+ public:
+  PosixWorkStealingPool(int max_threads, bool eager_init = false,
+                        bool pin_threads = false);
+
+  virtual ~PosixWorkStealingPool();
+  virtual void Schedule(void (*function)(void*), void* arg);
+  virtual std::string ToDebugString();
+  virtual void Resume();
+  virtual void Pause();
+
+ private:
+  struct Worker;
+  struct BGItem {
+    void* arg;
+    void (*function)(void*);
+  };
+  void InitPool();
+  // BGThread() is the body of the background thread
+  void BGThread(int id);
+  static void* BGWrapper(void* arg);
+  // Attempt to obtain a task. Look at the queue of worker "id" first, then the
+  // queues of the other workers, and the overflow queue at last.
+  bool Get(int id, BGItem* item);
+  // Block the calling worker until there is work for it
+  void Park(Worker* w);
+  bool ShouldWake() const {
+    return shutting_down_.load() || (!paused_.load() && pending_.load() != 0);
+  }
+  // Wake up one sleeping worker, preferring worker "hint"
+  void WakeOne(int hint);
+  void WakeAll();
+
+  port::Mutex mu_;
+  port::CondVar bg_cv_;
+  int num_pool_threads_;  // Protected by mu_
+  const int max_threads_;
+  const bool pin_threads_;
+  std::vector<Worker*> workers_;
+  std::atomic<bool> started_;
+  std::atomic<bool> shutting_down_;
+  std::atomic<bool> paused_;
+  // Total number of tasks scheduled but not yet picked up
+  std::atomic<size_t> pending_;
+  std::atomic<int> num_sleeping_;
+  std::atomic<unsigned> next_;  // Next worker to receive an outside task
+
+  port::Mutex overflow_mu_;
+  std::deque<BGItem> overflow_;  // Protected by overflow_mu_
+  std::atomic<size_t> overflow_size_;
+
+  // No copying allowed
+  void operator=(const PosixWorkStealingPool&);
+  PosixWorkStealingPool(const PosixWorkStealingPool&);
+};
+
 }  // namespace pdlfs
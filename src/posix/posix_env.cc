@@ -21,6 +21,7 @@
 #include "posix_filecopy.h"
 #include "posix_logger.h"
 #include "posix_mmap.h"
+#include "posix_uring.h"
 
 #include <dirent.h>
 #include <errno.h>
@@ -311,6 +312,63 @@ class PosixMmapIoEnvWrapper : public EnvWrapper {
   MmapLimiter mmap_limit_;
 };
 
+#if defined(PDLFS_IO_URING)
+class PosixIoUringEnvWrapper : public EnvWrapper {
+ public:
+  explicit PosixIoUringEnvWrapper(Env* base)
+      : EnvWrapper(base), ring_(IoUring::Open(kRingEntries)) {}
+  virtual ~PosixIoUringEnvWrapper() { delete ring_; }
+
+  virtual Status NewWritableFile(const char* fname, WritableFile** r) OVERRIDE {
+    if (ring_ == NULL) {
+      return target()->NewWritableFile(fname, r);
+    }
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd != -1) {
+      *r = new PosixUringWritableFile(fname, fd, ring_);
+      return Status::OK();
+    } else {
+      *r = NULL;
+      return PosixError(fname, errno);
+    }
+  }
+
+  virtual Status NewSequentialFile(  ///
+      const char* fname, SequentialFile** r) OVERRIDE {
+    if (ring_ == NULL) {
+      return target()->NewSequentialFile(fname, r);
+    }
+    int fd = open(fname, O_RDONLY);
+    if (fd != -1) {
+      *r = new PosixUringSequentialFile(fname, fd, ring_);
+      return Status::OK();
+    } else {
+      *r = NULL;
+      return PosixError(fname, errno);
+    }
+  }
+
+  virtual Status NewRandomAccessFile(  ///
+      const char* fname, RandomAccessFile** r) OVERRIDE {
+    if (ring_ == NULL) {
+      return target()->NewRandomAccessFile(fname, r);
+    }
+    int fd = open(fname, O_RDONLY);
+    if (fd != -1) {
+      *r = new PosixUringRandomAccessFile(fname, fd, ring_);
+      return Status::OK();
+    } else {
+      *r = NULL;
+      return PosixError(fname, errno);
+    }
+  }
+
+ private:
+  enum { kRingEntries = 128 };
+  IoUring* const ring_;  // NULL if io_uring is not available
+};
+#endif
+
 Env* Env::NewBufferedIoEnvWrapper(Env* const base) {
   return new PosixLibcBufferedIoEnvWrapper(base);
 }
@@ -319,6 +377,14 @@ Env* Env::NewMmapIoEnvWrapper(Env* const base) {
   return new PosixMmapIoEnvWrapper(base);
 }
 
+Env* Env::NewIoUringEnvWrapper(Env* const base) {
+#if defined(PDLFS_IO_URING)
+  return new PosixIoUringEnvWrapper(base);
+#else
+  return new EnvWrapper(base);
+#endif
+}
+
 static pthread_once_t once = PTHREAD_ONCE_INIT;
 
 static Env* posix_env_wrapped;
@@ -15,7 +15,10 @@
 
 #include "pdlfs-common/mutexlock.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 namespace pdlfs {
@@ -125,8 +128,42 @@ Status PosixSocketServer::status() {
   return bg_status_;
 }
 
+int PosixSocketServer::BGSocket(int myid) {
+  MutexLock ml(&mutex_);
+  assert(myid < bg_fds_.size());
+  return bg_fds_[myid];
+}
+
+Status PosixSocketServer::SetReusePort(int fd) {
+#if defined(SO_REUSEPORT)
+  int one = 1;
+  int rv = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  if (rv == -1) {
+    return Status::IOError("Cannot set SO_REUSEPORT", strerror(errno));
+  }
+  return Status::OK();
+#else
+  return Status::NotSupported("SO_REUSEPORT");
+#endif
+}
+
 Status PosixSocketServer::BGStart(Env* const env, int num_threads) {
   MutexLock ml(&mutex_);
+  if (fd_ == -1) {
+    return Status::AssertionFailed("Socket not opened");
+  }
+  // Have each new thread serve its own socket when requested. The first
+  // thread always serves the socket opened by OpenAndBind().
+  while (bg_fds_.size() < bg_n_ + num_threads) {
+    int fd = fd_;
+    if (options_.srv_reuseport && !bg_fds_.empty()) {
+      Status s = OpenExtraSocket(&fd);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    bg_fds_.push_back(fd);
+  }
   bg_n_ += num_threads;
   for (int i = 0; i < num_threads; i++) {
     env->StartThread(BGLoopWrapper, this);
@@ -153,6 +190,11 @@ PosixSocketServer::~PosixSocketServer() {
   BGStop();  // Stop background progressing
   delete actual_addr_;
   delete addr_;
+  for (size_t i = 0; i < bg_fds_.size(); i++) {
+    if (bg_fds_[i] != fd_) {
+      close(bg_fds_[i]);
+    }
+  }
   if (fd_ != -1) {
     close(fd_);
   }
@@ -173,6 +215,14 @@ PosixRPC::PosixRPC(const RPCOptions& options)
   }
 }
 
+PosixRPC::~PosixRPC() {
+  delete srv_;
+  std::map<std::string, PosixTCPConn*>::iterator it;
+  for (it = conns_.begin(); it != conns_.end(); ++it) {
+    it->second->Unref();
+  }
+}
+
 Status PosixRPC::Start() {
   Status status;
   if (srv_) {
@@ -216,10 +266,20 @@ rpc::If* PosixRPC::OpenStubFor(const std::string& uri) {
         new PosixUDPCli(options_.rpc_timeout, options_.udp_max_expected_msgsz);
     cli->Open(uri);
     return cli;
-  } else {
+  } else if (!options_.tcp_persistent_connections) {
     PosixTCPCli* const cli = new PosixTCPCli(options_.rpc_timeout);
     cli->SetTarget(uri);
     return cli;
+  } else {
+    MutexLock ml(&mutex_);
+    PosixTCPConn* conn = conns_[uri];
+    if (!conn) {
+      conn = new PosixTCPConn(options_.rpc_timeout);
+      conn->SetTarget(uri);
+      conn->Ref();  // Held by conns_
+      conns_[uri] = conn;
+    }
+    return new PosixTCPMuxCli(conn);
   }
 }
 
@@ -15,6 +15,7 @@
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/rpc.h"
 
+#include <map>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <sys/resource.h>
@@ -22,6 +23,8 @@
 #include <vector>
 
 namespace pdlfs {
+class PosixTCPConn;
+
 // Base RPC impl providing infrastructure for background progressing. To be
 // extended by subclasses.
 class PosixSocketServer {
@@ -49,6 +52,14 @@ class PosixSocketServer {
   static void BGLoopWrapper(void* arg);
   void BGCall();
   virtual Status BGLoop(int myid) = 0;  // To be implemented by subclasses...
+  // Open an additional socket bound to the server's actual address for use by
+  // a background thread. Only used when options_.srv_reuseport is set.
+  // REQUIRES: mutex_ has been locked.
+  virtual Status OpenExtraSocket(int* result) = 0;
+  // Return the socket background thread #myid should serve.
+  int BGSocket(int myid);
+  // Set SO_REUSEPORT on a socket before it is bound.
+  Status SetReusePort(int fd);
   struct BGUsageInfo {
     double user;    // user CPU time in seconds
     double system;  // system CPU time
@@ -68,6 +79,9 @@ class PosixSocketServer {
   std::vector<struct BGUsageInfo> bg_usage_;
   PosixSocketAddr* actual_addr_;
   PosixSocketAddr* addr_;
+  // Sockets served by each background thread. Each entry either equals fd_
+  // or, when options_.srv_reuseport is set, is a socket of its own.
+  std::vector<int> bg_fds_;
   int fd_;
 };
 
@@ -75,7 +89,7 @@ class PosixSocketServer {
 class PosixRPC : public RPC {
  public:
   explicit PosixRPC(const RPCOptions& options);
-  virtual ~PosixRPC() { delete srv_; }
+  virtual ~PosixRPC();
 
   virtual rpc::If* OpenStubFor(const std::string& uri);
   virtual Status Start();  // Open server the start background progressing
@@ -93,6 +107,9 @@ class PosixRPC : public RPC {
   PosixSocketServer* srv_;  // NULL for client only mode
   RPCOptions options_;
   int tcp_;  // O for UDP, non-0 for TCP
+  // Persistent TCP connections indexed by server uri
+  std::map<std::string, PosixTCPConn*> conns_;
+  port::Mutex mutex_;  // Protects conns_
 };
 
 }  // namespace pdlfs
@@ -10,17 +10,37 @@
  */
 #include "posix_rpc_tcp.h"
 
+#include "pdlfs-common/coding.h"
 #include "pdlfs-common/mutexlock.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <netinet/tcp.h>
 #include <poll.h>
+#include <set>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(PDLFS_OS_LINUX)
+#include <sys/epoll.h>
+#endif
 
 namespace pdlfs {
 PosixTCPServer::PosixTCPServer(const RPCOptions& opts, uint64_t t, size_t s)
-    : PosixSocketServer(opts), rpc_timeout_(t), buf_sz_(s) {}
+    : PosixSocketServer(opts),
+      rpc_timeout_(t),
+      buf_sz_(s),
+      persistent_(opts.tcp_persistent_connections),
+      bg_count_(0) {}
+
+PosixTCPServer::~PosixTCPServer() {
+  BGStop();  // Stop receiving new calls
+  MutexLock ml(&mutex_);
+  while (bg_count_ != 0) {  // Wait until all bg work items have been processed
+    bg_cv_.Wait();
+  }
+  // More resources will be released by parent
+}
 
 Status PosixTCPServer::OpenAndBind(const std::string& uri) {
   MutexLock ml(&mutex_);
@@ -34,21 +54,7 @@ Status PosixTCPServer::OpenAndBind(const std::string& uri) {
 
   // Try opening the server. If we fail we will clean up so that we can try
   // again later.
-  fd_ = socket(AF_INET, SOCK_STREAM, 0);
-  if (fd_ == -1) {
-    status = Status::IOError(strerror(errno));
-  } else {
-    int rv = bind(fd_, reinterpret_cast<struct sockaddr*>(addr_->rep()),
-                  sizeof(struct sockaddr_in));
-    if (rv != -1) {
-      rv = listen(fd_, 256);
-    }
-    if (rv == -1) {
-      status = Status::IOError(strerror(errno));
-      close(fd_);
-      fd_ = -1;
-    }
-  }
+  status = OpenSocket(*addr_, &fd_);
 
   if (status.ok()) {
     // Fetch the port that we have just bound to in case we have decided to have
@@ -61,6 +67,43 @@ Status PosixTCPServer::OpenAndBind(const std::string& uri) {
   return status;
 }
 
+Status PosixTCPServer::OpenExtraSocket(int* result) {
+  mutex_.AssertHeld();
+  return OpenSocket(*actual_addr_, result);
+}
+
+Status PosixTCPServer::OpenSocket(const PosixSocketAddr& addr, int* result) {
+  Status status;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1) {
+    status = Status::IOError(strerror(errno));
+    return status;
+  }
+  // Allow immediate restarts even if connections previously closed by us
+  // are still in TIME_WAIT
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (options_.srv_reuseport) {
+    status = SetReusePort(fd);
+  }
+  if (status.ok()) {
+    int rv = bind(fd, reinterpret_cast<const struct sockaddr*>(addr.rep()),
+                  sizeof(struct sockaddr_in));
+    if (rv != -1) {
+      rv = listen(fd, 256);
+    }
+    if (rv == -1) {
+      status = Status::IOError(strerror(errno));
+    }
+  }
+  if (!status.ok()) {
+    close(fd);
+  } else {
+    *result = fd;
+  }
+  return status;
+}
+
 namespace {
 // Set or unset the O_NONBLOCK flag on a given file.
 inline void SET_O_NONBLOCK(int fd, bool non_blocking) {
@@ -68,19 +111,83 @@ inline void SET_O_NONBLOCK(int fd, bool non_blocking) {
   flags = non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
   fcntl(fd, F_SETFL, flags);
 }
+
+inline void SET_TCP_NODELAY(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+#if defined(MSG_NOSIGNAL)
+const int kSendFlags = MSG_NOSIGNAL;  // Avoid SIGPIPE on closed connections
+#else
+const int kSendFlags = 0;
+#endif
+
+// Send a framed message over a non-blocking socket. Return OK on success, or a
+// non-OK status on errors or timeouts.
+Status WriteFrame(int fd, uint64_t id, const Slice& msg, uint64_t timeout) {
+  char header[kTCPFrameHeaderSize];
+  EncodeFixed32(header, static_cast<uint32_t>(msg.size()));
+  EncodeFixed64(header + 4, id);
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = const_cast<char*>(msg.data());
+  iov[1].iov_len = msg.size();
+  struct msghdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_iov = iov;
+  hdr.msg_iovlen = 2;
+  const uint64_t start = CurrentMicros();
+  size_t remaining = sizeof(header) + msg.size();
+  while (remaining != 0) {
+    ssize_t nbytes = sendmsg(fd, &hdr, kSendFlags);
+    if (nbytes > 0) {
+      remaining -= nbytes;
+      while (nbytes > 0) {  // Skip data that has been sent
+        if (size_t(nbytes) >= hdr.msg_iov->iov_len) {
+          nbytes -= hdr.msg_iov->iov_len;
+          hdr.msg_iov++;
+          hdr.msg_iovlen--;
+        } else {
+          hdr.msg_iov->iov_base =
+              static_cast<char*>(hdr.msg_iov->iov_base) + nbytes;
+          hdr.msg_iov->iov_len -= nbytes;
+          nbytes = 0;
+        }
+      }
+    } else if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+      struct pollfd po;
+      memset(&po, 0, sizeof(struct pollfd));
+      po.events = POLLOUT;
+      po.fd = fd;
+      poll(&po, 1, 200);
+      if (CurrentMicros() - start >= timeout) {
+        return Status::Disconnected("timeout");
+      }
+    } else {
+      return Status::IOError("TCP send", strerror(errno));
+    }
+  }
+  return Status::OK();
+}
 }  // namespace
 
 Status PosixTCPServer::BGLoop(int myid) {
-  SET_O_NONBLOCK(fd_, true);
+  if (persistent_) {
+    return BGLoopPersistent(myid);
+  }
+  const int fd = BGSocket(myid);
+  SET_O_NONBLOCK(fd, true);
   struct pollfd po;
   po.events = POLLIN;
-  po.fd = fd_;
+  po.fd = fd;
   CallState call;
 
   int err = 0;
   while (!err && !shutting_down_.Acquire_Load()) {
     call.addrlen = sizeof(call.addr);
-    int rv = accept(fd_, reinterpret_cast<struct sockaddr*>(&call.addr),
+    int rv = accept(fd, reinterpret_cast<struct sockaddr*>(&call.addr),
                     &call.addrlen);
     if (rv != -1) {
       call.fd = rv;
@@ -162,6 +269,198 @@ void PosixTCPServer::HandleIncomingCall(CallState* const call) {
   shutdown(call->fd, SHUT_WR);
 }
 
+PosixTCPServer::Conn* PosixTCPServer::NewConn(int fd) {
+  Conn* const conn = new Conn;
+  conn->parent_srv = this;
+  conn->fd = fd;
+  conn->refs = 1;  // Held by the background thread that accepted it
+  return conn;
+}
+
+void PosixTCPServer::Unref(Conn* const conn) {
+  mutex_.Lock();
+  assert(conn->refs > 0);
+  const bool dead = (--conn->refs == 0);
+  mutex_.Unlock();
+  if (dead) {
+    close(conn->fd);
+    delete conn;
+  }
+}
+
+#if defined(PDLFS_OS_LINUX)
+// Each background thread owns an epoll set containing its listening socket
+// and all connections accepted by that thread. The listening socket is shared
+// by all threads unless options_.srv_reuseport is set. Incoming calls are
+// either processed inline or redirected to options_.extra_workers.
+Status PosixTCPServer::BGLoopPersistent(int myid) {
+  const int ep = epoll_create(64);
+  if (ep == -1) {
+    return Status::IOError("epoll_create", strerror(errno));
+  }
+  const int fd = BGSocket(myid);
+  SET_O_NONBLOCK(fd, true);
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+#if defined(EPOLLEXCLUSIVE)
+  ev.events |= EPOLLEXCLUSIVE;  // Avoid waking up all threads on connects
+#endif
+  ev.data.ptr = NULL;  // NULL indicates the listening socket
+  int err = 0;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    err = errno;
+  }
+  std::set<Conn*> conns;  // Connections owned by this thread
+  struct epoll_event events[64];
+  char* const buf = new char[buf_sz_];
+  while (!err && !shutting_down_.Acquire_Load()) {
+    const int n = epoll_wait(ep, events, 64, 200);
+    if (n == -1) {
+      if (errno != EINTR) err = errno;
+      continue;
+    }
+    for (int i = 0; i < n; i++) {
+      Conn* conn = static_cast<Conn*>(events[i].data.ptr);
+      if (!conn) {  // Accept all pending connections
+        while (true) {
+          int rv = accept(fd, NULL, NULL);
+          if (rv == -1) {
+            if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR &&
+                errno != ECONNABORTED) {
+              Log(options_.info_log, 0, "Cannot accept TCP connection: %s",
+                  strerror(errno));
+            }
+            break;
+          }
+          SET_O_NONBLOCK(rv, true);
+          SET_TCP_NODELAY(rv);
+          conn = NewConn(rv);
+          struct epoll_event cev;
+          memset(&cev, 0, sizeof(cev));
+          cev.events = EPOLLIN;
+          cev.data.ptr = conn;
+          if (epoll_ctl(ep, EPOLL_CTL_ADD, rv, &cev) == -1) {
+            Log(options_.info_log, 0, "Cannot poll TCP connection: %s",
+                strerror(errno));
+            Unref(conn);
+          } else {
+            conns.insert(conn);
+          }
+        }
+        continue;
+      }
+      bool eof = false;
+      while (true) {
+        ssize_t rv = recv(conn->fd, buf, buf_sz_, 0);
+        if (rv > 0) {
+          conn->rbuf.append(buf, rv);
+          if (rv < buf_sz_) break;
+        } else if (rv == 0) {  // Connection closed by peer
+          eof = true;
+          break;
+        } else if (errno != EINTR) {
+          eof = (errno != EWOULDBLOCK && errno != EAGAIN);
+          break;
+        }
+      }
+      if (!DispatchFrames(conn)) {
+        Log(options_.info_log, 0, "Bad TCP frame from peer");
+        eof = true;
+      }
+      if (eof) {
+        epoll_ctl(ep, EPOLL_CTL_DEL, conn->fd, NULL);
+        conns.erase(conn);
+        Unref(conn);
+      }
+    }
+  }
+
+  for (std::set<Conn*>::iterator it = conns.begin(); it != conns.end(); ++it) {
+    Unref(*it);
+  }
+  delete[] buf;
+  close(ep);
+
+  Status status;
+  if (err) {
+    status = Status::IOError("TCP epoll", strerror(err));
+  }
+  return status;
+}
+#else
+Status PosixTCPServer::BGLoopPersistent(int myid) {
+  return Status::NotSupported("Persistent TCP connections require epoll");
+}
+#endif
+
+bool PosixTCPServer::DispatchFrames(Conn* const conn) {
+  Slice input(conn->rbuf);
+  bool ok = true;
+  while (input.size() >= kTCPFrameHeaderSize) {
+    const uint32_t len = DecodeFixed32(input.data());
+    if (len > kTCPMaxFrameSize) {
+      ok = false;
+      break;
+    } else if (input.size() < kTCPFrameHeaderSize + len) {
+      break;
+    }
+    const uint64_t id = DecodeFixed64(input.data() + 4);
+    Slice msg(input.data() + kTCPFrameHeaderSize, len);
+    input.remove_prefix(kTCPFrameHeaderSize + len);
+    if (options_.extra_workers) {
+      FramedCall* const call = new FramedCall;
+      call->conn = conn;
+      call->id = id;
+      call->msg = msg.ToString();
+      MutexLock ml(&mutex_);
+      ++conn->refs;
+      ++bg_count_;
+      options_.extra_workers->Schedule(ProcessFramedCallWrapper, call);
+    } else {
+      FramedCall call;
+      call.conn = conn;
+      call.id = id;
+      call.msg = msg.ToString();
+      ProcessFramedCall(&call);
+    }
+  }
+  conn->rbuf.erase(0, conn->rbuf.size() - input.size());
+  return ok;
+}
+
+void PosixTCPServer::ProcessFramedCallWrapper(void* arg) {
+  FramedCall* const call = reinterpret_cast<FramedCall*>(arg);
+  PosixTCPServer* const srv = call->conn->parent_srv;
+  srv->ProcessFramedCall(call);
+  srv->Unref(call->conn);
+  delete call;
+  MutexLock ml(&srv->mutex_);
+  assert(srv->bg_count_ > 0);
+  --srv->bg_count_;
+  if (!srv->bg_count_) {
+    srv->bg_cv_.SignalAll();
+  }
+}
+
+void PosixTCPServer::ProcessFramedCall(FramedCall* const call) {
+  rpc::If::Message in, out;
+  in.contents = call->msg;
+  Status s = options_.fs->Call(in, out);
+  if (!s.ok()) {
+    Log(options_.info_log, 0, "Fail to handle incoming call: %s",
+        s.ToString().c_str());
+    return;
+  }
+  Conn* const conn = call->conn;
+  MutexLock ml(&conn->send_mutex);
+  s = WriteFrame(conn->fd, call->id, out.contents, rpc_timeout_);
+  if (!s.ok()) {
+    Log(options_.info_log, 0, "Error sending data to client: %s",
+        s.ToString().c_str());
+  }
+}
+
 std::string PosixTCPServer::GetUri() {
   return std::string("tcp://") + GetBaseUri();
 }
@@ -169,6 +468,12 @@ std::string PosixTCPServer::GetUri() {
 PosixTCPCli::PosixTCPCli(uint64_t timeout, size_t buf_sz)
     : rpc_timeout_(timeout), buf_sz_(buf_sz) {}
 
+PosixTCPCli::~PosixTCPCli() {
+  for (size_t i = 0; i < outstanding_.size(); i++) {
+    close(outstanding_[i].fd);
+  }
+}
+
 void PosixTCPCli::SetTarget(const std::string& uri) {
   status_ = addr_.ResolvUri(uri);
 }
@@ -188,28 +493,38 @@ Status PosixTCPCli::OpenAndConnect(int* result) {
   return status;
 }
 
-Status PosixTCPCli::Call(Message& in, Message& out) RPCNOEXCEPT {
-  if (!status_.ok()) {
-    return status_;
-  }
-  int fd;
-  Status status = OpenAndConnect(&fd);
-  if (!status.ok()) {
-    return status;
-  }
-  Slice remaining_in = in.contents;
+// Send a message and then half-close the connection to mark the end of it.
+// Close the connection on errors.
+Status PosixTCPCli::SendAndShutdown(int fd, const Slice& msg) {
+  Slice remaining_in = msg;
   SET_O_NONBLOCK(fd, false);  // Force blocking semantics
   while (!remaining_in.empty()) {
     ssize_t nbytes = send(fd, remaining_in.data(), remaining_in.size(), 0);
     if (nbytes > 0) {
       remaining_in.remove_prefix(nbytes);
     } else {
-      status = Status::IOError(strerror(errno));
+      Status status = Status::IOError(strerror(errno));
       close(fd);
       return status;
     }
   }
   shutdown(fd, SHUT_WR);
+  return Status::OK();
+}
+
+Status PosixTCPCli::Call(Message& in, Message& out) RPCNOEXCEPT {
+  if (!status_.ok()) {
+    return status_;
+  }
+  int fd;
+  Status status = OpenAndConnect(&fd);
+  if (!status.ok()) {
+    return status;
+  }
+  status = SendAndShutdown(fd, in.contents);
+  if (!status.ok()) {
+    return status;
+  }
   const uint64_t start = CurrentMicros();
   struct pollfd po;
   memset(&po, 0, sizeof(struct pollfd));
@@ -247,4 +562,397 @@ Status PosixTCPCli::Call(Message& in, Message& out) RPCNOEXCEPT {
   return status;
 }
 
+Status PosixTCPCli::AsyncCall(Message& in, Message& out, Callback cb,
+                              void* arg) RPCNOEXCEPT {
+  if (!status_.ok()) {
+    return status_;
+  }
+  AsyncCallState call;
+  Status status = OpenAndConnect(&call.fd);
+  if (status.ok()) {
+    status = SendAndShutdown(call.fd, in.contents);
+  }
+  if (status.ok()) {
+    out.extra_buf.clear();
+    call.out = &out;
+    call.cb = cb;
+    call.arg = arg;
+    call.start = CurrentMicros();
+    outstanding_.push_back(call);
+  }
+  return status;
+}
+
+int PosixTCPCli::Poll(bool wait) RPCNOEXCEPT {
+  std::vector<std::pair<AsyncCallState, Status> > completed;
+  std::vector<struct pollfd> po;
+  char* const buf = new char[buf_sz_];
+  while (!outstanding_.empty()) {
+    po.resize(outstanding_.size());
+    for (size_t i = 0; i < po.size(); i++) {
+      memset(&po[i], 0, sizeof(struct pollfd));
+      po[i].events = POLLIN;
+      po[i].fd = outstanding_[i].fd;
+    }
+    int rv = poll(&po[0], po.size(), wait ? 200 : 0);
+    const uint64_t now = CurrentMicros();
+    size_t j = 0;  // Number of calls still outstanding
+    for (size_t i = 0; i < po.size(); i++) {
+      AsyncCallState& call = outstanding_[i];
+      bool done = false;
+      Status status;
+      while (rv > 0 && po[i].revents != 0) {
+        ssize_t nbytes = recv(call.fd, buf, buf_sz_, MSG_DONTWAIT);
+        if (nbytes > 0) {
+          call.out->extra_buf.append(buf, nbytes);
+          continue;
+        } else if (nbytes == 0) {  // End of message
+          call.out->contents = call.out->extra_buf;
+          done = true;
+        } else if (errno != EWOULDBLOCK) {
+          status = Status::IOError(strerror(errno));
+          done = true;
+        }
+        break;
+      }
+      if (!done && now - call.start >= rpc_timeout_) {
+        status = Status::Disconnected("timeout");
+        done = true;
+      }
+      if (done) {
+        close(call.fd);
+        completed.push_back(std::make_pair(call, status));
+      } else {
+        outstanding_[j++] = call;
+      }
+    }
+    outstanding_.resize(j);
+    if (!wait || !completed.empty()) {
+      break;
+    }
+  }
+  delete[] buf;
+  // Callbacks may submit new calls so we invoke them at the very end
+  for (size_t i = 0; i < completed.size(); i++) {
+    completed[i].first.cb(completed[i].second, completed[i].first.arg);
+  }
+  return int(completed.size());
+}
+
+PosixTCPConn::PosixTCPConn(uint64_t timeout, size_t buf_sz)
+    : rpc_timeout_(timeout),
+      buf_sz_(buf_sz),
+      cv_(&mutex_),
+      next_id_(1),
+      refs_(0),
+      nusers_(0),
+      reading_(false),
+      connecting_(false),
+      broken_(false),
+      fd_(-1) {}
+
+PosixTCPConn::~PosixTCPConn() {
+  assert(nusers_ == 0);
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+void PosixTCPConn::SetTarget(const std::string& uri) {
+  status_ = addr_.ResolvUri(uri);
+}
+
+void PosixTCPConn::Ref() {
+  MutexLock ml(&mutex_);
+  ++refs_;
+}
+
+void PosixTCPConn::Unref() {
+  mutex_.Lock();
+  assert(refs_ > 0);
+  const bool dead = (--refs_ == 0);
+  mutex_.Unlock();
+  if (dead) {
+    delete this;
+  }
+}
+
+// Connections are opened without holding mutex_ so that other callers are
+// not held up by a slow connect(). REQUIRES: mutex_ has been locked.
+Status PosixTCPConn::MaybeConnect() {
+  mutex_.AssertHeld();
+  while (connecting_) {  // Wait for the other caller's connection
+    cv_.Wait();
+  }
+  if (fd_ != -1) {
+    if (!broken_) {
+      return Status::OK();
+    } else if (nusers_ != 0 || reading_) {  // Wait for outstanding calls
+      return Status::Disconnected("Connection reset");
+    }
+    close(fd_);
+    fd_ = -1;
+    broken_ = false;
+    rbuf_.clear();
+  }
+  connecting_ = true;
+  mutex_.Unlock();
+  Status status;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1) {
+    status = Status::IOError(strerror(errno));
+  } else if (connect(fd, reinterpret_cast<struct sockaddr*>(addr_.rep()),
+                     sizeof(struct sockaddr_in)) == -1) {
+    status = Status::IOError(strerror(errno));
+    close(fd);
+  } else {
+    SET_O_NONBLOCK(fd, true);
+    SET_TCP_NODELAY(fd);
+  }
+  mutex_.Lock();
+  connecting_ = false;
+  cv_.SignalAll();
+  if (status.ok()) {
+    fd_ = fd;
+  }
+  return status;
+}
+
+// Record the final status of a call. Asynchronous calls are handed to their
+// queues for reporting. REQUIRES: mutex_ has been locked.
+void PosixTCPConn::Finish(PendingCall* const call, const Status& s) {
+  mutex_.AssertHeld();
+  call->status = s;
+  call->done = true;
+  if (call->q != NULL) {
+    call->q->done.push_back(call);
+    assert(nusers_ > 0);
+    --nusers_;
+  }
+}
+
+// REQUIRES: mutex_ has been locked.
+void PosixTCPConn::MarkBroken(const Status& s) {
+  mutex_.AssertHeld();
+  if (!broken_) {
+    broken_ = true;
+    shutdown(fd_, SHUT_RDWR);
+  }
+  std::map<uint64_t, PendingCall*>::iterator it;
+  for (it = pending_.begin(); it != pending_.end(); ++it) {
+    Finish(it->second, s);
+  }
+  pending_.clear();
+  cv_.SignalAll();
+}
+
+Status PosixTCPConn::SendFrame(uint64_t id, const Slice& msg) {
+  MutexLock ml(&send_mutex_);
+  return WriteFrame(fd_, id, msg, rpc_timeout_);
+}
+
+// Wait for data from the server and hand complete replies to their callers.
+// REQUIRES: the caller has set reading_ and mutex_ is not held.
+Status PosixTCPConn::ReadAndDispatch(int timeout_ms) {
+  struct pollfd po;
+  memset(&po, 0, sizeof(struct pollfd));
+  po.events = POLLIN;
+  po.fd = fd_;
+  int rv = poll(&po, 1, timeout_ms);
+  if (rv == -1) {
+    if (errno == EINTR) return Status::OK();
+    return Status::IOError("TCP poll", strerror(errno));
+  } else if (rv == 0) {
+    return Status::OK();
+  }
+  const size_t off = rbuf_.size();
+  rbuf_.resize(off + buf_sz_);
+  ssize_t nbytes = recv(fd_, &rbuf_[off], buf_sz_, 0);
+  rbuf_.resize(off + (nbytes > 0 ? nbytes : 0));
+  if (nbytes == 0) {
+    return Status::Disconnected("Connection closed by peer");
+  } else if (nbytes == -1) {
+    if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+      return Status::OK();
+    }
+    return Status::IOError("TCP recv", strerror(errno));
+  }
+  Status status;
+  Slice input(rbuf_);
+  MutexLock ml(&mutex_);
+  while (input.size() >= kTCPFrameHeaderSize) {
+    const uint32_t len = DecodeFixed32(input.data());
+    if (len > kTCPMaxFrameSize) {
+      status = Status::Corruption("Bad TCP frame");
+      break;
+    } else if (input.size() < kTCPFrameHeaderSize + len) {
+      break;
+    }
+    const uint64_t id = DecodeFixed64(input.data() + 4);
+    std::map<uint64_t, PendingCall*>::iterator it = pending_.find(id);
+    if (it != pending_.end()) {  // Otherwise the call has timed out
+      rpc::If::Message* const out = it->second->out;
+      out->extra_buf.assign(input.data() + kTCPFrameHeaderSize, len);
+      out->contents = out->extra_buf;
+      Finish(it->second, Status::OK());
+      pending_.erase(it);
+    }
+    input.remove_prefix(kTCPFrameHeaderSize + len);
+  }
+  rbuf_.erase(0, rbuf_.size() - input.size());
+  return status;
+}
+
+// Read replies if no other caller is doing so, or wait for the current reader
+// to make progress. REQUIRES: mutex_ has been locked.
+void PosixTCPConn::ReadOrWait(int timeout_ms) {
+  mutex_.AssertHeld();
+  if (!reading_) {
+    reading_ = true;
+    mutex_.Unlock();
+    Status status = ReadAndDispatch(timeout_ms);
+    mutex_.Lock();
+    reading_ = false;
+    if (!status.ok()) {
+      MarkBroken(status);
+    }
+    cv_.SignalAll();
+  } else if (timeout_ms != 0) {
+    cv_.TimedWait(uint64_t(timeout_ms) * 1000);
+  }
+}
+
+// Register a call and send it to the server. Send errors are reported through
+// the call itself. REQUIRES: mutex_ has been locked.
+Status PosixTCPConn::Submit(rpc::If::Message& in, PendingCall* const call,
+                            uint64_t* id) {
+  mutex_.AssertHeld();
+  Status status = MaybeConnect();
+  if (!status.ok()) {
+    return status;
+  }
+  call->done = false;
+  call->start = CurrentMicros();
+  *id = next_id_++;
+  pending_.insert(std::make_pair(*id, call));
+  ++nusers_;
+  mutex_.Unlock();
+  status = SendFrame(*id, in.contents);
+  mutex_.Lock();
+  if (!status.ok()) {
+    MarkBroken(status);
+  }
+  return Status::OK();
+}
+
+Status PosixTCPConn::Call(rpc::If::Message& in, rpc::If::Message& out) {
+  if (!status_.ok()) {
+    return status_;
+  }
+  MutexLock ml(&mutex_);
+  PendingCall call;
+  call.out = &out;
+  call.q = NULL;
+  uint64_t id;
+  Status status = Submit(in, &call, &id);
+  if (!status.ok()) {
+    return status;
+  }
+  // Callers take turns reading replies until their own reply has arrived.
+  while (!call.done) {
+    ReadOrWait(200);
+    if (!call.done && CurrentMicros() - call.start >= rpc_timeout_) {
+      pending_.erase(id);
+      call.status = Status::Disconnected("timeout");
+      call.done = true;
+    }
+  }
+  assert(nusers_ > 0);
+  --nusers_;
+  return call.status;
+}
+
+Status PosixTCPConn::AsyncCall(rpc::If::Message& in, rpc::If::Message& out,
+                               rpc::If::Callback cb, void* arg,
+                               AsyncQueue* q) {
+  if (!status_.ok()) {
+    return status_;
+  }
+  MutexLock ml(&mutex_);
+  PendingCall* const call = new PendingCall;
+  call->out = &out;
+  call->q = q;
+  call->cb = cb;
+  call->arg = arg;
+  uint64_t id;
+  Status status = Submit(in, call, &id);
+  if (status.ok()) {
+    q->outstanding++;
+  } else {
+    delete call;
+  }
+  return status;
+}
+
+// Fail calls of a queue that have been waiting for too long.
+// REQUIRES: mutex_ has been locked.
+void PosixTCPConn::ExpireCalls(AsyncQueue* q) {
+  mutex_.AssertHeld();
+  const uint64_t now = CurrentMicros();
+  std::map<uint64_t, PendingCall*>::iterator it = pending_.begin();
+  while (it != pending_.end()) {
+    PendingCall* const call = it->second;
+    if (call->q == q && now - call->start >= rpc_timeout_) {
+      Finish(call, Status::Disconnected("timeout"));
+      pending_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+int PosixTCPConn::Poll(AsyncQueue* q, bool wait) {
+  MutexLock ml(&mutex_);
+  if (q->done.empty() && q->outstanding != 0) {
+    ReadOrWait(0);  // Check for replies without blocking
+    ExpireCalls(q);
+  }
+  while (wait && q->done.empty() && q->outstanding != 0) {
+    ReadOrWait(200);
+    ExpireCalls(q);
+  }
+  std::vector<PendingCall*> done;
+  done.swap(q->done);
+  q->outstanding -= int(done.size());
+  mutex_.Unlock();
+  // Callbacks may submit new calls so we invoke them without holding mutex_
+  for (size_t i = 0; i < done.size(); i++) {
+    done[i]->cb(done[i]->status, done[i]->arg);
+    delete done[i];
+  }
+  mutex_.Lock();
+  return int(done.size());
+}
+
+void PosixTCPConn::Cancel(AsyncQueue* q) {
+  MutexLock ml(&mutex_);
+  std::map<uint64_t, PendingCall*>::iterator it = pending_.begin();
+  while (it != pending_.end()) {
+    PendingCall* const call = it->second;
+    if (call->q == q) {
+      assert(nusers_ > 0);
+      --nusers_;
+      delete call;
+      pending_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  for (size_t i = 0; i < q->done.size(); i++) {
+    delete q->done[i];
+  }
+  q->done.clear();
+  q->outstanding = 0;
+}
+
 }  // namespace pdlfs
@@ -12,18 +12,25 @@
 
 #include "posix_rpc.h"
 
+#include <map>
 #include <stddef.h>
 #include <sys/socket.h>
 
 namespace pdlfs {
+// When persistent connections are enabled (see
+// RPCOptions::tcp_persistent_connections), each message sent over a TCP
+// connection is framed by a fixed-size header consisting of a 32-bit payload
+// length followed by a 64-bit request id. Replies carry the id of the request
+// they answer so that many calls may be in flight over a single connection.
+static const size_t kTCPFrameHeaderSize = 12;
+static const size_t kTCPMaxFrameSize = 64u << 20;  // 64MB
+
 // RPC srv impl using TCP.
 class PosixTCPServer : public PosixSocketServer {
  public:
   PosixTCPServer(const RPCOptions& options, uint64_t timeout,
                  size_t buf_sz = 4000);
-  virtual ~PosixTCPServer() {
-    BGStop();
-  }  // More resources to be released by parent
+  virtual ~PosixTCPServer();
 
   // On OK, BGStart() from parent should then be called to commence background
   // server progressing.
@@ -37,22 +44,164 @@ class PosixTCPServer : public PosixSocketServer {
     socklen_t addrlen;
     int fd;
   };
+  virtual Status OpenExtraSocket(int* result);
+  Status OpenSocket(const PosixSocketAddr& addr, int* result);
   void HandleIncomingCall(CallState* call);
   virtual Status BGLoop(int myid);
   const uint64_t rpc_timeout_;  // In microseconds
   const size_t buf_sz_;         // Buffer size for reading peer data
+
+  // State for each persistent client connection. A connection is owned by the
+  // background thread that accepted it and may be temporarily shared with
+  // extra workers processing calls that arrived on it.
+  struct Conn {
+    PosixTCPServer* parent_srv;  // Back pointer to the server
+    int fd;
+    int refs;                // Protected by parent_srv->mutex_
+    port::Mutex send_mutex;  // Serializes replies sent over fd
+    std::string rbuf;        // Partially received frames
+  };
+  // A call received over a persistent connection.
+  struct FramedCall {
+    Conn* conn;
+    uint64_t id;
+    std::string msg;
+  };
+  Conn* NewConn(int fd);
+  void Unref(Conn* conn);
+  // Parse and dispatch all complete frames buffered at conn->rbuf. Return
+  // false if the peer has sent a malformed frame.
+  bool DispatchFrames(Conn* conn);
+  void ProcessFramedCall(FramedCall* call);
+  static void ProcessFramedCallWrapper(void* arg);
+  Status BGLoopPersistent(int myid);
+  const bool persistent_;
+  // State below protected by mutex_
+  int bg_count_;  // Total number of bg work items pending
+};
+
+// A persistent TCP connection to a remote server shared by all stubs opened
+// against that server. Calls are multiplexed over the connection using
+// request ids. Threads waiting for replies take turns reading from the socket
+// and hand each reply to the thread that is waiting for it. A broken
+// connection is closed once all calls using it have returned and is re-opened
+// on demand.
+class PosixTCPConn {
+ public:
+  PosixTCPConn(uint64_t timeout, size_t buf_sz = 4000);
+
+  struct AsyncQueue;
+  struct PendingCall {
+    rpc::If::Message* out;
+    Status status;
+    bool done;
+    uint64_t start;  // Submission time in microseconds
+    // Set for asynchronous calls
+    AsyncQueue* q;
+    rpc::If::Callback cb;
+    void* arg;
+  };
+
+  // Asynchronous calls submitted through a stub. Completed calls are queued
+  // here until they are reported by the stub's Poll().
+  struct AsyncQueue {
+    AsyncQueue() : outstanding(0) {}
+    std::vector<PendingCall*> done;
+    int outstanding;  // Calls submitted but not yet reported
+  };
+
+  Status Call(rpc::If::Message& in, rpc::If::Message& out);
+  Status AsyncCall(rpc::If::Message& in, rpc::If::Message& out,
+                   rpc::If::Callback cb, void* arg, AsyncQueue* q);
+  int Poll(AsyncQueue* q, bool wait);
+  // Drop all outstanding calls of a queue without invoking their callbacks.
+  void Cancel(AsyncQueue* q);
+
+  // If we fail to resolve the uri, we will record the error and return it at
+  // the next Call() invocation.
+  void SetTarget(const std::string& uri);
+
+  void Ref();
+  void Unref();
+
+ private:
+  ~PosixTCPConn();
+  // No copying allowed
+  void operator=(const PosixTCPConn&);
+  PosixTCPConn(const PosixTCPConn& other);
+  Status Submit(rpc::If::Message& in, PendingCall* call, uint64_t* id);
+  void Finish(PendingCall* call, const Status& s);
+  void ExpireCalls(AsyncQueue* q);
+  void ReadOrWait(int timeout_ms);
+  Status MaybeConnect();
+  Status SendFrame(uint64_t id, const Slice& msg);
+  Status ReadAndDispatch(int timeout_ms);
+  void MarkBroken(const Status& s);
+  const uint64_t rpc_timeout_;  // In microseconds
+  const size_t buf_sz_;
+  PosixSocketAddr addr_;
+  Status status_;
+  port::Mutex send_mutex_;  // Serializes frames sent over fd_
+  port::Mutex mutex_;
+  // State below protected by mutex_
+  port::CondVar cv_;
+  std::map<uint64_t, PendingCall*> pending_;
+  uint64_t next_id_;
+  int refs_;
+  int nusers_;       // Number of calls currently using fd_
+  bool reading_;     // True iff a caller is reading replies from fd_
+  bool connecting_;  // True iff a caller is opening a new fd_
+  bool broken_;
+  int fd_;
+  // Only accessed by the reading caller
+  std::string rbuf_;
+};
+
+// Client stub for a shared persistent TCP connection.
+class PosixTCPMuxCli : public rpc::If {
+ public:
+  explicit PosixTCPMuxCli(PosixTCPConn* conn) : conn_(conn) { conn_->Ref(); }
+  virtual ~PosixTCPMuxCli() {
+    conn_->Cancel(&q_);
+    conn_->Unref();
+  }
+
+  virtual Status Call(Message& in, Message& out) RPCNOEXCEPT {
+    return conn_->Call(in, out);
+  }
+
+  // Asynchronous calls are multiplexed over the shared connection.
+  virtual Status AsyncCall(Message& in, Message& out, Callback cb,
+                           void* arg) RPCNOEXCEPT {
+    return conn_->AsyncCall(in, out, cb, arg, &q_);
+  }
+
+  virtual int Poll(bool wait) RPCNOEXCEPT { return conn_->Poll(&q_, wait); }
+
+ private:
+  // No copying allowed
+  void operator=(const PosixTCPMuxCli&);
+  PosixTCPMuxCli(const PosixTCPMuxCli& other);
+  PosixTCPConn* const conn_;
+  PosixTCPConn::AsyncQueue q_;
 };
 
 // TCP client.
 class PosixTCPCli : public rpc::If {
  public:
   explicit PosixTCPCli(uint64_t timeout, size_t buf_sz = 4000);
-  virtual ~PosixTCPCli() {}
+  virtual ~PosixTCPCli();
 
   // Each call creates a new socket, followed by a connection operation, a send,
   // and a receive.
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
 
+  // Each asynchronous call uses a connection of its own. Poll() waits on all
+  // of them together.
+  virtual Status AsyncCall(Message& in, Message& out, Callback cb,
+                           void* arg) RPCNOEXCEPT;
+  virtual int Poll(bool wait) RPCNOEXCEPT;
+
   // If we fail to resolve the uri, we will record the error and return it at
   // the next Call() invocation.
   void SetTarget(const std::string& uri);
@@ -62,10 +211,19 @@ class PosixTCPCli : public rpc::If {
   void operator=(const PosixTCPCli&);
   PosixTCPCli(const PosixTCPCli& other);
   Status OpenAndConnect(int* fd);
+  Status SendAndShutdown(int fd, const Slice& msg);
   const uint64_t rpc_timeout_;  // In microseconds
   const size_t buf_sz_;
   PosixSocketAddr addr_;
   Status status_;
+  struct AsyncCallState {
+    int fd;
+    Message* out;
+    Callback cb;
+    void* arg;
+    uint64_t start;
+  };
+  std::vector<AsyncCallState> outstanding_;
 };
 
 }  // namespace pdlfs
@@ -17,6 +17,7 @@
 #include <netdb.h>
 #include <poll.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace pdlfs {
@@ -24,14 +25,22 @@ namespace pdlfs {
 PosixUDPServer::PosixUDPServer(const RPCOptions& options)
     : PosixSocketServer(options),
       max_msgsz_(options.udp_max_unexpected_msgsz),
+      batch_size_(options.udp_srv_batch_size),
       bg_count_(0) {}
 
 PosixUDPServer::~PosixUDPServer() {
   BGStop();  // Stop receiving new messages
   MutexLock ml(&mutex_);
-  while (bg_count_ != 0) {  // Wait until all bg work items have been processed
+  while (bg_count_.load() != 0) {  // Wait until all bg work items are done
     bg_cv_.Wait();
   }
+  for (size_t i = 0; i < pools_.size(); i++) {
+    CallPool* const pool = pools_[i];
+    for (size_t j = 0; j < pool->free_calls.size(); j++) {
+      free(pool->free_calls[j]);
+    }
+    delete pool;
+  }
   // More resources will be released by parent
 }
 
@@ -47,21 +56,51 @@ Status PosixUDPServer::OpenAndBind(const std::string& uri) {
 
   // Try opening the server. If we fail we will clean up so that we can try
   // again later.
-  fd_ = socket(AF_INET, SOCK_DGRAM, 0);
-  if (fd_ == -1) {
+  status = OpenSocket(*addr_, &fd_);
+
+  if (status.ok()) {
+    // Fetch the port that we have just bound to in case we have decided to have
+    // the OS choose the port
+    socklen_t tmp = sizeof(struct sockaddr_in);
+    getsockname(fd_, reinterpret_cast<struct sockaddr*>(actual_addr_->rep()),
+                &tmp);
+  }
+
+  return status;
+}
+
+Status PosixUDPServer::OpenExtraSocket(int* result) {
+  mutex_.AssertHeld();
+  return OpenSocket(*actual_addr_, result);
+}
+
+Status PosixUDPServer::OpenSocket(const PosixSocketAddr& addr, int* result) {
+  Status status;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd == -1) {
     status = Status::IOError("Cannot create UDP socket", strerror(errno));
-  } else {
-    int rv = bind(fd_, reinterpret_cast<struct sockaddr*>(addr_->rep()),
+    return status;
+  }
+
+  if (options_.srv_reuseport) {
+    status = SetReusePort(fd);
+  }
+
+  if (status.ok()) {
+    int rv = bind(fd, reinterpret_cast<const struct sockaddr*>(addr.rep()),
                   sizeof(struct sockaddr_in));
     if (rv == -1) {
       status = Status::IOError("UDP bind", strerror(errno));
-      close(fd_);
-      fd_ = -1;
     }
   }
 
+  if (!status.ok()) {
+    close(fd);
+    return status;
+  }
+
   if (options_.udp_srv_rcvbuf != -1) {
-    int rv = setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &options_.udp_srv_rcvbuf,
+    int rv = setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &options_.udp_srv_rcvbuf,
                         sizeof(options_.udp_srv_rcvbuf));
     if (rv != 0) {
       Log(options_.info_log, 0, "Cannot set SO_RCVBUF=%d: %s",
@@ -70,7 +109,7 @@ Status PosixUDPServer::OpenAndBind(const std::string& uri) {
   }
 
   if (options_.udp_srv_sndbuf != -1) {
-    int rv = setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &options_.udp_srv_sndbuf,
+    int rv = setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options_.udp_srv_sndbuf,
                         sizeof(options_.udp_srv_sndbuf));
     if (rv != 0) {
       Log(options_.info_log, 0, "Cannot set SO_SNDBUF=%d: %s",
@@ -78,36 +117,64 @@ Status PosixUDPServer::OpenAndBind(const std::string& uri) {
     }
   }
 
-  if (status.ok()) {
-    // Fetch the port that we have just bound to in case we have decided to have
-    // the OS choose the port
-    socklen_t tmp = sizeof(struct sockaddr_in);
-    getsockname(fd_, reinterpret_cast<struct sockaddr*>(actual_addr_->rep()),
-                &tmp);
-  }
-
+  *result = fd;
   return status;
 }
 
-inline PosixUDPServer::CallState* PosixUDPServer::CreateCallState() {
+PosixUDPServer::CallPool* PosixUDPServer::NewCallPool() {
+  CallPool* const pool = new CallPool;
+  MutexLock ml(&mutex_);
+  pools_.push_back(pool);
+  return pool;
+}
+
+inline PosixUDPServer::CallState* PosixUDPServer::NewCallState(
+    CallPool* const pool) {
+  {
+    MutexLock ml(&pool->mu);
+    if (!pool->free_calls.empty()) {
+      CallState* const call = pool->free_calls.back();
+      pool->free_calls.pop_back();
+      return call;
+    }
+  }
   CallState* const call = static_cast<CallState*>(
       malloc(sizeof(struct CallState) - 1 + max_msgsz_));
   call->parent_srv = this;
+  call->pool = pool;
   return call;
 }
 
+inline void PosixUDPServer::RecycleCallState(CallState* const call) {
+  CallPool* const pool = call->pool;
+  MutexLock ml(&pool->mu);
+  if (pool->free_calls.size() < CallPool::kMaxFreeCalls) {
+    pool->free_calls.push_back(call);
+  } else {
+    free(call);
+  }
+}
+
 Status PosixUDPServer::BGLoop(int myid) {
-  CallState* call = CreateCallState();
+#if defined(PDLFS_OS_LINUX)
+  if (batch_size_ > 1) {
+    return BGLoopBatched(myid);
+  }
+#endif
+  const int fd = BGSocket(myid);
+  CallPool* const pool = NewCallPool();
+  CallState* call = NewCallState(pool);
   struct pollfd po;
   po.events = POLLIN;
-  po.fd = fd_;
+  po.fd = fd;
 
   int err = 0;
   while (!err && !shutting_down_.Acquire_Load()) {
     call->addrlen = sizeof(call->addrstor);
+    call->fd = fd;
     // Try performing a quick non-blocking receive from peers before sinking
     // into poll.
-    ssize_t rv = recvfrom(fd_, call->msg, max_msgsz_, MSG_DONTWAIT,
+    ssize_t rv = recvfrom(fd, call->msg, max_msgsz_, MSG_DONTWAIT,
                           call->addrbuf(), &call->addrlen);
     if (rv > 0) {
       call->msgsz = rv;
@@ -125,7 +192,7 @@ Status PosixUDPServer::BGLoop(int myid) {
     }
   }
 
-  free(call);
+  RecycleCallState(call);
 
   Status status;
   if (err) {
@@ -134,18 +201,141 @@ Status PosixUDPServer::BGLoop(int myid) {
   return status;
 }
 
+#if defined(PDLFS_OS_LINUX)
+// Same as BGLoop() except that we receive up to batch_size_ calls per
+// recvmmsg(). When calls are processed inline, their replies are sent back
+// together using sendmmsg(). Calls handed to extra workers are spread across
+// the workers one by one so that a slow call never holds back the rest of its
+// batch, and each worker replies to its call with a single sendto().
+Status PosixUDPServer::BGLoopBatched(int myid) {
+  const int fd = BGSocket(myid);
+  const int n = batch_size_;
+  CallPool* const pool = NewCallPool();
+  std::vector<CallState*> calls(n);
+  for (int i = 0; i < n; i++) {
+    calls[i] = NewCallState(pool);
+  }
+  std::vector<struct mmsghdr> msgs(n);
+  std::vector<struct iovec> iovs(n);
+  std::vector<rpc::If::Message> outs(n);
+  std::vector<struct mmsghdr> replies(n);
+  std::vector<struct iovec> reply_iovs(n);
+  struct pollfd po;
+  po.events = POLLIN;
+  po.fd = fd;
+
+  int err = 0;
+  while (!err && !shutting_down_.Acquire_Load()) {
+    for (int i = 0; i < n; i++) {
+      iovs[i].iov_base = calls[i]->msg;
+      iovs[i].iov_len = max_msgsz_;
+      memset(&msgs[i], 0, sizeof(struct mmsghdr));
+      msgs[i].msg_hdr.msg_name = calls[i]->addrbuf();
+      msgs[i].msg_hdr.msg_namelen = sizeof(calls[i]->addrstor);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    // Try performing a quick non-blocking receive from peers before sinking
+    // into poll.
+    int rv = recvmmsg(fd, &msgs[0], n, MSG_DONTWAIT, NULL);
+    if (rv > 0) {
+      for (int i = 0; i < rv; i++) {
+        calls[i]->addrlen = msgs[i].msg_hdr.msg_namelen;
+        calls[i]->msgsz = msgs[i].msg_len;
+        calls[i]->fd = fd;
+      }
+      if (options_.extra_workers) {
+        for (int i = 0; i < rv; i++) {
+          if (calls[i]->msgsz != 0) {  // Skip empty messages
+            ScheduleCall(&calls[i]);
+          }
+        }
+        continue;
+      }
+      int k = 0;  // Number of replies to send
+      for (int i = 0; i < rv; i++) {
+        if (calls[i]->msgsz != 0 && InvokeCall(calls[i], &outs[k])) {
+          reply_iovs[k].iov_base = const_cast<char*>(outs[k].contents.data());
+          reply_iovs[k].iov_len = outs[k].contents.size();
+          memset(&replies[k], 0, sizeof(struct mmsghdr));
+          replies[k].msg_hdr.msg_name = calls[i]->addrbuf();
+          replies[k].msg_hdr.msg_namelen = calls[i]->addrlen;
+          replies[k].msg_hdr.msg_iov = &reply_iovs[k];
+          replies[k].msg_hdr.msg_iovlen = 1;
+          k++;
+        }
+      }
+      int sent = 0;
+      while (sent < k) {
+        int r = sendmmsg(fd, &replies[sent], k - sent, 0);
+        if (r > 0) {
+          sent += r;
+        } else {  // Skip the reply that cannot be sent
+          Log(options_.info_log, 0, "Error sending data to client: %s",
+              strerror(errno));
+          sent++;
+        }
+      }
+      for (int i = 0; i < k; i++) {
+        // Do not let one large reply pin memory for the server's lifetime
+        if (outs[i].extra_buf.capacity() > max_msgsz_) {
+          std::string().swap(outs[i].extra_buf);
+        }
+      }
+      continue;
+    } else if (errno == EWOULDBLOCK) {
+      rv = poll(&po, 1, 200);
+    }
+
+    // Either poll() or recvmmsg() may have returned error
+    if (rv == -1) {
+      err = errno;
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    RecycleCallState(calls[i]);
+  }
+
+  Status status;
+  if (err) {
+    status = Status::IOError("UDP recvmmsg/poll", strerror(err));
+  }
+  return status;
+}
+#endif
+
+void PosixUDPServer::ScheduleCall(CallState** call) {
+  CallPool* const pool = (*call)->pool;
+  bg_count_.fetch_add(1);
+  // XXX: senders/callers are implicitly rate-limited by not sending them
+  // replies. Should we more explicitly rate-limit them? For example, when
+  // bg_work_ is larger than a certain threshold, incoming calls are instantly
+  // rejected with a special reply. This special reply is understood by
+  // PosixUDPCli, which in turn returns a special Status to the caller.
+  options_.extra_workers->Schedule(ProcessCallWrapper, *call);
+  *call = NewCallState(pool);
+}
+
+// Only the work item that may be the last one takes mutex_, so that the
+// destructor sees bg_count_ drop to 0 before it may proceed.
+void PosixUDPServer::FinishScheduledCall() {
+  int n = bg_count_.load();
+  while (n > 1) {
+    if (bg_count_.compare_exchange_weak(n, n - 1)) {
+      return;
+    }
+  }
+  MutexLock ml(&mutex_);
+  assert(bg_count_.load() > 0);
+  if (bg_count_.fetch_sub(1) == 1) {
+    bg_cv_.SignalAll();
+  }
+}
+
 void PosixUDPServer::HandleIncomingCall(CallState** call) {
   if (options_.extra_workers) {
-    mutex_.Lock();
-    ++bg_count_;
-    // XXX: senders/callers are implicitly rate-limited by not sending them
-    // replies. Should we more explicitly rate-limit them? For example, when
-    // bg_work_ is larger than a certain threshold, incoming calls are instantly
-    // rejected with a special reply. This special reply is understood by
-    // PosixUDPCli, which in turn returns a special Status to the caller.
-    options_.extra_workers->Schedule(ProcessCallWrapper, *call);
-    mutex_.Unlock();
-    *call = CreateCallState();
+    ScheduleCall(call);
   } else {
     ProcessCall(*call);
   }
@@ -155,25 +345,31 @@ void PosixUDPServer::ProcessCallWrapper(void* arg) {
   CallState* const call = reinterpret_cast<CallState*>(arg);
   PosixUDPServer* const srv = call->parent_srv;
   srv->ProcessCall(call);
-  free(call);
-  MutexLock ml(&srv->mutex_);
-  assert(srv->bg_count_ > 0);
-  --srv->bg_count_;
-  if (!srv->bg_count_) {
-    srv->bg_cv_.SignalAll();
-  }
+  RecycleCallState(call);
+  srv->FinishScheduledCall();
 }
 
-void PosixUDPServer::ProcessCall(CallState* const call) {
-  rpc::If::Message in, out;
+bool PosixUDPServer::InvokeCall(CallState* const call, rpc::If::Message* out) {
+  rpc::If::Message in;
   in.contents = Slice(call->msg, call->msgsz);
-  Status s = options_.fs->Call(in, out);
+  // Messages may be reused across calls so no stale reply is kept
+  out->contents = Slice();
+  out->extra_buf.clear();
+  Status s = options_.fs->Call(in, *out);
   if (!s.ok()) {
     Log(options_.info_log, 0, "Fail to handle incoming call: %s",
         s.ToString().c_str());
+    return false;
+  }
+  return true;
+}
+
+void PosixUDPServer::ProcessCall(CallState* const call) {
+  rpc::If::Message out;
+  if (!InvokeCall(call, &out)) {
     return;
   }
-  ssize_t nbytes = sendto(fd_, out.contents.data(), out.contents.size(), 0,
+  ssize_t nbytes = sendto(call->fd, out.contents.data(), out.contents.size(), 0,
                           call->addrbuf(), call->addrlen);
   if (nbytes != out.contents.size()) {
 #if VERBOSE >= 1
@@ -199,23 +395,27 @@ PosixUDPCli::PosixUDPCli(uint64_t timeout, size_t max_msgsz)
     : rpc_timeout_(timeout), max_msgsz_(max_msgsz), fd_(-1) {}
 
 void PosixUDPCli::Open(const std::string& uri) {
-  PosixSocketAddr addr;
-  status_ = addr.ResolvUri(uri);
+  status_ = addr_.ResolvUri(uri);
   if (!status_.ok()) {
     return;
   }
-  fd_ = socket(AF_INET, SOCK_DGRAM, 0);
-  if (fd_ == -1) {
-    status_ = Status::IOError("Cannot create UDP socket", strerror(errno));
-    return;
+  status_ = Connect(&fd_);
+}
+
+Status PosixUDPCli::Connect(int* result) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd == -1) {
+    return Status::IOError("Cannot create UDP socket", strerror(errno));
   }
-  int rv = connect(fd_, reinterpret_cast<struct sockaddr*>(addr.rep()),
+  int rv = connect(fd, reinterpret_cast<struct sockaddr*>(addr_.rep()),
                    sizeof(struct sockaddr_in));
   if (rv == -1) {
-    status_ = Status::IOError("UDP connect", strerror(errno));
-    close(fd_);
-    fd_ = -1;
+    Status status = Status::IOError("UDP connect", strerror(errno));
+    close(fd);
+    return status;
   }
+  *result = fd;
+  return Status::OK();
 }
 
 // We do a synchronous send, followed by one or more non-blocking receives
@@ -268,7 +468,101 @@ Status PosixUDPCli::Call(Message& in, Message& out) RPCNOEXCEPT {
   return status;
 }
 
+Status PosixUDPCli::AsyncCall(Message& in, Message& out, Callback cb,
+                              void* arg) RPCNOEXCEPT {
+  if (!status_.ok()) {
+    return status_;
+  }
+  AsyncCallState call;
+  if (!free_fds_.empty()) {
+    call.fd = free_fds_.back();
+    free_fds_.pop_back();
+  } else {
+    Status status = Connect(&call.fd);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  ssize_t rv = send(call.fd, in.contents.data(), in.contents.size(), 0);
+  if (rv != in.contents.size()) {
+    Status status = Status::IOError("UDP send", strerror(errno));
+    close(call.fd);
+    return status;
+  }
+  call.out = &out;
+  call.cb = cb;
+  call.arg = arg;
+  call.start = CurrentMicros();
+  outstanding_.push_back(call);
+  return Status::OK();
+}
+
+int PosixUDPCli::Poll(bool wait) RPCNOEXCEPT {
+  std::vector<std::pair<AsyncCallState, Status> > completed;
+  std::vector<struct pollfd> po;
+  while (!outstanding_.empty()) {
+    po.resize(outstanding_.size());
+    for (size_t i = 0; i < po.size(); i++) {
+      memset(&po[i], 0, sizeof(struct pollfd));
+      po[i].events = POLLIN;
+      po[i].fd = outstanding_[i].fd;
+    }
+    int rv = poll(&po[0], po.size(), wait ? 200 : 0);
+    const uint64_t now = CurrentMicros();
+    size_t j = 0;  // Number of calls still outstanding
+    for (size_t i = 0; i < po.size(); i++) {
+      AsyncCallState& call = outstanding_[i];
+      bool done = false;
+      Status status;
+      if (rv > 0 && po[i].revents != 0) {
+        std::string& buf = call.out->extra_buf;
+        buf.resize(max_msgsz_);
+        ssize_t nbytes = recv(call.fd, &buf[0], max_msgsz_, MSG_DONTWAIT);
+        if (nbytes >= 0) {
+          buf.resize(nbytes);
+          call.out->contents = buf;
+          done = true;
+        } else if (errno != EWOULDBLOCK) {
+          status = Status::IOError("UDP recv", strerror(errno));
+          done = true;
+        }
+      }
+      if (!done && now - call.start >= rpc_timeout_) {
+        status = Status::Disconnected("timeout");
+        done = true;
+      }
+      if (done) {
+        // Sockets of failed calls may still receive late replies so they are
+        // closed rather than reused
+        if (status.ok()) {
+          free_fds_.push_back(call.fd);
+        } else {
+          close(call.fd);
+        }
+        completed.push_back(std::make_pair(call, status));
+      } else {
+        outstanding_[j++] = call;
+      }
+    }
+    outstanding_.resize(j);
+    if (!wait || !completed.empty()) {
+      break;
+    }
+  }
+  // Callbacks may submit new calls so we invoke them at the very end
+  for (size_t i = 0; i < completed.size(); i++) {
+    completed[i].first.cb(completed[i].second, completed[i].first.arg);
+  }
+  return int(completed.size());
+}
+
 PosixUDPCli::~PosixUDPCli() {
+  for (size_t i = 0; i < outstanding_.size(); i++) {
+    close(outstanding_[i].fd);
+  }
+  for (size_t i = 0; i < free_fds_.size(); i++) {
+    close(free_fds_[i]);
+  }
   if (fd_ != -1) {
     close(fd_);
   }
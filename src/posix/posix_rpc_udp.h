@@ -12,6 +12,7 @@
 
 #include "posix_rpc.h"
 
+#include <atomic>
 #include <stddef.h>
 #include <sys/socket.h>
 
@@ -28,26 +29,51 @@ class PosixUDPServer : public PosixSocketServer {
   virtual std::string GetUri();
 
  private:
+  struct CallPool;
   // State for each incoming procedure call.
   struct CallState {
     PosixUDPServer* parent_srv;  // Back pointer to the server
+    CallPool* pool;              // Pool the state is recycled through
     // Location of the caller
     struct sockaddr_storage addrstor;
     struct sockaddr* addrbuf() {
       return reinterpret_cast<struct sockaddr*>(&addrstor);
     }
     socklen_t addrlen;
+    int fd;        // Socket on which the call was received
     size_t msgsz;  // Payload size
     char msg[1];
   };
-  CallState* CreateCallState();
+  virtual Status OpenExtraSocket(int* result);
+  Status OpenSocket(const PosixSocketAddr& addr, int* result);
+  // Call states of each background thread. States handed to extra workers
+  // are returned to the pool of the thread that received them, so a pool's
+  // lock is only shared by its thread and the workers finishing its calls.
+  struct CallPool {
+    enum { kMaxFreeCalls = 256 };
+    port::Mutex mu;
+    std::vector<CallState*> free_calls;
+  };
+  CallPool* NewCallPool();
+  CallState* NewCallState(CallPool* pool);
+  static void RecycleCallState(CallState* call);
+  void ScheduleCall(CallState** call);  // Send call to bg worker pool
+  void FinishScheduledCall();
   void HandleIncomingCall(CallState** call);  // May send call to bg worker pool
+  // Run the server callback on a call and store its reply at *out.
+  // Return false if no reply should be sent.
+  bool InvokeCall(CallState* call, rpc::If::Message* out);
   void ProcessCall(CallState* call);
   static void ProcessCallWrapper(void* arg);
   virtual Status BGLoop(int myid);
+  Status BGLoopBatched(int myid);
   const size_t max_msgsz_;  // Buffer size for incoming rpc messages
+  const int batch_size_;    // Max number of messages per recvmmsg/sendmmsg
+  // Total number of bg work items pending. Only updated under mutex_ when
+  // it may drop to 0 so that the destructor can wait for it.
+  std::atomic<int> bg_count_;
   // State below protected by mutex_
-  int bg_count_;  // Total number of bg work items pending
+  std::vector<CallPool*> pools_;  // One per background thread
 };
 
 // UDP client.
@@ -58,6 +84,14 @@ class PosixUDPCli : public rpc::If {
 
   // Each call results in 1 UDP send and 1 UDP receive.
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT;
+
+  // Each outstanding asynchronous call uses a connected socket of its own so
+  // that replies can be matched to calls without changing the wire format.
+  // Sockets are reused across calls.
+  virtual Status AsyncCall(Message& in, Message& out, Callback cb,
+                           void* arg) RPCNOEXCEPT;
+  virtual int Poll(bool wait) RPCNOEXCEPT;
+
   // If we fail to open, error status will be set and the next Call()
   // operation will return it.
   void Open(const std::string& uri);
@@ -66,10 +100,21 @@ class PosixUDPCli : public rpc::If {
   // No copying allowed
   void operator=(const PosixUDPCli&);
   PosixUDPCli(const PosixUDPCli& other);
+  Status Connect(int* result);
   const uint64_t rpc_timeout_;  // In microseconds
   const size_t max_msgsz_;
+  PosixSocketAddr addr_;
   Status status_;
   int fd_;
+  struct AsyncCallState {
+    int fd;
+    Message* out;
+    Callback cb;
+    void* arg;
+    uint64_t start;
+  };
+  std::vector<AsyncCallState> outstanding_;
+  std::vector<int> free_fds_;  // Sockets available to asynchronous calls
 };
 
 }  // namespace pdlfs
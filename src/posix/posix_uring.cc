@@ -0,0 +1,496 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "posix_uring.h"
+
+#include "posix_env.h"
+
+#include "pdlfs-common/mutexlock.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <vector>
+
+#if defined(PDLFS_IO_URING)
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace pdlfs {
+
+#if defined(PDLFS_IO_URING)
+namespace {
+// Buffered data is written behind once there is this much of it.
+const size_t kWriteBufferSize = 64 << 10;
+// Appends wait for the oldest write once this many writes are in progress.
+const size_t kMaxPendingWrites = 8;
+// Submissions refused for lack of kernel resources are retried this many
+// times before their requests are failed.
+const int kMaxEnterRetries = 1000;
+
+int SysSetup(unsigned entries, struct io_uring_params* p) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+int SysEnter(int fd, unsigned to_submit, unsigned min_complete,
+             unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                  min_complete, flags, NULL, 0));
+}
+
+void* MapRing(int fd, size_t size, off_t offset) {
+  void* const base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, offset);
+  return base != MAP_FAILED ? base : NULL;
+}
+
+template <typename T>
+T* At(void* base, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+}  // namespace
+
+IoUring* IoUring::Open(unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  const int fd = SysSetup(entries, &p);
+  if (fd < 0) {
+    return NULL;
+  }
+  IoUring* const ring = new IoUring(fd);
+  if (!ring->Map(p)) {
+    delete ring;
+    return NULL;
+  }
+  return ring;
+}
+
+IoUring::IoUring(int fd)
+    : cv_(&mu_),
+      ring_fd_(fd),
+      sq_ring_(NULL),
+      sq_ring_size_(0),
+      cq_ring_(NULL),
+      cq_ring_size_(0),
+      sqes_(NULL),
+      sqes_size_(0),
+      inflight_(0),
+      reaping_(false) {}
+
+bool IoUring::Map(const struct io_uring_params& p) {
+  sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    cq_ring_size_ = sq_ring_size_;
+  }
+  sq_ring_ = MapRing(ring_fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == NULL) {
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = MapRing(ring_fd_, cq_ring_size_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == NULL) {
+      return false;
+    }
+  }
+  sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe*>(
+      MapRing(ring_fd_, sqes_size_, IORING_OFF_SQES));
+  if (sqes_ == NULL) {
+    return false;
+  }
+  sq_tail_ = At<unsigned>(sq_ring_, p.sq_off.tail);
+  sq_array_ = At<unsigned>(sq_ring_, p.sq_off.array);
+  sq_mask_ = *At<unsigned>(sq_ring_, p.sq_off.ring_mask);
+  sq_entries_ = p.sq_entries;
+  cq_head_ = At<unsigned>(cq_ring_, p.cq_off.head);
+  cq_tail_ = At<unsigned>(cq_ring_, p.cq_off.tail);
+  cqes_ = At<struct io_uring_cqe>(cq_ring_, p.cq_off.cqes);
+  cq_mask_ = *At<unsigned>(cq_ring_, p.cq_off.ring_mask);
+  cq_entries_ = p.cq_entries;
+  return true;
+}
+
+IoUring::~IoUring() {
+  assert(inflight_ == 0);
+  if (sqes_ != NULL) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != NULL && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != NULL) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  close(ring_fd_);
+}
+
+void IoUring::Submit(Request* reqs, size_t n) {
+  MutexLock l(&mu_);
+  unsigned queued = 0;
+  for (size_t i = 0; i < n; i++) {
+    while (inflight_ + queued >= cq_entries_) {
+      if (queued != 0) {
+        EnterLocked(queued);
+        queued = 0;
+      } else {
+        WaitLocked();
+      }
+    }
+    if (queued == sq_entries_) {
+      EnterLocked(queued);
+      queued = 0;
+    }
+    PrepLocked(&reqs[i]);
+    queued++;
+  }
+  if (queued != 0) {
+    EnterLocked(queued);
+  }
+}
+
+void IoUring::Wait(Request* r) {
+  MutexLock l(&mu_);
+  while (!r->done) {
+    WaitLocked();
+  }
+}
+
+bool IoUring::Poll(Request* r) {
+  MutexLock l(&mu_);
+  if (!r->done) {
+    ReapLocked();
+  }
+  return r->done;
+}
+
+void IoUring::PrepLocked(Request* r) {
+  mu_.AssertHeld();
+  // We are the only one producing to the submission queue
+  const unsigned tail = *sq_tail_;
+  const unsigned index = tail & sq_mask_;
+  struct io_uring_sqe* const sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  r->result = 0;
+  r->done = false;
+  r->iov.iov_base = r->buf;
+  r->iov.iov_len = r->n;
+  switch (r->op) {
+    case kRead:
+      sqe->opcode = IORING_OP_READV;
+      break;
+    case kWrite:
+      sqe->opcode = IORING_OP_WRITEV;
+      break;
+    case kDataSync:
+      sqe->opcode = IORING_OP_FSYNC;
+      sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+      break;
+  }
+  if (r->op != kDataSync) {
+    sqe->addr = reinterpret_cast<uintptr_t>(&r->iov);
+    sqe->len = 1;
+    sqe->off = r->offset;
+  }
+  sqe->fd = r->fd;
+  sqe->user_data = reinterpret_cast<uintptr_t>(r);
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Submit the last "n" requests queued. Requests submitted with errors still
+// complete, reporting their errors through the completion queue. If the
+// kernel refuses the requests altogether, those not yet submitted are taken
+// back from the submission queue and are marked done with the error.
+void IoUring::EnterLocked(unsigned n) {
+  mu_.AssertHeld();
+  int retries = 0;
+  while (n != 0) {
+    const int r = SysEnter(ring_fd_, n, 0, 0);
+    if (r > 0) {
+      inflight_ += r;
+      n -= r;
+      retries = 0;
+    } else if (r == 0 || errno == EAGAIN || errno == EBUSY) {
+      // The kernel is short of resources, possibly because completions are
+      // piling up. The lock is kept so that no one else may queue requests
+      // behind ours, so we reap completions ourselves to free them up. We
+      // give up after a while.
+      const int err = (r == 0) ? EAGAIN : errno;
+      if (++retries > kMaxEnterRetries) {
+        FailLocked(n, err);
+        n = 0;
+      } else if (ReapLocked() == 0) {
+        // Have the kernel flush any completions it holds back because the
+        // completion queue was full, without waiting for more
+        SysEnter(ring_fd_, 0, 0, IORING_ENTER_GETEVENTS);
+        if (ReapLocked() == 0) {
+          sched_yield();
+        }
+      }
+    } else if (errno != EINTR) {
+      FailLocked(n, errno);
+      n = 0;
+    }
+  }
+}
+
+// Take back the last "n" requests queued, which the kernel has not consumed,
+// and mark them done with error "err".
+void IoUring::FailLocked(unsigned n, int err) {
+  mu_.AssertHeld();
+  // The kernel only consumes the submission queue from within
+  // io_uring_enter, which is always called with the lock held
+  const unsigned tail = *sq_tail_ - n;
+  for (unsigned i = 0; i < n; i++) {
+    const struct io_uring_sqe* const sqe = &sqes_[(tail + i) & sq_mask_];
+    Request* const r = reinterpret_cast<Request*>(sqe->user_data);
+    r->result = -err;
+    r->done = true;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+  cv_.SignalAll();
+}
+
+// Mark all requests in the completion queue as done and signal their waiters.
+// Return the number of requests reaped.
+unsigned IoUring::ReapLocked() {
+  mu_.AssertHeld();
+  unsigned head = *cq_head_;
+  const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  const unsigned result = tail - head;
+  for (; head != tail; head++) {
+    const struct io_uring_cqe* const cqe = &cqes_[head & cq_mask_];
+    Request* const r = reinterpret_cast<Request*>(cqe->user_data);
+    r->result = cqe->res;
+    r->done = true;
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  inflight_ -= result;
+  if (result != 0) {
+    cv_.SignalAll();
+  }
+  return result;
+}
+
+// Wait for at least one more request to complete. Only one thread waits in
+// the kernel at a time. The others wait for it to reap the completions.
+// REQUIRES: some request is in progress.
+void IoUring::WaitLocked() {
+  mu_.AssertHeld();
+  assert(inflight_ != 0);
+  if (reaping_) {
+    cv_.Wait();
+  } else if (ReapLocked() == 0) {
+    reaping_ = true;
+    mu_.Unlock();
+    while (SysEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+           errno == EINTR) {
+    }
+    mu_.Lock();
+    reaping_ = false;
+    ReapLocked();
+    cv_.SignalAll();  // Let another thread wait in the kernel if needed
+  }
+}
+
+PosixUringSequentialFile::~PosixUringSequentialFile() { close(fd_); }
+
+Status PosixUringSequentialFile::Read(size_t n, Slice* result,
+                                      char* scratch) {
+  IoUring::Request r(IoUring::kRead, fd_, scratch, n, offset_);
+  ring_->Submit(&r, 1);
+  ring_->Wait(&r);
+  if (r.result < 0) {
+    return PosixError(filename_, -r.result);
+  } else {
+    offset_ += r.result;
+    *result = Slice(scratch, r.result);
+    return Status::OK();
+  }
+}
+
+PosixUringRandomAccessFile::~PosixUringRandomAccessFile() { close(fd_); }
+
+Status PosixUringRandomAccessFile::Read(uint64_t offset, size_t n,
+                                        Slice* result, char* scratch) const {
+  IoUring::Request r(IoUring::kRead, fd_, scratch, n, offset);
+  ring_->Submit(&r, 1);
+  ring_->Wait(&r);
+  if (r.result < 0) {
+    *result = Slice();
+    return PosixError(filename_, -r.result);
+  } else {
+    *result = Slice(scratch, r.result);
+    return Status::OK();
+  }
+}
+
+void PosixUringRandomAccessFile::MultiRead(ReadRequest* reqs,
+                                           size_t n) const {
+  if (n == 0) {
+    return;
+  }
+  std::vector<IoUring::Request> rs(n);
+  for (size_t i = 0; i < n; i++) {
+    rs[i] = IoUring::Request(IoUring::kRead, fd_, reqs[i].scratch, reqs[i].n,
+                             reqs[i].offset);
+  }
+  ring_->Submit(&rs[0], n);
+  for (size_t i = 0; i < n; i++) {
+    ring_->Wait(&rs[i]);
+    if (rs[i].result < 0) {
+      reqs[i].result = Slice();
+      reqs[i].status = PosixError(filename_, -rs[i].result);
+    } else {
+      reqs[i].result = Slice(reqs[i].scratch, rs[i].result);
+      reqs[i].status = Status::OK();
+    }
+  }
+}
+
+PosixUringWritableFile::~PosixUringWritableFile() {
+  if (fd_ != -1) {
+    // Ignoring any potential errors
+    Close();
+  }
+}
+
+// Submit all buffered data for writing without waiting for it. Writes that
+// have already completed are cleaned up along the way.
+void PosixUringWritableFile::WriteBehind() {
+  while (!pending_.empty() && ring_->Poll(&pending_.front()->io)) {
+    Finish(pending_.front());
+    pending_.pop_front();
+  }
+  if (buf_.empty()) {
+    return;
+  }
+  while (pending_.size() >= kMaxPendingWrites) {
+    Finish(pending_.front());
+    pending_.pop_front();
+  }
+  PendingWrite* const w = new PendingWrite;
+  w->data.swap(buf_);
+  w->io = IoUring::Request(IoUring::kWrite, fd_, &w->data[0], w->data.size(),
+                           offset_);
+  offset_ += w->data.size();
+  ring_->Submit(&w->io, 1);
+  pending_.push_back(w);
+}
+
+// Wait for a write to complete and then delete it. Short writes are
+// resumed until all data is written.
+void PosixUringWritableFile::Finish(PendingWrite* w) {
+  IoUring::Request* const r = &w->io;
+  while (true) {
+    ring_->Wait(r);
+    if (r->result < 0) {
+      if (status_.ok()) status_ = PosixError(filename_, -r->result);
+      break;
+    } else if (r->result == 0) {
+      if (status_.ok()) status_ = Status::IOError(filename_, "Short write");
+      break;
+    } else if (static_cast<size_t>(r->result) == r->n) {
+      break;
+    }
+    r->buf += r->result;
+    r->n -= r->result;
+    r->offset += r->result;
+    ring_->Submit(r, 1);
+  }
+  delete w;
+}
+
+void PosixUringWritableFile::WaitForAll() {
+  while (!pending_.empty()) {
+    Finish(pending_.front());
+    pending_.pop_front();
+  }
+}
+
+Status PosixUringWritableFile::Append(const Slice& data) {
+  if (!status_.ok()) {
+    return status_;
+  }
+  buf_.append(data.data(), data.size());
+  if (buf_.size() >= kWriteBufferSize) {
+    WriteBehind();
+  }
+  return status_;
+}
+
+Status PosixUringWritableFile::Close() {
+  WriteBehind();
+  WaitForAll();
+  close(fd_);
+  fd_ = -1;
+  return status_;
+}
+
+Status PosixUringWritableFile::Flush() {
+  WriteBehind();
+  return status_;
+}
+
+static Status SyncDirIfManifest(const std::string& filename) {
+  const char* f = filename.c_str();
+  const char* sep = strrchr(f, '/');
+  Slice basename;
+  std::string dir;
+  if (sep == NULL) {
+    dir = ".";
+    basename = f;
+  } else {
+    dir = std::string(f, sep - f);
+    basename = sep + 1;
+  }
+  Status s;
+  if (basename.starts_with("MANIFEST")) {
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd < 0) {
+      s = PosixError(dir, errno);
+    } else {
+      if (fsync(fd) < 0) {
+        s = PosixError(dir, errno);
+      }
+      close(fd);
+    }
+  }
+  return s;
+}
+
+Status PosixUringWritableFile::Sync() {
+  WriteBehind();
+  WaitForAll();
+  if (!status_.ok()) {
+    return status_;
+  }
+  // Ensure new files referred to by the manifest are in the file system.
+  Status s = SyncDirIfManifest(filename_);
+  if (s.ok()) {
+    IoUring::Request r(IoUring::kDataSync, fd_, NULL, 0, 0);
+    ring_->Submit(&r, 1);
+    ring_->Wait(&r);
+    if (r.result < 0) {
+      s = PosixError(filename_, -r.result);
+    }
+  }
+  return s;
+}
+#endif
+
+}  // namespace pdlfs
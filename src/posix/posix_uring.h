@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#pragma once
+
+#include "pdlfs-common/env.h"
+#include "pdlfs-common/pdlfs_platform.h"
+#include "pdlfs-common/port.h"
+
+#include <deque>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/uio.h>
+
+#if defined(PDLFS_OS_LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PDLFS_IO_URING 1
+#endif
+#endif
+
+#if defined(PDLFS_IO_URING)
+struct io_uring_cqe;
+struct io_uring_params;
+struct io_uring_sqe;
+#endif
+
+namespace pdlfs {
+
+#if defined(PDLFS_IO_URING)
+// A Linux io_uring instance that may be shared by multiple threads. Requests
+// are handed to the kernel in batches through a submission queue and are
+// then collected from a completion queue, so that many reads and writes can
+// be in progress at the same time.
+class IoUring {
+ public:
+  // Return NULL if io_uring is not supported by the running kernel or is
+  // not permitted (e.g., by a seccomp filter). The ring has room for
+  // "entries" requests to be submitted at once.
+  static IoUring* Open(unsigned entries);
+
+  // REQUIRES: no request is in progress.
+  ~IoUring();
+
+  enum Op { kRead, kWrite, kDataSync };
+
+  struct Request {
+    Request()
+        : op(kRead), fd(-1), buf(NULL), n(0), offset(0), result(0),
+          done(false) {}
+    Request(Op op, int fd, char* buf, size_t n, uint64_t offset)
+        : op(op), fd(fd), buf(buf), n(n), offset(offset), result(0),
+          done(false) {}
+
+    Op op;
+    int fd;
+    char* buf;  // Not used by kDataSync
+    size_t n;
+    uint64_t offset;
+
+    // Set once the request completes: the number of bytes transferred, or a
+    // negated errno on errors.
+    int result;
+    bool done;
+
+   private:
+    friend class IoUring;
+    struct iovec iov;
+  };
+
+  // Hand "reqs[0..n-1]" to the kernel without waiting for them to complete.
+  // Each request must remain live until it is done. Requests the kernel
+  // refuses to take are done at once with a negated errno as their result.
+  void Submit(Request* reqs, size_t n);
+
+  // Wait for a submitted request to complete.
+  void Wait(Request* r);
+
+  // Return true iff a submitted request has completed. Never blocks.
+  bool Poll(Request* r);
+
+ private:
+  explicit IoUring(int fd);
+  bool Map(const struct io_uring_params& p);
+  void PrepLocked(Request* r);
+  void EnterLocked(unsigned n);
+  void FailLocked(unsigned n, int err);
+  unsigned ReapLocked();
+  void WaitLocked();
+
+  port::Mutex mu_;
+  port::CondVar cv_;
+  const int ring_fd_;
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;  // Same as sq_ring_ if the kernel maps both rings at once
+  size_t cq_ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned* sq_tail_;
+  unsigned* sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  struct io_uring_cqe* cqes_;
+  unsigned cq_mask_;
+  unsigned cq_entries_;
+  // Number of requests submitted but not yet reaped. Never exceeds the size
+  // of the completion queue so that no completion is ever dropped.
+  unsigned inflight_;
+  bool reaping_;  // True while a thread waits for completions in the kernel
+
+  // No copying allowed
+  IoUring(const IoUring&);
+  void operator=(const IoUring&);
+};
+
+class PosixUringSequentialFile : public SequentialFile {
+ private:
+  const std::string filename_;
+  const int fd_;
+  IoUring* const ring_;
+  uint64_t offset_;
+
+ public:
+  PosixUringSequentialFile(const char* fname, int fd, IoUring* ring)
+      : filename_(fname), fd_(fd), ring_(ring), offset_(0) {}
+
+  virtual ~PosixUringSequentialFile();
+
+  virtual Status Read(size_t n, Slice* result, char* scratch);
+
+  virtual Status Skip(uint64_t n) {
+    offset_ += n;
+    return Status::OK();
+  }
+};
+
+class PosixUringRandomAccessFile : public RandomAccessFile {
+ private:
+  const std::string filename_;
+  const int fd_;
+  IoUring* const ring_;
+
+ public:
+  PosixUringRandomAccessFile(const char* fname, int fd, IoUring* ring)
+      : filename_(fname), fd_(fd), ring_(ring) {}
+
+  virtual ~PosixUringRandomAccessFile();
+
+  virtual Status Read(uint64_t offset, size_t n, Slice* result,
+                      char* scratch) const;
+
+  // Submits all reads at once and then waits for them.
+  virtual void MultiRead(ReadRequest* reqs, size_t n) const;
+};
+
+// Appends are buffered and written behind in the background: full buffers
+// and buffers passed to Flush() are submitted without waiting for them to
+// complete. Errors from these writes are reported by later calls. Sync() and
+// Close() wait for all writes.
+class PosixUringWritableFile : public WritableFile {
+ private:
+  struct PendingWrite {
+    IoUring::Request io;
+    std::string data;
+  };
+
+  std::string filename_;
+  int fd_;
+  IoUring* const ring_;
+  uint64_t offset_;  // Where the next buffer will be written
+  std::string buf_;
+  std::deque<PendingWrite*> pending_;  // Writes submitted in offset order
+  Status status_;                      // First error seen by a write
+
+  void WriteBehind();
+  void Finish(PendingWrite* w);
+  void WaitForAll();
+
+ public:
+  PosixUringWritableFile(const char* fname, int fd, IoUring* ring)
+      : filename_(fname), fd_(fd), ring_(ring), offset_(0) {}
+
+  virtual ~PosixUringWritableFile();
+
+  virtual Status Append(const Slice& data);
+  virtual Status Close();
+  virtual Status Flush();
+  virtual Status Sync();
+};
+#endif
+
+}  // namespace pdlfs
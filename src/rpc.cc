@@ -42,7 +42,10 @@ RPCOptions::RPCOptions()
       udp_max_unexpected_msgsz(1432),
       udp_max_expected_msgsz(1432),
       udp_srv_rcvbuf(-1),
-      udp_srv_sndbuf(-1) {}
+      udp_srv_sndbuf(-1),
+      udp_srv_batch_size(1),
+      srv_reuseport(false),
+      tcp_persistent_connections(false) {}
 
 int RPC::GetPort() { return -1; }
 
@@ -117,6 +120,14 @@ namespace rpc {
 
 If::~If() {}
 
+Status If::AsyncCall(Message& in, Message& out, Callback cb,
+                     void* arg) RPCNOEXCEPT {
+  cb(Call(in, out), arg);
+  return Status::OK();
+}
+
+int If::Poll(bool wait) RPCNOEXCEPT { return 0; }
+
 namespace {
 #if defined(PDLFS_MARGO_RPC)
 class MargoRPCImpl : public RPC {
@@ -10,6 +10,7 @@
  */
 #include "pdlfs-common/rpc.h"
 
+#include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/port.h"
 #include "pdlfs-common/testharness.h"
 
@@ -20,23 +21,30 @@ namespace pdlfs {
 
 class RPCTest : public rpc::If {
  public:
-  RPCTest() {}
+  RPCTest() : append_replies_(false) {}
 
   virtual Status Call(Message& in, Message& out) RPCNOEXCEPT {
-    out.extra_buf.assign(in.contents.data(), in.contents.size());
+    if (!append_replies_) {
+      out.extra_buf.assign(in.contents.data(), in.contents.size());
+    } else {  // Expects the server to pass in an empty reply buffer
+      out.extra_buf.append(in.contents.data(), in.contents.size());
+    }
     out.contents = out.extra_buf;
     return Status::OK();
   }
 
   RPC* Open(const std::string& uri, int num_rpc_threads = 1,
             ThreadPool* extra_worker = NULL) {
-    RPCOptions options;
+    RPCOptions options(options_);
     options.num_rpc_threads = num_rpc_threads;
     options.extra_workers = extra_worker;
     options.uri = uri;
     options.fs = this;
     return RPC::Open(options);
   }
+
+  RPCOptions options_;  // Base options for Open()
+  bool append_replies_;
 };
 
 TEST(RPCTest, Addr) {
@@ -93,6 +101,216 @@ TEST(RPCTest, SendAndRecv) {
   delete extra_worker;
 }
 
+namespace {
+struct CallerState {
+  rpc::If* client;  // If NULL, each caller opens a stub of its own via rpc
+  RPC* rpc;
+  std::string uri;
+  port::Mutex mu;
+  port::CondVar cv;
+  int num_running;
+  int num_errors;
+  int next_id;
+  CallerState()
+      : client(NULL),
+        rpc(NULL),
+        cv(&mu),
+        num_running(0),
+        num_errors(0),
+        next_id(0) {}
+};
+
+void CallerThread(void* arg) {
+  CallerState* const state = reinterpret_cast<CallerState*>(arg);
+  state->mu.Lock();
+  const int id = state->next_id++;
+  state->mu.Unlock();
+  rpc::If* const client =
+      state->client ? state->client : state->rpc->OpenStubFor(state->uri);
+  int errors = 0;
+  char tmp[100];
+  for (int i = 0; i < 200; i++) {
+    snprintf(tmp, sizeof(tmp), "caller-%d-call-%d", id, i);
+    rpc::If::Message in, out;
+    in.contents = Slice(tmp);
+    Status status = client->Call(in, out);
+    if (!status.ok() || out.contents != in.contents) {
+      errors++;
+    }
+  }
+  if (client != state->client) {
+    delete client;
+  }
+  MutexLock ml(&state->mu);
+  state->num_errors += errors;
+  if (--state->num_running == 0) {
+    state->cv.SignalAll();
+  }
+}
+}  // namespace
+
+TEST(RPCTest, PersistentTCP) {
+  ThreadPool* extra_worker = ThreadPool::NewFixed(2, true);
+  const char* uri = "tcp://127.0.0.1:22222";
+  options_.tcp_persistent_connections = true;
+  for (int j = 0; j < 2; j++) {
+    RPC* rpc = Open(uri, 2, j == 0 ? NULL : extra_worker);
+    ASSERT_TRUE(rpc != NULL);
+    ASSERT_OK(rpc->Start());
+    ASSERT_OK(rpc->status());
+    rpc::If* c1 = rpc->OpenStubFor(uri);
+    rpc::If* c2 = rpc->OpenStubFor(uri);  // Shares c1's connection
+    for (int i = 0; i < 10; i++) {
+      rpc::If::Message in, out;
+      in.contents = Slice("xxyyzz");
+      ASSERT_OK((i % 2 == 0 ? c1 : c2)->Call(in, out));
+      ASSERT_TRUE(out.contents == in.contents);
+    }
+    CallerState state;
+    state.client = c1;
+    state.num_running = 8;
+    for (int i = 0; i < 8; i++) {
+      Env::Default()->StartThread(CallerThread, &state);
+    }
+    state.mu.Lock();
+    while (state.num_running != 0) {
+      state.cv.Wait();
+    }
+    state.mu.Unlock();
+    ASSERT_EQ(state.num_errors, 0);
+    delete c1;
+    delete c2;
+    ASSERT_OK(rpc->Stop());
+    delete rpc;
+  }
+  delete extra_worker;
+}
+
+TEST(RPCTest, BatchedUDP) {
+  ThreadPool* extra_worker = ThreadPool::NewFixed(2, true);
+  const char* uri = "udp://127.0.0.1:22222";
+  options_.udp_srv_batch_size = 16;
+  for (int j = 0; j < 2; j++) {
+    RPC* rpc = Open(uri, 1, j == 0 ? NULL : extra_worker);
+    ASSERT_TRUE(rpc != NULL);
+    ASSERT_OK(rpc->Start());
+    ASSERT_OK(rpc->status());
+    CallerState state;
+    state.rpc = rpc;
+    state.uri = uri;
+    state.num_running = 8;
+    for (int i = 0; i < 8; i++) {
+      Env::Default()->StartThread(CallerThread, &state);
+    }
+    state.mu.Lock();
+    while (state.num_running != 0) {
+      state.cv.Wait();
+    }
+    state.mu.Unlock();
+    ASSERT_EQ(state.num_errors, 0);
+    ASSERT_OK(rpc->Stop());
+    delete rpc;
+  }
+  delete extra_worker;
+}
+
+TEST(RPCTest, BatchedUDPFreshReplies) {
+  const char* uri = "udp://127.0.0.1:22222";
+  options_.udp_srv_batch_size = 16;
+  append_replies_ = true;
+  RPC* rpc = Open(uri);
+  ASSERT_TRUE(rpc != NULL);
+  ASSERT_OK(rpc->Start());
+  ASSERT_OK(rpc->status());
+  rpc::If* c = rpc->OpenStubFor(uri);
+  for (int i = 0; i < 10; i++) {
+    rpc::If::Message in, out;
+    in.contents = Slice("xxyyzz");
+    ASSERT_OK(c->Call(in, out));
+    ASSERT_TRUE(out.contents == in.contents);
+  }
+  delete c;
+  ASSERT_OK(rpc->Stop());
+  delete rpc;
+}
+
+TEST(RPCTest, ReusePort) {
+  const char* uris[3] = {"udp://127.0.0.1:22222", "tcp://127.0.0.1:22222",
+                         "tcp://127.0.0.1:22222"};
+  options_.srv_reuseport = true;
+  for (int i = 0; i < 3; i++) {
+    fprintf(stderr, "Uri: %s%s\n", uris[i], i == 2 ? " (persistent)" : "");
+    options_.tcp_persistent_connections = (i == 2);
+    RPC* rpc = Open(uris[i], 4);
+    ASSERT_TRUE(rpc != NULL);
+    ASSERT_OK(rpc->Start());
+    ASSERT_OK(rpc->status());
+    for (int j = 0; j < 16; j++) {
+      rpc::If* client = rpc->OpenStubFor(uris[i]);
+      ASSERT_TRUE(client != NULL);
+      rpc::If::Message in, out;
+      in.contents = Slice("xxyyzz");
+      ASSERT_OK(client->Call(in, out));
+      ASSERT_TRUE(out.contents == in.contents);
+      delete client;
+    }
+    ASSERT_OK(rpc->Stop());
+    delete rpc;
+  }
+}
+
+namespace {
+struct AsyncResult {
+  rpc::If::Message in, out;
+  std::string expected;
+  Status status;
+  bool done;
+};
+
+void AsyncDone(const Status& status, void* arg) {
+  AsyncResult* const r = reinterpret_cast<AsyncResult*>(arg);
+  ASSERT_FALSE(r->done);
+  r->status = status;
+  r->done = true;
+}
+}  // namespace
+
+TEST(RPCTest, AsyncCall) {
+  const char* uris[3] = {"udp://127.0.0.1:22222", "tcp://127.0.0.1:22222",
+                         "tcp://127.0.0.1:22222"};
+  for (int i = 0; i < 3; i++) {
+    fprintf(stderr, "Uri: %s%s\n", uris[i], i == 2 ? " (persistent)" : "");
+    options_.tcp_persistent_connections = (i == 2);
+    RPC* rpc = Open(uris[i], 2);
+    ASSERT_TRUE(rpc != NULL);
+    ASSERT_OK(rpc->Start());
+    rpc::If* client = rpc->OpenStubFor(uris[i]);
+    ASSERT_TRUE(client != NULL);
+    ASSERT_EQ(client->Poll(false), 0);
+    const int n = 64;
+    std::vector<AsyncResult> results(n);
+    for (int j = 0; j < n; j++) {
+      char tmp[30];
+      snprintf(tmp, sizeof(tmp), "async-%d", j);
+      results[j].expected = tmp;
+      results[j].in.contents = results[j].expected;
+      results[j].done = false;
+      ASSERT_OK(client->AsyncCall(results[j].in, results[j].out, AsyncDone,
+                                  &results[j]));
+    }
+    client->WaitAll();
+    for (int j = 0; j < n; j++) {
+      ASSERT_TRUE(results[j].done);
+      ASSERT_OK(results[j].status);
+      ASSERT_EQ(results[j].out.contents.ToString(), results[j].expected);
+    }
+    ASSERT_EQ(client->Poll(true), 0);
+    delete client;
+    ASSERT_OK(rpc->Stop());
+    delete rpc;
+  }
+}
+
 namespace {
 int GetOptionFromEnv(const char* key, int def) {
   const char* env = getenv(key);
@@ -115,6 +333,7 @@ class RPCBench {
   RPCBench(rpc::Mode mode, const char* uri) : rpc_(NULL) {
     options_.mode = mode;
     options_.uri = uri;
+    options_.tcp_persistent_connections = GetOption("RPC_TCP_PERSISTENT", 0);
   }
 
   ~RPCBench() {
@@ -133,6 +352,8 @@ class RPCBenchServer : public RPCBench, public rpc::If {
       : RPCBench(rpc::kServerClient, uri), shutting_down_(NULL) {
     int n = GetOption("RPC_NUM_THREADS", 1);
     options_.num_rpc_threads = n;
+    options_.srv_reuseport = GetOption("RPC_SRV_REUSEPORT", 0);
+    options_.udp_srv_batch_size = GetOption("RPC_UDP_BATCH_SIZE", 1);
     options_.fs = this;
     rpc_ = RPC::Open(options_);
   }
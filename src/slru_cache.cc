@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2019 Carnegie Mellon University,
+ * Copyright (c) 2019 Triad National Security, LLC, as operator of
+ *     Los Alamos National Laboratory.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+#include "pdlfs-common/cache.h"
+#include "pdlfs-common/hash.h"
+#include "pdlfs-common/hashmap.h"
+#include "pdlfs-common/mutexlock.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// A segmented LRU (SLRU) cache. Each shard splits its entries into two LRU
+// segments:
+//
+// * probation: entries that have been inserted but not yet hit. New entries
+//     enter here and are the first to be evicted.
+//
+// * protected: entries that have been hit at least once after insertion. The
+//     protected segment is capped at a fraction of the shard capacity. When
+//     it overflows, its least recently used entries are demoted back to the
+//     head of the probation segment.
+//
+// A scan touches each block once, so its blocks only pass through the
+// probation segment and cannot flush the hot working set kept in the protected
+// segment. Like LRUCache, entries currently referenced by clients are kept on
+// a separate in-use list and are never evicted automatically.
+namespace pdlfs {
+
+namespace {
+
+struct SLRUEntry {
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  SLRUEntry* next_hash;
+  SLRUEntry* next;
+  SLRUEntry* prev;
+  size_t charge;
+  size_t key_length;
+  uint32_t refs;
+  uint32_t hash;     // Hash of key(); used for fast partitioning and comparisons
+  bool in_cache;     // True iff entry has a reference from the cache
+  bool protect;      // True iff entry belongs to the protected segment
+  char key_data[1];  // Beginning of the key
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+// Requires external synchronization.
+class SLRUCacheShard {
+ public:
+  SLRUCacheShard()
+      : capacity_(0), protected_capacity_(0), usage_(0), protected_usage_(0) {
+    MakeEmpty(&in_use_);
+    MakeEmpty(&probation_);
+    MakeEmpty(&protected_);
+  }
+
+  ~SLRUCacheShard() {
+    assert(in_use_.next == &in_use_);  // Error if caller has a handle
+    DeleteAll(&probation_);
+    DeleteAll(&protected_);
+  }
+
+  void SetCapacity(size_t capacity, double protected_ratio) {
+    capacity_ = capacity;
+    protected_capacity_ = static_cast<size_t>(capacity * protected_ratio);
+  }
+
+  SLRUEntry* Insert(const Slice& key, uint32_t hash, void* value,
+                    size_t charge,
+                    void (*deleter)(const Slice& key, void* value)) {
+    SLRUEntry* const e = static_cast<SLRUEntry*>(
+        malloc(sizeof(SLRUEntry) - 1 + key.size()));
+    e->value = value;
+    e->deleter = deleter;
+    e->charge = charge;
+    e->key_length = key.size();
+    e->hash = hash;
+    e->in_cache = false;
+    e->protect = false;
+    e->refs = 1;  // This is for the handle to be returned to the client
+    memcpy(e->key_data, key.data(), key.size());
+    Append(&in_use_, e);
+    if (!capacity_) {
+      return e;
+    }
+    e->refs++;  // This is for the cache itself
+    e->in_cache = true;
+    usage_ += charge;
+    SLRUEntry* const old = table_.Insert(e);
+    if (old != NULL) {
+      Remove(old);
+    }
+    // Make room for the incoming entry. Evict from the probation segment
+    // first.
+    while (usage_ > capacity_) {
+      SLRUEntry* victim = probation_.next;
+      if (victim == &probation_) {
+        victim = protected_.next;
+        if (victim == &protected_) {
+          break;  // All remaining entries are in use
+        }
+      }
+      assert(victim->refs == 1);
+      table_.Remove(victim);
+      Remove(victim);
+    }
+    // Don't cache the incoming entry if we turn out to have run out of room.
+    if (usage_ > capacity_) {
+      table_.Remove(e);
+      Remove(e);
+    }
+    return e;
+  }
+
+  SLRUEntry* Lookup(const Slice& key, uint32_t hash) {
+    SLRUEntry* const e = *table_.FindPointer(key, hash);
+    if (e != NULL) {
+      if (e->refs == 1) {
+        Unlink(e);  // Take it off its idle list
+        Append(&in_use_, e);
+      }
+      e->refs++;
+      if (!e->protect) {  // A hit promotes the entry to the protected segment
+        e->protect = true;
+        protected_usage_ += e->charge;
+      }
+    }
+    return e;
+  }
+
+  void Release(SLRUEntry* e) { Unref(e); }
+
+  void Erase(const Slice& key, uint32_t hash) {
+    SLRUEntry* const e = table_.Remove(key, hash);
+    if (e != NULL) {
+      Remove(e);
+    }
+  }
+
+ private:
+  static void MakeEmpty(SLRUEntry* list) {
+    list->next = list;
+    list->prev = list;
+  }
+
+  static void Unlink(SLRUEntry* e) {
+    e->next->prev = e->prev;
+    e->prev->next = e->next;
+  }
+
+  static void Append(SLRUEntry* list, SLRUEntry* e) {
+    // Make "e" newest entry by inserting just before *list
+    e->next = list;
+    e->prev = list->prev;
+    e->prev->next = e;
+    e->next->prev = e;
+  }
+
+  // Return an idle entry to the tail of its segment. Demote the oldest
+  // protected entries if the protected segment has grown beyond its share.
+  void MakeIdle(SLRUEntry* e) {
+    Append(e->protect ? &protected_ : &probation_, e);
+    while (protected_usage_ > protected_capacity_ &&
+           protected_.next != &protected_) {
+      SLRUEntry* const victim = protected_.next;
+      Unlink(victim);
+      victim->protect = false;
+      protected_usage_ -= victim->charge;
+      Append(&probation_, victim);
+    }
+  }
+
+  void Unref(SLRUEntry* e) {
+    assert(e->refs > 0);
+    e->refs--;
+    if (e->refs == 0) {
+      Unlink(e);
+      assert(!e->in_cache);
+      (*e->deleter)(e->key(), e->value);
+      free(e);
+    } else if (e->in_cache && e->refs == 1) {
+      Unlink(e);  // No longer in use
+      MakeIdle(e);
+    }
+  }
+
+  // REQUIRES: *e has been removed from table_.
+  void Remove(SLRUEntry* e) {
+    assert(e->in_cache);
+    e->in_cache = false;
+    usage_ -= e->charge;
+    if (e->protect) {
+      e->protect = false;
+      protected_usage_ -= e->charge;
+    }
+    Unref(e);
+  }
+
+  void DeleteAll(SLRUEntry* list) {
+    for (SLRUEntry* e = list->next; e != list;) {
+      SLRUEntry* const next = e->next;
+      assert(e->refs == 1 && e->in_cache);
+      e->in_cache = false;
+      Unref(e);
+      e = next;
+    }
+  }
+
+  size_t capacity_;
+  size_t protected_capacity_;
+  size_t usage_;
+  size_t protected_usage_;
+  SLRUEntry in_use_;     // Dummy head of entries referenced by clients
+  SLRUEntry probation_;  // Dummy head; probation_.next is the oldest
+  SLRUEntry protected_;  // Dummy head; protected_.next is the oldest
+  HashTable<SLRUEntry> table_;
+
+  // No copying allowed
+  void operator=(const SLRUCacheShard&);
+  SLRUCacheShard(const SLRUCacheShard&);
+};
+
+class ShardedSLRUCache : public Cache {
+ private:
+  port::Mutex id_mu_;
+  uint64_t id_;  // The last allocated id number
+
+  static inline uint32_t hashval(const Slice& in) {
+    return Hash(in.data(), in.size(), 0);
+  }
+
+  static uint32_t sha(uint32_t hash) { return hash >> (32 - kNumShardBits); }
+
+  enum { kNumShardBits = 4 };
+  enum { kNumShards = 1 << kNumShardBits };
+
+  SLRUCacheShard sh_[kNumShards];
+  port::Mutex mu_[kNumShards];
+
+ public:
+  ShardedSLRUCache(size_t capacity, double protected_ratio) : id_(0) {
+    const size_t per_shard = (capacity + (kNumShards - 1)) / kNumShards;
+    for (int s = 0; s < kNumShards; s++) {
+      sh_[s].SetCapacity(per_shard, protected_ratio);
+    }
+  }
+
+  virtual ~ShardedSLRUCache() {}
+
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    const uint32_t hash = hashval(key);
+    const uint32_t s = sha(hash);
+    MutexLock l(&mu_[s]);
+    SLRUEntry* e = sh_[s].Insert(key, hash, value, charge, deleter);
+    return reinterpret_cast<Handle*>(e);
+  }
+
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = hashval(key);
+    const uint32_t s = sha(hash);
+    MutexLock l(&mu_[s]);
+    SLRUEntry* e = sh_[s].Lookup(key, hash);
+    return reinterpret_cast<Handle*>(e);
+  }
+
+  virtual void Release(Handle* handle) {
+    SLRUEntry* e = reinterpret_cast<SLRUEntry*>(handle);
+    const uint32_t s = sha(e->hash);
+    MutexLock l(&mu_[s]);
+    sh_[s].Release(e);
+  }
+
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = hashval(key);
+    const uint32_t s = sha(hash);
+    MutexLock l(&mu_[s]);
+    sh_[s].Erase(key, hash);
+  }
+
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<SLRUEntry*>(handle)->value;
+  }
+
+  virtual uint64_t NewId() {
+    MutexLock l(&id_mu_);
+    return ++(id_);
+  }
+};
+
+}  // namespace
+
+Cache* NewSLRUCache(size_t capacity, double protected_ratio) {
+  return new ShardedSLRUCache(capacity, protected_ratio);
+}
+
+}  // namespace pdlfs
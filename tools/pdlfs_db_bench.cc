@@ -6,12 +6,17 @@
 #include <stdlib.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
 #include "pdlfs-common/cache.h"
 #include "pdlfs-common/crc32c.h"
 #include "pdlfs-common/env.h"
 #include "pdlfs-common/histogram.h"
-#include "pdlfs-common/leveldb/db/db.h"
-#include "pdlfs-common/leveldb/db/write_batch.h"
+#include "pdlfs-common/leveldb/db.h"
+#include "pdlfs-common/leveldb/filter_policy.h"
+#include "pdlfs-common/leveldb/write_batch.h"
 #include "pdlfs-common/mutexlock.h"
 #include "pdlfs-common/pdlfs_config.h"
 #include "pdlfs-common/port.h"
@@ -31,7 +36,11 @@
 //      readreverse   -- read N times in reverse order
 //      readrandom    -- read N times in random order
 //      readmissing   -- read N missing keys in random order
+//      multireadrandom -- readrandom using MultiGet() in batches of
+//                       --batch_size keys
 //      readhot       -- read N times in random order from 1% section of DB
+//      readhotscan   -- readhot interleaved with short sequential scans;
+//                       reports point read latency and block cache hit rate
 //      seekrandom    -- N random seeks
 //      open          -- cost of opening a DB
 //      crc32c        -- repeated crc32c of 4K of data
@@ -95,6 +104,30 @@ static int FLAGS_block_size = 0;
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// Block cache implementation: "lru", "clock", or "slru" (scan-resistant).
+// Only used when --cache_size is set.
+static const char* FLAGS_cache_type = "lru";
+
+// If false, read table files through pread() rather than mmap(). Blocks read
+// through mmap() are not inserted into the block cache.
+static bool FLAGS_mmap_reads = true;
+
+// If true, perform all file io through io_uring. Overrides --mmap_reads.
+static bool FLAGS_io_uring = false;
+
+// Maximum number of data blocks read ahead by readseq. Readahead runs on a
+// pool with as many threads.
+static int FLAGS_readahead_blocks = 0;
+
+// Number of keys looked up by each MultiGet() in multireadrandom.
+static int FLAGS_batch_size = 100;
+
+// Number of point reads between two scans in readhotscan.
+static int FLAGS_scan_interval = 100;
+
+// Number of keys read by each scan in readhotscan.
+static int FLAGS_scan_length = 1000;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
@@ -102,6 +135,18 @@ static int FLAGS_open_files = 0;
 // Negative means use default settings.
 static int FLAGS_bloom_bits = -1;
 
+// If true, add a hash index to each data block for faster point lookups.
+static bool FLAGS_data_block_hash_index = false;
+
+// If true, use an ECT index in tables with fixed-length keys.
+static bool FLAGS_ect_index = false;
+
+// Block compression: "none", "snappy", "lz4", or "zstd".
+static const char* FLAGS_compression_type = "snappy";
+
+// If not 0, train a zstd dictionary of this many bytes for each table.
+static int FLAGS_zstd_dict_size = 0;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -110,6 +155,13 @@ static bool FLAGS_use_existing_db = false;
 // If true, reuse existing log/MANIFEST files when re-opening a database.
 static bool FLAGS_reuse_logs = false;
 
+// If true, let grouped writers insert into the memtable in parallel.
+static bool FLAGS_allow_concurrent_memtable_write = false;
+
+// If true, overlap the log write of one write group with the memtable
+// insertion of the previous group.
+static bool FLAGS_enable_pipelined_write = false;
+
 // Use the db with the following name.
 static const char* FLAGS_db = NULL;
 
@@ -298,6 +350,56 @@ struct SharedState {
   SharedState() : cv(&mu) {}
 };
 
+// A block cache wrapper counting hits and misses.
+class CountingCache : public Cache {
+ public:
+  explicit CountingCache(Cache* base) : base_(base), hits_(0), misses_(0) {}
+  virtual ~CountingCache() { delete base_; }
+
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    return base_->Insert(key, value, charge, deleter);
+  }
+
+  virtual Handle* Lookup(const Slice& key) {
+    Handle* h = base_->Lookup(key);
+    if (h != NULL) {
+      hits_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      misses_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return h;
+  }
+
+  virtual void Release(Handle* handle) { base_->Release(handle); }
+  virtual void* Value(Handle* handle) { return base_->Value(handle); }
+  virtual void Erase(const Slice& key) { base_->Erase(key); }
+  virtual uint64_t NewId() { return base_->NewId(); }
+
+  void GetCounters(uint64_t* hits, uint64_t* misses) {
+    *hits = hits_.load(std::memory_order_relaxed);
+    *misses = misses_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  Cache* base_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+
+Cache* NewBenchCache() {
+  if (FLAGS_cache_size < 0) {
+    return NULL;
+  } else if (strcmp(FLAGS_cache_type, "clock") == 0) {
+    return new CountingCache(NewClockCache(FLAGS_cache_size));
+  } else if (strcmp(FLAGS_cache_type, "slru") == 0) {
+    return new CountingCache(NewSLRUCache(FLAGS_cache_size));
+  } else {
+    assert(strcmp(FLAGS_cache_type, "lru") == 0);
+    return new CountingCache(NewLRUCache(FLAGS_cache_size));
+  }
+}
+
 // Per-thread state for concurrent executions of the same benchmark.
 struct ThreadState {
   int tid;      // 0..n-1 when running in n threads
@@ -312,8 +414,9 @@ struct ThreadState {
 
 class Benchmark {
  private:
-  Cache* cache_;
+  CountingCache* cache_;
   const FilterPolicy* filter_policy_;
+  ThreadPool* readahead_pool_;
   DB* db_;
   int num_;
   int value_size_;
@@ -398,10 +501,13 @@ class Benchmark {
 
  public:
   Benchmark()
-      : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
+      : cache_(static_cast<CountingCache*>(NewBenchCache())),
         filter_policy_(FLAGS_bloom_bits >= 0
                            ? NewBloomFilterPolicy(FLAGS_bloom_bits)
                            : NULL),
+        readahead_pool_(FLAGS_readahead_blocks > 0
+                            ? ThreadPool::NewFixed(FLAGS_readahead_blocks)
+                            : NULL),
         db_(NULL),
         num_(FLAGS_num),
         value_size_(FLAGS_value_size),
@@ -412,7 +518,7 @@ class Benchmark {
     g_env->GetChildren(FLAGS_db, &files);
     for (size_t i = 0; i < files.size(); i++) {
       if (Slice(files[i]).starts_with("heap-")) {
-        g_env->DeleteFile(std::string(FLAGS_db) + "/" + files[i]);
+        g_env->DeleteFile((std::string(FLAGS_db) + "/" + files[i]).c_str());
       }
     }
     if (!FLAGS_use_existing_db) {
@@ -422,6 +528,7 @@ class Benchmark {
 
   ~Benchmark() {
     delete db_;
+    delete readahead_pool_;
     delete cache_;
     delete filter_policy_;
   }
@@ -486,12 +593,16 @@ class Benchmark {
         method = &Benchmark::ReadReverse;
       } else if (name == Slice("readrandom")) {
         method = &Benchmark::ReadRandom;
+      } else if (name == Slice("multireadrandom")) {
+        method = &Benchmark::MultiReadRandom;
       } else if (name == Slice("readmissing")) {
         method = &Benchmark::ReadMissing;
       } else if (name == Slice("seekrandom")) {
         method = &Benchmark::SeekRandom;
       } else if (name == Slice("readhot")) {
         method = &Benchmark::ReadHot;
+      } else if (name == Slice("readhotscan")) {
+        method = &Benchmark::ReadHotScan;
       } else if (name == Slice("readrandomsmall")) {
         reads_ /= 1000;
         method = &Benchmark::ReadRandom;
@@ -717,9 +828,25 @@ class Benchmark {
     options.max_open_files = FLAGS_open_files;
 #endif
     options.filter_policy = filter_policy_;
+    options.data_block_hash_index = FLAGS_data_block_hash_index;
+    options.ect_index = FLAGS_ect_index;
+    if (strcmp(FLAGS_compression_type, "none") == 0) {
+      options.compression = kNoCompression;
+    } else if (strcmp(FLAGS_compression_type, "lz4") == 0) {
+      options.compression = kLZ4Compression;
+    } else if (strcmp(FLAGS_compression_type, "zstd") == 0) {
+      options.compression = kZstdCompression;
+    } else {
+      assert(strcmp(FLAGS_compression_type, "snappy") == 0);
+      options.compression = kSnappyCompression;
+    }
+    options.zstd_dict_size = FLAGS_zstd_dict_size;
 #if 0 /* XXXCDC: not imported into our options yet */
     options.reuse_logs = FLAGS_reuse_logs;
 #endif
+    options.allow_concurrent_memtable_write =
+        FLAGS_allow_concurrent_memtable_write;
+    options.enable_pipelined_write = FLAGS_enable_pipelined_write;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -770,7 +897,10 @@ class Benchmark {
   }
 
   void ReadSequential(ThreadState* thread) {
-    Iterator* iter = db_->NewIterator(ReadOptions());
+    ReadOptions options;
+    options.readahead_blocks = FLAGS_readahead_blocks;
+    options.readahead_pool = readahead_pool_;
+    Iterator* iter = db_->NewIterator(options);
     int i = 0;
     int64_t bytes = 0;
     for (iter->SeekToFirst(); i < reads_ && iter->Valid(); iter->Next()) {
@@ -813,6 +943,36 @@ class Benchmark {
     thread->stats.AddMessage(msg);
   }
 
+  void MultiReadRandom(ThreadState* thread) {
+    ReadOptions options;
+    const int batch_size = FLAGS_batch_size > 0 ? FLAGS_batch_size : 1;
+    std::vector<std::string> keys(batch_size);
+    std::vector<Slice> key_slices(batch_size);
+    std::vector<std::string> values(batch_size);
+    std::vector<Status> s(batch_size);
+    int found = 0;
+    for (int i = 0; i < reads_; i += batch_size) {
+      const int n = std::min(batch_size, reads_ - i);
+      for (int j = 0; j < n; j++) {
+        char key[100];
+        const int k = thread->rand.Next() % FLAGS_num;
+        snprintf(key, sizeof(key), "%016d", k);
+        keys[j] = key;
+        key_slices[j] = keys[j];
+      }
+      db_->MultiGet(options, n, &key_slices[0], &values[0], &s[0]);
+      for (int j = 0; j < n; j++) {
+        if (s[j].ok()) {
+          found++;
+        }
+        thread->stats.FinishedSingleOp();
+      }
+    }
+    char msg[100];
+    snprintf(msg, sizeof(msg), "(%d of %d found)", found, num_);
+    thread->stats.AddMessage(msg);
+  }
+
   void ReadMissing(ThreadState* thread) {
     ReadOptions options;
     std::string value;
@@ -825,6 +985,55 @@ class Benchmark {
     }
   }
 
+  // Point reads on a hot 1% of the key space interleaved with short scans over
+  // the entire key space. With a plain LRU block cache, the scans keep
+  // flushing the blocks holding the hot keys.
+  void ReadHotScan(ThreadState* thread) {
+    ReadOptions options;
+    std::string value;
+    const int range = (FLAGS_num + 99) / 100;
+    uint64_t hits0 = 0, misses0 = 0;
+    if (cache_ != NULL) {
+      cache_->GetCounters(&hits0, &misses0);
+    }
+    Histogram point_reads;
+    int scans = 0;
+    for (int i = 0; i < reads_; i++) {
+      if (FLAGS_scan_interval > 0 && i % FLAGS_scan_interval == 0) {
+        Iterator* iter = db_->NewIterator(options);
+        char key[100];
+        snprintf(key, sizeof(key), "%016d", thread->rand.Next() % FLAGS_num);
+        iter->Seek(key);
+        for (int j = 0; j < FLAGS_scan_length && iter->Valid(); j++) {
+          iter->Next();
+        }
+        delete iter;
+        scans++;
+      }
+      char key[100];
+      const int k = thread->rand.Next() % range;
+      snprintf(key, sizeof(key), "%016d", k);
+      const uint64_t start = g_env->NowMicros();
+      db_->Get(options, key, &value);
+      point_reads.Add(g_env->NowMicros() - start);
+      thread->stats.FinishedSingleOp();
+    }
+    char msg[200];
+    snprintf(msg, sizeof(msg),
+             "(%d scans; point read avg %.3f p99 %.3f micros)", scans,
+             point_reads.Average(), point_reads.Percentile(99));
+    thread->stats.AddMessage(msg);
+    if (cache_ != NULL) {
+      uint64_t hits = 0, misses = 0;
+      cache_->GetCounters(&hits, &misses);
+      hits -= hits0;
+      misses -= misses0;
+      snprintf(msg, sizeof(msg), "(%s cache hit rate %.2f%%)", FLAGS_cache_type,
+               hits + misses != 0 ? 100.0 * hits / (hits + misses) : 0.0);
+      thread->stats.AddMessage(msg);
+    }
+  }
+
   void ReadHot(ThreadState* thread) {
     ReadOptions options;
     std::string value;
@@ -970,9 +1179,23 @@ int main(int argc, char** argv) {
     } else if (sscanf(argv[i], "--use_existing_db=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_use_existing_db = n;
+    } else if (sscanf(argv[i], "--mmap_reads=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_mmap_reads = n;
+    } else if (sscanf(argv[i], "--io_uring=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_io_uring = n;
     } else if (sscanf(argv[i], "--reuse_logs=%d%c", &n, &junk) == 1 &&
                (n == 0 || n == 1)) {
       FLAGS_reuse_logs = n;
+    } else if (sscanf(argv[i], "--allow_concurrent_memtable_write=%d%c", &n,
+                      &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_allow_concurrent_memtable_write = n;
+    } else if (sscanf(argv[i], "--enable_pipelined_write=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_enable_pipelined_write = n;
     } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
       FLAGS_num = n;
     } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
@@ -989,8 +1212,36 @@ int main(int argc, char** argv) {
       FLAGS_block_size = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (strncmp(argv[i], "--cache_type=", 13) == 0 &&
+               (strcmp(argv[i] + 13, "lru") == 0 ||
+                strcmp(argv[i] + 13, "clock") == 0 ||
+                strcmp(argv[i] + 13, "slru") == 0)) {
+      FLAGS_cache_type = argv[i] + 13;
+    } else if (sscanf(argv[i], "--readahead_blocks=%d%c", &n, &junk) == 1) {
+      FLAGS_readahead_blocks = n;
+    } else if (sscanf(argv[i], "--batch_size=%d%c", &n, &junk) == 1) {
+      FLAGS_batch_size = n;
+    } else if (sscanf(argv[i], "--scan_interval=%d%c", &n, &junk) == 1) {
+      FLAGS_scan_interval = n;
+    } else if (sscanf(argv[i], "--scan_length=%d%c", &n, &junk) == 1) {
+      FLAGS_scan_length = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
+    } else if (sscanf(argv[i], "--data_block_hash_index=%d%c", &n, &junk) ==
+                   1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_data_block_hash_index = n;
+    } else if (sscanf(argv[i], "--ect_index=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_ect_index = n;
+    } else if (strncmp(argv[i], "--compression_type=", 19) == 0 &&
+               (strcmp(argv[i] + 19, "none") == 0 ||
+                strcmp(argv[i] + 19, "snappy") == 0 ||
+                strcmp(argv[i] + 19, "lz4") == 0 ||
+                strcmp(argv[i] + 19, "zstd") == 0)) {
+      FLAGS_compression_type = argv[i] + 19;
+    } else if (sscanf(argv[i], "--zstd_dict_size=%d%c", &n, &junk) == 1) {
+      FLAGS_zstd_dict_size = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
@@ -1001,7 +1252,12 @@ int main(int argc, char** argv) {
     }
   }
 
-  pdlfs::g_env = pdlfs::Env::Default();
+  pdlfs::g_env = FLAGS_mmap_reads ? pdlfs::Env::Default()
+                                   : pdlfs::Env::GetUnBufferedIoEnv();
+  if (FLAGS_io_uring) {
+    pdlfs::g_env =
+        pdlfs::Env::NewIoUringEnvWrapper(pdlfs::Env::GetUnBufferedIoEnv());
+  }
 
   // Choose a location for the test database if none given with --db=<path>
   if (FLAGS_db == NULL) {
@@ -1010,7 +1266,12 @@ int main(int argc, char** argv) {
     FLAGS_db = default_db_path.c_str();
   }
 
-  pdlfs::Benchmark benchmark;
-  benchmark.Run();
+  {
+    pdlfs::Benchmark benchmark;
+    benchmark.Run();
+  }
+  if (FLAGS_io_uring) {
+    delete pdlfs::g_env;
+  }
   return 0;
 }